@@ -813,10 +813,24 @@ int main(int argc, char *argv[])
 		schedule->max_workers = config->max_workers;
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
+		schedule->shard_listeners = config->shard_listeners;
+		schedule->work_stealing = config->work_stealing;
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
 
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.state_affinity = config->state_affinity;
+		schedule->network.worker_select = fr_table_value_by_str(fr_network_worker_select_table,
+									config->worker_select,
+									FR_NETWORK_WORKER_SELECT_MAX);
+		if (schedule->network.worker_select == FR_NETWORK_WORKER_SELECT_MAX) {
+			ERROR("Invalid value for 'thread.worker_select = %s'", config->worker_select);
+			EXIT_WITH_FAILURE;
+		}
+		schedule->network.control_spin = config->control_spin;
 		schedule->worker.max_requests = config->max_requests;
 		schedule->worker.max_request_time = config->max_request_time;
+		schedule->worker.control_spin = config->control_spin;
 
 		/*
 		 *	Single server mode: use the global event list.
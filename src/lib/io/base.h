@@ -177,6 +177,49 @@ typedef size_t (*fr_io_nak_t)(fr_listen_t *li, void *packet_ctx, uint8_t *const
  */
 typedef ssize_t (*fr_io_data_read_t)(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, bool *dup);
 
+/** Return how many packets can be read without blocking.
+ *
+ * Datagram transports may read more than one packet from the kernel
+ * in a single system call.  When they do, the network side calls
+ * read() again for each buffered packet, instead of waiting for the
+ * socket to become readable again.  The socket may not become
+ * readable again, as the data has already been taken from the kernel.
+ *
+ * @param[in] li		the listener for this socket
+ * @return the number of packets which can be returned by read() without blocking.
+ */
+typedef size_t (*fr_io_data_pending_t)(fr_listen_t *li);
+
+/** Return a key which identifies the session a packet belongs to
+ *
+ * When the network uses "sticky" worker selection, packets with the
+ * same key are sent to the same worker.  This lets multi-round
+ * sessions (EAP, accounting) benefit from worker-local caches.
+ *
+ * @param[in] li		the listener for this socket
+ * @param[in] packet_ctx	Request specific data, as returned by read().
+ * @param[in] buffer		the raw packet.
+ * @param[in] buffer_len	the length of the packet.
+ * @return a hash of the key.
+ */
+typedef uint32_t (*fr_io_data_key_t)(fr_listen_t *li, void const *packet_ctx, uint8_t const *buffer, size_t buffer_len);
+
+/** Return the worker which owns the session state for a packet
+ *
+ * When the network uses state affinity, packets carrying a State value
+ * are sent to the worker which created it, so that the session state
+ * never has to move between threads.
+ *
+ * @param[in] li		the listener for this socket
+ * @param[in] packet_ctx	Request specific data, as returned by read().
+ * @param[in] buffer		the raw packet.
+ * @param[in] buffer_len	the length of the packet.
+ * @return
+ *	- The ID of the worker which owns the session state.
+ *	- -1 if the packet has no session state we recognise.
+ */
+typedef int (*fr_io_data_state_owner_t)(fr_listen_t *li, void const *packet_ctx, uint8_t const *buffer, size_t buffer_len);
+
 /** Write a socket.
  *
  *  If the socket is a datagram socket, then the function can read or
@@ -303,6 +346,19 @@ typedef void *(*fr_io_track_create_t)(void const *instance, void *thread_instanc
  */
 typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *one, void const *two);
 
+/** Return the ID of a packet, for the fixed-size duplicate detection table
+ *
+ * Protocols with 8 bit packet IDs can provide this.  The master IO
+ * layer then tracks packets from unconnected sockets in a table
+ * indexed by source port and ID, instead of a tree.  The full
+ * fr_io_track_cmp_t comparison is still used to find matches.
+ *
+ * @param[in] packet		The raw packet.
+ * @param[in] packet_len	Length of the packet.
+ * @return the packet ID.
+ */
+typedef uint8_t (*fr_io_track_id_t)(uint8_t const *packet, size_t packet_len);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -44,11 +44,6 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 typedef enum {
 	TO_RESPONDER = 0,
 	TO_REQUESTOR = 1
@@ -62,10 +57,6 @@ static fr_table_num_sorted_t const channel_direction[] = {
 size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
 #endif
 
-#if 0
-#define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between responder signals.
-#endif
-
 /** Size of the atomic queues
  *
  * The queue reader MUST service the queue occasionally,
@@ -118,17 +109,15 @@ typedef struct {
 	fr_channel_recv_callback_t recv;	//!< callback for receiving messages
 	void			*recv_uctx;	//!< context for receiving messages
 
-	bool			must_signal;	//!< we need to signal the other end
-
-
 	uint64_t		sequence;	//!< Sequence number for this channel.
 	uint64_t		ack;		//!< Sequence number of the other end.
 	uint64_t		their_view_of_my_sequence;	//!< Should be clear.
 
-	uint64_t		sequence_at_last_signal;	//!< When we last signaled.
-
 	fr_atomic_queue_t	*aq;		//!< The queue of messages - visible only to this channel.
 
+	atomic_int64_t		queued;		//!< Messages pushed onto aq which the other end
+						///< hasn't yet popped.  Written by both threads.
+
 	atomic_bool		active;		//!< Whether the channel is active.
 
 	fr_channel_stats_t	stats;		//!< channel statistics
@@ -275,7 +264,6 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 
 	end->stats.last_sent_signal = when;
 	end->stats.signals++;
-	end->must_signal = false;
 
 	cc.signal = which;
 	cc.ack = end->ack;
@@ -288,6 +276,41 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Account for a message we've just pushed onto the other end's queue
+ *
+ * The other end is only guaranteed to be awake while the queue depth is
+ * non-zero, because it always drains the queue until empty once it has
+ * been signalled.  So we only need to signal when the depth goes from
+ * zero to one.  Otherwise the other end will pick up the message as part
+ * of the drain which is already in progress, or which has already been
+ * signalled.
+ *
+ * The depth MUST be incremented after the push, and decremented (by
+ * #fr_channel_queue_popped) after the pop.  The depth may then go
+ * transiently negative, but a message can't be lost.
+ *
+ * @param[in] end	whose queue the message was pushed onto.
+ * @return
+ *	- true if the other end may be asleep, and must be signalled.
+ *	- false if the signal can be skipped.
+ */
+static inline CC_HINT(always_inline) bool fr_channel_queue_pushed(fr_channel_end_t *end)
+{
+	if (atomic_fetch_add(&end->queued, 1) == 0) return true;
+
+	end->stats.skips++;
+	return false;
+}
+
+/** Account for a message we've just popped from the other end's queue
+ *
+ * @param[in] end	whose queue the message was popped from.
+ */
+static inline CC_HINT(always_inline) void fr_channel_queue_popped(fr_channel_end_t *end)
+{
+	atomic_fetch_sub(&end->queued, 1);
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
 
@@ -309,6 +332,7 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	fr_time_t when;
 	fr_time_delta_t message_interval;
 	fr_channel_end_t *requestor;
+	bool must_signal;
 
 	if (!fr_cond_assert_msg(atomic_load(&ch->end[TO_RESPONDER].active), "Channel not active")) return -1;
 
@@ -337,6 +361,7 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 		while (fr_channel_recv_reply(ch));
 		return -1;
 	}
+	must_signal = fr_channel_queue_pushed(requestor);
 
 	requestor->sequence = sequence;
 	message_interval = fr_time_sub(when, requestor->stats.last_write);
@@ -357,34 +382,14 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	MPRINT("REQUESTOR requests %"PRIu64", num_outstanding %"PRIu64"\n", requestor->stats.packets, requestor->stats.outstanding);
 
-#if ENABLE_SKIPS
 	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
+	 *	The responder is still draining its queue, and will
+	 *	see this message without being woken up.
 	 */
-	if (requestor->stats.outstanding == 1) {
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (requestor->stats.outstanding > 1) {
-		bool has_reply;
-
-		has_reply = fr_channel_recv_reply(ch);
-
-		if (has_reply) while (fr_channel_recv_reply(ch));
-
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!requestor->must_signal && (!has_reply || (has_reply && (requestor->stats.outstanding > 1)))) {
-			MPRINT("REQUESTOR SKIPS signal\n");
-			return 0;
-		}
+	if (!must_signal) {
+		MPRINT("REQUESTOR SKIPS signal\n");
+		return 0;
 	}
-#endif
 
 	/*
 	 *	Tell the other end that there is new data ready.
@@ -420,6 +425,7 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 	 *	It's OK for the queue to be empty.
 	 */
 	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	fr_channel_queue_popped(&ch->end[TO_REQUESTOR]);
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -482,6 +488,7 @@ bool fr_channel_recv_request(fr_channel_t *ch)
 	 *	It's OK for the queue to be empty.
 	 */
 	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	fr_channel_queue_popped(&ch->end[TO_RESPONDER]);
 
 	fr_assert(cd->live.sequence > responder->ack);
 	fr_assert(cd->live.sequence >= responder->sequence); /* must have more requests than replies */
@@ -514,6 +521,7 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	fr_time_t		when;
 	fr_time_delta_t		message_interval;
 	fr_channel_end_t	*responder;
+	bool			must_signal;
 
 	if (!fr_cond_assert_msg(atomic_load(&ch->end[TO_REQUESTOR].active), "Channel not active")) return -1;
 
@@ -539,6 +547,7 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 		while (fr_channel_recv_request(ch));
 		return -1;
 	}
+	must_signal = fr_channel_queue_pushed(responder);
 
 	fr_assert(responder->stats.outstanding > 0);
 	responder->stats.outstanding--;
@@ -562,49 +571,24 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 	 */
 	while (fr_channel_recv_request(ch));
 
+	fr_assert(responder->their_view_of_my_sequence <= responder->sequence);
+
 	/*
-	 *	No packets outstanding, we HAVE to signal the requestor
-	 *	thread.
+	 *	The requestor is still draining its queue, and will
+	 *	see this reply without being woken up.
 	 */
-	if (responder->stats.outstanding == 0) {
-		(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER);
+	if (!must_signal) {
+		MPRINT("\tRESPONDER SKIPS signal num_outstanding %"PRIu64"\n", responder->stats.outstanding);
 		return 0;
 	}
 
-	MPRINT("\twhen - last_read_other = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", when, responder->stats.last_read_other, when - responder->stats.last_read_other);
-	MPRINT("\twhen - last signal = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", when, responder->stats.last_sent_signal, when - responder->stats.last_sent_signal);
-	MPRINT("\tsequence - ack = %"PRIu64" - %"PRIu64" = %"PRIu64"\n", responder->sequence, responder->their_view_of_my_sequence, responder->sequence - responder->their_view_of_my_sequence);
-
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (responder->sequence_at_last_signal > responder->their_view_of_my_sequence) return 0;
-#endif
-
 	/*
-	 *	If we've received a new packet in the last while, OR
-	 *	we've sent a signal in the last while, then we don't
-	 *	need to send a new signal.  But we DO send a signal if
-	 *	we haven't seen an ACK for a few packets.
-	 *
-	 *	FIXME: make these limits configurable, or include
-	 *	predictions about packet processing time?
+	 *	No packets outstanding, tell the requestor we're done.
 	 */
-	fr_assert(responder->their_view_of_my_sequence <= responder->sequence);
-#if 0
-	if (((responder->sequence - their_view_of_my_sequence) <= 1000) &&
-	    ((when - responder->stats.last_read_other < SIGNAL_INTERVAL) ||
-	     ((when - responder->stats.last_sent_signal) < SIGNAL_INTERVAL))) {
-		MPRINT("\tRESPONDER SKIPS signal\n");
+	if (responder->stats.outstanding == 0) {
+		(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER);
 		return 0;
 	}
-#endif
 
 	MPRINT("\tRESPONDER SIGNALS num_outstanding %"PRIu64"\n", responder->stats.outstanding);
 	(void) fr_channel_data_ready(ch, when, responder, FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR);
@@ -685,9 +669,6 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
 {
 	int rcode;
-#if ENABLE_SKIPS
-	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
 	fr_channel_signal_t cs;
 	fr_channel_event_t ce = FR_CHANNEL_ERROR;
@@ -698,9 +679,6 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	memcpy(&cc, data, data_size);
 
 	cs = cc.signal;
-#if ENABLE_SKIPS
-	ack = cc.ack;
-#endif
 	*p_channel = ch = cc.ch;
 
 	switch (cs) {
@@ -718,52 +696,35 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 		return (fr_channel_event_t) cs;
 
 	/*
-	 *	Only sent by the responder.  Both of these
-	 *	situations are largely the same, except for
-	 *	return codes.
+	 *	Only sent by the responder.  There's data for us, and
+	 *	the responder has no more packets outstanding.
 	 */
 	case FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER:
 		MPRINT("channel got data_done_responder\n");
-		ce = FR_CHANNEL_DATA_READY_REQUESTOR;
-		ch->end[TO_RESPONDER].must_signal = true;
-		break;
+		return FR_CHANNEL_DATA_READY_REQUESTOR;
 
 	case FR_CHANNEL_SIGNAL_RESPONDER_SLEEPING:
 		MPRINT("channel got responder_sleeping\n");
 		ce = FR_CHANNEL_NOOP;
-		ch->end[TO_RESPONDER].must_signal = true;
 		break;
 	}
 
 	/*
-	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the responder
-	 *	to wake up.
+	 *	The responder drains its queue whenever it's
+	 *	signalled, so it shouldn't go to sleep with messages
+	 *	still queued.  If it has, wake it up again.
 	 */
 	requestor = &ch->end[TO_RESPONDER];
-#if ENABLE_SKIPS
-	if (!requestor->must_signal && (ack == requestor->sequence)) {
+	if (atomic_load(&requestor->queued) <= 0) {
 		MPRINT("REQUESTOR SKIPS signal AFTER CE %d num_outstanding %"PRIu64"\n", cs, requestor->stats.outstanding);
-		MPRINT("REQUESTOR has ack %"PRIu64", my seq %"PRIu64" my_view %"PRIu64"\n", ack, requestor->sequence, requestor->their_view_of_my_sequence);
 		return ce;
 	}
 
-	/*
-	 *	The responder is sleeping or done.  There are more
-	 *	packets available, so we signal it to wake up again.
-	 */
-	fr_assert(ack <= requestor->sequence);
-#endif
-
 	/*
 	 *	We're signaling it again...
 	 */
 	requestor->stats.resignals++;
 
-	/*
-	 *	The responder hasn't seen our last few packets.  Signal
-	 *	that there is data ready.
-	 */
 	MPRINT("REQUESTOR SIGNALS AFTER CE %d\n", cs);
 	rcode = fr_channel_data_ready(ch, when, requestor, FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER);
 	if (rcode < 0) return FR_CHANNEL_ERROR;
@@ -965,6 +926,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.skips);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -975,6 +937,7 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\tsignals skipped = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.skips);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", fr_time_delta_unwrap(ch->end[TO_REQUESTOR].stats.message_interval));
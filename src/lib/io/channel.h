@@ -82,6 +82,7 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		skips;		//!< Number of signals skipped, as the other end was awake.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
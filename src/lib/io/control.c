@@ -35,8 +35,34 @@ RCSID("$Id$")
 #include <string.h>
 #include <sys/event.h>
 
+#ifdef HAVE_SYS_EVENTFD_H
+#  include <sys/eventfd.h>
+#endif
+
 #define FR_CONTROL_MAX_TYPES	(32)
 
+#define FR_CONTROL_SPIN_MIN	(16)	//!< Never adapt the spin count below this.
+#define FR_CONTROL_SPIN_NSEC	(100)	//!< Rough cost of one poll of the queue.
+
+/*
+ *	A sender which pushed a message this recently is treated
+ *	as busy, and likely to send us another one soon.
+ */
+#define FR_CONTROL_BUSY_NSEC	(NSEC / 10000)
+
+/*
+ *	Tell the CPU we're busy-waiting, so that it doesn't
+ *	speculate through the spin loop, or starve a sibling
+ *	hyperthread.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#  define CONTROL_SPIN_PAUSE()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#  define CONTROL_SPIN_PAUSE()	__asm__ __volatile__("yield")
+#else
+#  define CONTROL_SPIN_PAUSE()
+#endif
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -81,32 +107,45 @@ struct fr_control_s {
 
 	fr_atomic_queue_t	*aq;			//!< destination AQ
 
-	int			pipe[2];       		//!< our pipes
+	int			fd[2];			//!< Read and write ends of our wakeup descriptor.
+							///< With eventfd, both are the same descriptor.
+
+	atomic_bool		awake;			//!< The receiver is awake, or has a wakeup pending.
+							///< Senders only need to signal it when this is false.
+
+	uint32_t		spin_max;		//!< Maximum number of times to poll the queue
+							///< before sleeping.  0 to disable spinning.
+	uint32_t		spin;			//!< Current spin count, adapted between
+							///< #FR_CONTROL_SPIN_MIN and spin_max.
+	atomic_int64_t		last_push;		//!< When a sender last pushed a message.  Only
+							///< updated when spinning is enabled.
 
 	bool			same_thread;		//!< are the two ends in the same thread
 
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
-static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+/** Call the callbacks for all queued control messages
+ *
+ * @param[in] c		the control structure.
+ * @param[in] now	the current time.
+ * @return the number of messages we processed.
+ */
+static int control_dispatch(fr_control_t *c, fr_time_t now)
 {
-	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	ssize_t i, num;
-	fr_time_t now;
-	char read_buffer[256];
+	int	num = 0;
 	uint8_t	data[256];
 
-	num = read(fd, read_buffer, sizeof(read_buffer));
-	if (num <= 0) return;
-
-	now = fr_time();
-
-	for (i = 0; i < num; i++) {
+	while (true) {
 		uint32_t id = 0;
-		size_t message_size;
+		ssize_t message_size;
 
 		message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data));
-		if (!message_size) return;
+		if (!message_size) break;
+
+		num++;
+
+		if (message_size < 0) continue;
 
 		if (id >= FR_CONTROL_MAX_TYPES) continue;
 
@@ -114,6 +153,112 @@ static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void
 
 		c->type[id].callback(c->type[id].ctx, data, message_size, now);
 	}
+
+	return num;
+}
+
+/** Tell the receiver that it's about to go to sleep
+ *
+ * Any sender which pushes a message after this will signal the
+ * receiver.  Any message pushed before this will be seen by the
+ * subsequent #control_dispatch.
+ */
+static inline CC_HINT(always_inline) void control_sleeping(fr_control_t *c)
+{
+	(void) atomic_exchange(&c->awake, false);
+}
+
+static void control_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_control_t	*c = talloc_get_type_abort(uctx, fr_control_t);
+#ifdef HAVE_SYS_EVENTFD_H
+	uint64_t	count;
+
+	/*
+	 *	We don't care how many times we were signalled, only
+	 *	that the descriptor is no longer readable.
+	 */
+	if (read(fd, &count, sizeof(count)) < 0) count = 0;
+#else
+	char		read_buffer[256];
+
+	/*
+	 *	Senders coalesce wakeups, so there's usually only one
+	 *	byte here.  But empty the pipe anyway.
+	 */
+	while (read(fd, read_buffer, sizeof(read_buffer)) == sizeof(read_buffer));
+#endif
+
+	control_sleeping(c);
+	(void) control_dispatch(c, fr_time());
+}
+
+/** Poll the queue for a while before the event loop sleeps
+ *
+ * When the other thread is busy, it's likely to send us another
+ * message very soon.  Picking that message up by polling is much
+ * cheaper for both threads than a write / wakeup / read.  While
+ * we're spinning, senders see that we're awake, and don't signal us.
+ *
+ * We only spin if a sender has pushed a message within the last
+ * #FR_CONTROL_BUSY_NSEC, and the event loop would otherwise sleep
+ * for longer than the spin takes.
+ *
+ * The spin count adapts.  It grows when spinning finds messages, and
+ * shrinks when it doesn't, so an idle receiver quickly stops burning
+ * CPU.
+ *
+ * @return
+ *	- 0 if we can sleep.
+ *	- 1 if we processed messages, and the caller may have more work to do.
+ */
+static int control_pre_event(fr_time_t now, fr_time_delta_t wake, void *uctx)
+{
+	fr_control_t	*c = talloc_get_type_abort(uctx, fr_control_t);
+	uint32_t	i;
+	int		num = 0;
+
+	/*
+	 *	A timer is due before we'd finish spinning.  Don't
+	 *	delay it.
+	 */
+	if (fr_time_delta_lt(wake, fr_time_delta_wrap((int64_t) c->spin * FR_CONTROL_SPIN_NSEC))) return 0;
+
+	/*
+	 *	No one has sent us anything recently, so there's
+	 *	nothing to wait for.
+	 */
+	if (fr_time_delta_gt(fr_time_sub(now, fr_time_wrap(atomic_load_explicit(&c->last_push, memory_order_relaxed))),
+			     fr_time_delta_wrap(FR_CONTROL_BUSY_NSEC))) return 0;
+
+	/*
+	 *	A sender has already signalled us, the event loop
+	 *	will see the wakeup immediately.
+	 */
+	if (atomic_exchange(&c->awake, true)) return 0;
+
+	for (i = 0; i < c->spin; i++) {
+		num = control_dispatch(c, fr_time());
+		if (num > 0) break;
+
+		CONTROL_SPIN_PAUSE();
+	}
+
+	if (num > 0) {
+		c->spin = (c->spin < (c->spin_max / 2)) ? (c->spin * 2) : c->spin_max;
+	} else {
+		c->spin = (c->spin > (FR_CONTROL_SPIN_MIN * 2)) ? (c->spin / 2) : FR_CONTROL_SPIN_MIN;
+		if (c->spin > c->spin_max) c->spin = c->spin_max;
+	}
+
+	/*
+	 *	Go back to needing a signal, and pick up anything
+	 *	which was pushed while we were spinning.
+	 */
+	control_sleeping(c);
+	num += control_dispatch(c, fr_time());
+
+	return (num > 0);
 }
 
 /** Free a control structure
@@ -127,12 +272,13 @@ static int _control_free(fr_control_t *c)
 	(void) talloc_get_type_abort(c, fr_control_t);
 
 #ifndef NDEBUG
-	(void) fr_event_fd_unarmour(c->el, c->pipe[0], FR_EVENT_FILTER_IO, (uintptr_t)c);
+	(void) fr_event_fd_unarmour(c->el, c->fd[0], FR_EVENT_FILTER_IO, (uintptr_t)c);
 #endif
-	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
+	(void) fr_event_fd_delete(c->el, c->fd[0], FR_EVENT_FILTER_IO);
+	if (c->spin_max) (void) fr_event_pre_delete(c->el, control_pre_event, c);
 
-	close(c->pipe[0]);
-	close(c->pipe[1]);
+	close(c->fd[0]);
+	if (c->fd[1] != c->fd[0]) close(c->fd[1]);
 
 	return 0;
 }
@@ -158,32 +304,78 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	c->el = el;
 	c->aq = aq;
 
-	if (pipe((int *) &c->pipe) < 0) {
+#ifdef HAVE_SYS_EVENTFD_H
+	/*
+	 *	An eventfd is a counter, so multiple wakeups coalesce
+	 *	into one read, and it's one descriptor instead of two.
+	 */
+	c->fd[0] = c->fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (c->fd[0] < 0) {
+		talloc_free(c);
+		fr_strerror_printf("Failed opening eventfd for control socket: %s", fr_syserror(errno));
+		return NULL;
+	}
+#else
+	if (pipe((int *) &c->fd) < 0) {
 		talloc_free(c);
 		fr_strerror_printf("Failed opening pipe for control socket: %s", fr_syserror(errno));
 		return NULL;
 	}
-	talloc_set_destructor(c, _control_free);
 
 	/*
 	 *	We don't want reads from the pipe to be blocking.
 	 */
-	(void) fcntl(c->pipe[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
-	(void) fcntl(c->pipe[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+	(void) fcntl(c->fd[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+	(void) fcntl(c->fd[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+#endif
+	talloc_set_destructor(c, _control_free);
 
-	if (fr_event_fd_insert(c, el, c->pipe[0], pipe_read, NULL, NULL, c) < 0) {
+	if (fr_event_fd_insert(c, el, c->fd[0], control_read, NULL, NULL, c) < 0) {
 		talloc_free(c);
 		fr_strerror_const_push("Failed adding FD to event list control socket");
 		return NULL;
 	}
 
 #ifndef NDEBUG
-	(void) fr_event_fd_armour(c->el, c->pipe[0], FR_EVENT_FILTER_IO, (uintptr_t)c);
+	(void) fr_event_fd_armour(c->el, c->fd[0], FR_EVENT_FILTER_IO, (uintptr_t)c);
 #endif
 
 	return c;
 }
 
+/** Poll for control messages before sleeping
+ *
+ * Must be called from the receiving thread, i.e. the one which
+ * services the event list passed to #fr_control_create.
+ *
+ * @param[in] c		the control structure.
+ * @param[in] spin_max	the maximum number of times to poll the queue
+ *			before the event loop sleeps.  0 disables spinning.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_control_spin_set(fr_control_t *c, uint32_t spin_max)
+{
+	(void) talloc_get_type_abort(c, fr_control_t);
+
+	if (!spin_max) {
+		if (c->spin_max) (void) fr_event_pre_delete(c->el, control_pre_event, c);
+		c->spin_max = c->spin = 0;
+		return 0;
+	}
+
+	if (!c->spin_max && (fr_event_pre_insert(c->el, control_pre_event, c) < 0)) {
+		fr_strerror_const_push("Failed adding control plane spin callback");
+		return -1;
+	}
+
+	c->spin_max = spin_max;
+	c->spin = (spin_max < FR_CONTROL_SPIN_MIN) ? spin_max : FR_CONTROL_SPIN_MIN;
+
+	return 0;
+}
+
 
 /** Clean up messages in a control-plane buffer
  *
@@ -353,9 +545,31 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
-	while (write(c->pipe[1], ".", 1) == 0) {
+	/*
+	 *	Let a spinning receiver know that we're busy.
+	 */
+	if (c->spin_max) atomic_store_explicit(&c->last_push, fr_time_unwrap(fr_time()), memory_order_relaxed);
+
+	/*
+	 *	The receiver is awake, or someone else has already
+	 *	woken it up.  It will see our message without us
+	 *	signalling it.
+	 */
+	if (atomic_exchange(&c->awake, true)) return 0;
+
+#ifdef HAVE_SYS_EVENTFD_H
+	{
+		uint64_t one = 1;
+
+		while (write(c->fd[1], &one, sizeof(one)) == 0) {
+			/* nothing */
+		}
+	}
+#else
+	while (write(c->fd[1], ".", 1) == 0) {
 		/* nothing */
 	}
+#endif
 
 	return 0;
 }
@@ -471,9 +685,10 @@ int fr_control_callback_delete(fr_control_t *c, uint32_t id)
 int fr_control_same_thread(fr_control_t *c)
 {
 	c->same_thread = true;
-	(void) fr_event_fd_delete(c->el, c->pipe[0], FR_EVENT_FILTER_IO);
-	close(c->pipe[0]);
-	close(c->pipe[1]);
+	(void) fr_event_fd_delete(c->el, c->fd[0], FR_EVENT_FILTER_IO);
+	if (c->spin_max) (void) fr_event_pre_delete(c->el, control_pre_event, c);
+	close(c->fd[0]);
+	if (c->fd[1] != c->fd[0]) close(c->fd[1]);
 
 	/*
 	 *	Nothing more to do now that everything is gone.
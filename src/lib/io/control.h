@@ -58,9 +58,14 @@ typedef	void (*fr_control_callback_t)(void *ctx, void const *data, size_t data_s
 #define FR_CONTROL_ID_WORKER	(3)
 #define FR_CONTROL_ID_DIRECTORY (4)
 #define FR_CONTROL_ID_INJECT 	(5)
+#define FR_CONTROL_ID_STEAL	(6)
+#define FR_CONTROL_ID_STOLEN	(7)
+#define FR_CONTROL_ID_STOLEN_SIGNAL (8)
 
 fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_queue_t *aq) CC_HINT(nonnull(3));
 
+int fr_control_spin_set(fr_control_t *c, uint32_t spin_max) CC_HINT(nonnull);
+
 int fr_control_gc(fr_control_t *c, fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size) CC_HINT(nonnull);
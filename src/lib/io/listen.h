@@ -43,6 +43,9 @@ struct fr_listen {
 	bool			track_duplicates;	//!< do we track duplicate packets?
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+
+	uint32_t		shard;			//!< index of this socket in its SO_REUSEPORT group.
+	uint32_t		num_shards;		//!< number of sockets sharing the same address and port.
 };
 
 /**
@@ -64,6 +67,10 @@ struct fr_async_s {
 	uint32_t		priority;	//!< higher == higher priority
 
 	uint32_t		sequence;	//!< higher == higher priority, too
+
+	void			*stolen_from;	//!< Loan recording which worker's backlog this
+						//!< request was taken from.  NULL if the request
+						//!< is being run by the worker which owns "channel".
 };
 
 int fr_io_listen_free(fr_listen_t *li);
@@ -31,6 +31,9 @@
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 
+#define FR_IO_TRACK_SLOTS	(1024)	//!< Size of the per-client tracking table.  Must be a power of 2.
+#define FR_IO_TRACK_SLAB_SIZE	(256)	//!< Maximum number of free tracking entries kept per thread.
+
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
@@ -46,6 +49,9 @@ typedef struct {
 	// @todo - count num_nak_clients, and num_nak_connections, too
 	uint32_t			num_connections;		//!< number of dynamic connections
 	uint32_t			num_pending_packets;   		//!< number of pending packets
+
+	fr_io_track_t			*track_slab[FR_IO_TRACK_SLAB_SIZE]; //!< free tracking entries, for reuse
+	uint32_t			num_track_slab;			//!< number of entries in track_slab
 } fr_io_thread_t;
 
 /** A saved packet
@@ -97,6 +103,9 @@ struct fr_io_client_s {
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
 	fr_rb_tree_t			*table;		//!< tracking table for packets
+	fr_io_track_t			**slots;	//!< tracking table for packets, indexed by
+							///< source port and ID.  Used instead of "table"
+							///< when the app_io provides track_id.
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -144,6 +153,8 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+static bool track_table_delete(fr_io_client_t *client, fr_io_track_t *track);
+
 static int track_free(fr_io_track_t *track)
 {
 	if (track->ev) (void) fr_event_timer_delete(&track->ev);
@@ -158,10 +169,9 @@ static int track_free(fr_io_track_t *track)
 
 static int track_dedup_free(fr_io_track_t *track)
 {
-	fr_assert(track->client->table != NULL);
-	fr_assert(fr_rb_find(track->client->table, track) != NULL);
+	fr_assert((track->client->table != NULL) || (track->client->slots != NULL));
 
-	if (!fr_rb_delete(track->client->table, track)) {
+	if (!track_table_delete(track->client, track)) {
 		fr_assert(0);
 	}
 
@@ -315,6 +325,121 @@ static int8_t track_connected_cmp(void const *one, void const *two)
 }
 
 
+/** Return the slot in the tracking table for a packet
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t track_slot(fr_io_track_t const *track)
+{
+	return ((((uint32_t) track->address->socket.inet.src_port) << 8) | track->id) & (FR_IO_TRACK_SLOTS - 1);
+}
+
+/** Find a tracking entry with the same dedup fields as a packet
+ *
+ */
+static fr_io_track_t *track_table_find(fr_io_client_t *client, fr_io_track_t const *track)
+{
+	fr_io_track_t *old;
+
+	if (!client->slots) return fr_rb_find(client->table, track);
+
+	for (old = client->slots[track_slot(track)]; old; old = old->next) {
+		if (track_cmp(old, track) == 0) return old;
+	}
+
+	return NULL;
+}
+
+/** Insert a tracking entry into the tracking table
+ *
+ * @note The caller must have removed any entry with the same dedup fields.
+ */
+static bool track_table_insert(fr_io_client_t *client, fr_io_track_t *track)
+{
+	fr_io_track_t **slot;
+
+	if (!client->slots) return fr_rb_insert(client->table, track);
+
+	slot = &client->slots[track_slot(track)];
+	track->next = *slot;
+	*slot = track;
+
+	return true;
+}
+
+/** Remove a tracking entry from the tracking table
+ *
+ * @return
+ *	- true if the entry was removed.
+ *	- false if the entry wasn't in the table.
+ */
+static bool track_table_delete(fr_io_client_t *client, fr_io_track_t *track)
+{
+	fr_io_track_t **slot;
+
+	if (!client->slots) return fr_rb_delete(client->table, track);
+
+	for (slot = &client->slots[track_slot(track)]; *slot; slot = &(*slot)->next) {
+		if (*slot != track) continue;
+
+		*slot = track->next;
+		track->next = NULL;
+		return true;
+	}
+
+	return false;
+}
+
+/** Allocate a tracking entry, reusing one from the thread's slab if possible
+ *
+ */
+static fr_io_track_t *track_alloc(fr_io_client_t *client)
+{
+	fr_io_thread_t	*thread = client->thread;
+	fr_io_track_t	*track;
+
+	if (client->slots && (thread->num_track_slab > 0)) {
+		track = thread->track_slab[--thread->num_track_slab];
+		(void) talloc_steal(client, track);
+		return track;
+	}
+
+	/*
+	 *	The pool holds the address, and the summary
+	 *	created by track_create().
+	 */
+	return talloc_zero_pooled_object(client, fr_io_track_t, 2, sizeof(*track->address) + 64);
+}
+
+/** Free a tracking entry, or put it back into the thread's slab
+ *
+ * Only entries which have been counted in client->packets can be
+ * released this way.  The entry is treated exactly as if it were
+ * freed, but the memory (and its talloc pool) is kept for the next
+ * packet.
+ */
+static void track_release(fr_io_track_t *track)
+{
+	fr_io_client_t	*client = track->client;
+	fr_io_thread_t	*thread = client->thread;
+
+	if (!client->slots || (thread->num_track_slab >= FR_IO_TRACK_SLAB_SIZE)) {
+		talloc_free(track);
+		return;
+	}
+
+	/*
+	 *	Do what the destructor would do.  Conflicting
+	 *	entries have already been removed from the table.
+	 */
+	talloc_set_destructor(track, NULL);
+	(void) track_table_delete(client, track);
+	(void) track_free(track);
+
+	memset(track, 0, sizeof(*track));
+	(void) talloc_steal(thread, track);
+	thread->track_slab[thread->num_track_slab++] = track;
+}
+
 static fr_io_pending_packet_t *pending_packet_pop(fr_io_thread_t *thread)
 {
 	fr_io_client_t *client;
@@ -374,6 +499,11 @@ static RADCLIENT *radclient_clone(TALLOC_CTX *ctx, RADCLIENT const *parent)
 	DUP_FIELD(server);
 	DUP_FIELD(nas_type);
 
+	if (c->secret) {
+		c->secret_md5 = fr_md5_secret_alloc(c, (uint8_t const *) c->secret, talloc_array_length(c->secret) - 1);
+		if (!c->secret_md5) goto error;
+	}
+
 	COPY_FIELD(message_authenticator);
 	/* dynamic MUST be false */
 	COPY_FIELD(server_cs);
@@ -865,7 +995,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *	Allocate a new tracking structure.  Most of the time
 	 *	there are no duplicates, so this is fine.
 	 */
-	MEM(track = talloc_zero_pooled_object(client, fr_io_track_t, 1, sizeof(*track) + sizeof(track->address) + 64));
+	MEM(track = track_alloc(client));
 	MEM(track->address = my_address = talloc_zero(track, fr_io_address_t));
 
 	memcpy(my_address, address, sizeof(*address));
@@ -903,10 +1033,12 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 		return NULL;
 	}
 
+	if (client->slots) track->id = client->inst->app_io->track_id(packet, packet_len);
+
 	/*
 	 *	No existing duplicate.  Return the new tracking entry.
 	 */
-	old = fr_rb_find(client->table, track);
+	old = track_table_find(client, track);
 	if (!old) goto do_insert;
 
 	fr_assert(old->client == client);
@@ -970,12 +1102,12 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *	and return the new one.
 	 */
 	if (old->reply_len || old->do_not_respond) {
-		talloc_free(old);
+		track_release(old);
 
 	} else {
 		fr_assert(client == old->client);
 
-		if (!fr_rb_delete(client->table, old)) {
+		if (!track_table_delete(client, old)) {
 			fr_assert(0);
 		}
 		if (old->ev) (void) fr_event_timer_delete(&old->ev);
@@ -986,7 +1118,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	}
 
 do_insert:
-	if (!fr_rb_insert(client->table, track)) {
+	if (!track_table_insert(client, track)) {
 		fr_assert(0);
 	}
 
@@ -1015,7 +1147,7 @@ static int pending_free(fr_io_pending_packet_t *pending)
 	 *	No more packets using this tracking entry,
 	 *	delete it.
 	 */
-	if (track->packets == 0) talloc_free(track);
+	if (track->packets == 0) track_release(track);
 
 	return 0;
 }
@@ -1472,7 +1604,17 @@ do_read:
 		 */
 		if (inst->app_io->track_duplicates) {
 			fr_assert(inst->app_io->track_compare != NULL);
-			MEM(client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node, track_cmp, NULL));
+
+			/*
+			 *	Protocols with 8 bit IDs can use a
+			 *	fixed size table, which avoids
+			 *	rebalancing a tree for every packet.
+			 */
+			if (inst->app_io->track_id) {
+				MEM(client->slots = talloc_zero_array(client, fr_io_track_t *, FR_IO_TRACK_SLOTS));
+			} else {
+				MEM(client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node, track_cmp, NULL));
+			}
 		}
 
 		/*
@@ -1734,6 +1876,78 @@ done:
 	return 0;
 }
 
+/** Return how many packets the child can return without blocking.
+ *
+ *  Always called in the context of the network.
+ */
+static size_t mod_pending(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->pending) return 0;
+
+	return inst->app_io->pending(child);
+}
+
+/** Hash the client address of a packet, for choosing a worker
+ *
+ * @param[in] track	the tracking structure for the packet.
+ * @return a hash of the source IP address.
+ */
+uint32_t fr_master_io_track_key(fr_io_track_t const *track)
+{
+	fr_ipaddr_t const *ipaddr = &track->address->socket.inet.src_ipaddr;
+
+	if (ipaddr->af == AF_INET) return fr_hash(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4));
+
+	return fr_hash(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6));
+}
+
+static uint32_t mod_key(fr_listen_t *li, void const *packet_ctx, uint8_t const *buffer, size_t buffer_len)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+	fr_io_track_t const *track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->key) return fr_master_io_track_key(track);
+
+	return inst->app_io->key(child, track, buffer, buffer_len);
+}
+
+static int mod_state_owner(fr_listen_t *li, void const *packet_ctx, uint8_t const *buffer, size_t buffer_len)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+	fr_io_track_t const *track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->state_owner) return -1;
+
+	return inst->app_io->state_owner(child, track, buffer, buffer_len);
+}
+
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Inject a packet to a connection.
  *
  *  Always called in the context of the network.
@@ -2090,9 +2304,13 @@ static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		 *	if the timer succeeds, then "track"
 		 *	will be cleaned up when the timer
 		 *	fires.
+		 *
+		 *	Duplicates re-arm this timer, and it
+		 *	doesn't matter if it fires a little late,
+		 *	so it goes into the timer wheel.
 		 */
-		if (fr_event_timer_at(track, el, &track->ev,
-				      track->expires, packet_expiry_timer, track) == 0) {
+		if (fr_event_timer_coarse_at(track, el, &track->ev,
+					     track->expires, packet_expiry_timer, track) == 0) {
 			DEBUG("proto_%s - cleaning up request in %.6fs", inst->app_io->name,
 			      fr_time_delta_unwrap(inst->cleanup_delay) / (double)NSEC);
 			return;
@@ -2115,7 +2333,7 @@ static void packet_expiry_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	/*
 	 *	Delete the tracking entry.
 	 */
-	talloc_free(track);
+	track_release(track);
 
 	/*
 	 *	The client isn't dynamic, stop here.
@@ -2263,6 +2481,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		client->state = PR_CLIENT_NAK;
 		TALLOC_FREE(client->pending);
 		if (client->table) TALLOC_FREE(client->table);
+		if (client->slots) TALLOC_FREE(client->slots);
 		fr_assert(client->packets == 0);
 
 		/*
@@ -2878,25 +3097,26 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Open one socket for a listener, and add it to the scheduler
+ *
+ * @param[in] ctx			to allocate the listener in.
+ * @param[in] inst			of the master IO handler.
+ * @param[in] sc			the scheduler.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] shard			index of this socket.
+ * @param[in] num_shards		number of sockets opened for the listener.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int master_io_listen_shard(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages,
+				  uint32_t shard, uint32_t num_shards)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2927,6 +3147,9 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->default_message_size = default_message_size;
 	li->num_messages = num_messages;
 
+	li->shard = shard;
+	li->num_shards = num_shards;
+
 	/*
 	 *	Per-socket data lives here.
 	 */
@@ -3011,9 +3234,10 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards
+	 *	deliberately share the same address and port.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3042,6 +3266,40 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	return 0;
 }
 
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	uint32_t	shard, num_shards = 1;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	/*
+	 *	UDP listeners can open one socket per network thread.
+	 *	Each socket has its own client and duplicate tracking,
+	 *	so the kernel must always send packets from a
+	 *	particular client to the same socket.
+	 */
+	if (inst->ipproto == IPPROTO_UDP) num_shards = fr_schedule_listen_shards(sc);
+
+	for (shard = 0; shard < num_shards; shard++) {
+		if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages,
+					   shard, num_shards) < 0) return -1;
+	}
+
+	return 0;
+}
+
 
 fr_app_io_t fr_master_app_io = {
 	.magic			= RLM_MODULE_INIT,
@@ -3054,7 +3312,11 @@ fr_app_io_t fr_master_app_io = {
 	.track_duplicates	= true,
 
 	.read			= mod_read,
+	.pending		= mod_pending,
 	.write			= mod_write,
+	.key			= mod_key,
+	.state_owner		= mod_state_owner,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
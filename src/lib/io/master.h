@@ -38,7 +38,11 @@ extern "C" {
 typedef struct fr_io_client_s fr_io_client_t;
 
 typedef struct fr_io_track_s {
-	fr_rb_node_t			node;		//!< rbtree node in the tracking tree.
+	union {
+		fr_rb_node_t		node;		//!< rbtree node in the tracking tree.
+		struct fr_io_track_s	*next;		//!< next entry in the same slot of the tracking table.
+	};
+	uint8_t				id;		//!< packet ID, if the app_io provides track_id.
 	fr_event_timer_t const		*ev;		//!< when we clean up this tracking entry
 	fr_time_t			timestamp;	//!< when this packet was received
 	fr_time_t			expires;	//!< when this packet expires
@@ -115,6 +119,7 @@ extern fr_app_io_t fr_master_app_io;
 fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_ipaddr_t *deny);
 int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *io, fr_schedule_t *sc,
 			size_t default_message_size, size_t num_messages) CC_HINT(nonnull);
+uint32_t fr_master_io_track_key(fr_io_track_t const *track) CC_HINT(nonnull);
 
 #ifdef __cplusplus
 }
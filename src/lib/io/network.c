@@ -67,6 +67,7 @@ typedef struct {
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
+	int			id;			//!< ID of the worker, as assigned by the scheduler.
 	fr_io_stats_t		stats;
 } fr_network_worker_t;
 
@@ -89,10 +90,18 @@ typedef struct {
 	fr_message_set_t	*ms;			//!< message buffers for this socket.
 	fr_channel_data_t	*cd;			//!< cached in case of allocation & read error
 	size_t			leftover;		//!< leftover data from a previous read
+	fr_event_timer_t const	*read_ev;		//!< to read packets buffered by the transport.
 	size_t			written;		//!< however much we did in a partial write
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets with replies to write.
+
+	size_t			unflushed;		//!< packets written, but not yet flushed
+	uint64_t		flushes;		//!< number of times the socket was flushed
+	uint64_t		flushed;		//!< number of packets written by flushes
+	size_t			max_flushed;		//!< largest number of packets written by one flush
+
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -127,6 +136,7 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have replies to write
 
 	fr_io_stats_t		stats;
 
@@ -144,7 +154,18 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	uint64_t		selected[FR_NETWORK_WORKER_SELECT_MAX];	//!< workers chosen by each policy
+	uint64_t		selected_scan;		//!< workers chosen by scanning for one which isn't blocked
+	uint64_t		selected_state;		//!< workers chosen because they own the session state
+};
+
+fr_table_num_sorted_t const fr_network_worker_select_table[] = {
+	{ L("p2c"),		FR_NETWORK_WORKER_SELECT_P2C		},
+	{ L("queue-depth"),	FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH	},
+	{ L("sticky"),		FR_NETWORK_WORKER_SELECT_STICKY		}
 };
+size_t fr_network_worker_select_table_len = NUM_ELEMENTS(fr_network_worker_select_table);
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
 static int fr_network_pre_event(fr_time_t now, fr_time_delta_t wake, void *uctx);
@@ -387,6 +408,51 @@ int fr_network_listen_inject(fr_network_t *nr, fr_listen_t *li, uint8_t const *p
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_INJECT, &my_inject, sizeof(my_inject));
 }
 
+/** Check if the transport has packets buffered from a previous read
+ *
+ * @param[in] s		the network socket.
+ * @return
+ *	- true if read() can return more packets without blocking.
+ *	- false otherwise.
+ */
+static inline bool fr_network_read_pending(fr_network_socket_t *s)
+{
+	fr_app_io_t const *app_io = s->listen->app_io;
+
+	return (app_io->pending && (app_io->pending(s->listen) > 0));
+}
+
+/** Read packets which the transport buffered before we stopped reading
+ *
+ */
+static void fr_network_read_buffered(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_network_socket_t *s = talloc_get_type_abort(uctx, fr_network_socket_t);
+
+	/*
+	 *	We'll be called again when reading is resumed.
+	 */
+	if (s->nr->suspended || s->dead) return;
+
+	fr_network_read(el, s->listen->fd, 0, s);
+}
+
+/** Arrange to read packets buffered by the transport on the next pass through the event loop
+ *
+ * The socket won't become readable for packets which have already
+ * been taken from the kernel, so we can't wait for it.
+ *
+ * @param[in] s		the network socket.
+ */
+static void fr_network_read_defer(fr_network_socket_t *s)
+{
+	if (s->read_ev || s->dead) return;
+
+	if (fr_event_timer_in(s, s->nr->el, &s->read_ev, fr_time_delta_wrap(0), fr_network_read_buffered, s) < 0) {
+		PERROR("Failed inserting timer to read buffered packets");
+	}
+}
+
 static void fr_network_suspend(fr_network_t *nr)
 {
 	static fr_event_update_t pause_read[] = {
@@ -421,6 +487,12 @@ static void fr_network_unsuspend(fr_network_t *nr)
 	     socket;
 	     socket = fr_rb_iter_next_inorder(&iter)) {
 		fr_event_filter_update(socket->nr->el, socket->listen->fd, FR_EVENT_FILTER_IO, resume_read);
+
+		/*
+		 *	Packets buffered by the transport when we
+		 *	suspended reading have to be read first.
+		 */
+		if (fr_network_read_pending(socket)) fr_network_read_defer(socket);
 	}
 	nr->suspended = false;
 }
@@ -543,29 +615,83 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	}
 }
 
-/** Send a message on the "best" channel.
+/** Return true if worker "a" is a better choice than worker "b"
+ *
+ */
+static inline bool fr_network_worker_cmp(fr_network_t const *nr, fr_network_worker_t const *a, fr_network_worker_t const *b)
+{
+	if (nr->config.worker_select == FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH) {
+		uint64_t a_depth = a->stats.in - a->stats.out;
+		uint64_t b_depth = b->stats.in - b->stats.out;
+
+		if (a_depth != b_depth) return (a_depth < b_depth);
+	}
+
+	return fr_time_delta_lt(a->cpu_time, b->cpu_time);
+}
+
+/** Choose a worker for a request
+ *
+ * With state affinity, packets carrying a State value we created are
+ * sent to the worker which owns it, unless that worker is blocked or
+ * has exited.
+ *
+ * "sticky" sends all packets with the same key to the same worker,
+ * unless that worker is blocked.  Otherwise we pick two workers at
+ * random, and choose the one with the lower CPU time ("p2c"), or the
+ * one with fewer outstanding requests ("queue-depth").
  *
  * @param nr the network
  * @param cd the message we've received
+ * @return
+ *	- the worker to send the request to.
+ *	- NULL if all workers are blocked.
  */
-static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
+static fr_network_worker_t *fr_network_worker_select(fr_network_t *nr, fr_channel_data_t *cd)
 {
-	fr_network_worker_t *worker;
+	fr_network_worker_t	*worker;
+	fr_app_io_t const	*app_io = cd->listen->app_io;
 
-	(void) talloc_get_type_abort(nr, fr_network_t);
+	if (nr->config.state_affinity && app_io->state_owner) {
+		int owner, i;
 
-retry:
-	if (nr->num_workers == 1) {
-		worker = nr->workers[0];
-		if (worker->blocked) {
-			RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
-					  "In single-threaded mode and worker is blocked");
-		drop:
-			worker->stats.dropped++;
-			return -1;
+		owner = app_io->state_owner(cd->listen, cd->packet_ctx, cd->m.data, cd->m.data_size);
+		for (i = 0; (owner >= 0) && (i < nr->num_workers); i++) {
+			worker = nr->workers[i];
+			if (worker->id != owner) continue;
+
+			if (!worker->blocked) {
+				nr->selected_state++;
+				return worker;
+			}
+
+			/*
+			 *	The owner is blocked.  Any other worker
+			 *	can still find the state entry, it just
+			 *	has to share the owner's lock.
+			 */
+			break;
+		}
+	}
+
+	if ((nr->config.worker_select == FR_NETWORK_WORKER_SELECT_STICKY) && app_io->key) {
+		uint32_t key;
+
+		key = app_io->key(cd->listen, cd->packet_ctx, cd->m.data, cd->m.data_size);
+
+		worker = nr->workers[key % nr->num_workers];
+		if (!worker->blocked) {
+			nr->selected[FR_NETWORK_WORKER_SELECT_STICKY]++;
+			return worker;
 		}
 
-	} else if (nr->num_blocked == 0) {
+		/*
+		 *	Else the preferred worker is blocked, so we
+		 *	pick another one.
+		 */
+	}
+
+	if (nr->num_blocked == 0) {
 		uint32_t one, two;
 
 		one = fr_rand() % nr->num_workers;
@@ -573,36 +699,70 @@ retry:
 			two = fr_rand() % nr->num_workers;
 		} while (two == one);
 
-		if (fr_time_delta_lt(nr->workers[one]->cpu_time, nr->workers[two]->cpu_time)) {
+		if (fr_network_worker_cmp(nr, nr->workers[one], nr->workers[two])) {
 			worker = nr->workers[one];
 		} else {
 			worker = nr->workers[two];
 		}
+
+		if (nr->config.worker_select == FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH) {
+			nr->selected[FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH]++;
+		} else {
+			nr->selected[FR_NETWORK_WORKER_SELECT_P2C]++;
+		}
 	} else {
 		int i;
-		fr_time_delta_t cpu_time = fr_time_delta_max();
 		fr_network_worker_t *found = NULL;
 
 		/*
-		 *	Some workers are blocked.  Pick an active
-		 *	worker with low CPU time.
+		 *	Some workers are blocked.  Pick the best
+		 *	active worker.
 		 */
 		for (i = 0; i < nr->num_workers; i++) {
 			worker = nr->workers[i];
 			if (worker->blocked) continue;
 
-			if (fr_time_delta_lt(worker->cpu_time, cpu_time)) {
-				found = worker;
-			}
+			if (!found || fr_network_worker_cmp(nr, worker, found)) found = worker;
+		}
+
+		if (!found) return NULL;
+
+		worker = found;
+		nr->selected_scan++;
+	}
+
+	return worker;
+}
+
+/** Send a message on the "best" channel.
+ *
+ * @param nr the network
+ * @param cd the message we've received
+ */
+static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
+{
+	fr_network_worker_t *worker;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+
+retry:
+	if (nr->num_workers == 1) {
+		worker = nr->workers[0];
+		if (worker->blocked) {
+			RATE_LIMIT_GLOBAL(ERROR, "Failed sending packet to worker - "
+					  "In single-threaded mode and worker is blocked");
+		drop:
+			worker->stats.dropped++;
+			return -1;
 		}
 
-		if (!found) {
+	} else {
+		worker = fr_network_worker_select(nr, cd);
+		if (!worker) {
 			 RATE_LIMIT_GLOBAL(PERROR, "Failed sending packet to worker - Couldn't find active worker, "
 			 		   "%u/%u workers are blocked", nr->num_blocked, nr->num_workers);
 			 return -1;
 		}
-
-		worker = found;
 	}
 
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
@@ -729,6 +889,7 @@ next_message:
 	 */
 	if (num_messages > 16) {
 		s->cd = cd;
+		if (fr_network_read_pending(s)) fr_network_read_defer(s);
 		return;
 	}
 
@@ -760,6 +921,17 @@ next_message:
 		 *	blocking issues can happen for stream sockets.
 		 */
 		s->cd = cd;
+
+		/*
+		 *	The transport discarded a packet which it had
+		 *	already taken from the kernel.  Go get the
+		 *	next one, as the socket won't be marked
+		 *	readable for the packets which are buffered.
+		 *
+		 *	If the workers are blocked, the packets stay
+		 *	buffered until reading is resumed.
+		 */
+		if (!nr->suspended && fr_network_read_pending(s)) goto next_message;
 		return;
 	}
 
@@ -850,6 +1022,27 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Datagram transports may read multiple packets from
+	 *	the kernel in one system call.  Drain them into new
+	 *	messages now.  There are at most a batch worth of
+	 *	them, so we don't count them against num_messages.
+	 *
+	 *	If sending the packet blocked the last worker, we
+	 *	stop, and fr_network_unsuspend() reads the rest.
+	 */
+	if (!nr->suspended && fr_network_read_pending(s)) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		goto next_message;
+	}
 }
 
 
@@ -1022,6 +1215,7 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		fr_message_done(&cd->m);
 		nr->stats.out++;
 		s->stats.out++;
+		s->unflushed++;
 
 		/*
 		 *	Grab the net entry.
@@ -1029,6 +1223,37 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(s->waiting);
 	}
 
+	/*
+	 *	Transports which queue packets in write() send them
+	 *	all at once, now that there's nothing left to write.
+	 */
+	if (li->app_io->flush && s->unflushed) {
+		if (li->app_io->flush(li) < 0) {
+			if (errno == EWOULDBLOCK) {
+				if (!s->blocked) {
+					if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+						PERROR("Failed adding write callback to event loop");
+						fr_network_socket_dead(nr, s);
+						return;
+					}
+
+					s->blocked = true;
+				}
+				return;
+			}
+
+			PERROR("Failed flushing socket %s", s->listen->name);
+			if (li->app_io->error) li->app_io->error(li);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		s->flushes++;
+		s->flushed += s->unflushed;
+		if (s->unflushed > s->max_flushed) s->max_flushed = s->unflushed;
+		s->unflushed = 0;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1049,6 +1274,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
@@ -1255,6 +1482,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
 	w->worker = worker;
+	w->id = fr_worker_id(worker);
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
 
@@ -1341,6 +1569,7 @@ static int fr_network_pre_event(UNUSED fr_time_t now, UNUSED fr_time_delta_t wak
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	/*
@@ -1349,7 +1578,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1396,17 +1624,26 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		}
 
 		/*
-		 *	No pending message, let's try writing it.
-		 *
-		 *	If there is a pending message, then we're
-		 *	waiting for IO write to become ready.
+		 *	Queue the reply.  If there is a pending
+		 *	message, then we're waiting for IO write to
+		 *	become ready, and the reply will be written
+		 *	then.
 		 */
-		if (!s->pending) {
+		(void) fr_heap_insert(s->waiting, cd);
+
+		if (!s->pending && !fr_dlist_entry_in_list(&s->flush_entry)) {
 			fr_assert(!s->blocked);
-			(void) fr_heap_insert(s->waiting, cd);
-			fr_network_write(nr->el, s->listen->fd, 0, s);
+			fr_dlist_insert_tail(&nr->flush, s);
 		}
 	}
+
+	/*
+	 *	Write all of the replies for each socket in one go,
+	 *	so that the transport can coalesce them.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		fr_network_write(nr->el, s->listen->fd, 0, s);
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -1667,6 +1904,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	if (fr_control_spin_set(nr->control, nr->config.control_spin) < 0) goto fail2;
+
 	/*
 	 *	Create the various heaps.
 	 */
@@ -1688,6 +1927,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
@@ -1723,10 +1964,15 @@ int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 	if (num >= 3) stats[2] = nr->stats.dup;
 	if (num >= 4) stats[3] = nr->stats.dropped;
 	if (num >= 5) stats[4] = nr->num_workers;
+	if (num >= 6) stats[5] = nr->selected[FR_NETWORK_WORKER_SELECT_P2C];
+	if (num >= 7) stats[6] = nr->selected[FR_NETWORK_WORKER_SELECT_STICKY];
+	if (num >= 8) stats[7] = nr->selected[FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH];
+	if (num >= 9) stats[8] = nr->selected_scan;
+	if (num >= 10) stats[9] = nr->selected_state;
 
-	if (num <= 5) return num;
+	if (num <= 10) return num;
 
-	return 5;
+	return 10;
 }
 
 void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
@@ -1752,6 +1998,11 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
+	fprintf(fp, "select.p2c\t%" PRIu64 "\n", nr->selected[FR_NETWORK_WORKER_SELECT_P2C]);
+	fprintf(fp, "select.sticky\t%" PRIu64 "\n", nr->selected[FR_NETWORK_WORKER_SELECT_STICKY]);
+	fprintf(fp, "select.queue-depth\t%" PRIu64 "\n", nr->selected[FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH]);
+	fprintf(fp, "select.scan\t%" PRIu64 "\n", nr->selected_scan);
+	fprintf(fp, "select.state\t%" PRIu64 "\n", nr->selected_state);
 
 	return 0;
 }
@@ -1792,6 +2043,12 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
 
+	if (s->listen->app_io->flush) {
+		fprintf(fp, "batch.flushes\t%" PRIu64 "\n", s->flushes);
+		fprintf(fp, "batch.packets\t%" PRIu64 "\n", s->flushed);
+		fprintf(fp, "batch.max\t%zu\n", s->max_flushed);
+	}
+
 	return 0;
 }
 
@@ -37,13 +37,31 @@ typedef struct fr_network_s fr_network_t;
 
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/table.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/** How the network chooses a worker for each request
+ *
+ */
+typedef enum {
+	FR_NETWORK_WORKER_SELECT_P2C = 0,		//!< Lower CPU time of two random workers.
+	FR_NETWORK_WORKER_SELECT_STICKY,		//!< Hash of the session key from the listener.
+	FR_NETWORK_WORKER_SELECT_QUEUE_DEPTH,		//!< Fewer outstanding requests of two random workers.
+	FR_NETWORK_WORKER_SELECT_MAX
+} fr_network_worker_select_t;
+
+extern fr_table_num_sorted_t const fr_network_worker_select_table[];
+extern size_t fr_network_worker_select_table_len;
+
 typedef struct {
-	uint32_t	max_outstanding;
+	uint32_t			max_outstanding;
+	fr_network_worker_select_t	worker_select;	//!< how to choose a worker for each request.
+	bool				state_affinity;	//!< send packets with a State value to the worker
+							///< which created it.
+	uint32_t			control_spin;	//!< poll the control plane this many times before sleeping.
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
@@ -28,14 +28,20 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/server/state.h>
 #include <freeradius-devel/server/trigger.h>
 
 #include <pthread.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -62,6 +68,15 @@ RCSID("$Id$")
 #define sem_destroy(s) semaphore_destroy(mach_task_self(),*s)
 #endif	/* __APPLE__ */
 
+/*
+ *	Upper bound on the CPU numbers we can pin threads to.
+ */
+#ifdef CPU_SETSIZE
+#  define MAX_CPUS CPU_SETSIZE
+#else
+#  define MAX_CPUS (1024)
+#endif
+
 #define SEM_WAIT_INTR(_x) do {if (sem_wait(_x) == 0) break;} while (errno == EINTR)
 
 /**
@@ -146,6 +161,11 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	uint32_t	*network_cpus;		//!< CPUs the network threads are pinned to.
+	uint32_t	*worker_cpus;		//!< CPUs the worker threads are pinned to.
+
+	fr_worker_steal_t *steal;		//!< for workers to take requests from each other.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +179,117 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the list in.
+ * @param[out] out	array of CPU numbers.  NULL if spec is NULL.
+ * @param[in] name	of the configuration item, for error messages.
+ * @param[in] spec	the list of CPUs.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_schedule_cpus_parse(TALLOC_CTX *ctx, uint32_t **out, char const *name, char const *spec)
+{
+	char const	*p = spec;
+	uint32_t	*cpus;
+	size_t		num = 0;
+
+	*out = NULL;
+	if (!spec || !*spec) return 0;
+
+	cpus = talloc_array(ctx, uint32_t, 0);
+	if (!cpus) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	while (*p) {
+		char		*q;
+		unsigned long	first, last, i;
+
+		first = last = strtoul(p, &q, 10);
+		if (q == p) {
+		invalid:
+			fr_strerror_printf("Invalid CPU list for '%s' at '%s'", name, p);
+			talloc_free(cpus);
+			return -1;
+		}
+		p = q;
+
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &q, 10);
+			if ((q == p) || (last < first)) goto invalid;
+			p = q;
+		}
+
+		if (last >= MAX_CPUS) goto invalid;
+
+		if (*p == ',') {
+			p++;
+		} else if (*p) {
+			goto invalid;
+		}
+
+		for (i = first; i <= last; i++) {
+			uint32_t *tmp;
+
+			tmp = talloc_realloc(ctx, cpus, uint32_t, num + 1);
+			if (!tmp) {
+				talloc_free(cpus);
+				goto oom;
+			}
+			cpus = tmp;
+			cpus[num++] = i;
+		}
+	}
+
+	*out = cpus;
+	return 0;
+}
+
+/** Pin the current thread to one CPU from a list
+ *
+ * Threads are assigned CPUs from the list in order, wrapping around
+ * if there are more threads than CPUs.  Failure to pin a thread is
+ * not fatal.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] cpus	the list of CPUs.  May be NULL.
+ * @param[in] id	of the thread.
+ */
+static void fr_schedule_thread_pin(fr_schedule_t *sc, char const *name, uint32_t const *cpus, unsigned int id)
+{
+	uint32_t	cpu;
+
+	if (!cpus) return;
+
+	cpu = cpus[id % talloc_array_length(cpus)];
+
+#ifdef __linux__
+	{
+		cpu_set_t	set;
+		int		ret;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (ret != 0) {
+			WARN("%s - Failed pinning thread to CPU %u: %s", name, cpu, fr_syserror(ret));
+			return;
+		}
+	}
+
+	DEBUG2("%s - Pinned to CPU %u", name, cpu);
+#else
+	WARN("%s - Cannot pin thread to CPU %u: Not supported on this platform", name, cpu);
+#endif
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -174,6 +305,7 @@ static void *fr_schedule_worker_thread(void *arg)
 	char				worker_name[32];
 
 	worker_id = sw->id;		/* Store the current worker ID */
+	fr_state_owner_set(sw->id);	/* State entries created by this thread belong to it */
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
@@ -185,6 +317,8 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	INFO("%s - Starting", worker_name);
 
+	fr_schedule_thread_pin(sc, worker_name, sc->worker_cpus, sw->id);
+
 	sw->el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!sw->el) {
 		PERROR("%s - Failed creating event list", worker_name);
@@ -198,6 +332,11 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->steal && (fr_worker_steal_join(sw->worker, sc->steal, sw->id) < 0)) {
+		PERROR("%s - Failed enabling work stealing", worker_name);
+		goto fail;
+	}
+
 	/*
 	 *	@todo make this a registry
 	 */
@@ -298,6 +437,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	fr_schedule_thread_pin(sc, network_name, sc->network_cpus, sn->id);
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -434,6 +575,12 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	 *	If we're single-threaded, create network / worker, and insert them into the event loop.
 	 */
 	if (el) {
+		/*
+		 *	Both ends of every control plane are in this
+		 *	thread, so there's no-one to spin waiting for.
+		 */
+		sc->config->network.control_spin = sc->config->worker.control_spin = 0;
+
 		sc->single_network = fr_network_create(sc, el, "Network", sc->log, sc->lvl, &sc->config->network);
 		if (!sc->single_network) {
 			PERROR("Failed creating network");
@@ -514,6 +661,13 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
 	}
 
+	if ((fr_schedule_cpus_parse(sc, &sc->network_cpus, "network_cpus", sc->config->network_cpus) < 0) ||
+	    (fr_schedule_cpus_parse(sc, &sc->worker_cpus, "worker_cpus", sc->config->worker_cpus) < 0)) {
+		PERROR("Failed parsing thread configuration");
+		talloc_free(sc);
+		return NULL;
+	}
+
 	/*
 	 *	Create the lists which hold the workers and networks.
 	 */
@@ -593,6 +747,19 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	/*
+	 *	The workers share their backlogs, so the shared state
+	 *	has to exist before any of them start.
+	 */
+	if (sc->config->work_stealing && (sc->config->max_workers > 1)) {
+		sc->steal = fr_worker_steal_alloc(sc, sc->config->max_workers, &sc->config->worker);
+		if (!sc->steal) {
+			PERROR("Failed allocating work stealing state");
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -681,8 +848,10 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
-	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
-		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
+	if (sc) INFO("Scheduler created successfully with %u networks and %u workers%s",
+		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers),
+		     (fr_schedule_listen_shards(sc) > 1) ? ", listeners sharded across networks" : "");
+	if (sc && sc->steal) INFO("Idle workers will take requests from busy workers");
 
 	return sc;
 }
@@ -811,7 +980,28 @@ done:
 	return 0;
 }
 
+/** Return how many sockets each sharded listener should open
+ *
+ * When sharding is enabled, each UDP listener opens one socket per
+ * network thread, all bound to the same address and port with
+ * SO_REUSEPORT.  The kernel then distributes packets between the
+ * sockets, and each network thread reads from its own socket.
+ *
+ * @param[in] sc the scheduler
+ * @return the number of sockets to open.  1 if sharding is disabled.
+ */
+uint32_t fr_schedule_listen_shards(fr_schedule_t const *sc)
+{
+	if (sc->el || !sc->config->shard_listeners) return 1;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
 /** Add a fr_listen_t to a scheduler.
+ *
+ * Sharded listeners are added to the network thread matching their
+ * shard number.  All other listeners are added to the same network
+ * thread.
  *
  * @param[in] sc the scheduler
  * @param[in] li the ctx and callbacks for the transport.
@@ -835,6 +1025,19 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 		 *	or maybe add it to the same parent thread?
 		 */
 		sn = fr_dlist_head(&sc->networks);
+
+		if (li->num_shards > 1) {
+			fr_schedule_network_t *shard;
+
+			for (shard = fr_dlist_head(&sc->networks);
+			     shard != NULL;
+			     shard = fr_dlist_next(&sc->networks, shard)) {
+				if (shard->id == (li->shard % fr_dlist_num_elements(&sc->networks))) {
+					sn = shard;
+					break;
+				}
+			}
+		}
 		nr = sn->nr;
 	}
 
@@ -68,6 +68,11 @@ typedef struct {
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	bool		shard_listeners;	//!< open one socket per network thread for UDP listeners.
+	bool		work_stealing;		//!< let idle workers take queued requests from busy ones.
+	char const	*network_cpus;		//!< CPUs to pin network threads to, e.g. "0-3".
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to, e.g. "4-7,12".
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -80,6 +85,7 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
+uint32_t		fr_schedule_listen_shards(fr_schedule_t const *sc) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
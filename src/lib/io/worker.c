@@ -44,6 +44,14 @@
  *  If a request is yielded, it is placed onto the yielded list in
  *  the worker "tracking" data structure.
  *
+ *  When work stealing is enabled, requests which arrive while the
+ *  worker already has runnable requests are not decoded immediately.
+ *  Instead, they are placed into a per-worker backlog.  The worker
+ *  starts them once its runnable heap is empty, and idle peers take
+ *  the oldest ones.  A peer which takes a request runs it to
+ *  completion, and then hands the encoded reply back to the owner
+ *  of the channel, which is the only thread allowed to write to it.
+ *
  * @copyright 2016 Alan DeKok (aland@freeradius.org)
  */
 RCSID("$Id$")
@@ -54,6 +62,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/message.h>
+#include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/time_tracking.h>
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/unlang/base.h>
@@ -72,13 +81,108 @@ static void worker_verify(fr_worker_t *worker);
 #endif
 
 #define CACHE_LINE_SIZE	64
+
+/*
+ *	If a peer's control queue is full when we return a stolen
+ *	request, the reply is parked, and retried from a timer.
+ *	Replies which can't be returned before the timeout are
+ *	discarded.
+ */
+#define WORKER_STOLEN_RETRY		fr_time_delta_from_msec(1)
+#define WORKER_STOLEN_TIMEOUT		fr_time_delta_from_sec(1)
+
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
+/** Per-worker state which is shared with the other workers in a steal group
+ *
+ *  This is owned by the group and not by the worker, so that peers can
+ *  still look at it after the worker has exited.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects the backlog, "control", "dedup" and "loans".
+	fr_channel_data_t	**backlog;	//!< Ring of requests which have not been bootstrapped.
+	uint32_t		head;		//!< Oldest entry in the backlog.
+	uint32_t		size;		//!< Number of entries the backlog can hold.
+	atomic_uint32_t		num;		//!< Number of requests in the backlog.
+						///< Peers read this without taking the mutex.
+	atomic_bool		idle;		//!< Worker is waiting for events, and can be
+						///< woken up to steal requests.
+
+	fr_control_t		*control;	//!< Control plane of the worker.  NULL if it has exited.
+	fr_ring_buffer_t	*rb;		//!< For the worker to send control messages to peers.
+
+	fr_rb_tree_t		*dedup;		//!< The worker's dedup tree.  Peers check it so that they
+						///< don't take packets which conflict with a running request.
+						///< NULL if the worker has exited.
+	fr_rb_tree_t		*loans;		//!< Requests which peers took from our backlog, and are
+						///< still running.  Used for dedup and conflict detection.
+} fr_worker_peer_t;
+
+struct fr_worker_steal_s {
+	unsigned int		num_workers;	//!< Number of workers in the group.
+	fr_worker_peer_t	*peer;		//!< One entry per worker.
+};
+
+/** A request which a peer took from our backlog
+ *
+ * This is allocated by the worker which takes the request, and lives
+ * for as long as the request does.  While it's in the owner's "loans"
+ * tree, the owner can find the request when a duplicate or conflicting
+ * packet arrives, and tell the worker running it.
+ */
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the owner's "loans" tree.
+	fr_dlist_t		entry;		//!< Entry in the list of loans held by the worker running it.
+	uint64_t		id;		//!< Unique per worker, so signals can't reach the wrong request.
+
+	fr_listen_t const	*listen;	//!< Key, as for the dedup tree.
+	void			*packet_ctx;	//!< Key, as for the dedup tree.
+	fr_time_t		recv_time;	//!< To tell duplicates from conflicting packets.
+
+	fr_worker_peer_t	*owner;		//!< Worker which owns the channel.
+	fr_worker_peer_t	*holder;	//!< Worker running the request.
+	fr_worker_t		*worker;	//!< Worker running the request.  Only it may use this.
+	request_t		*request;	//!< NULL until the request has been decoded.
+} fr_worker_loan_t;
+
+/** Tell the worker running a stolen request about a duplicate or conflicting packet
+ *
+ */
+typedef struct {
+	fr_worker_loan_t	*loan;		//!< May have been freed, so check before using it.
+	uint64_t		id;		//!< Of the loan.
+	fr_signal_t		action;		//!< FR_SIGNAL_DUP or FR_SIGNAL_CANCEL.
+} fr_worker_signal_t;
+
+/** A reply (or NAK) for a stolen request, sent back to the worker which owns the channel
+ *
+ */
+typedef struct {
+	fr_channel_data_t	*cd;		//!< Request to NAK.  NULL if there's a reply.
+	fr_channel_t		*ch;		//!< Channel the request was received on.
+	fr_listen_t		*listen;	//!< Listener the request was received on.
+	void			*packet_ctx;	//!< Packet context for the reply.
+	uint8_t			*data;		//!< Encoded reply, allocated in the NULL ctx.
+	size_t			data_len;	//!< Length of the encoded reply.
+	fr_time_t		request_time;	//!< When the request was received.
+	fr_time_delta_t		processing_time; //!< How long the request took to process.
+} fr_worker_stolen_t;
+
+/** A reply for a stolen request, waiting for space in the owner's control queue
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of replies parked for the owner.
+	fr_time_t		expires;	//!< When we give up, and discard the reply.
+	fr_worker_stolen_t	stolen;		//!< The reply.
+} fr_worker_stolen_parked_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
 struct fr_worker_s {
 	char const		*name;		//!< name of this worker
+	int			id;		//!< ID assigned by the scheduler.
 	fr_worker_config_t	config;		//!< external configuration
 
 	unlang_interpret_t 	*intp;		//!< Worker's local interpreter.
@@ -118,9 +222,25 @@ struct fr_worker_s {
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
 
 	fr_channel_t		**channel;	//!< list of channels
+
+	fr_worker_steal_t	*steal;		//!< Workers we can take requests from.  NULL if disabled.
+	fr_worker_peer_t	*peer;		//!< Our entry in the steal group.
+	unsigned int		steal_next;	//!< Where to start looking for peers with a backlog.
+
+	fr_dlist_head_t		loans;		//!< Requests we took from peers, and are still running.
+	uint64_t		next_loan_id;	//!< ID of the next request we take from a peer.
+
+	fr_dlist_head_t		*parked;	//!< Replies waiting to be returned, one list per peer.
+	fr_event_timer_t const	*ev_parked;	//!< Retries sending parked replies.
+
+	uint64_t		num_backlogged;	//!< number of requests placed into our backlog
+	uint64_t		num_stolen;	//!< number of requests we took from peers
 };
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_loan_t *loan);
+static bool worker_backlog_push(fr_worker_t *worker, fr_channel_data_t *cd);
+static void worker_backlog_flush(fr_worker_t *worker, fr_channel_t *ch);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t size, fr_time_t now);
 static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx);
 static void worker_max_request_timer(fr_worker_t *worker);
@@ -138,7 +258,13 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	/*
+	 *	We're busy, let an idle peer have it.
+	 */
+	if (worker->peer && worker_backlog_push(worker, cd)) return;
+
+	worker_request_bootstrap(worker, cd, fr_time(), NULL);
 }
 
 static void worker_exit(fr_worker_t *worker)
@@ -245,6 +371,8 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 
 			if (worker->channel[i] != ch) continue;
 
+			if (worker->peer) worker_backlog_flush(worker, ch);
+
 			ms = fr_channel_responder_uctx_get(ch);
 
 			fr_channel_responder_ack_close(ch);
@@ -270,6 +398,131 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 	}
 }
 
+static void worker_stolen_retry(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Send as many parked replies as the owners' control queues will take
+ *
+ * @param[in] worker	which ran the requests.
+ * @param[in] now	the current time.
+ * @param[in] discard	everything that can't be sent now.
+ */
+static void worker_stolen_flush(fr_worker_t *worker, fr_time_t now, bool discard)
+{
+	unsigned int	i;
+	bool		pending = false;
+
+	for (i = 0; i < worker->steal->num_workers; i++) {
+		fr_worker_peer_t		*owner = &worker->steal->peer[i];
+		fr_dlist_head_t			*list = &worker->parked[i];
+		fr_worker_stolen_parked_t	*parked;
+
+		if (fr_dlist_empty(list)) continue;
+
+		pthread_mutex_lock(&owner->mutex);
+		while ((parked = fr_dlist_head(list)) != NULL) {
+			/*
+			 *	The owner has exited, so there's no one
+			 *	to send the replies to.
+			 */
+			if (owner->control &&
+			    (fr_control_message_send(owner->control, worker->peer->rb, FR_CONTROL_ID_STOLEN,
+						     &parked->stolen, sizeof(parked->stolen)) < 0)) break;
+
+			fr_dlist_remove(list, parked);
+			if (!owner->control) talloc_free(parked->stolen.data);
+			talloc_free(parked);
+		}
+		pthread_mutex_unlock(&owner->mutex);
+
+		/*
+		 *	Replies are parked in order, so the
+		 *	oldest ones time out first.
+		 */
+		while ((parked = fr_dlist_head(list)) != NULL) {
+			if (!discard && fr_time_lt(now, parked->expires)) break;
+
+			ERROR("Timed out returning stolen request to its owner");
+			fr_dlist_remove(list, parked);
+			talloc_free(parked->stolen.data);
+			talloc_free(parked);
+		}
+
+		if (!fr_dlist_empty(list)) pending = true;
+	}
+
+	if (!pending || worker->ev_parked) return;
+
+	if (fr_event_timer_in(worker, worker->el, &worker->ev_parked, WORKER_STOLEN_RETRY,
+			      worker_stolen_retry, worker) < 0) {
+		PERROR("Failed inserting stolen reply retry timer");
+	}
+}
+
+static void worker_stolen_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_worker_t *worker = talloc_get_type_abort(uctx, fr_worker_t);
+
+	worker->ev_parked = NULL;
+	worker_stolen_flush(worker, now, false);
+}
+
+/** Hand a reply or NAK for a stolen request back to the worker which owns the channel
+ *
+ * Only the owner of a channel can write to it, so the owner sends
+ * the reply to the network thread on our behalf.
+ *
+ * Until the owner sends the reply or NAK, the network thread thinks
+ * the request is still running.  So if the owner's control queue is
+ * full, the reply is parked and retried from a timer, instead of
+ * being discarded.  We never wait for the owner in this thread.
+ *
+ * @param[in] worker	the worker which ran the request.
+ * @param[in] owner	the worker which owns the channel.
+ * @param[in] stolen	the reply to return.
+ */
+static void worker_stolen_return(fr_worker_t *worker, fr_worker_peer_t *owner, fr_worker_stolen_t *stolen)
+{
+	fr_dlist_head_t			*list = &worker->parked[owner - worker->steal->peer];
+	fr_worker_stolen_parked_t	*parked;
+	fr_time_t			now = fr_time();
+
+	/*
+	 *	Don't overtake replies which are already parked.
+	 */
+	if (fr_dlist_empty(list)) {
+		int ret;
+
+		pthread_mutex_lock(&owner->mutex);
+
+		/*
+		 *	The owner has exited, so there's no one to send the
+		 *	reply to.
+		 */
+		if (!owner->control) {
+			pthread_mutex_unlock(&owner->mutex);
+			talloc_free(stolen->data);
+			return;
+		}
+
+		ret = fr_control_message_send(owner->control, worker->peer->rb, FR_CONTROL_ID_STOLEN,
+					      stolen, sizeof(*stolen));
+		pthread_mutex_unlock(&owner->mutex);
+
+		if (ret == 0) return;
+	}
+
+	MEM(parked = talloc_zero(worker, fr_worker_stolen_parked_t));
+	parked->expires = fr_time_add(now, WORKER_STOLEN_TIMEOUT);
+	parked->stolen = *stolen;
+	fr_dlist_insert_tail(list, parked);
+
+	if (worker->ev_parked) return;
+
+	if (fr_event_timer_in(worker, worker->el, &worker->ev_parked, WORKER_STOLEN_RETRY,
+			      worker_stolen_retry, worker) < 0) {
+		PERROR("Failed inserting stolen reply retry timer");
+	}
+}
 
 /** Send a NAK to the network thread
  *
@@ -280,8 +533,9 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
  * @param[in] worker	the worker
  * @param[in] cd	the message to NAK
  * @param[in] now	when the message is NAKd
+ * @param[in] owner	of the channel, if the message was stolen from a peer.
  */
-static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now, fr_worker_peer_t *owner)
 {
 	size_t			size;
 	fr_channel_data_t	*reply;
@@ -289,6 +543,17 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	fr_message_set_t	*ms;
 	fr_listen_t		*listen;
 
+	/*
+	 *	Let the owner of the channel send the NAK.
+	 */
+	if (owner) {
+		worker_stolen_return(worker, owner, &(fr_worker_stolen_t){
+					.cd = cd,
+					.ch = cd->channel.ch
+				     });
+		return;
+	}
+
 	worker->num_naks++;
 
 	/*
@@ -443,9 +708,14 @@ static void worker_max_request_timer(fr_worker_t *worker)
 
 	cleanup = fr_time_add(request->async->recv_time, worker->config.max_request_time);
 
+	/*
+	 *	This is re-armed every time the oldest request
+	 *	finishes, and max_request_time is measured in
+	 *	seconds, so it goes into the timer wheel.
+	 */
 	DEBUG2("Resetting cleanup timer to +%pV", fr_box_time_delta(worker->config.max_request_time));
-	if (fr_event_timer_at(worker, worker->el, &worker->ev_cleanup,
-			      cleanup, worker_max_request_time, worker) < 0) {
+	if (fr_event_timer_coarse_at(worker, worker->el, &worker->ev_cleanup,
+				     cleanup, worker_max_request_time, worker) < 0) {
 		ERROR("Failed inserting max_request_time timer");
 	}
 }
@@ -486,6 +756,58 @@ static void worker_request_time_tracking_end(fr_worker_t *worker, request_t *req
 	if (fr_minmax_heap_entry_inserted(request->time_order_id)) (void) fr_minmax_heap_extract(worker->time_order, request);
 }
 
+/** Encode the reply for a stolen request, and return it to the worker which owns the channel
+ *
+ * @param[in] worker		This worker.
+ * @param[in] request		we're sending a reply for.
+ * @param[in] size		The maximum size of the reply data
+ * @param[in] now		The current time
+ */
+static void worker_stolen_reply(fr_worker_t *worker, request_t *request, size_t size, fr_time_t now)
+{
+	uint8_t			*data;
+	ssize_t			slen = 0;
+	fr_listen_t const	*listen = request->async->listen;
+	fr_worker_loan_t	*loan = request->async->stolen_from;
+
+	MEM(data = talloc_zero_array(NULL, uint8_t, size ? size : 1));
+
+	/*
+	 *	Stopped requests have nothing to encode, and "size"
+	 *	is only big enough for a NAK.
+	 */
+	if (request->master_state == REQUEST_STOP_PROCESSING) {
+		slen = 1;
+
+	} else if (size) {
+		if (listen->app->encode) {
+			slen = listen->app->encode(listen->app_instance, request, data, size);
+		} else if (listen->app_io->encode) {
+			slen = listen->app_io->encode(listen->app_io_instance, request, data, size);
+		}
+		if (slen < 0) {
+			RPERROR("Failed encoding request");
+			*data = 0;
+			slen = 1;
+		}
+	}
+
+	fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, request->async->tracking.running_total));
+	fr_time_elapsed_update(&worker->wall_clock, request->async->recv_time, now);
+
+	RDEBUG("Finished request, returning reply to the worker which owns the channel");
+
+	worker_stolen_return(worker, loan->owner, &(fr_worker_stolen_t){
+				.ch = request->async->channel,
+				.listen = request->async->listen,
+				.packet_ctx = request->async->packet_ctx,
+				.data = data,
+				.data_len = slen,
+				.request_time = request->async->recv_time,
+				.processing_time = request->async->tracking.running_total
+			     });
+}
+
 /** Send a response packet to the network side
  *
  * @param[in] worker		This worker.
@@ -528,6 +850,15 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 		return;
 	}
 
+	/*
+	 *	We took this request from a peer.  Encode the reply
+	 *	here, and have the peer send it.
+	 */
+	if (request->async->stolen_from) {
+		worker_stolen_reply(worker, request, size, now);
+		goto done;
+	}
+
 	ms = fr_channel_responder_uctx_get(ch);
 	fr_assert(ms != NULL);
 
@@ -600,6 +931,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 
 	worker->stats.out++;
 
+done:
 	fr_assert(!fr_minmax_heap_entry_inserted(request->time_order_id));
 	fr_assert(!fr_heap_entry_inserted(request->runnable_id));
 
@@ -609,6 +941,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 	request->async->channel = NULL;
 	request->async->packet_ctx = NULL;
 	request->async->listen = NULL;
+	request->async->stolen_from = NULL;
 #endif
 }
 
@@ -662,13 +995,93 @@ void worker_request_name_number(request_t *request)
 	request->name = itoa_internal(request, request->number);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+/** Send a signal to the worker running a request which it took from our backlog
+ *
+ * This is best effort.  If the signal is lost, the request is cleaned up
+ * by max_request_time.
+ *
+ * @param[in] worker	the worker which owns the request.
+ * @param[in] holder	the worker running the request.
+ * @param[in] signal	to send.
+ */
+static void worker_loan_signal(fr_worker_t *worker, fr_worker_peer_t *holder, fr_worker_signal_t *signal)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&holder->mutex);
+	if (holder->control) ret = fr_control_message_send(holder->control, worker->peer->rb, FR_CONTROL_ID_STOLEN_SIGNAL,
+							   signal, sizeof(*signal));
+	pthread_mutex_unlock(&holder->mutex);
+
+	if (ret < 0) PERROR("Failed signalling request which is running on a peer");
+}
+
+/** The owner of a request we're running got a duplicate or conflicting packet
+ *
+ * @param[in] ctx	the worker
+ * @param[in] data	the fr_worker_signal_t
+ * @param[in] data_size	size of the data
+ * @param[in] now	when the control plane was read.
+ */
+static void worker_stolen_signal_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t now)
+{
+	fr_worker_t		*worker = talloc_get_type_abort(ctx, fr_worker_t);
+	fr_worker_signal_t	signal;
+	fr_worker_loan_t	*loan = NULL;
+	request_t		*request;
+
+	if (!fr_cond_assert(data_size == sizeof(signal))) return;
+	memcpy(&signal, data, sizeof(signal));
+
+	/*
+	 *	The request may have finished while the signal was
+	 *	in flight, so only use loans we still hold.
+	 */
+	while ((loan = fr_dlist_next(&worker->loans, loan))) {
+		if ((loan == signal.loan) && (loan->id == signal.id)) break;
+	}
+	if (!loan || !loan->request) return;
+
+	request = loan->request;
+
+	switch (signal.action) {
+	case FR_SIGNAL_DUP:
+		unlang_interpret_signal(request, FR_SIGNAL_DUP);
+		break;
+
+	case FR_SIGNAL_CANCEL:
+		RWARN("Owner got conflicting packet for request (%" PRIu64 "), stopping", request->number);
+		worker_stop_request(&request);
+		break;
+
+	default:
+		fr_assert(0);
+		break;
+	}
+}
+
+/** Remove a loan from the owner's tree, and from our list
+ *
+ */
+static int _worker_loan_free(fr_worker_loan_t *loan)
+{
+	pthread_mutex_lock(&loan->owner->mutex);
+	if (fr_rb_node_inline_in_tree(&loan->node)) (void) fr_rb_remove(loan->owner->loans, loan);
+	pthread_mutex_unlock(&loan->owner->mutex);
+
+	fr_dlist_remove(&loan->worker->loans, loan);
+	return 0;
+}
+
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now,
+				     fr_worker_loan_t *loan)
 {
 	bool			is_dup;
 	int			ret = -1;
 	request_t		*request;
 	TALLOC_CTX		*ctx;
 	fr_listen_t const	*listen;
+	fr_worker_peer_t	*owner = loan ? loan->owner : NULL;
 
 	if (fr_minmax_heap_num_elements(worker->time_order) >= (uint32_t) worker->config.max_requests) goto nak;
 
@@ -716,7 +1129,8 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, now, owner);
+		talloc_free(loan);
 		return;
 	}
 
@@ -725,10 +1139,21 @@ nak:
 	 */
 	if (unlang_call_push(request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, now, owner);
+		talloc_free(loan);
 		return;
 	}
 
+	/*
+	 *	The loan lives as long as the request, so that the
+	 *	owner can find the request for as long as it runs.
+	 */
+	if (loan) {
+		talloc_steal(request, loan);
+		loan->request = request;
+		request->async->stolen_from = loan;
+	}
+
 	/*
 	 *	We're done with this message.
 	 */
@@ -738,17 +1163,40 @@ nak:
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
 	 *	requested to do so.
+	 *
+	 *	Requests taken from a peer were checked by
+	 *	worker_backlog_lend() against the owner's dedup tree,
+	 *	and are in the owner's "loans" tree.  The owner checks
+	 *	that tree for duplicates, and signals us.
 	 */
-	if (request->async->listen->track_duplicates) {
-		request_t *old;
+	if (!loan && request->async->listen->track_duplicates) {
+		request_t		*old;
+		fr_worker_loan_t	*lent = NULL;
+		fr_worker_peer_t	*holder;
+		fr_worker_signal_t	signal;
+
+		/*
+		 *	Peers check our dedup tree and loans before
+		 *	taking requests from our backlog, so the checks
+		 *	and the insert have to be done together.
+		 */
+		if (worker->peer) pthread_mutex_lock(&worker->peer->mutex);
 
 		old = fr_rb_find(worker->dedup, request);
 		if (!old) {
+			if (worker->peer) lent = fr_rb_find(worker->peer->loans, &(fr_worker_loan_t){
+									.listen = request->async->listen,
+									.packet_ctx = request->async->packet_ctx
+								     });
+			if (lent) goto lent;
+
 			/*
 			 *	Ignore duplicate packets where we've
 			 *	already sent the reply.
 			 */
 			if (is_dup) {
+				if (worker->peer) pthread_mutex_unlock(&worker->peer->mutex);
+
 				RDEBUG("Got duplicate packet notice after we had sent a reply - ignoring");
 				fr_channel_null_reply(request->async->channel);
 				talloc_free(request);
@@ -778,6 +1226,8 @@ nak:
 		 *	depth, and not sequence / ack.
 		 */
 		if (fr_time_eq(old->async->recv_time, request->async->recv_time)) {
+			if (worker->peer) pthread_mutex_unlock(&worker->peer->mutex);
+
 			RWARN("Discarding duplicate of request (%"PRIu64")", old->number);
 
 			fr_channel_null_reply(request->async->channel);
@@ -801,20 +1251,406 @@ nak:
 
 		/*
 		 *	Stop the old request, and decrement the number
-		 *	of active requests.
+		 *	of active requests.  The new request replaces
+		 *	it in the dedup tree first, so that peers never
+		 *	see the key as being free.
 		 */
+		(void) fr_rb_remove(worker->dedup, old);
+		(void) fr_rb_insert(worker->dedup, request);
+		if (worker->peer) pthread_mutex_unlock(&worker->peer->mutex);
+
 		RWARN("Got conflicting packet for request (%" PRIu64 "), telling old request to stop", old->number);
 
 		worker_stop_request(&old);
 		worker->stats.dropped++;
+		goto done;
+
+	lent:
+		/*
+		 *	A peer took the old packet from our backlog, and
+		 *	is still running it.  Tell the peer what to do
+		 *	with it.
+		 */
+		holder = lent->holder;
+		signal = (fr_worker_signal_t){
+			.loan = lent,
+			.id = lent->id
+		};
+
+		if (fr_time_eq(lent->recv_time, request->async->recv_time)) {
+			pthread_mutex_unlock(&worker->peer->mutex);
+
+			RWARN("Discarding duplicate of request running on a peer");
+
+			fr_channel_null_reply(request->async->channel);
+			talloc_free(request);
+
+			signal.action = FR_SIGNAL_DUP;
+			worker_loan_signal(worker, holder, &signal);
+			worker->stats.dup++;
+			return;
+		}
+
+		/*
+		 *	The peer will return a NAK for the old request
+		 *	once it has stopped it.
+		 */
+		(void) fr_rb_remove(worker->peer->loans, lent);
+		(void) fr_rb_insert(worker->dedup, request);
+		pthread_mutex_unlock(&worker->peer->mutex);
+
+		RWARN("Got conflicting packet for request running on a peer, telling it to stop");
+
+		signal.action = FR_SIGNAL_CANCEL;
+		worker_loan_signal(worker, holder, &signal);
+		worker->stats.dropped++;
+		goto done;
 
 	insert_new:
 		(void) fr_rb_insert(worker->dedup, request);
+		if (worker->peer) pthread_mutex_unlock(&worker->peer->mutex);
 	}
 
+done:
 	worker_request_time_tracking_start(worker, request, now);
 }
 
+/** Queue a request which we're too busy to start, so that an idle peer can take it
+ *
+ * @param[in] worker	the worker.
+ * @param[in] cd	the request to queue.
+ * @return
+ *	- true if the request was queued.
+ *	- false if the caller should bootstrap it now.
+ */
+static bool worker_backlog_push(fr_worker_t *worker, fr_channel_data_t *cd)
+{
+	fr_worker_peer_t	*peer = worker->peer;
+	fr_worker_steal_t	*steal = worker->steal;
+	uint32_t		num;
+	unsigned int		i;
+
+	/*
+	 *	Nothing else is waiting to run, so there's no point
+	 *	in making this request wait.
+	 */
+	num = atomic_load(&peer->num);
+	if ((num == 0) && (fr_heap_num_elements(worker->runnable) == 0)) return false;
+
+	/*
+	 *	Too many requests.  Let worker_request_bootstrap() NAK it.
+	 */
+	if ((fr_minmax_heap_num_elements(worker->time_order) + num) >= (uint32_t) worker->config.max_requests) return false;
+
+	pthread_mutex_lock(&peer->mutex);
+	num = atomic_load(&peer->num);
+	if (num == peer->size) {
+		pthread_mutex_unlock(&peer->mutex);
+		return false;
+	}
+	peer->backlog[(peer->head + num) % peer->size] = cd;
+	atomic_store(&peer->num, num + 1);
+	pthread_mutex_unlock(&peer->mutex);
+
+	worker->num_backlogged++;
+
+	/*
+	 *	Wake up one idle peer to come and take it.  Peers set
+	 *	"idle" before checking the backlogs, so either they
+	 *	see the new request, or we see that they're idle.
+	 */
+	for (i = 0; i < steal->num_workers; i++) {
+		fr_worker_peer_t	*other = &steal->peer[(worker->steal_next + i) % steal->num_workers];
+		bool			idle = true;
+
+		if (other == peer) continue;
+
+		if (!atomic_compare_exchange_strong(&other->idle, &idle, false)) continue;
+
+		pthread_mutex_lock(&other->mutex);
+		if (other->control) (void) fr_control_message_send(other->control, peer->rb, FR_CONTROL_ID_STEAL,
+								    &worker, sizeof(worker));
+		pthread_mutex_unlock(&other->mutex);
+		break;
+	}
+
+	return true;
+}
+
+/** Take the oldest request from a backlog
+ *
+ * @param[in] peer	whose backlog we're taking the request from.
+ * @return
+ *	- NULL if the backlog is empty.
+ *	- the request.
+ */
+static fr_channel_data_t *worker_backlog_pop(fr_worker_peer_t *peer)
+{
+	fr_channel_data_t	*cd;
+	uint32_t		num;
+
+	if (atomic_load(&peer->num) == 0) return NULL;
+
+	pthread_mutex_lock(&peer->mutex);
+	num = atomic_load(&peer->num);
+	if (num == 0) {
+		pthread_mutex_unlock(&peer->mutex);
+		return NULL;
+	}
+
+	cd = peer->backlog[peer->head];
+	peer->head = (peer->head + 1) % peer->size;
+	atomic_store(&peer->num, num - 1);
+	pthread_mutex_unlock(&peer->mutex);
+
+	return cd;
+}
+
+/** Take the oldest request from a peer's backlog, and record that we're running it
+ *
+ * If the request has the same key as one the peer is running, or one
+ * which has been taken by another worker, we leave it for the peer.
+ * The peer's dedup code then decides what to do with it.
+ *
+ * @param[in] worker	the worker taking the request.
+ * @param[in] peer	whose backlog we're taking the request from.
+ * @param[out] cd_p	the request.
+ * @return
+ *	- NULL if the backlog is empty, or we can't take the oldest request.
+ *	- the loan, which must be passed to worker_request_bootstrap().
+ */
+static fr_worker_loan_t *worker_backlog_lend(fr_worker_t *worker, fr_worker_peer_t *peer, fr_channel_data_t **cd_p)
+{
+	fr_channel_data_t	*cd;
+	fr_worker_loan_t	*loan;
+	uint32_t		num;
+
+	if (atomic_load(&peer->num) == 0) return NULL;
+
+	/*
+	 *	Allocate before taking the lock.  It's cheaper to free
+	 *	the loan if the backlog is empty.
+	 */
+	MEM(loan = talloc_zero(NULL, fr_worker_loan_t));
+
+	pthread_mutex_lock(&peer->mutex);
+	num = atomic_load(&peer->num);
+	if (num == 0) {
+	leave:
+		pthread_mutex_unlock(&peer->mutex);
+		talloc_free(loan);
+		return NULL;
+	}
+
+	cd = peer->backlog[peer->head];
+
+	loan->id = worker->next_loan_id++;
+	loan->listen = cd->listen;
+	loan->packet_ctx = cd->packet_ctx;
+	loan->recv_time = cd->request.recv_time;
+	loan->owner = peer;
+	loan->holder = worker->peer;
+	loan->worker = worker;
+
+	if (cd->listen->track_duplicates) {
+		fr_async_t	async = { .listen = cd->listen, .packet_ctx = cd->packet_ctx };
+		request_t	find = { .async = &async };
+
+		if (cd->request.is_dup || fr_rb_find(peer->loans, loan) ||
+		    (peer->dedup && fr_rb_find(peer->dedup, &find))) goto leave;
+
+		(void) fr_rb_insert(peer->loans, loan);
+	}
+
+	peer->head = (peer->head + 1) % peer->size;
+	atomic_store(&peer->num, num - 1);
+	pthread_mutex_unlock(&peer->mutex);
+
+	fr_dlist_insert_tail(&worker->loans, loan);
+	talloc_set_destructor(loan, _worker_loan_free);
+
+	*cd_p = cd;
+	return loan;
+}
+
+/** Discard requests in our backlog
+ *
+ * @param[in] worker	the worker.
+ * @param[in] ch	discard only requests received on this channel.
+ *			If NULL, discard all requests.
+ */
+static void worker_backlog_flush(fr_worker_t *worker, fr_channel_t *ch)
+{
+	fr_worker_peer_t	*peer = worker->peer;
+	uint32_t		i, num, kept = 0;
+
+	pthread_mutex_lock(&peer->mutex);
+	num = atomic_load(&peer->num);
+	for (i = 0; i < num; i++) {
+		fr_channel_data_t *cd = peer->backlog[(peer->head + i) % peer->size];
+
+		if (!ch || (cd->channel.ch == ch)) {
+			fr_message_done(&cd->m);
+			continue;
+		}
+
+		peer->backlog[(peer->head + kept++) % peer->size] = cd;
+	}
+	atomic_store(&peer->num, kept);
+	pthread_mutex_unlock(&peer->mutex);
+}
+
+/** Whether we're allowed to take requests from peers
+ *
+ */
+static inline CC_HINT(always_inline) bool worker_can_steal(fr_worker_t *worker)
+{
+	return (fr_minmax_heap_num_elements(worker->time_order) < (uint32_t) worker->config.max_requests);
+}
+
+/** Check if there are any requests in our backlog, or in the backlog of a peer
+ *
+ */
+static bool worker_backlog_ready(fr_worker_t *worker)
+{
+	unsigned int i;
+
+	if (atomic_load(&worker->peer->num) > 0) return true;
+
+	if (!worker_can_steal(worker)) return false;
+
+	for (i = 0; i < worker->steal->num_workers; i++) {
+		if (atomic_load(&worker->steal->peer[i].num) > 0) return true;
+	}
+
+	return false;
+}
+
+/** Start the next request from our backlog, or take one from the busiest peer
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ * @return
+ *	- true if a request was started (or NAK'd).
+ *	- false if there was nothing to do.
+ */
+static bool worker_backlog_start(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	fr_worker_peer_t	*victim = NULL;
+	fr_worker_loan_t	*loan;
+	fr_channel_data_t	*cd;
+	uint32_t		most = 0;
+	unsigned int		i;
+
+	cd = worker_backlog_pop(worker->peer);
+	if (cd) {
+		worker_request_bootstrap(worker, cd, now, NULL);
+		return true;
+	}
+
+	if (!worker_can_steal(worker)) return false;
+
+	/*
+	 *	Start at a different peer each time, so that ties
+	 *	don't always go to the same one.
+	 */
+	for (i = 0; i < steal->num_workers; i++) {
+		fr_worker_peer_t	*peer = &steal->peer[(worker->steal_next + i) % steal->num_workers];
+		uint32_t		num;
+
+		if (peer == worker->peer) continue;
+
+		num = atomic_load(&peer->num);
+		if (num <= most) continue;
+
+		most = num;
+		victim = peer;
+	}
+	worker->steal_next++;
+
+	if (!victim) return false;
+
+	loan = worker_backlog_lend(worker, victim, &cd);
+	if (!loan) return false;
+
+	worker->num_stolen++;
+	DEBUG3("Took request from the backlog of a peer");
+	worker_request_bootstrap(worker, cd, now, loan);
+	return true;
+}
+
+/** A peer queued a request while we were idle
+ *
+ * We've been woken up, and worker_run_request() will take the request.
+ */
+static void worker_steal_callback(UNUSED void *ctx, UNUSED void const *data, UNUSED size_t data_size, UNUSED fr_time_t now)
+{
+}
+
+/** A peer finished running a request it took from our backlog
+ *
+ * @param[in] ctx	the worker
+ * @param[in] data	the fr_worker_stolen_t
+ * @param[in] data_size	size of the data
+ * @param[in] when	when the control plane was read.
+ */
+static void worker_stolen_callback(void *ctx, void const *data, size_t data_size, UNUSED fr_time_t when)
+{
+	fr_worker_t		*worker = talloc_get_type_abort(ctx, fr_worker_t);
+	fr_worker_stolen_t	stolen;
+	fr_channel_data_t	*reply;
+	fr_message_set_t	*ms;
+	fr_time_t		now;
+
+	/*
+	 *	Replies sent while handling earlier control messages
+	 *	may be newer than "when".
+	 */
+	now = fr_time();
+
+	if (!fr_cond_assert(data_size == sizeof(stolen))) return;
+	memcpy(&stolen, data, sizeof(stolen));
+
+	/*
+	 *	The network closed the channel while the peer was
+	 *	running the request.  There's no one to reply to.
+	 */
+	if (!fr_channel_active(stolen.ch)) {
+		talloc_free(stolen.data);
+		return;
+	}
+
+	if (stolen.cd) {
+		worker_nak(worker, stolen.cd, now, NULL);
+		return;
+	}
+
+	ms = fr_channel_responder_uctx_get(stolen.ch);
+	fr_assert(ms != NULL);
+
+	reply = (fr_channel_data_t *) fr_message_reserve(ms, stolen.data_len);
+	fr_assert(reply != NULL);
+
+	memcpy(reply->m.data, stolen.data, stolen.data_len);
+	(void) fr_message_alloc(ms, &reply->m, stolen.data_len);
+	talloc_free(stolen.data);
+
+	reply->m.when = now;
+	reply->reply.cpu_time = worker->tracking.running_total;
+	reply->reply.processing_time = stolen.processing_time;
+	reply->reply.request_time = stolen.request_time;
+
+	reply->listen = stolen.listen;
+	reply->packet_ctx = stolen.packet_ctx;
+
+	if (fr_channel_send_reply(stolen.ch, reply) < 0) {
+		PERROR("Failed sending reply to network thread");
+	}
+
+	worker->stats.out++;
+}
+
 /**
  *  Track a request_t in the "runnable" heap.
  */
@@ -856,6 +1692,20 @@ static int8_t worker_dedup_cmp(void const *one, void const *two)
 	return CMP(a->async->packet_ctx, b->async->packet_ctx);
 }
 
+/**
+ *  Track a fr_worker_loan_t in the owner's "loans" tree, with the same key as "dedup"
+ */
+static int8_t worker_loan_cmp(void const *one, void const *two)
+{
+	int ret;
+	fr_worker_loan_t const *a = one, *b = two;
+
+	ret = CMP(a->listen, b->listen);
+	if (ret) return ret;
+
+	return CMP(a->packet_ctx, b->packet_ctx);
+}
+
 /** Destroy a worker
  *
  * The input channels are signaled, and local messages are cleaned up.
@@ -880,10 +1730,28 @@ void fr_worker_destroy(fr_worker_t *worker)
 	 */
 	unlang_interpret_set_thread_default(NULL);
 
+	/*
+	 *	Tell peers we're gone, and discard any requests we
+	 *	haven't started.  Peers drop the replies for any
+	 *	requests they took from us.
+	 */
+	if (worker->peer) {
+		pthread_mutex_lock(&worker->peer->mutex);
+		worker->peer->control = NULL;
+		worker->peer->dedup = NULL;
+		pthread_mutex_unlock(&worker->peer->mutex);
+
+		worker_backlog_flush(worker, NULL);
+	}
+
 	/*
 	 *	Destroy all of the active requests.  These are ones
 	 *	which are still waiting for timers or file descriptor
 	 *	events.
+	 *
+	 *	Stopping a request we took from a peer returns a NAK
+	 *	to the peer, so that it and the network thread stop
+	 *	counting the request as outstanding.
 	 */
 	count = 0;
 	while ((request = fr_minmax_heap_min_peek(worker->time_order)) != NULL) {
@@ -894,6 +1762,13 @@ void fr_worker_destroy(fr_worker_t *worker)
 		worker_stop_request(&request);
 	}
 	fr_assert(fr_heap_num_elements(worker->runnable) == 0);
+	fr_assert(fr_dlist_num_elements(&worker->loans) == 0);
+
+	/*
+	 *	Make one last attempt to return replies which
+	 *	are parked, and discard the rest.
+	 */
+	if (worker->peer) worker_stolen_flush(worker, fr_time(), true);
 
 	/*
 	 *	Signal the channels that we're closing.
@@ -950,8 +1825,16 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 *	Only real packets are in the dedup tree.  And even
 	 *	then, only some of the time.
 	 */
-	if (request->async->listen->track_duplicates) {
-		(void) fr_rb_delete(worker->dedup, request);
+	if (request->async->listen->track_duplicates && !request->async->stolen_from) {
+		if (worker->peer) pthread_mutex_lock(&worker->peer->mutex);
+
+		/*
+		 *	A conflicting packet may already have replaced
+		 *	this request in the tree.
+		 */
+		if (fr_rb_find(worker->dedup, request) == request) (void) fr_rb_delete(worker->dedup, request);
+
+		if (worker->peer) pthread_mutex_unlock(&worker->peer->mutex);
 	}
 
 	/*
@@ -1166,8 +2049,18 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 	 *	event loop fewer times per second, instead of after
 	 *	every request.
 	 */
-	while (fr_time_delta_lt(fr_time_sub(now, start), fr_time_delta_wrap(NSEC / 100000)) &&
-	       ((request = fr_heap_pop(worker->runnable)) != NULL)) {
+	while (fr_time_delta_lt(fr_time_sub(now, start), fr_time_delta_wrap(NSEC / 100000))) {
+		request = fr_heap_pop(worker->runnable);
+		if (!request) {
+			/*
+			 *	Start the next request from our
+			 *	backlog, or take one from a peer.
+			 */
+			if (!worker->peer || !worker_backlog_start(worker, now)) break;
+
+			now = fr_time();
+			continue;
+		}
 
 		REQUEST_VERIFY(request);
 		fr_assert(!fr_heap_entry_inserted(request->runnable_id));
@@ -1212,6 +2105,7 @@ nomem:
 	}
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
+	worker->id = fr_schedule_worker_id();
 
 	unlang_thread_instantiate(worker);
 
@@ -1273,6 +2167,8 @@ nomem:
 		goto fail;
 	}
 
+	if (fr_control_spin_set(worker->control, worker->config.control_spin) < 0) goto fail;
+
 	worker->runnable = fr_heap_talloc_alloc(worker, worker_runnable_cmp, request_t, runnable_id, 0);
 	if (!worker->runnable) {
 		fr_strerror_const("Failed creating runnable heap");
@@ -1291,6 +2187,8 @@ nomem:
 		goto fail;
 	}
 
+	fr_dlist_init(&worker->loans, fr_worker_loan_t, entry);
+
 	worker->intp = unlang_interpret_init(worker, el,
 					     &(unlang_request_func_t){
 							.init_internal = _worker_request_internal_init,
@@ -1337,6 +2235,17 @@ void fr_worker(fr_worker_t *worker)
 		 *	the event loop, but we don't wait for events.
 		 */
 		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+
+		/*
+		 *	Tell peers we're idle before checking the
+		 *	backlogs, so that a request queued after the
+		 *	check will wake us up.
+		 */
+		if (wait_for_event && worker->peer) {
+			atomic_store(&worker->peer->idle, true);
+			wait_for_event = !worker_backlog_ready(worker);
+		}
+
 		if (wait_for_event) {
 			DEBUG4("Ready to process requests");
 		}
@@ -1347,6 +2256,7 @@ void fr_worker(fr_worker_t *worker)
 		 */
 		DEBUG3("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
 		num_events = fr_event_corral(worker->el, fr_time(), wait_for_event);
+		if (worker->peer) atomic_store(&worker->peer->idle, false);
 		if (num_events < 0) {
 			PERROR("Failed retrieving events");
 			break;
@@ -1459,6 +2369,145 @@ fr_channel_t *fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 	return ch;
 }
 
+static int _worker_steal_free(fr_worker_steal_t *steal)
+{
+	unsigned int i;
+
+	for (i = 0; i < steal->num_workers; i++) pthread_mutex_destroy(&steal->peer[i].mutex);
+
+	return 0;
+}
+
+/** Allocate shared state for a group of workers which take requests from each other
+ *
+ * This must be called before any of the worker threads are started, and freed
+ * only after they have all exited.
+ *
+ * @param[in] ctx		to allocate the group in.
+ * @param[in] num_workers	the number of workers in the group.
+ * @param[in] config		worker configuration, used to size the backlogs.
+ * @return
+ *	- NULL on error.
+ *	- fr_worker_steal_t on success.
+ */
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers, fr_worker_config_t const *config)
+{
+	fr_worker_steal_t	*steal;
+	uint32_t		size;
+	unsigned int		i;
+
+	/*
+	 *	The backlog can never hold more than max_requests.
+	 */
+	size = (config->max_requests > 0) ? (uint32_t) config->max_requests : 1024;
+	if (size < 1024) size = 1024;
+	if (size > 65536) size = 65536;
+
+	steal = talloc_zero(ctx, fr_worker_steal_t);
+	if (!steal) {
+	nomem:
+		fr_strerror_const("Failed allocating memory");
+		return NULL;
+	}
+	talloc_set_destructor(steal, _worker_steal_free);
+
+	steal->peer = talloc_zero_array(steal, fr_worker_peer_t, num_workers);
+	if (!steal->peer) {
+	fail:
+		talloc_free(steal);
+		goto nomem;
+	}
+
+	/*
+	 *	Everything is allocated here, as peers can't safely
+	 *	allocate from a shared talloc ctx once their threads
+	 *	are running.
+	 */
+	for (i = 0; i < num_workers; i++) {
+		fr_worker_peer_t *peer = &steal->peer[i];
+
+		peer->backlog = talloc_zero_array(steal->peer, fr_channel_data_t *, size);
+		if (!peer->backlog) goto fail;
+
+		peer->rb = fr_ring_buffer_create(steal->peer, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE * 2);
+		if (!peer->rb) goto fail;
+
+		peer->loans = fr_rb_inline_alloc(steal->peer, fr_worker_loan_t, node, worker_loan_cmp, NULL);
+		if (!peer->loans) goto fail;
+
+		peer->size = size;
+		pthread_mutex_init(&peer->mutex, NULL);
+		steal->num_workers++;
+	}
+
+	return steal;
+}
+
+/** Add a worker to a steal group
+ *
+ * Must be called from the worker's thread, before it starts processing requests.
+ *
+ * @param[in] worker	to add.
+ * @param[in] steal	the group to add it to.
+ * @param[in] id	of the worker, from 0 to num_workers - 1.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id)
+{
+	fr_worker_peer_t	*peer;
+	unsigned int		i;
+
+	if (id >= steal->num_workers) {
+		fr_strerror_printf("Worker ID %u is outside of the steal group", id);
+		return -1;
+	}
+	peer = &steal->peer[id];
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL, worker, worker_steal_callback) < 0) {
+		fr_strerror_const_push("Failed adding steal callback");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STOLEN, worker, worker_stolen_callback) < 0) {
+		fr_strerror_const_push("Failed adding stolen callback");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STOLEN_SIGNAL, worker,
+				    worker_stolen_signal_callback) < 0) {
+		fr_strerror_const_push("Failed adding stolen signal callback");
+		return -1;
+	}
+
+	MEM(worker->parked = talloc_array(worker, fr_dlist_head_t, steal->num_workers));
+	for (i = 0; i < steal->num_workers; i++) {
+		fr_dlist_talloc_init(&worker->parked[i], fr_worker_stolen_parked_t, entry);
+	}
+
+	pthread_mutex_lock(&peer->mutex);
+	peer->control = worker->control;
+	peer->dedup = worker->dedup;
+	pthread_mutex_unlock(&peer->mutex);
+
+	worker->steal = steal;
+	worker->peer = peer;
+	worker->steal_next = id + 1;
+
+	return 0;
+}
+
+/** Return the ID the scheduler assigned to a worker
+ *
+ * @param[in] worker	to return the ID of.
+ * @return the worker ID.
+ */
+int fr_worker_id(fr_worker_t const *worker)
+{
+	return worker->id;
+}
+
 #ifdef WITH_VERIFY_PTR
 /** Verify the worker data structures.
  *
@@ -1502,10 +2551,12 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	if (num >= 4) stats[3] = worker->stats.dropped;
 	if (num >= 5) stats[4] = worker->num_naks;
 	if (num >= 6) stats[5] = worker->num_active;
+	if (num >= 7) stats[6] = worker->num_backlogged;
+	if (num >= 8) stats[7] = worker->num_stolen;
 
-	if (num <= 6) return num;
+	if (num <= 8) return num;
 
-	return 6;
+	return 8;
 }
 
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
@@ -1521,6 +2572,11 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
+		if (worker->peer) {
+			fprintf(fp, "count.backlog\t\t\t%u\n", (unsigned int) atomic_load(&worker->peer->num));
+			fprintf(fp, "count.backlogged\t\t%" PRIu64 "\n", worker->num_backlogged);
+			fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+		}
 	}
 
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
@@ -37,6 +37,11 @@ extern "C" {
  */
 typedef struct fr_worker_s fr_worker_t;
 
+/**
+ *  A group of workers which can take requests from each others backlogs.
+ */
+typedef struct fr_worker_steal_s fr_worker_steal_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +71,8 @@ typedef struct {
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
 	size_t		talloc_pool_size;	//!< for each request
+
+	uint32_t	control_spin;		//!< poll the control plane this many times before sleeping.
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -85,6 +92,12 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+int		fr_worker_id(fr_worker_t const *worker) CC_HINT(nonnull);
+
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, unsigned int num_workers, fr_worker_config_t const *config);
+
+int		fr_worker_steal_join(fr_worker_t *worker, fr_worker_steal_t *steal, unsigned int id) CC_HINT(nonnull);
+
 #include <freeradius-devel/server/module.h>
 
 int		fr_worker_subrequest_add(request_t *request) CC_HINT(nonnull);
@@ -157,7 +157,7 @@
 #include "cluster.h"
 #include "crc16.h"
 
-#define KEY_SLOTS		16384			//!< Maximum number of keyslots (should not change).
+#define KEY_SLOTS		FR_REDIS_CLUSTER_KEY_SLOTS	//!< Maximum number of keyslots (should not change).
 
 #define MAX_SLAVES		5			//!< Maximum number of slaves associated
 							//!< with a keyslot.
@@ -1650,6 +1650,35 @@ int fr_redis_cluster_port(uint16_t *out, fr_redis_cluster_node_t const *node)
 	return 0;
 }
 
+/** Return the number of the key slot a key hashes to
+ *
+ * Unlike #fr_redis_cluster_slot_by_key this always hashes the key,
+ * whether or not the cluster has multiple nodes.
+ *
+ * @param[in] key	to hash.
+ * @param[in] key_len	Length of the key.
+ * @return key slot 0..#FR_REDIS_CLUSTER_KEY_SLOTS - 1.
+ */
+uint16_t fr_redis_cluster_key_slot_num(uint8_t const *key, size_t key_len)
+{
+	return cluster_key_hash(key, key_len);
+}
+
+/** Extract the key slot and node address from a MOVED or ASK error
+ *
+ * @param[out] key_slot		The redirect applies to (may be NULL).
+ * @param[out] node_addr	Address of the node we were redirected to.
+ * @param[in] redirect		Error reply from the server.
+ * @return
+ *	- FR_REDIS_CLUSTER_RCODE_SUCCESS on success.
+ *	- FR_REDIS_CLUSTER_RCODE_BAD_INPUT if the server returned an invalid redirect.
+ */
+fr_redis_cluster_rcode_t fr_redis_cluster_redirect_addr(uint16_t *key_slot, fr_socket_t *node_addr,
+							redisReply *redirect)
+{
+	return cluster_node_conf_from_redirect(key_slot, node_addr, redirect);
+}
+
 /** Resolve a key to a pool, and reserve a connection in that pool
  *
  * This should be used with #fr_redis_cluster_state_next, and #fr_redis_command_status, to
@@ -35,6 +35,8 @@ RCSIDH(cluster_h, "$Id$")
 extern "C" {
 #endif
 
+#define FR_REDIS_CLUSTER_KEY_SLOTS	16384		//!< Number of key slots in a Redis cluster.
+
 typedef struct fr_redis_cluster fr_redis_cluster_t;
 typedef struct fr_redis_cluster_key_slot_s fr_redis_cluster_key_slot_t;
 typedef struct fr_redis_cluster_node_s fr_redis_cluster_node_t;
@@ -100,6 +102,10 @@ int fr_redis_cluster_ipaddr(fr_ipaddr_t *out, fr_redis_cluster_node_t const *nod
 
 int fr_redis_cluster_port(uint16_t *out, fr_redis_cluster_node_t const *node);
 
+uint16_t fr_redis_cluster_key_slot_num(uint8_t const *key, size_t key_len);
+
+fr_redis_cluster_rcode_t fr_redis_cluster_redirect_addr(uint16_t *key_slot, fr_socket_t *node_addr,
+							redisReply *redirect);
 
 
 /*
@@ -66,6 +66,27 @@ static void _redis_connected(redisAsyncContext const *ac, UNUSED int status)
 	fr_connection_signal_connected(conn);
 }
 
+/** Called by hiredis with the result of the AUTH and SELECT commands sent on connection
+ *
+ */
+static void _redis_setup_reply(redisAsyncContext *ac, void *vreply, void *privdata)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(ac->data, fr_connection_t);
+	redisReply		*reply = vreply;
+	char const		*cmd = privdata;
+
+	if (!reply) return;	/* Disconnected, the disconnect callback deals with this */
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		ERROR("%s failed: %s", cmd, reply->str);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+	}
+
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	fr_redis_reply_free(&reply);
+#endif
+}
+
 /** Redis FD became readable
  *
  */
@@ -343,6 +364,35 @@ static fr_connection_state_t _redis_io_connection_init(void **h_out, fr_connecti
 	 */
 	memcpy(&h->ac->data, &conn, sizeof(h->ac->data));
 
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	/*
+	 *	Replies are kept with the commands that
+	 *	produced them until the whole command set
+	 *	is complete, so hiredis mustn't free them
+	 *	when the callback returns.
+	 */
+	h->ac->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+#endif
+
+	/*
+	 *	hiredis buffers these until the connection
+	 *	is open, and they'll be written out before
+	 *	any commands the trunk enqueues.
+	 *
+	 *	They don't pass through the pipeline demux
+	 *	so they don't affect the SQNs.
+	 */
+	if (conf->password &&
+	    (redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "AUTH"), "AUTH %s", conf->password) != REDIS_OK)) {
+		ERROR("Failed queueing AUTH for %s:%u", host, port);
+		goto error;
+	}
+	if (conf->database &&
+	    (redisAsyncCommand(h->ac, _redis_setup_reply, UNCONST(char *, "SELECT"), "SELECT %u", conf->database) != REDIS_OK)) {
+		ERROR("Failed queueing SELECT for %s:%u", host, port);
+		goto error;
+	}
+
 	/*
 	 *	Handle has to be associated with the
 	 *	conn in case I/O handlers want to get
@@ -27,6 +27,7 @@
 
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/util/rb.h>
 
 #include "pipeline.h"
 #include "io.h"
@@ -42,6 +43,14 @@ struct fr_redis_cluster_thread_s {
 	char				*log_prefix;	//!< Common log prefix to use for all cluster related
 							///< messages.
 	bool				delay_start;	//!< Prevent connections from spawning immediately.
+
+	fr_redis_cluster_t		*cluster;	//!< Shared cluster map, used to find the node
+							///< responsible for a key.
+	fr_redis_io_conf_t const	*io_conf;	//!< Database, password and timeouts for connections
+							///< to every node.
+	fr_rb_tree_t			*trunks;	//!< Trunks for each node we've talked to, by address.
+	fr_redis_trunk_t		**moved;	//!< Key slots we've received MOVED for, and the
+							///< trunk they now map to.  Allocated on first use.
 };
 
 /** The thread local free list
@@ -72,6 +81,7 @@ struct fr_redis_command_s {
 
 	char const			*str;		//!< The command string.
 	size_t				len;		//!< Length of the command string.
+	bool				formatted;	//!< str is already in the Redis protocol format.
 
 	uint64_t			sqn;		//!< The sequence number of the command.  This is only
 							///< valid for a specific handle, and is unique within
@@ -147,6 +157,10 @@ struct fr_redis_trunk_s {
 	fr_trunk_t			*trunk;		//!< Trunk containing all the connections to a specific
 							///< host.
 	fr_redis_cluster_thread_t	*cluster;	//!< Cluster this trunk belongs to.
+
+	fr_rb_node_t			node;		//!< Entry in the cluster thread's tree of trunks.
+	fr_ipaddr_t			ipaddr;		//!< Address of the node.
+	uint16_t			port;		//!< Port of the node.
 };
 
 /** Free any free requests when the thread is joined
@@ -180,7 +194,8 @@ static int _redis_command_set_free(fr_redis_command_set_t *cmds)
 	}
 
 	talloc_free_children(cmds);
-	memset(&cmds, 0, sizeof(cmds));
+	memset(cmds, 0, sizeof(*cmds));
+	fr_dlist_entry_init(&cmds->entry);
 
 	fr_dlist_insert_head(command_set_free_list, cmds);
 
@@ -262,7 +277,9 @@ fr_redis_command_set_t *fr_redis_command_set_alloc(TALLOC_CTX *ctx,
  */
 static int _redis_command_free(fr_redis_command_t *cmd)
 {
-	//if (cmd->result) fr_redis_reply_free(&cmd->result);
+#ifdef REDIS_NO_AUTO_FREE_REPLIES
+	if (cmd->result) fr_redis_reply_free(&cmd->result);
+#endif
 
 	return 0;
 }
@@ -272,29 +289,36 @@ redisReply *fr_redis_command_get_result(fr_redis_command_t *cmd)
 	return cmd->result;
 }
 
-/** Add a preformatted/expanded command to the command set
+/** Take ownership of the result of a command
  *
- * The command must either be entirely static, or parented by the command set.
+ * The result will no longer be freed with the command set, and must
+ * be freed by the caller with #fr_redis_reply_free.
  *
- * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
- * 	 As subscribing to a stream where we're not expecting it would break
- * 	 things, badly.
+ * @param[in] cmd	to take the result from.
+ * @return The reply, or NULL if there was no reply.
+ */
+redisReply *fr_redis_command_steal_result(fr_redis_command_t *cmd)
+{
+	redisReply *reply = cmd->result;
+
+	cmd->result = NULL;
+
+	return reply;
+}
+
+/** Check a command doesn't leave a transaction block in a bad state
  *
- * @param[in] cmds	Command set to add command to.
- * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
- *			Must be static, or have the same lifetime as the
- *			command set (allocated with the command set as the parent).
- * @param[in] cmd_len	Length of the command.
+ * @param[out] type	of the command.
+ * @param[in] cmds	Command set the command is being added to.
+ * @param[in] cmd_str	Command, only the command name is checked.
  * @return
- *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
- *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if the command would create a bad sequence.
+ *	- FR_REDIS_PIPELINE_OK if the command can be added.
  */
-fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
-							     char const *cmd_str, size_t cmd_len)
+static fr_redis_pipeline_status_t redis_command_type(fr_redis_command_type_t *type,
+						     fr_redis_command_set_t *cmds, char const *cmd_str)
 {
-	request_t			*request = cmds->request;
-	fr_redis_command_t	*cmd;
-	fr_redis_command_type_t	type = FR_REDIS_COMMAND_NORMAL;
+	request_t		*request = cmds->request;
 
 	/*
 	 *	Transaction sanity checks.
@@ -306,6 +330,8 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	 *	We try very hard to do this without incurring a performance penalty
 	 *      for non-transactional commands.
 	 */
+	*type = FR_REDIS_COMMAND_NORMAL;
+
 	switch (tolower(cmd_str[0])) {
 	case 'm':
 		if (tolower(cmd_str[1] != 'u')) break;
@@ -323,7 +349,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		 *	that's marked as the start of the transaction
 		 *	block.
 		 */
-		type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
+		*type = cmds->txn_watch ? FR_REDIS_COMMAND_TRANSACTION_START : FR_REDIS_COMMAND_NORMAL;
 		cmds->txn_start++;	/* Yes MULTI increments start, not WATCH */
 		break;
 
@@ -345,7 +371,7 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 			ROPTIONAL(ERROR, REDEBUG, "Transaction not started, missing \"MULTI\" command");
 			return FR_REDIS_PIPELINE_BAD_CMDS;
 		}
-		type = FR_REDIS_COMMAND_TRANSACTION_END;
+		*type = FR_REDIS_COMMAND_TRANSACTION_END;
 		cmds->txn_end++;
 		break;
 
@@ -366,6 +392,34 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 		break;
 	}
 
+	return FR_REDIS_PIPELINE_OK;
+}
+
+/** Add a preformatted/expanded command to the command set
+ *
+ * The command must either be entirely static, or parented by the command set.
+ *
+ * @note Caller should disallow "SUBSCRIBE" et al, if they're not appropriate.
+ * 	 As subscribing to a stream where we're not expecting it would break
+ * 	 things, badly.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] cmd_str	A fully expanded/formatted command to send to redis.
+ *			Must be static, or have the same lifetime as the
+ *			command set (allocated with the command set as the parent).
+ * @param[in] cmd_len	Length of the command.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_set_t *cmds,
+							     char const *cmd_str, size_t cmd_len)
+{
+	fr_redis_command_t	*cmd;
+	fr_redis_command_type_t	type;
+
+	if (redis_command_type(&type, cmds, cmd_str) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
 	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
 	talloc_set_destructor(cmd, _redis_command_free);
 	cmd->cmds = cmds;
@@ -377,11 +431,59 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
 	return FR_REDIS_PIPELINE_OK;
 }
 
+/** Add a command to the command set, with each argument passed separately
+ *
+ * Arguments may contain spaces or binary data.  They're copied, so don't
+ * need to outlive the call.
+ *
+ * @param[in] cmds	Command set to add command to.
+ * @param[in] argc	Number of arguments, including the command name.
+ * @param[in] argv	Command name, then its arguments.
+ * @param[in] argv_len	Length of each argument.
+ * @return
+ *	- FR_REDIS_PIPELINE_BAD_CMDS if a bad command sequence is enqueued.
+ *	- FR_REDIS_PIPELINE_OK if command was enqueued successfully.
+ */
+fr_redis_pipeline_status_t fr_redis_command_argv_add(fr_redis_command_set_t *cmds,
+						     int argc, char const *argv[], size_t const argv_len[])
+{
+	request_t		*request = cmds->request;
+	fr_redis_command_t	*cmd;
+	fr_redis_command_type_t	type;
+	char			*formatted;
+	long long		len;
+
+	if (unlikely(argc < 1)) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	if (redis_command_type(&type, cmds, argv[0]) != FR_REDIS_PIPELINE_OK) return FR_REDIS_PIPELINE_BAD_CMDS;
+
+	len = redisFormatCommandArgv(&formatted, argc, argv, argv_len);
+	if (len < 0) {
+		ROPTIONAL(ERROR, REDEBUG, "Failed formatting \"%s\" command", argv[0]);
+		return FR_REDIS_PIPELINE_BAD_CMDS;
+	}
+
+	MEM(cmd = talloc_zero(cmds, fr_redis_command_t));
+	talloc_set_destructor(cmd, _redis_command_free);
+	cmd->cmds = cmds;
+	cmd->type = type;
+	MEM(cmd->str = talloc_memdup(cmd, formatted, (size_t)len));
+	cmd->len = (size_t)len;
+	cmd->formatted = true;
+	redisFreeCommand(formatted);
+
+	fr_dlist_insert_tail(&cmds->pending, cmd);
+
+	return FR_REDIS_PIPELINE_OK;
+}
+
 /** Enqueue a command set on a specific trunk
  *
  * The command set may be passed around several trunks before it is complete.
  * This is to allow it to follow MOVED and ASK responses.
  *
+ * If the command set can't be enqueued it's freed.
+ *
  * @param[in] rtrunk	to enqueue command set on.
  * @param[in] cmds	Command set to enqueue.
  * @return
@@ -391,9 +493,12 @@ fr_redis_pipeline_status_t fr_redis_command_preformatted_add(fr_redis_command_se
  */
 fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, fr_redis_command_set_t *cmds)
 {
+	fr_redis_pipeline_status_t	status;
+
 	if (cmds->txn_start != cmds->txn_end) {
 		ERROR("Refusing to enqueue - Unbalanced transaction start/stop commands");
-		return FR_REDIS_PIPELINE_BAD_CMDS;
+		status = FR_REDIS_PIPELINE_BAD_CMDS;
+		goto error;
 	}
 
 	switch (fr_trunk_request_enqueue(&cmds->treq, rtrunk->trunk, cmds->request, cmds, cmds->rctx)) {
@@ -402,11 +507,40 @@ fr_redis_pipeline_status_t redis_command_set_enqueue(fr_redis_trunk_t *rtrunk, f
 		return FR_REDIS_PIPELINE_OK;
 
 	case FR_TRUNK_ENQUEUE_DST_UNAVAILABLE:
-		return FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+		status = FR_REDIS_PIPELINE_DST_UNAVAILABLE;
+		break;
 
 	default:
-		return FR_REDIS_PIPELINE_FAIL;
+		status = FR_REDIS_PIPELINE_FAIL;
+		break;
 	}
+
+	/*
+	 *	If the trunk allocated a treq, freeing
+	 *	it frees the command set too.
+	 */
+error:
+	if (cmds->treq) {
+		fr_trunk_request_free(&cmds->treq);
+	} else {
+		talloc_free(cmds);
+	}
+
+	return status;
+}
+
+/** Stop waiting for the results of a command set
+ *
+ * Neither the complete or fail callbacks will be called, and any replies
+ * received for commands already sent will be discarded.
+ *
+ * @param[in] cmds	to cancel.
+ */
+void redis_command_set_cancel(fr_redis_command_set_t *cmds)
+{
+	if (!cmds->treq) return;
+
+	fr_trunk_request_signal_cancel(cmds->treq);
 }
 
 /** Callback for for receiving Redis replies
@@ -441,9 +575,9 @@ static void _redis_pipeline_demux(struct redisAsyncContext *ac, void *vreply, vo
 	}
 
 	/*
-	 *	FIXME - Need to check TRYAGAIN, MOVED etc...
-	 *	I guess we might want to wait for the end of
-	 *	the command set to do that.
+	 *	TRYAGAIN, MOVED, ASK etc... are left for
+	 *	the API client to deal with, once it has
+	 *	the results for the whole command set.
 	 */
 	cmd = talloc_get_type_abort(privdata, fr_redis_command_t);
 	cmds = cmd->cmds;
@@ -472,45 +606,60 @@ static fr_connection_t *_redis_pipeline_connection_alloc(fr_trunk_connection_t *
 
 /** Enqueue one or more command sets onto a redis handle
  *
- * Because the trunk is in always writable mode, _redis_pipeline_mux
- * will be called any time fr_trunk_request_enqueue is called, so there'll only
- * ever be one command to dequeue.
+ * Responses are matched to commands by their SQN, so we write out every
+ * command set the trunk has for this connection, and let them all be in
+ * flight at the same time.
  *
+ * @param[in] el		For timer management.  Unused.
  * @param[in] tconn		Trunk connection holding the commands to enqueue.
  * @param[in] conn		Connection handle containing the fr_redis_handle_t.
  * @param[in] uctx		fr_redis_cluster_t.  Unused.
  */
-static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+static void _redis_pipeline_mux(UNUSED fr_event_list_t *el,
+				fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	fr_trunk_request_t	*treq;
 	fr_redis_command_set_t 	*cmds;
 	fr_redis_command_t	*cmd;
 	fr_redis_handle_t	*h = talloc_get_type_abort(conn->h, fr_redis_handle_t);
-	request_t			*request;
-
-	treq = fr_trunk_connection_pop_request(&request, (void *)&cmds, NULL, tconn);
-	while ((cmd = fr_dlist_head(&cmds->pending))) {
-		/*
-		 *	If this fails it probably means the connection
-		 *	is disconnecting, but if that's happening then
-		 *	we shouldn't be enqueueing new requests?
-		 */
-		if (unlikely(redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str) != REDIS_OK)) {
-			ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
-
-			while ((cmd = fr_dlist_head(&cmds->sent))) {
-				fr_redis_connection_ignore_response(h, cmd->sqn);
-				fr_dlist_remove(&cmds->sent, cmd);
-				fr_dlist_insert_tail(&cmds->pending, cmd);
+	request_t		*request;
+
+	while ((fr_trunk_connection_pop_request(&treq, tconn) == 0) && treq) {
+		int ret = REDIS_OK;
+
+		cmds = talloc_get_type_abort(treq->preq, fr_redis_command_set_t);
+		request = treq->request;
+
+		while ((cmd = fr_dlist_head(&cmds->pending))) {
+			/*
+			 *	If this fails it probably means the connection
+			 *	is disconnecting, but if that's happening then
+			 *	we shouldn't be enqueueing new requests?
+			 */
+			if (cmd->formatted) {
+				ret = redisAsyncFormattedCommand(h->ac, _redis_pipeline_demux, cmd, cmd->str, cmd->len);
+			} else {
+				ret = redisAsyncCommand(h->ac, _redis_pipeline_demux, cmd, "%s", cmd->str);
 			}
-			fr_trunk_request_signal_fail(treq);
-			return;
+			if (unlikely(ret != REDIS_OK)) {
+				ROPTIONAL(ERROR, REDEBUG, "Unexpected error queueing REDIS command");
+
+				while ((cmd = fr_dlist_head(&cmds->sent))) {
+					fr_redis_connection_ignore_response(h, cmd->sqn);
+					fr_dlist_remove(&cmds->sent, cmd);
+					fr_dlist_insert_tail(&cmds->pending, cmd);
+				}
+				fr_trunk_request_signal_fail(treq);
+				break;
+			}
+			cmd->sqn = fr_redis_connection_sent_request(h);
+			fr_dlist_remove(&cmds->pending, cmd);
+			fr_dlist_insert_tail(&cmds->sent, cmd);
 		}
-		cmd->sqn = fr_redis_connection_sent_request(h);
-		fr_dlist_remove(&cmds->pending, cmd);
-		fr_dlist_insert_tail(&cmds->sent, cmd);
+		if (ret != REDIS_OK) continue;
+
+		fr_trunk_request_signal_sent(treq);
 	}
-	fr_trunk_request_signal_sent(treq);
 }
 
 /** Deal with cancellation of sent requests
@@ -519,7 +668,7 @@ static void _redis_pipeline_mux(fr_trunk_connection_t *tconn, fr_connection_t *c
  * on why the commands were cancelled, we either tell the handle to ignore
  * them, or move them back into the pending list.
  */
-static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_trunk_request_t *treq, void *preq,
+static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, void *preq,
 					       fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
@@ -564,6 +713,25 @@ static void _redis_pipeline_command_set_cancel(fr_connection_t *conn, UNUSED fr_
 			fr_redis_connection_ignore_response(h, cmd->sqn);
 		}
 	}
+		return;
+
+	/*
+	 *	The connection is still usable, so the
+	 *	responses will still arrive.  Ignore them
+	 *	and get the commands ready to be sent again.
+	 */
+	case FR_TRUNK_CANCEL_REASON_REQUEUE:
+	{
+		fr_redis_command_t	*cmd;
+
+		for (cmd = fr_dlist_head(&cmds->sent);
+		     cmd;
+		     cmd = fr_dlist_next(&cmds->sent, cmd)) {
+			fr_redis_connection_ignore_response(h, cmd->sqn);
+		}
+		fr_dlist_move_head(&cmds->pending, &cmds->sent);
+	}
+		return;
 
 	case FR_TRUNK_CANCEL_REASON_NONE:
 		fr_assert(0);
@@ -586,7 +754,8 @@ static void _redis_pipeline_command_set_complete(UNUSED request_t *request, void
  *
  */
 static void _redis_pipeline_command_set_fail(UNUSED request_t *request, void *preq,
-					     UNUSED void *rctx, UNUSED void *uctx)
+					     UNUSED void *rctx, UNUSED fr_trunk_request_state_t state,
+					     UNUSED void *uctx)
 {
 	fr_redis_command_set_t	*cmds = talloc_get_type_abort(preq, fr_redis_command_set_t);
 
@@ -627,6 +796,7 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 
 	MEM(rtrunk = talloc_zero(cluster_thread, fr_redis_trunk_t));
 	rtrunk->io_conf = io_conf;
+	rtrunk->cluster = cluster_thread;
 	rtrunk->trunk = fr_trunk_alloc(rtrunk, cluster_thread->el,
 				       &io_funcs, cluster_thread->tconf, cluster_thread->log_prefix, rtrunk,
 				       cluster_thread->delay_start);
@@ -638,13 +808,166 @@ fr_redis_trunk_t *fr_redis_trunk_alloc(fr_redis_cluster_thread_t *cluster_thread
 	return rtrunk;
 }
 
+/** Compare two trunks by the address of the node they connect to
+ *
+ */
+static int8_t _redis_trunk_cmp(void const *one, void const *two)
+{
+	fr_redis_trunk_t const *a = one;
+	fr_redis_trunk_t const *b = two;
+	int8_t ret;
+
+	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+	if (ret != 0) return ret;
+
+	return CMP(a->port, b->port);
+}
+
+/** Remove a trunk from the cluster thread's tree when it's freed
+ *
+ */
+static int _redis_trunk_free(fr_redis_trunk_t *rtrunk)
+{
+	if (fr_rb_node_inline_in_tree(&rtrunk->node)) fr_rb_remove(rtrunk->cluster->trunks, rtrunk);
+
+	return 0;
+}
+
+/** Find the trunk for a node, creating one if this is the first time we've talked to it
+ *
+ * @param[in] cluster_thread	to search for trunks in.
+ * @param[in] ipaddr		of the node.
+ * @param[in] port		of the node.
+ * @return
+ *	- The trunk for the node.
+ *	- NULL if we couldn't allocate a new trunk.
+ */
+static fr_redis_trunk_t *redis_trunk_by_addr(fr_redis_cluster_thread_t *cluster_thread,
+					     fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_redis_trunk_t	find, *rtrunk;
+	fr_redis_io_conf_t	*io_conf;
+	char			buffer[FR_IPADDR_STRLEN];
+
+	find.ipaddr = *ipaddr;
+	find.port = port;
+
+	rtrunk = fr_rb_find(cluster_thread->trunks, &find);
+	if (rtrunk) return rtrunk;
+
+	MEM(io_conf = talloc_memdup(cluster_thread, cluster_thread->io_conf, sizeof(*io_conf)));
+	MEM(io_conf->hostname = talloc_strdup(io_conf, fr_inet_ntop(buffer, sizeof(buffer), ipaddr)));
+	io_conf->port = port;
+
+	rtrunk = fr_redis_trunk_alloc(cluster_thread, io_conf);
+	if (!rtrunk) {
+		talloc_free(io_conf);
+		return NULL;
+	}
+	talloc_steal(rtrunk, io_conf);
+	rtrunk->ipaddr = *ipaddr;
+	rtrunk->port = port;
+
+	fr_rb_insert(cluster_thread->trunks, rtrunk);
+	talloc_set_destructor(rtrunk, _redis_trunk_free);
+
+	return rtrunk;
+}
+
+/** Find the trunk for the master node responsible for a key
+ *
+ * Key slots we've received a MOVED redirect for are sent to the node we
+ * were redirected to, as the shared cluster map is only updated by the
+ * synchronous cluster code.
+ *
+ * @param[in] cluster_thread	to search for trunks in.
+ * @param[in] request		The current request.  May be NULL.
+ * @param[in] key		to hash.
+ * @param[in] key_len		Length of the key.
+ * @return
+ *	- The trunk to enqueue commands on.
+ *	- NULL if there's no node available.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk_by_key(fr_redis_cluster_thread_t *cluster_thread,
+						       request_t *request,
+						       uint8_t const *key, size_t key_len)
+{
+	fr_redis_cluster_key_slot_t const	*key_slot;
+	fr_redis_cluster_node_t const		*node;
+	fr_ipaddr_t				ipaddr;
+	uint16_t				port;
+
+	if (cluster_thread->moved) {
+		fr_redis_trunk_t *rtrunk = cluster_thread->moved[fr_redis_cluster_key_slot_num(key, key_len)];
+
+		if (rtrunk) return rtrunk;
+	}
+
+	key_slot = fr_redis_cluster_slot_by_key(cluster_thread->cluster, request, key, key_len);
+	node = fr_redis_cluster_master(cluster_thread->cluster, key_slot);
+	if ((fr_redis_cluster_ipaddr(&ipaddr, node) < 0) || (fr_redis_cluster_port(&port, node) < 0)) {
+		ROPTIONAL(REDEBUG, ERROR, "No master node available for key");
+		return NULL;
+	}
+
+	return redis_trunk_by_addr(cluster_thread, &ipaddr, port);
+}
+
+/** Find the trunk for the node a MOVED or ASK error redirected us to
+ *
+ * For MOVED, the key slot is remapped so future commands go straight to
+ * the new node.
+ *
+ * @param[in] cluster_thread	to search for trunks in.
+ * @param[in] redirect		Error reply from the server.
+ * @return
+ *	- The trunk to enqueue commands on.
+ *	- NULL if the redirect was invalid, or we couldn't allocate a trunk.
+ */
+fr_redis_trunk_t *fr_redis_cluster_thread_trunk_by_redirect(fr_redis_cluster_thread_t *cluster_thread,
+							    redisReply *redirect)
+{
+	fr_redis_trunk_t	*rtrunk;
+	fr_socket_t		node_addr;
+	uint16_t		key_slot;
+
+	if (fr_redis_cluster_redirect_addr(&key_slot, &node_addr, redirect) != FR_REDIS_CLUSTER_RCODE_SUCCESS) {
+		return NULL;
+	}
+
+	rtrunk = redis_trunk_by_addr(cluster_thread, &node_addr.inet.dst_ipaddr, node_addr.inet.dst_port);
+	if (!rtrunk) return NULL;
+
+	if (strncmp(REDIS_ERROR_MOVED_STR, redirect->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) == 0) {
+		if (!cluster_thread->moved) {
+			MEM(cluster_thread->moved = talloc_zero_array(cluster_thread, fr_redis_trunk_t *,
+								      FR_REDIS_CLUSTER_KEY_SLOTS));
+		}
+		cluster_thread->moved[key_slot & (FR_REDIS_CLUSTER_KEY_SLOTS - 1)] = rtrunk;
+	}
+
+	return rtrunk;
+}
+
 /** Allocate per-thread, per-cluster instance
  *
  * This structure represents all the connections for a given thread for a given cluster.
  * The structures holds the trunk connections to talk to each cluster member.
  *
+ * @param[in] ctx		to allocate the cluster thread in.
+ * @param[in] el		to run trunk connections in.
+ * @param[in] tconf		Trunk configuration.  Trunks are always writable.
+ * @param[in] cluster		Shared cluster map.  May be NULL if trunks will only be
+ *				allocated with #fr_redis_trunk_alloc.
+ * @param[in] io_conf		Template for the connection configuration of each node.
+ *				May be NULL if cluster is NULL.
+ * @param[in] log_prefix	for trunk log messages.
  */
-fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_trunk_conf_t const *tconf)
+fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							 fr_trunk_conf_t const *tconf,
+							 fr_redis_cluster_t *cluster,
+							 fr_redis_io_conf_t const *io_conf,
+							 char const *log_prefix)
 {
 	fr_redis_cluster_thread_t *cluster_thread;
 	fr_trunk_conf_t *our_tconf;
@@ -655,8 +978,11 @@ fr_redis_cluster_thread_t *fr_redis_cluster_thread_alloc(TALLOC_CTX *ctx, fr_eve
 
 	cluster_thread->el = el;
 	cluster_thread->tconf = our_tconf;
+	cluster_thread->cluster = cluster;
+	cluster_thread->io_conf = io_conf;
+	if (log_prefix) MEM(cluster_thread->log_prefix = talloc_strdup(cluster_thread, log_prefix));
+	MEM(cluster_thread->trunks = fr_rb_inline_talloc_alloc(cluster_thread, fr_redis_trunk_t, node,
+							       _redis_trunk_cmp, NULL));
 
 	return cluster_thread;
 }
-
-
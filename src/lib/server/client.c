@@ -886,6 +886,18 @@ RADCLIENT *client_afrom_cs(TALLOC_CTX *ctx, CONF_SECTION *cs, CONF_SECTION *serv
 			c->limit.idle_timeout = fr_time_delta_wrap(0);
 	}
 
+	/*
+	 *	Absorb the secret into MD5 once, instead of for
+	 *	every packet we sign, verify, or (de)obfuscate.
+	 */
+	if (c->secret) {
+		c->secret_md5 = fr_md5_secret_alloc(c, (uint8_t const *) c->secret, talloc_array_length(c->secret) - 1);
+		if (!c->secret_md5) {
+			cf_log_perr(cs, "Failed precomputing shared secret state");
+			goto error;
+		}
+	}
+
 	return c;
 }
 
@@ -926,6 +938,13 @@ RADCLIENT *client_afrom_query(TALLOC_CTX *ctx, char const *identifier, char cons
 	 *	Other values (secret, shortname, nas_type, virtual_server)
 	 */
 	c->secret = talloc_typed_strdup(c, secret);
+	c->secret_md5 = fr_md5_secret_alloc(c, (uint8_t const *) c->secret, talloc_array_length(c->secret) - 1);
+	if (!c->secret_md5) {
+		PERROR("Failed precomputing shared secret state");
+		talloc_free(c);
+
+		return NULL;
+	}
 	if (shortname) c->shortname = talloc_typed_strdup(c, shortname);
 	if (type) c->nas_type = talloc_typed_strdup(c, type);
 	if (server) c->server = talloc_typed_strdup(c, server);
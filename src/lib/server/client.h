@@ -70,6 +70,7 @@ typedef int (*client_value_cb_t)(char **out, CONF_PAIR const *cp, void *data);
 #include <freeradius-devel/server/socket.h>
 #include <freeradius-devel/server/stats.h>
 #include <freeradius-devel/util/inet.h>
+#include <freeradius-devel/util/md5.h>
 
 /** Describes a host allowed to send packets to the server
  *
@@ -85,6 +86,7 @@ struct rad_client {
 	char const		*shortname;		//!< Client nickname.
 
 	char const		*secret;		//!< Secret PSK.
+	fr_md5_secret_t		*secret_md5;		//!< Precomputed MD5 state for the secret.
 
 	bool			message_authenticator;	//!< Require RADIUS message authenticator in requests.
 	bool			dynamic;		//!< Whether the client was dynamically defined.
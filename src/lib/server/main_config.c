@@ -168,6 +168,14 @@ static const CONF_PARSER thread_config[] = {
 
 	{ FR_CONF_OFFSET("stats_interval", FR_TYPE_TIME_DELTA | FR_TYPE_HIDDEN, main_config_t, stats_interval), },
 
+	{ FR_CONF_OFFSET("shard_listeners", FR_TYPE_BOOL, main_config_t, shard_listeners), .dflt = "no" },
+	{ FR_CONF_OFFSET("worker_select", FR_TYPE_STRING, main_config_t, worker_select), .dflt = "p2c" },
+	{ FR_CONF_OFFSET("work_stealing", FR_TYPE_BOOL, main_config_t, work_stealing), .dflt = "no" },
+	{ FR_CONF_OFFSET("state_affinity", FR_TYPE_BOOL, main_config_t, state_affinity), .dflt = "no" },
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET("control_spin", FR_TYPE_UINT32, main_config_t, control_spin), .dflt = "0" },
+
 #ifdef HAVE_OPENSSL_CRYPTO_H
 	{ FR_CONF_OFFSET("openssl_async_pool_init", FR_TYPE_SIZE, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET("openssl_async_pool_max", FR_TYPE_SIZE, main_config_t, openssl_async_pool_max), .dflt = "1024" },
@@ -378,7 +386,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -149,6 +149,13 @@ struct main_config_s {
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	bool		shard_listeners;		//!< for the scheduler
+	char const	*worker_select;			//!< for the scheduler
+	bool		work_stealing;			//!< for the scheduler
+	bool		state_affinity;			//!< for the scheduler, and state trees
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	uint32_t	control_spin;			//!< for the scheduler
 
 };
 
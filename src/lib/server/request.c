@@ -59,6 +59,36 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/*
+ *	Pool memory every request needs.
+ */
+#define REQUEST_POOL_BASE		((UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */ \
+					 (sizeof(fr_pair_t) * 5) +			/* pair lists and root*/ \
+					 (sizeof(fr_radius_packet_t) * 2))		/* packets */
+
+/*
+ *	Bounds for the extra memory given to each request's pool.
+ */
+#define REQUEST_POOL_EXTRA_MIN		128
+#define REQUEST_POOL_EXTRA_MAX		(64 * 1024)
+
+/*
+ *	How often to check whether requests fit in their pool.
+ */
+#define REQUEST_POOL_SAMPLE_INTERVAL	32
+
+/** Extra memory to give the pools of new requests
+ *
+ * Pairs, value buffers and other data allocated in a request's ctxs are
+ * bump allocated from the request's talloc pool, and the pool is reset
+ * when the request is returned to the free list.  Anything which doesn't
+ * fit spills over to malloc, so this grows when we see requests outgrow
+ * their pools.
+ */
+static _Thread_local size_t request_pool_extra = REQUEST_POOL_EXTRA_MIN;
+
+static _Thread_local unsigned int request_pool_sample;	//!< Requests freed since we last checked.
+
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
 {
@@ -197,7 +227,8 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 			.detachable = args->detachable
 		},
 		.alloc_file = file,
-		.alloc_line = line
+		.alloc_line = line,
+		.pool_size = request->pool_size
 	};
 
 
@@ -235,7 +266,8 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 #define list_init(_ctx, _list) \
 	do { \
 		vp = fr_pair_afrom_da(_ctx, request_attr_##_list); \
-		if (unlikely(!vp)) { \
+		if (unlikely(!vp || (fr_pair_list_index_enable(vp, &vp->vp_group) < 0))) { \
+			talloc_free(vp); \
 			talloc_free(pair_root); \
 			memset(&request->pair_list, 0, sizeof(request->pair_list)); \
 			return -1; \
@@ -275,6 +307,35 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 	return 0;
 }
 
+/** Check whether a request outgrew its pool
+ *
+ * Only a sample of requests are checked, as walking the request's
+ * allocations isn't free.  If the request outgrew its pool, pools
+ * for new requests are made larger.
+ *
+ * @param[in] request	about to be reset.
+ * @return
+ *	- true if the request should be freed so it's replaced with
+ *	  one with a larger pool.
+ *	- false if the request should be reused.
+ */
+static inline CC_HINT(always_inline) bool request_pool_outgrown(request_t *request)
+{
+	size_t used, extra;
+
+	if (++request_pool_sample < REQUEST_POOL_SAMPLE_INTERVAL) return false;
+	request_pool_sample = 0;
+
+	used = talloc_total_size(request) - sizeof(*request);
+	if (used <= request->pool_size) return false;
+
+	extra = ROUND_UP_POW2(used - REQUEST_POOL_BASE, 1024);
+	if (extra > REQUEST_POOL_EXTRA_MAX) extra = REQUEST_POOL_EXTRA_MAX;
+	if (extra > request_pool_extra) request_pool_extra = extra;
+
+	return (request->pool_size < (REQUEST_POOL_BASE + request_pool_extra));
+}
+
 /** Callback for freeing a request struct
  *
  * @param[in] request		to free or return to the free list.
@@ -312,8 +373,9 @@ static int _request_free(request_t *request)
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
+	if ((fr_dlist_num_elements(request_free_list) <= 256) && !request_pool_outgrown(request)) {
 		fr_dlist_head_t		*free_list;
+		size_t			pool_size = request->pool_size;
 
 		if (request->session_state_ctx) {
 			fr_assert(talloc_parent(request->session_state_ctx) != request);	/* Should never be directly parented */
@@ -328,6 +390,7 @@ static int _request_free(request_t *request)
 
 		memset(request, 0, sizeof(*request));
 		request->component = "free_list";
+		request->pool_size = pool_size;
 #ifndef NDEBUG
 		/*
 		 *	So we don't trip heap asserts
@@ -384,7 +447,11 @@ static void _request_free_list_free_on_exit(void *arg)
 
 static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx)
 {
-	request_t *request;
+	request_t	*request;
+	size_t		extra = request_pool_extra;
+	size_t		pool_size;
+
+	pool_size = REQUEST_POOL_BASE + extra;
 
 	/*
 	 *	Only allocate requests in the NULL
@@ -399,13 +466,11 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
-					   10,					/* extra */
-					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
-					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
-					   (sizeof(fr_radius_packet_t) * 2) +	/* packets */
-					   128					/* extra */
-					   ));
+					   10 +					/* extra */
+					   (extra / sizeof(fr_pair_t)),		/* pairs in the extra memory */
+					   pool_size));
 	fr_assert(ctx != request);
+	request->pool_size = pool_size;
 
 	return request;
 }
@@ -230,6 +230,9 @@ struct request_s {
 
 	int			alloc_line;	//!< Line the request was allocated on.
 
+	size_t			pool_size;	//!< Size of the talloc pool the request was allocated with.
+						///< Preserved when the request is reused.
+
 	fr_dlist_t		free_entry;	//!< Request's entry in the free list.
 };				/* request_t typedef */
 
@@ -32,6 +32,17 @@
  * are allocated in) to a #fr_state_entry_t.  This #fr_state_entry_t holds the
  * value of the State attribute, that will be send out in the response.
  *
+ * Entries are split between a fixed number of shards, each with its own
+ * mutex, hash table and expiry list.  The shard is selected by one of the
+ * random bytes of the State value, so concurrent conversations rarely
+ * contend for the same lock.
+ *
+ * With worker affinity enabled, the State value also records the worker
+ * which created it, and the entry is kept in that worker's shard.  The
+ * network side uses #fr_state_owner to send the next round back to the
+ * same worker, so the shard lock is almost never contended.  If the owning
+ * worker is unavailable, any other worker can still find the entry.
+ *
  * When the next request is received, #fr_state_to_request is called to transfer
  * the fr_pair_ts and state ctx to the new request.
  *
@@ -58,12 +69,23 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define STATE_SHARDS		64		//!< Number of independently locked shards.
+						///< Must be a power of 2.
+#define STATE_SHARD_MIN_SLOTS	16		//!< Smallest hash table a shard will have.
+#define STATE_SHARD_INIT_SLOTS	4096		//!< Largest hash table we allocate up front.
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
 typedef struct {
 	uint64_t		id;				//!< State number within state heap.
-	fr_rb_node_t		node;				//!< Entry in the state rbtree.
+	uint32_t		hash;				//!< Hash of the state value.
 	union {
 		/** Server ID components
 		 *
@@ -72,7 +94,8 @@ typedef struct {
 		struct state_comp {
 			uint8_t		tries;			//!< Number of rounds so far in this state sequence.
 			uint8_t		tx;			//!< Bits changed in the tries counter for this round.
-			uint8_t		r_0;			//!< Random component.
+			uint8_t		r_0;			//!< Random component.  Also selects the shard
+								///< unless worker affinity is enabled.
 			uint8_t		server_id;		//!< Configured server ID.  Used for debugging
 								//!< to locate authentication sessions originating
 								//!< from a particular backend authentication server.
@@ -95,7 +118,9 @@ typedef struct {
 			uint8_t		vx_2;			//!< Random component.
 			uint8_t		r_7;			//!< Random component.
 			uint8_t		r_8;			//!< Random component.
-			uint8_t		r_9;			//!< Random component.
+			uint8_t		owner;			//!< ID of the worker which created the entry
+								///< if worker affinity is enabled, otherwise
+								///< a random component.
 		} state_comp;
 
 		uint8_t		state[sizeof(struct state_comp)];	//!< State value in binary.
@@ -142,19 +167,38 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
+/** A subset of the state entries, with its own lock
+ *
+ * Entries are stored in an open-addressed hash table, using linear probing.
+ * Every entry in the table is also in the to_expire list.  As all entries
+ * in a tree have the same timeout, the list is ordered by cleanup time, so
+ * expiry only has to look at its head.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex for this shard.
+
+	fr_state_entry_t	**slots;			//!< Hash table used to lookup state value.
+	uint32_t		num_slots;			//!< Size of the hash table, a power of 2.
+	uint32_t		num_entries;			//!< How many entries are in the hash table.
+
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
+	uint64_t		timed_out;			//!< Number of states in this shard that were
+								//!< cleaned up due to timeout.
+	uint64_t		contended;			//!< How many times we had to wait for the mutex.
+} fr_state_shard_t;
+
 struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	atomic_uint_fast32_t	used_sessions;			//!< How many sessions are currently in progress.
+
+	fr_state_shard_t	shard[STATE_SHARDS];		//!< Entries, split by the r_0 byte of the state value.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entires.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
+	bool			worker_affinity;		//!< Select shards using the owner byte of the state value.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -163,44 +207,296 @@ struct fr_state_tree_s {
 	fr_dict_attr_t const	*da;				//!< State attribute used.
 };
 
-#define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
-#define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
+static _Thread_local uint8_t state_owner;		//!< ID of the worker running in this thread.
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+/** Return the shard an entry belongs in
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	uint8_t key = state->worker_affinity ? entry->state_comp.owner : entry->state_comp.r_0;
 
-/** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
+	return &state->shard[key & (STATE_SHARDS - 1)];
+}
+
+/** Lock a shard, recording whether another thread was holding it
  *
  */
-static int8_t state_entry_cmp(void const *one, void const *two)
+static inline CC_HINT(always_inline)
+void state_shard_lock(fr_state_tree_t *state, fr_state_shard_t *shard)
 {
-	fr_state_entry_t const *a = one, *b = two;
-	int ret;
+	if (!state->thread_safe) return;
 
-	ret = memcmp(a->state, b->state, sizeof(a->state));
-	return CMP(ret, 0);
+	if (pthread_mutex_trylock(&shard->mutex) == 0) return;
+
+	pthread_mutex_lock(&shard->mutex);
+	shard->contended++;
 }
 
-/** Free the state tree
+/** Unlock a shard
  *
  */
-static int _state_tree_free(fr_state_tree_t *state)
+static inline CC_HINT(always_inline)
+void state_shard_unlock(fr_state_tree_t *state, fr_state_shard_t *shard)
 {
-	fr_state_entry_t *entry;
+	if (!state->thread_safe) return;
+
+	pthread_mutex_unlock(&shard->mutex);
+}
 
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+/** Hash a state value
+ *
+ * State values are mostly random, so folding the two halves together
+ * and mixing the result is sufficient.
+ */
+static inline CC_HINT(always_inline)
+uint32_t state_entry_hash(uint8_t const *value)
+{
+	uint64_t a, b;
 
-	DEBUG4("Freeing state tree %p", state);
+	memcpy(&a, value, sizeof(a));
+	memcpy(&b, value + sizeof(a), sizeof(b));
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
+	a ^= b;
+	a *= 0x9e3779b97f4a7c15ULL;
+
+	return (uint32_t)(a >> 32);
+}
+
+/** Find the slot holding a state value, or the empty slot it would be inserted into
+ *
+ * @note Called with the shard mutex held.
+ */
+static uint32_t state_shard_probe(fr_state_shard_t *shard, uint32_t hash, uint8_t const *value)
+{
+	uint32_t		mask = shard->num_slots - 1;
+	uint32_t		i;
+	fr_state_entry_t	*entry;
+
+	for (i = hash & mask; (entry = shard->slots[i]); i = (i + 1) & mask) {
+		if ((entry->hash == hash) && (memcmp(entry->state, value, sizeof(entry->state)) == 0)) break;
+	}
+
+	return i;
+}
+
+/** Double the size of a shard's hash table
+ *
+ * @note Called with the shard mutex held.
+ */
+static int state_shard_grow(fr_state_shard_t *shard)
+{
+	fr_state_entry_t	**old = shard->slots;
+	uint32_t		old_num = shard->num_slots;
+	uint32_t		i;
+
+	shard->slots = talloc_zero_array(NULL, fr_state_entry_t *, old_num * 2);
+	if (!shard->slots) {
+		shard->slots = old;
+		return -1;
+	}
+	shard->num_slots = old_num * 2;
+
+	for (i = 0; i < old_num; i++) {
+		if (!old[i]) continue;
+
+		shard->slots[state_shard_probe(shard, old[i]->hash, old[i]->state)] = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Insert an entry into a shard
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value exists, or we couldn't grow the table.
+ */
+static int state_shard_insert(fr_state_shard_t *shard, fr_state_entry_t *entry)
+{
+	uint32_t i;
+
+	/*
+	 *	Keep the load factor below 50% so probe
+	 *	sequences stay short.
+	 */
+	if ((((shard->num_entries + 1) * 2) > shard->num_slots) && (state_shard_grow(shard) < 0)) return -1;
+
+	i = state_shard_probe(shard, entry->hash, entry->state);
+	if (shard->slots[i]) return -1;
+
+	shard->slots[i] = entry;
+	shard->num_entries++;
+
+	/*
+	 *	Link it to the end of the list, which is implicitly
+	 *	ordered by cleanup time.
+	 */
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+
+	return 0;
+}
+
+/** Remove the entry in a slot, shifting back any entries which were displaced by it
+ *
+ * @note Called with the shard mutex held.
+ */
+static void state_shard_remove_slot(fr_state_shard_t *shard, uint32_t i)
+{
+	uint32_t mask = shard->num_slots - 1;
+	uint32_t j, k;
+
+	fr_dlist_remove(&shard->to_expire, shard->slots[i]);
+	shard->num_entries--;
+
+	for (j = (i + 1) & mask; shard->slots[j]; j = (j + 1) & mask) {
+		k = shard->slots[j]->hash & mask;
+
+		/*
+		 *	Entry can stay where it is if its home
+		 *	slot is (cyclically) within (i, j].
+		 */
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+		shard->slots[i] = shard->slots[j];
+		i = j;
 	}
+	shard->slots[i] = NULL;
+}
+
+/** Unlink an entry and remove if from its shard
+ *
+ * @note Called with the shard mutex held.
+ */
+static inline CC_HINT(always_inline)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
+{
+	uint32_t i;
+
+	/*
+	 *	Check the memory is still valid
+	 */
+	(void) talloc_get_type_abort(entry, fr_state_entry_t);
+
+	i = state_shard_probe(shard, entry->hash, entry->state);
+	fr_assert(shard->slots[i] == entry);
+	state_shard_remove_slot(shard, i);
+
+	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
+}
+
+/** Unlink any entries in a shard which have passed their cleanup time
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	to clean up.
+ * @param[out] to_free	List to add expired entries to.  These should be
+ *			freed after the mutex is released.
+ * @param[in] now	The current time.
+ * @return The number of entries unlinked.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_dlist_head_t *to_free, fr_time_t now)
+{
+	fr_state_entry_t	*entry;
+	uint64_t		timed_out = 0;
 
 	/*
-	 *	Free the rbtree
+	 *	All entries have the same timeout, so the head
+	 *	of the list is always the next one to expire.
 	 */
-	talloc_free(state->tree);
+	while ((entry = fr_dlist_head(&shard->to_expire)) && fr_time_lt(entry->cleanup, now)) {
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
+	shard->timed_out += timed_out;
+
+	return timed_out;
+}
+
+/** Unlink expired entries from every shard
+ *
+ */
+static uint64_t state_tree_expire(fr_state_tree_t *state, fr_dlist_head_t *to_free, fr_time_t now)
+{
+	uint64_t	timed_out = 0;
+	size_t		i;
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		state_shard_lock(state, &state->shard[i]);
+		timed_out += state_shard_expire(&state->shard[i], to_free, now);
+		state_shard_unlock(state, &state->shard[i]);
+	}
+
+	return timed_out;
+}
+
+/** Free entries previously unlinked
+ *
+ * We do this outside of the mutex as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed also,
+ * and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Reserve one of the max_sessions slots
+ *
+ * @return
+ *	- true if a session was reserved.
+ *	- false if we're at the session limit.
+ */
+static bool state_session_reserve(fr_state_tree_t *state)
+{
+	uint_fast32_t used = atomic_load_explicit(&state->used_sessions, memory_order_relaxed);
+
+	do {
+		if (used >= state->max_sessions) return false;
+	} while (!atomic_compare_exchange_weak_explicit(&state->used_sessions, &used, used + 1,
+							memory_order_relaxed, memory_order_relaxed));
+
+	return true;
+}
+
+/** Free the state tree
+ *
+ */
+static int _state_tree_free(fr_state_tree_t *state)
+{
+	fr_state_entry_t	*entry;
+	size_t			i;
+
+	DEBUG4("Freeing state tree %p", state);
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the hash table
+		 */
+		talloc_free(shard->slots);
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+	}
 
 	return 0;
 }
@@ -210,6 +506,8 @@ static int _state_tree_free(fr_state_tree_t *state)
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
  * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] worker_affinity	Whether entries should be kept in the shard of the
+ *				worker which created them.  See #fr_state_owner.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -220,10 +518,12 @@ static int _state_tree_free(fr_state_tree_t *state)
  *	- NULL on failure.
  */
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, bool thread_safe,
-				    uint32_t max_sessions, fr_time_delta_t timeout,
+				    bool worker_affinity, uint32_t max_sessions, fr_time_delta_t timeout,
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	num_slots = STATE_SHARD_MIN_SLOTS;
+	size_t		i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
@@ -240,51 +540,54 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
-
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
+	/*
+	 *	Size the shards so that max_sessions spread
+	 *	evenly across them stays below 50% load, but
+	 *	don't allocate huge tables up front for very
+	 *	large limits.  The tables grow if needed.
+	 */
+	while ((num_slots < ((uint64_t)max_sessions * 2) / STATE_SHARDS) &&
+	       (num_slots < STATE_SHARD_INIT_SLOTS)) num_slots <<= 1;
 
 	/*
 	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	hash tables, so that all the state entries
+	 *	are freed before they're destroyed.  Hence
+	 *	them being parented from the NULL ctx.
 	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
-	}
 	talloc_set_destructor(state, _state_tree_free);
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		shard->slots = talloc_zero_array(NULL, fr_state_entry_t *, num_slots);
+		if (!shard->slots) {
+			talloc_free(state);
+			return NULL;
+		}
+		shard->num_slots = num_slots;
+	}
+
+	if (thread_safe) {
+		for (i = 0; i < STATE_SHARDS; i++) {
+			if (pthread_mutex_init(&state->shard[i].mutex, NULL) == 0) continue;
+
+			while (i-- > 0) pthread_mutex_destroy(&state->shard[i].mutex);
+			talloc_free(state);
+			return NULL;
+		}
+	}
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
 	state->thread_safe = thread_safe;
+	state->worker_affinity = worker_affinity;
 
 	return state;
 }
 
-/** Unlink an entry and remove if from the tree
- *
- */
-static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
-{
-	/*
-	 *	Check the memory is still valid
-	 */
-	(void) talloc_get_type_abort(entry, fr_state_entry_t);
-
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
-
-	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
-}
-
 /** Frees any data associated with a state
  *
  */
@@ -320,128 +623,92 @@ static int _state_entry_free(fr_state_entry_t *entry)
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * The session-state ctx and persistable request data are transferred to the
+ * new entry before it's inserted, so other threads never see a partially
+ * populated entry.
+ *
+ * @note Called with the mutex free.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+					    fr_pair_list_t *reply_list, fr_state_entry_t *old,
+					    fr_dlist_head_t *data)
 {
 	size_t			i;
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
+	uint64_t		timed_out;
+	int			ret;
 	fr_dlist_head_t		to_free;
 
 	/*
 	 *	Shouldn't be in any lists if it's being reused
 	 */
-	fr_assert(!old ||
-		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
-		   !fr_rb_node_inline_in_tree(&old->node)));
+	fr_assert(!old || !fr_dlist_entry_in_list(&old->expire_entry));
 
 	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
 
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
- 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
-
-	state->timed_out += timed_out;
-
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
-	} else {
-		old_tries = old->tries;
-		memcpy(old_state, old->state, sizeof(old_state));
-	}
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
-
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
 	 */
 	if (!old) {
+		if (!state_session_reserve(state)) {
+			/*
+			 *	Shards only clean up when something is
+			 *	inserted into them, so there may be expired
+			 *	entries we can reclaim elsewhere.
+			 */
+			timed_out = state_tree_expire(state, &to_free, now);
+			if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+			state_entries_free(&to_free);
+
+			if (!state_session_reserve(state)) {
+				RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+				       state->max_sessions);
+				return NULL;
+			}
+		}
+
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
-		/* tree->used_sessions incremented above */
 	/*
 	 *	Reuse the old state entry cleaning up any memory associated
 	 *	with it.
 	 */
 	} else {
+		old_tries = old->tries;
+		memcpy(old_state, old->state, sizeof(old_state));
+
 		_state_entry_free(old);
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
+
+		/*
+		 *	_state_entry_free released the session,
+		 *	but we're still using it.
+		 */
+		atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed);
 	}
 
 	entry->state_tree = state;
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -520,6 +787,12 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		 */
 		entry->state_comp.server_id = state->server_id;
 
+		/*
+		 *	Record which worker owns the entry, so the
+		 *	next round can be sent back to it.
+		 */
+		if (state->worker_affinity) entry->state_comp.owner = state_owner;
+
 		MEM(vp = fr_pair_afrom_da(request->reply_ctx, state->da));
 		fr_pair_value_memdup(vp, entry->state, sizeof(entry->state), false);
 		fr_pair_append(reply_list, vp);
@@ -529,7 +802,11 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
+	fr_assert(request->session_state_ctx);
+
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->session_state_ctx;
+	fr_dlist_move(&entry->data, data);
 
 	/*
 	 *	XOR the server hash with four bytes of random data.
@@ -538,29 +815,43 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 *	value.
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
+	entry->hash = state_entry_hash(entry->state);
+
+	shard = state_shard(state, entry);
+
+	state_shard_lock(state, shard);
+	timed_out = state_shard_expire(shard, &to_free, now);
+	ret = state_shard_insert(shard, entry);
+	state_shard_unlock(state, shard);
+
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	state_entries_free(&to_free);
 
-	if (!fr_rb_insert(state->tree, entry)) {
+	if (ret < 0) {
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(reply_list, state->da);
+
+		/*
+		 *	Give the caller back what it passed in
+		 */
+		entry->ctx = NULL;
+		fr_dlist_move(data, &entry->data);
 		talloc_free(entry);
 		return NULL;
 	}
 
-	/*
-	 *	Link it to the end of the list, which is implicitely
-	 *	ordered by cleanup time.
-	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
-
 	return entry;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
  *
+ * @note Called with the mutex free.
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
+	uint32_t		hash, i;
 
 	/*
 	 *	Assume our own State first.
@@ -589,15 +880,60 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	hash = state_entry_hash(my_entry.state);
+	shard = state_shard(state, &my_entry);
+
+	state_shard_lock(state, shard);
+	i = state_shard_probe(shard, hash, my_entry.state);
+	entry = shard->slots[i];
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		state_shard_remove_slot(shard, i);
 	}
+	state_shard_unlock(state, shard);
 
 	return entry;
 }
 
+/** Set the ID of the worker which owns state entries created by the current thread
+ *
+ * @param[in] owner	ID of the worker running in this thread.
+ */
+void fr_state_owner_set(uint8_t owner)
+{
+	state_owner = owner;
+}
+
+/** Return the ID of the worker which created a State value
+ *
+ * This only looks at the raw value, so it can be called from the
+ * network side before the packet is decoded.
+ *
+ * @param[in] value	of the State attribute, as received.
+ * @param[in] value_len	Length of the State attribute.
+ * @return
+ *	- The ID of the worker which created the value.
+ *	- -1 if the value wasn't created by a state tree.
+ */
+int fr_state_owner(uint8_t const *value, size_t value_len)
+{
+	uint8_t r_0;
+
+	if (value_len != sizeof(struct state_comp)) return -1;
+
+	/*
+	 *	The vx_* bytes are derived from r_0, so we
+	 *	can tell our values apart from ones created
+	 *	by modules.
+	 */
+	r_0 = value[offsetof(struct state_comp, r_0)];
+	if ((value[offsetof(struct state_comp, vx_0)] != (r_0 ^ ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 16) & 0xff))) ||
+	    (value[offsetof(struct state_comp, vx_1)] != (r_0 ^ ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 8) & 0xff))) ||
+	    (value[offsetof(struct state_comp, vx_2)] != (r_0 ^ (((uint32_t) HEXIFY(RADIUSD_VERSION)) & 0xff)))) return -1;
+
+	return value[offsetof(struct state_comp, owner)];
+}
+
 /** Called when sending an Access-Accept/Access-Reject to discard state information
  *
  */
@@ -609,13 +945,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da_idx(&request->request_pairs, state->da, 0);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -673,19 +1004,15 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
 		RERROR("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		return -2;
 	}
 	if (request->session_state_ctx) old_ctx = request->session_state_ctx;	/* Store for later freeing */
@@ -754,27 +1081,16 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->session_state_pairs, "&session-state.");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	Reuses old if possible
 	 */
-	entry = state_entry_create(state, request, &request->reply_pairs, old);
+	entry = state_entry_create(state, request, &request->reply_pairs, old, &data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
 	}
 
-	fr_assert(entry->ctx == NULL);
-	fr_assert(request->session_state_ctx);
-
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->session_state_ctx;
-	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	MEM(request->session_state_ctx = fr_pair_afrom_da(NULL, request_attr_state));	/* fixme - should use a pool */
 
 	RDEBUG3("%s - saved", state->da->name);
@@ -926,7 +1242,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -934,7 +1250,16 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	size_t		i;
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		state_shard_lock(state, &state->shard[i]);
+		timed_out += state->shard[i].timed_out;
+		state_shard_unlock(state, &state->shard[i]);
+	}
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -942,5 +1267,31 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	size_t		i;
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		state_shard_lock(state, &state->shard[i]);
+		tracked += state->shard[i].num_entries;
+		state_shard_unlock(state, &state->shard[i]);
+	}
+
+	return tracked;
+}
+
+/** Return number of times a thread had to wait for a shard held by another thread
+ *
+ */
+uint64_t fr_state_entries_contended(fr_state_tree_t *state)
+{
+	uint64_t	contended = 0;
+	size_t		i;
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		state_shard_lock(state, &state->shard[i]);
+		contended += state->shard[i].contended;
+		state_shard_unlock(state, &state->shard[i]);
+	}
+
+	return contended;
 }
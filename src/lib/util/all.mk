@@ -8,11 +8,13 @@ SUBMAKEFILES := \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	md5_mb_perf_test.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
 	pair_tests.mk \
 	rb_tests.mk \
 	sbuff_tests.mk \
-	strerror_tests.mk
+	strerror_tests.mk \
+	timer_wheel_tests.mk
 
@@ -36,13 +36,31 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/table.h>
+#include <freeradius-devel/util/timer_wheel.h>
 #include <freeradius-devel/util/token.h>
 #include <freeradius-devel/util/atexit.h>
 
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <pthread.h>
 
+/*
+ *	Linux hosts register the I/O (read/write) filters for sockets,
+ *	pipes and other pollable descriptors directly with epoll, which
+ *	avoids libkqueue's per-filter bookkeeping and the extra syscalls
+ *	it makes on every change and every wakeup.
+ *
+ *	libkqueue is still used for vnode, proc and user filters, and
+ *	for regular files (which epoll can't monitor).  The kqueue
+ *	descriptor is itself nested in the epoll set, so events from
+ *	either source wake the loop.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && !defined(WITHOUT_EVENT_EPOLL)
+#  define EVENT_EPOLL
+#  include <sys/epoll.h>
+#endif
+
 #ifdef NDEBUG
 /*
  *	Turn off documentation warnings as file/line
@@ -55,6 +73,11 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 
 #define FR_EV_BATCH_FDS (256)
 
+/*
+ *	Resolution of coarse timers, in nanoseconds.
+ */
+#define FR_EV_WHEEL_TICK (NSEC / MSEC)
+
 DIAG_OFF(unused-macros)
 #define fr_time() static_assert(0, "Use el->time for event loop timing")
 DIAG_ON(unused-macros)
@@ -106,8 +129,12 @@ struct fr_event_timer {
 							///< event.
 
 	fr_lst_index_t		lst_id;	     	  	//!< Where to store opaque lst data.
+	fr_timer_wheel_node_t	wheel_node;		//!< Where to store opaque timer wheel data.
 	fr_dlist_t		entry;			//!< List of deferred timer events.
 
+	bool			coarse;			//!< Timer is in the timer wheel, and may fire up to
+							///< one tick late.
+
 	fr_event_list_t		*el;			//!< Event list containing this timer.
 
 #ifndef NDEBUG
@@ -309,6 +336,11 @@ struct fr_event_fd {
 	bool			is_registered;		//!< Whether this fr_event_fd_t's FD has been registered with
 							///< kevent.  Mostly for debugging.
 
+#ifdef EVENT_EPOLL
+	bool			in_epoll;		//!< I/O filters are registered with epoll, not kevent.
+	uint32_t		epoll_events;		//!< Event mask currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -387,6 +419,7 @@ typedef struct {
  */
 struct fr_event_list {
 	fr_lst_t		*times;			//!< of timer events to be executed.
+	fr_timer_wheel_t	*wheel;			//!< of coarse timer events to be executed.
 	fr_rb_tree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			will_exit;		//!< Will exit on next call to fr_event_corral.
@@ -402,6 +435,11 @@ struct fr_event_list {
 
 	int			kq;			//!< instance associated with this event list.
 
+#ifdef EVENT_EPOLL
+	int			epfd;			//!< epoll instance, containing I/O filters and the kq.
+	struct epoll_event	epoll_events[FR_EV_BATCH_FDS / 2]; //!< Each may expand to a read and a write event.
+#endif
+
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -585,7 +623,7 @@ uint64_t fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_lst_num_elements(el->times);
+	return fr_lst_num_elements(el->times) + fr_timer_wheel_num_elements(el->wheel);
 }
 
 /** Return the kq associated with an event list.
@@ -828,6 +866,44 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 	return 0;
 }
 
+#ifdef EVENT_EPOLL
+/** Bring the epoll registration for an fd in line with its active I/O functions
+ *
+ * epoll always reports EPOLLERR and EPOLLHUP, so an fd with no active
+ * functions (i.e. all suspended) is removed from the epoll set entirely,
+ * and added back when one of its functions is resumed.
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	to update.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int event_epoll_update(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	struct epoll_event	ev = { .data.ptr = ef };
+	int			op;
+
+	if (ef->active.io.read && (ef->active.io.read != fr_event_fd_noop)) ev.events |= EPOLLIN | EPOLLRDHUP;
+	if (ef->active.io.write && (ef->active.io.write != fr_event_fd_noop)) ev.events |= EPOLLOUT;
+
+	if (ev.events == ef->epoll_events) return 0;
+
+	if (!ev.events) {
+		op = EPOLL_CTL_DEL;
+	} else if (!ef->epoll_events) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+	ef->epoll_events = ev.events;
+
+	return 0;
+}
+#endif
+
 /** Remove a file descriptor from the event loop and rbtree but don't explicitly free it
  *
  *
@@ -857,6 +933,15 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 		 */
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, &funcs, &ef->active);
+#ifdef EVENT_EPOLL
+		if (ef->in_epoll) {
+			if (!fr_cond_assert_msg(event_epoll_update(el, ef) == 0,
+						"FD %i was closed without being removed from epoll: %s",
+						ef->fd, fr_syserror(errno))) {
+				return -1;	/* Prevent the free, and leave the fd in the trees */
+			}
+		} else
+#endif
 		if (count > 0) {
 			int ret;
 
@@ -1025,6 +1110,16 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
+#ifdef EVENT_EPOLL
+	if (ef->in_epoll) {
+		if (unlikely(event_epoll_update(el, ef) < 0)) {
+			fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
+			goto error;
+		}
+		return 0;
+	}
+#endif
+
 	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
@@ -1132,6 +1227,23 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
+
+#ifdef EVENT_EPOLL
+		/*
+		 *	Prefer epoll for I/O filters.  It refuses
+		 *	descriptors it can't poll (regular files)
+		 *	with EPERM, and those stay with libkqueue.
+		 */
+		if (filter == FR_EVENT_FILTER_IO) {
+			if (event_epoll_update(el, ef) == 0) {
+				ef->in_epoll = true;
+				count = 0;
+			} else if (errno != EPERM) {
+				fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
+				goto free;
+			}
+		}
+#endif
 		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
@@ -1164,6 +1276,14 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
+#ifdef EVENT_EPOLL
+		if (ef->in_epoll) {
+			if (unlikely(event_epoll_update(el, ef) < 0)) {
+				fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
+				goto error;
+			}
+		} else
+#endif
 		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
@@ -1356,6 +1476,83 @@ int fr_event_fd_unarmour(fr_event_list_t *el, int fd, fr_event_filter_t filter,
 }
 #endif
 
+/** Convert a time to a timer wheel tick, rounding down
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t event_wheel_tick(fr_time_t when)
+{
+	if (fr_time_unwrap(when) <= 0) return 0;
+
+	return (uint64_t)fr_time_unwrap(when) / FR_EV_WHEEL_TICK;
+}
+
+/** Convert a time to a timer wheel tick, rounding up so coarse timers never fire early
+ *
+ */
+static inline CC_HINT(always_inline) uint64_t event_wheel_tick_round_up(fr_time_t when)
+{
+	if (fr_time_unwrap(when) <= 0) return 0;
+
+	return ((uint64_t)fr_time_unwrap(when) + (FR_EV_WHEEL_TICK - 1)) / FR_EV_WHEEL_TICK;
+}
+
+/** Insert a timer event into the lst or the timer wheel
+ *
+ */
+static inline CC_HINT(always_inline) int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->coarse) return fr_timer_wheel_insert(el->wheel, ev, event_wheel_tick_round_up(ev->when));
+
+	return fr_lst_insert(el->times, ev);
+}
+
+/** Remove a timer event from the lst or the timer wheel
+ *
+ */
+static inline CC_HINT(always_inline) int event_timer_extract(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	if (ev->coarse) return fr_timer_wheel_extract(el->wheel, ev);
+
+	return fr_lst_extract(el->times, ev);
+}
+
+/** Find a timer event which is due to run
+ *
+ * Precise timers are checked first, then coarse timers.
+ *
+ * @param[in] el	containing the timer events.
+ * @param[in] now	The current time.
+ * @param[out] next	When the next timer event is due to run, if none are due now.
+ *			May be earlier than any timer event, if the timer wheel
+ *			needs to move coarse timers forward.
+ *			fr_time_wrap(0) if there are no timer events.
+ * @return
+ *	- A timer event which is due.
+ *	- NULL if no timer events are due.
+ */
+static fr_event_timer_t *event_timer_due(fr_event_list_t *el, fr_time_t now, fr_time_t *next)
+{
+	fr_event_timer_t	*ev, *coarse;
+	fr_time_t		wheel_next;
+
+	ev = fr_lst_peek(el->times);
+	if (ev && fr_time_lteq(ev->when, now)) return ev;
+
+	if (fr_timer_wheel_num_elements(el->wheel) > 0) {
+		coarse = fr_timer_wheel_peek(el->wheel, event_wheel_tick(now));
+		if (coarse) return coarse;
+
+		wheel_next = fr_time_wrap((int64_t)(fr_timer_wheel_next(el->wheel) * FR_EV_WHEEL_TICK));
+		if (!ev || fr_time_lt(wheel_next, ev->when)) {
+			*next = wheel_next;
+			return NULL;
+		}
+	}
+
+	*next = ev ? ev->when : fr_time_wrap(0);
+	return NULL;
+}
+
 /** Remove an event from the event loop
  *
  * @param[in] ev	to free.
@@ -1371,7 +1568,7 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
 	} else {
-		int		ret = fr_lst_extract(el->times, ev);
+		int		ret = event_timer_extract(el, ev);
 		char const	*err_file = "not-available";
 		int		err_line = 0;
 
@@ -1396,27 +1593,22 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	return 0;
 }
 
-/** Insert a timer event into an event list
- *
- * @note The talloc parent of the memory returned in ev_p must not be changed.
- *	 If the lifetime of the event needs to be bound to another context
- *	 this function should be called with the existing event pointed to by
- *	 ev_p.
+/** Insert a precise or coarse timer event into an event list
  *
  * @param[in] ctx		to bind lifetime of the event to.
  * @param[in] el		to insert event into.
- * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
- *				in a temporal sense, not in a memory structure or dependency sense.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.
  * @param[in] when		we should run the event.
+ * @param[in] coarse		if true, insert the event into the timer wheel.
  * @param[in] callback		function to execute if the event fires.
  * @param[in] uctx		user data to pass to the event.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
-		       TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
-		       fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+static int event_timer_at(NDEBUG_LOCATION_ARGS
+			  TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			  fr_time_t when, bool coarse, fr_event_timer_cb_t callback, void const *uctx)
 {
 	fr_event_timer_t *ev;
 
@@ -1490,7 +1682,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 			char const	*err_file = "not-available";
 			int		err_line = 0;
 
-			ret = fr_lst_extract(el->times, ev);
+			ret = event_timer_extract(el, ev);
 
 #ifndef NDEBUG
 			err_file = ev->file;
@@ -1509,6 +1701,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 
 	ev->el = el;
 	ev->when = when;
+	ev->coarse = coarse;
 	ev->callback = callback;
 	ev->uctx = uctx;
 	ev->linked_ctx = ctx;
@@ -1525,7 +1718,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -1538,6 +1731,31 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 	return 0;
 }
 
+/** Insert a timer event into an event list
+ *
+ * @note The talloc parent of the memory returned in ev_p must not be changed.
+ *	 If the lifetime of the event needs to be bound to another context
+ *	 this function should be called with the existing event pointed to by
+ *	 ev_p.
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
+ *				in a temporal sense, not in a memory structure or dependency sense.
+ * @param[in] when		we should run the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
+		       TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+		       fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS ctx, el, ev_p, when, false, callback, uctx);
+}
+
 /** Insert a timer event into an event list
  *
  * @note The talloc parent of the memory returned in ev_p must not be changed.
@@ -1560,8 +1778,62 @@ int _fr_event_timer_in(NDEBUG_LOCATION_ARGS
 		       TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
 		       fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx)
 {
-	return _fr_event_timer_at(NDEBUG_LOCATION_VALS
-				  ctx, el, ev_p, fr_time_add(el->time(), delta), callback, uctx);
+	return event_timer_at(NDEBUG_LOCATION_VALS
+			      ctx, el, ev_p, fr_time_add(el->time(), delta), false, callback, uctx);
+}
+
+/** Insert a coarse timer event into an event list
+ *
+ * Coarse timers are kept in a timer wheel with millisecond resolution,
+ * instead of the lst used for precise timers.  Insertion and deletion
+ * are O(1), so they should be used for timeouts which are usually
+ * deleted or re-armed before they fire, and which can tolerate firing
+ * up to a millisecond late.  They never fire early.
+ *
+ * @note The talloc parent of the memory returned in ev_p must not be changed.
+ *	 If the lifetime of the event needs to be bound to another context
+ *	 this function should be called with the existing event pointed to by
+ *	 ev_p.
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.  This is a parent
+ *				in a temporal sense, not in a memory structure or dependency sense.
+ *				The existing event may be a precise or coarse timer.
+ * @param[in] when		we should run the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_coarse_at(NDEBUG_LOCATION_ARGS
+			      TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			      fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS ctx, el, ev_p, when, true, callback, uctx);
+}
+
+/** Insert a coarse timer event into an event list
+ *
+ * @see _fr_event_timer_coarse_at
+ *
+ * @param[in] ctx		to bind lifetime of the event to.
+ * @param[in] el		to insert event into.
+ * @param[in,out] ev_p		If not NULL modify this event instead of creating a new one.
+ * @param[in] delta		In how many nanoseconds to wait before should we execute the event.
+ * @param[in] callback		function to execute if the event fires.
+ * @param[in] uctx		user data to pass to the event.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int _fr_event_timer_coarse_in(NDEBUG_LOCATION_ARGS
+			      TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t const **ev_p,
+			      fr_time_delta_t delta, fr_event_timer_cb_t callback, void const *uctx)
+{
+	return event_timer_at(NDEBUG_LOCATION_VALS
+			      ctx, el, ev_p, fr_time_add(el->time(), delta), true, callback, uctx);
 }
 
 /** Delete a timer event from the event list
@@ -2114,24 +2386,11 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_lst_num_elements(el->times) == 0) {
-		*when = fr_time_wrap(0);
-		return 0;
-	}
-
-	ev = fr_lst_peek(el->times);
-	if (!ev) {
-		*when = fr_time_wrap(0);
-		return 0;
-	}
-
 	/*
-	 *	See if it's time to do this one.
+	 *	See if it's time to do one.
 	 */
-	if (fr_time_gt(ev->when, *when)) {
-		*when = ev->when;
-		return 0;
-	}
+	ev = event_timer_due(el, *when, when);
+	if (!ev) return 0;
 
 	callback = ev->callback;
 	memcpy(&uctx, &ev->uctx, sizeof(uctx));
@@ -2148,6 +2407,86 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	return 1;
 }
 
+#ifdef EVENT_EPOLL
+/** Wait for epoll events, translating them into the kevents fr_event_service() expects
+ *
+ * I/O events are written to el->events as the EVFILT_READ/EVFILT_WRITE
+ * kevents libkqueue would have produced for them, with hangups reported
+ * as EV_EOF, and socket errors as EV_EOF with the error in fflags.
+ *
+ * If the nested kqueue is readable, its pending events are appended
+ * without blocking.
+ *
+ * @param[in] el	to wait on.
+ * @param[in] ts_wake	how long to wait for, or NULL to wait forever.
+ * @return
+ *	- >= 0 the number of events written to el->events.
+ *	- < 0 on error, with errno set.
+ */
+static int event_epoll_wait(fr_event_list_t *el, struct timespec const *ts_wake)
+{
+	int		timeout = -1;
+	int		num, i, out = 0;
+	bool		kq_ready = false;
+
+	/*
+	 *	epoll only has millisecond resolution.  Round up,
+	 *	so we don't spin waiting for a timer that's less
+	 *	than a millisecond away.
+	 */
+	if (ts_wake) {
+		int64_t ms = ((int64_t)ts_wake->tv_sec * MSEC) + ((ts_wake->tv_nsec + (NSEC / MSEC) - 1) / (NSEC / MSEC));
+
+		timeout = (ms > INT_MAX) ? INT_MAX : (int)ms;
+	}
+
+	num = epoll_wait(el->epfd, el->epoll_events, NUM_ELEMENTS(el->epoll_events), timeout);
+	if (num < 0) return -1;
+
+	for (i = 0; i < num; i++) {
+		struct epoll_event	*ep = &el->epoll_events[i];
+		fr_event_fd_t		*ef = ep->data.ptr;
+		uint16_t		flags = 0;
+		uint32_t		fflags = 0;
+
+		/*
+		 *	The kqueue has vnode, proc or user events pending.
+		 */
+		if (!ef) {
+			kq_ready = true;
+			continue;
+		}
+
+		if (ep->events & EPOLLERR) {
+			int		sock_errno = 0;
+			socklen_t	len = sizeof(sock_errno);
+
+			(void) getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &sock_errno, &len);
+			flags |= EV_EOF;
+			fflags = sock_errno;
+		}
+		if (ep->events & (EPOLLHUP | EPOLLRDHUP)) flags |= EV_EOF;
+
+		if ((ef->epoll_events & EPOLLIN) && (ep->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+			EV_SET(&el->events[out++], ef->fd, EVFILT_READ, flags, fflags, 0, ef);
+		}
+		if ((ef->epoll_events & EPOLLOUT) && (ep->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+			EV_SET(&el->events[out++], ef->fd, EVFILT_WRITE, flags, fflags, 0, ef);
+		}
+	}
+
+	if (kq_ready && (out < FR_EV_BATCH_FDS)) {
+		int ret;
+
+		ret = kevent(el->kq, NULL, 0, el->events + out, FR_EV_BATCH_FDS - out, &(struct timespec){ 0 });
+		if (ret < 0) return -1;
+		out += ret;
+	}
+
+	return out;
+}
+#endif
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -2188,13 +2527,14 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
-	ev = fr_lst_peek(el->times);
-	if (ev) {
-		if (fr_time_lteq(ev->when, el->now)) {
+	if (fr_event_list_num_timers(el) > 0) {
+		fr_time_t next;
+
+		if (event_timer_due(el, el->now, &next)) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = fr_time_sub(ev->when, el->now);
+			when = fr_time_sub(next, el->now);
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -2218,7 +2558,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 		for (pre = fr_dlist_head(&el->pre_callbacks);
 		     pre != NULL;
 		     pre = fr_dlist_next(&el->pre_callbacks, pre)) {
-			if (pre->callback(now, wake ? *wake : fr_time_delta_wrap(0), pre->uctx) > 0) {
+			if (pre->callback(now, wake ? *wake : fr_time_delta_max(), pre->uctx) > 0) {
 				wake = &when;
 				when = fr_time_delta_wrap(0);
 			}
@@ -2242,7 +2582,11 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	that occurred since this function was last called
 	 *	or wait for the next timer event.
 	 */
+#ifdef EVENT_EPOLL
+	num_fd_events = event_epoll_wait(el, ts_wake);
+#else
 	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#endif
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -2465,7 +2809,7 @@ void fr_event_service(fr_event_list_t *el)
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_lst_num_elements(el->times) > 0) {
+	if (fr_event_list_num_timers(el) > 0) {
 		el->in_handler = true;
 
 		do {
@@ -2491,7 +2835,7 @@ void fr_event_service(fr_event_list_t *el)
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_lst_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting lst event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2570,12 +2914,20 @@ static int _event_list_free(fr_event_list_t *el)
 	fr_event_timer_t const *ev;
 
 	while ((ev = fr_lst_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
+	if (el->wheel) {
+		fr_timer_wheel_iter_t	iter;
+
+		while ((ev = fr_timer_wheel_iter_init(el->wheel, &iter)) != NULL) fr_event_timer_delete(&ev);
+	}
 
 	fr_event_list_reap_signal(el, fr_time_delta_wrap(0), SIGKILL);
 
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+#endif
 
 	return 0;
 }
@@ -2624,6 +2976,9 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	}
 	el->time = fr_time;
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef EVENT_EPOLL
+	el->epfd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_lst_talloc_alloc(el, fr_event_timer_cmp, fr_event_timer_t, lst_id, 0);
@@ -2634,6 +2989,12 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 
+	el->wheel = fr_timer_wheel_talloc_alloc(el, fr_event_timer_t, wheel_node, event_wheel_tick(el->time()));
+	if (!el->wheel) {
+		fr_strerror_const("Failed allocating event timer wheel");
+		goto error;
+	}
+
 	el->fds = fr_rb_inline_talloc_alloc(el, fr_event_fd_t, node, fr_event_fd_cmp, NULL);
 	if (!el->fds) {
 		fr_strerror_const("Failed allocating FD tree");
@@ -2646,6 +3007,23 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef EVENT_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Nest the kqueue so that vnode, proc and user
+	 *	events wake us.  A NULL data.ptr marks it.
+	 */
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->kq, &(struct epoll_event){ .events = EPOLLIN }) < 0) {
+		fr_strerror_printf("Failed adding kqueue to epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+#endif
+
 	fr_dlist_talloc_init(&el->pre_callbacks, fr_event_pre_t, entry);
 	fr_dlist_talloc_init(&el->post_callbacks, fr_event_post_t, entry);
 	fr_dlist_talloc_init(&el->user_callbacks, fr_event_user_t, entry);
@@ -2678,6 +3056,15 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t func)
 {
 	el->time = func;
+
+	/*
+	 *	Move the timer wheel to the new time source's
+	 *	idea of now.  This only works while the wheel
+	 *	is empty, which it should be, if the time source
+	 *	is being changed.
+	 */
+	fr_assert(fr_timer_wheel_num_elements(el->wheel) == 0);
+	(void) fr_timer_wheel_peek(el->wheel, event_wheel_tick(func()));
 }
 
 /** Return whether the event loop has any active events
@@ -2685,7 +3072,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_lst_num_elements(el->times) && !fr_rb_num_elements(el->fds);
+	return !fr_event_list_num_timers(el) && !fr_rb_num_elements(el->fds);
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -2724,6 +3111,41 @@ static int8_t event_timer_location_cmp(void const *one, void const *two)
 	return CMP(a->line, b->line);
 }
 
+/** Count a timer event against the location it was allocated at
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on out of memory.
+ */
+static int event_report_timer(fr_rb_tree_t *locations[], size_t array[], fr_event_timer_t const *ev, fr_time_t now)
+{
+	fr_time_delta_t diff = fr_time_sub(ev->when, now);
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(decades); i++) {
+		if ((diff <= decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
+			fr_event_counter_t find = { .file = ev->file, .line = ev->line };
+			fr_event_counter_t *counter;
+
+			counter = fr_rb_find(locations[i], &find);
+			if (!counter) {
+				counter = talloc(locations[i], fr_event_counter_t);
+				if (!counter) return -1;
+				counter->file = ev->file;
+				counter->line = ev->line;
+				counter->count = 1;
+				fr_rb_insert(locations[i], counter);
+			} else {
+				counter->count++;
+			}
+
+			array[i]++;
+			break;
+		}
+	}
+
+	return 0;
+}
 
 /** Print out information about the number of events in the event loop
  *
@@ -2731,6 +3153,7 @@ static int8_t event_timer_location_cmp(void const *one, void const *two)
 void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	fr_lst_iter_t		iter;
+	fr_timer_wheel_iter_t	wheel_iter;
 	fr_event_timer_t const	*ev;
 	size_t			i;
 
@@ -2759,29 +3182,13 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	for (ev = fr_lst_iter_init(el->times, &iter);
 	     ev != NULL;
 	     ev = fr_lst_iter_next(el->times, &iter)) {
-		fr_time_delta_t diff = fr_time_sub(ev->when, now);
-
-		for (i = 0; i < NUM_ELEMENTS(decades); i++) {
-			if ((diff <= decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
-				fr_event_counter_t find = { .file = ev->file, .line = ev->line };
-				fr_event_counter_t *counter;
-
-				counter = fr_rb_find(locations[i], &find);
-				if (!counter) {
-					counter = talloc(locations[i], fr_event_counter_t);
-					if (!counter) goto oom;
-					counter->file = ev->file;
-					counter->line = ev->line;
-					counter->count = 1;
-					fr_rb_insert(locations[i], counter);
-				} else {
-					counter->count++;
-				}
+		if (event_report_timer(locations, array, ev, now) < 0) goto oom;
+	}
 
-				array[i]++;
-				break;
-			}
-		}
+	for (ev = fr_timer_wheel_iter_init(el->wheel, &wheel_iter);
+	     ev != NULL;
+	     ev = fr_timer_wheel_iter_next(el->wheel, &wheel_iter)) {
+		if (event_report_timer(locations, array, ev, now) < 0) goto oom;
 	}
 
 	pthread_mutex_lock(&print_lock);
@@ -2823,6 +3230,7 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 void fr_event_timer_dump(fr_event_list_t *el)
 {
 	fr_lst_iter_t		iter;
+	fr_timer_wheel_iter_t	wheel_iter;
 	fr_event_timer_t 	*ev;
 	fr_time_t		now;
 
@@ -2838,6 +3246,15 @@ void fr_event_timer_dump(fr_event_list_t *el)
 			    ev->file, ev->line, ev, fr_time_unwrap(ev->when),
 			    fr_time_gt(now, ev->when) ? '<' : '>', ev->callback);
 	}
+
+	for (ev = fr_timer_wheel_iter_init(el->wheel, &wheel_iter);
+	     ev;
+	     ev = fr_timer_wheel_iter_next(el->wheel, &wheel_iter)) {
+		(void)talloc_get_type_abort(ev, fr_event_timer_t);
+		EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (%c), callback=%p (coarse)",
+			    ev->file, ev->line, ev, fr_time_unwrap(ev->when),
+			    fr_time_gt(now, ev->when) ? '<' : '>', ev->callback);
+	}
 }
 #endif
 #endif
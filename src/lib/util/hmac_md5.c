@@ -179,3 +179,108 @@ int fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inl
 	return 0;
 }
 #endif /* HAVE_OPENSSL_EVP_H */
+
+static int _md5_secret_free(fr_md5_secret_t *secret)
+{
+	if (secret->prefix) fr_md5_ctx_free(&secret->prefix);
+	if (secret->hmac_ipad) fr_md5_ctx_free(&secret->hmac_ipad);
+	if (secret->hmac_opad) fr_md5_ctx_free(&secret->hmac_opad);
+
+	return 0;
+}
+
+/** Precompute the MD5 and HMAC-MD5 state for a secret
+ *
+ * @param[in] ctx		to allocate the precomputed state in.
+ * @param[in] secret		to absorb.
+ * @param[in] secret_len	Length of the secret.
+ * @return
+ *	- The precomputed state on success.
+ *	- NULL on error.
+ */
+fr_md5_secret_t *fr_md5_secret_alloc(TALLOC_CTX *ctx, uint8_t const *secret, size_t secret_len)
+{
+	fr_md5_secret_t	*out;
+	uint8_t		k_ipad[64];
+	uint8_t		k_opad[64];
+	uint8_t		tk[MD5_DIGEST_LENGTH];
+	uint8_t const	*key = secret;
+	size_t		key_len = secret_len;
+	size_t		i;
+
+	out = talloc_zero(ctx, fr_md5_secret_t);
+	if (unlikely(!out)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	talloc_set_destructor(out, _md5_secret_free);
+
+	out->prefix = fr_md5_ctx_alloc(false);
+	out->hmac_ipad = fr_md5_ctx_alloc(false);
+	out->hmac_opad = fr_md5_ctx_alloc(false);
+	if (unlikely(!out->prefix || !out->hmac_ipad || !out->hmac_opad)) {
+		talloc_free(out);
+		goto oom;
+	}
+
+	fr_md5_update(out->prefix, secret, secret_len);
+
+	/* if key is longer than 64 bytes reset it to key=MD5(key) */
+	if (key_len > sizeof(k_ipad)) {
+		fr_md5_calc(tk, key, key_len);
+		key = tk;
+		key_len = sizeof(tk);
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memcpy(k_ipad, key, key_len);
+	memcpy(k_opad, k_ipad, sizeof(k_opad));
+
+	for (i = 0; i < sizeof(k_ipad); i++) {
+		k_ipad[i] ^= 0x36;
+		k_opad[i] ^= 0x5c;
+	}
+
+	fr_md5_update(out->hmac_ipad, k_ipad, sizeof(k_ipad));
+	fr_md5_update(out->hmac_opad, k_opad, sizeof(k_opad));
+
+	fr_md5_mb_block_state(out->hmac_ipad_state, k_ipad);
+	fr_md5_mb_block_state(out->hmac_opad_state, k_opad);
+
+	return out;
+}
+
+/** Calculate HMAC-MD5 using precomputed inner and outer pad state
+ *
+ * Produces the same digest as #fr_hmac_md5, but skips hashing the
+ * key pads, which is two of the four MD5 compressions for a short message.
+ *
+ * @param digest Caller digest to be filled in.
+ * @param in Pointer to data stream.
+ * @param inlen length of data stream.
+ * @param secret Precomputed state from #fr_md5_secret_alloc.
+ * @return
+ *	- 0 on success.
+ *      - -1 on error.
+ */
+int fr_hmac_md5_secret(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+		       fr_md5_secret_t const *secret)
+{
+	fr_md5_ctx_t	*ctx;
+
+	ctx = fr_md5_ctx_alloc(true);
+	if (unlikely(!ctx)) return -1;
+
+	fr_md5_ctx_copy(ctx, secret->hmac_ipad);
+	fr_md5_update(ctx, in, inlen);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_copy(ctx, secret->hmac_opad);
+	fr_md5_update(ctx, digest, MD5_DIGEST_LENGTH);
+	fr_md5_final(digest, ctx);
+
+	fr_md5_ctx_free(&ctx);
+
+	return 0;
+}
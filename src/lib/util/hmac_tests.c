@@ -129,6 +129,88 @@ static void test_hmac_md5(void)
 			      sizeof(digest)), 0);
 }
 
+/*
+ *	Same vectors as above, plus RFC 2202 test case 6 which has a key longer
+ *	than the MD5 block size, computed from precomputed pad state.
+ */
+static void test_hmac_md5_secret(void)
+{
+	uint8_t		digest[MD5_DIGEST_LENGTH];
+	uint8_t		key[80];
+	fr_md5_secret_t	*secret;
+
+	memset(key, 0x0b, 16);
+	secret = fr_md5_secret_alloc(NULL, key, 16);
+	TEST_ASSERT(secret != NULL);
+	TEST_CHECK(fr_hmac_md5_secret(digest, (uint8_t const *)"Hi There", 8, secret) == 0);
+	TEST_CHECK_RET(memcmp(digest,
+			      (uint8_t[]){
+					0x92, 0x94, 0x72, 0x7a, 0x36, 0x38, 0xbb, 0x1c,
+					0x13, 0xf4, 0x8e, 0xf8, 0x15, 0x8b, 0xfc, 0x9d
+			      },
+			      sizeof(digest)), 0);
+	talloc_free(secret);
+
+	secret = fr_md5_secret_alloc(NULL, (uint8_t const *)"Jefe", 4);
+	TEST_ASSERT(secret != NULL);
+	TEST_CHECK(fr_hmac_md5_secret(digest, (uint8_t const *)"what do ya want for nothing?", 28, secret) == 0);
+	TEST_CHECK_RET(memcmp(digest,
+			      (uint8_t[]){
+					0x75, 0x0c, 0x78, 0x3e, 0x6a, 0xb0, 0xb5, 0x03,
+					0xea, 0xa8, 0x6e, 0x31, 0x0a, 0x5d, 0xb7, 0x38
+			      },
+			      sizeof(digest)), 0);
+	talloc_free(secret);
+
+	memset(key, 0xaa, sizeof(key));
+	secret = fr_md5_secret_alloc(NULL, key, sizeof(key));
+	TEST_ASSERT(secret != NULL);
+	TEST_CHECK(fr_hmac_md5_secret(digest,
+				      (uint8_t const *)"Test Using Larger Than Block-Size Key - Hash Key First", 54,
+				      secret) == 0);
+	TEST_CHECK_RET(memcmp(digest,
+			      (uint8_t[]){
+					0x6b, 0x1a, 0xb7, 0xfe, 0x4b, 0xd7, 0xbf, 0x8f,
+					0x0b, 0x62, 0xe6, 0xce, 0x61, 0xb9, 0xd0, 0xcd
+			      },
+			      sizeof(digest)), 0);
+	talloc_free(secret);
+}
+
+/*
+ *	Resuming from the precomputed prefix must give MD5(secret + data).
+ */
+static void test_md5_secret_prefix(void)
+{
+	uint8_t		digest[MD5_DIGEST_LENGTH], expected[MD5_DIGEST_LENGTH];
+	uint8_t		buffer[128];
+	size_t		secret_lens[] = { 0, 10, 64, 100 };
+	size_t		i;
+
+	for (i = 0; i < sizeof(buffer); i++) buffer[i] = i;
+
+	for (i = 0; i < NUM_ELEMENTS(secret_lens); i++) {
+		fr_md5_secret_t	*secret;
+		fr_md5_ctx_t	*ctx;
+
+		secret = fr_md5_secret_alloc(NULL, buffer, secret_lens[i]);
+		TEST_ASSERT(secret != NULL);
+
+		fr_md5_calc(expected, buffer, secret_lens[i] + 16);
+
+		ctx = fr_md5_ctx_alloc(true);
+		fr_md5_ctx_copy(ctx, secret->prefix);
+		fr_md5_update(ctx, buffer + secret_lens[i], 16);
+		fr_md5_final(digest, ctx);
+		fr_md5_ctx_free(&ctx);
+
+		TEST_CHECK(memcmp(digest, expected, sizeof(digest)) == 0);
+		TEST_MSG("secret_len %zu", secret_lens[i]);
+
+		talloc_free(secret);
+	}
+}
+
 /*
 Test Vectors (Trailing '\0' of a character string not included in test):
 
@@ -210,6 +292,8 @@ TEST_LIST = {
 	 *	Allocation and management
 	 */
 	{ "hmac-md5",			test_hmac_md5	},
+	{ "hmac-md5-secret",		test_hmac_md5_secret	},
+	{ "md5-secret-prefix",		test_md5_secret_prefix	},
 	{ "hmac-sha1",			test_hmac_sha1	},
 
 	{ NULL }
@@ -45,6 +45,7 @@ SOURCES		:= \
 		   machine.c \
 		   md4.c \
 		   md5.c \
+		   md5_mb.c \
 		   minmax_heap.c \
 		   misc.c \
 		   missing.c \
@@ -76,6 +77,7 @@ SOURCES		:= \
 		   table.c \
 		   talloc.c \
 		   time.c \
+		   timer_wheel.c \
 		   timeval.c \
 		   token.c \
 		   trie.c \
@@ -3,6 +3,7 @@
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/timer_wheel.h>
 
 /*
  *	This counterintuitive #include gives these separately-compiled tests
@@ -12,9 +13,10 @@
 #include "lst.c"
 
 typedef struct {
-	unsigned int	data;
-	fr_lst_index_t	idx;
-	bool		visited;	/* Only used by iterator test */
+	unsigned int		data;
+	fr_lst_index_t		idx;
+	fr_timer_wheel_node_t	wheel;		/* Only used by insert/cancel benchmark */
+	bool			visited;	/* Only used by iterator test */
 } lst_thing;
 
 #if 0
@@ -579,6 +581,165 @@ static void queue_cmp_1000(void)
 	queue_cmp(1000);
 }
 
+/*
+ *	Every request arms a timeout, which is almost always cancelled
+ *	when the reply arrives, long before it would fire.
+ */
+#define INSERT_CANCEL_REPLY_PCT		95	//!< Percentage of requests which get a reply.
+#define INSERT_CANCEL_REPLY_DELAY	200	//!< Ticks between a request and its reply.
+#define INSERT_CANCEL_TIMEOUT		1000	//!< Minimum timeout, always more than the reply delay.
+
+static void insert_cancel_populate(lst_thing values[], bool replied[], unsigned int count)
+{
+	unsigned int	i;
+	fr_fast_rand_t	rand_ctx;
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	for (i = 0; i < count; i++) {
+		values[i].data = i + INSERT_CANCEL_TIMEOUT + (fr_fast_rand(&rand_ctx) % (INSERT_CANCEL_TIMEOUT * 4));
+		values[i].idx = 0;
+		memset(&values[i].wheel, 0, sizeof(values[i].wheel));
+		replied[i] = (fr_fast_rand(&rand_ctx) % 100) < INSERT_CANCEL_REPLY_PCT;
+	}
+}
+
+/** Benchmarks for LSTs vs heaps vs timer wheels when used for proxy timeouts
+ *
+ * One request (and timeout) is started per tick.  Replies cancel the
+ * timeout of the request sent INSERT_CANCEL_REPLY_DELAY ticks earlier,
+ * and any timeouts which are due are then fired.
+ */
+static void insert_cancel_cmp(unsigned int count)
+{
+	lst_thing	*values, *t;
+	bool		*replied;
+	unsigned int	i, fired, lst_fired = 0;
+
+	values = talloc_array(NULL, lst_thing, count);
+	replied = talloc_array(NULL, bool, count);
+
+	/*
+	 *	LST
+	 */
+	{
+		fr_lst_t	*lst;
+		fr_time_t	start, end;
+
+		insert_cancel_populate(values, replied, count);
+
+		lst = fr_lst_alloc(NULL, lst_cmp, lst_thing, idx, 0);
+		TEST_CHECK(lst != NULL);
+
+		fired = 0;
+		start = fr_time();
+		for (i = 0; i < count; i++) {
+			fr_lst_insert(lst, &values[i]);
+
+			if ((i >= INSERT_CANCEL_REPLY_DELAY) && replied[i - INSERT_CANCEL_REPLY_DELAY]) {
+				TEST_CHECK(fr_lst_extract(lst, &values[i - INSERT_CANCEL_REPLY_DELAY]) == 0);
+			}
+
+			while ((t = fr_lst_peek(lst)) && (t->data <= i)) {
+				(void) fr_lst_pop(lst);
+				fired++;
+			}
+		}
+		end = fr_time();
+		lst_fired = fired;
+
+		TEST_MSG_ALWAYS("\nlst requests: %u, timeouts: %u\n", count, fired);
+		TEST_MSG_ALWAYS("time: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end, start)) / 1000);
+
+		talloc_free(lst);
+	}
+
+	/*
+	 *	Heap
+	 */
+	{
+		fr_heap_t	*heap;
+		fr_time_t	start, end;
+
+		insert_cancel_populate(values, replied, count);
+
+		heap = fr_heap_alloc(NULL, lst_cmp, lst_thing, idx, 0);
+		TEST_CHECK(heap != NULL);
+
+		fired = 0;
+		start = fr_time();
+		for (i = 0; i < count; i++) {
+			fr_heap_insert(heap, &values[i]);
+
+			if ((i >= INSERT_CANCEL_REPLY_DELAY) && replied[i - INSERT_CANCEL_REPLY_DELAY]) {
+				TEST_CHECK(fr_heap_extract(heap, &values[i - INSERT_CANCEL_REPLY_DELAY]) == 0);
+			}
+
+			while ((t = fr_heap_peek(heap)) && (t->data <= i)) {
+				(void) fr_heap_pop(heap);
+				fired++;
+			}
+		}
+		end = fr_time();
+
+		TEST_MSG_ALWAYS("\nheap requests: %u, timeouts: %u\n", count, fired);
+		TEST_MSG_ALWAYS("time: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end, start)) / 1000);
+
+		talloc_free(heap);
+	}
+
+	/*
+	 *	Timer wheel
+	 */
+	{
+		fr_timer_wheel_t	*tw;
+		fr_time_t		start, end;
+
+		insert_cancel_populate(values, replied, count);
+
+		tw = fr_timer_wheel_alloc(NULL, lst_thing, wheel, 0);
+		TEST_CHECK(tw != NULL);
+
+		fired = 0;
+		start = fr_time();
+		for (i = 0; i < count; i++) {
+			fr_timer_wheel_insert(tw, &values[i], values[i].data);
+
+			if ((i >= INSERT_CANCEL_REPLY_DELAY) && replied[i - INSERT_CANCEL_REPLY_DELAY]) {
+				TEST_CHECK(fr_timer_wheel_extract(tw, &values[i - INSERT_CANCEL_REPLY_DELAY]) == 0);
+			}
+
+			while ((t = fr_timer_wheel_pop(tw, i))) {
+				TEST_CHECK(t->data <= i);
+				fired++;
+			}
+		}
+		end = fr_time();
+
+		TEST_MSG_ALWAYS("\ntimer wheel requests: %u, timeouts: %u\n", count, fired);
+		TEST_MSG_ALWAYS("time: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end, start)) / 1000);
+
+		TEST_CHECK(fired == lst_fired);
+		TEST_MSG("timer wheel fired %u timeouts, lst fired %u", fired, lst_fired);
+
+		talloc_free(tw);
+	}
+
+	talloc_free(replied);
+	talloc_free(values);
+}
+
+static void insert_cancel_cmp_10000(void)
+{
+	insert_cancel_cmp(10000);
+}
+
+static void insert_cancel_cmp_1000000(void)
+{
+	insert_cancel_cmp(1000000);
+}
+
 TEST_LIST = {
 	/*
 	 *	Basic tests
@@ -595,5 +756,7 @@ TEST_LIST = {
 	{ "queue_cmp_50",	queue_cmp_50 },
 	{ "queue_cmp_100",	queue_cmp_100 },
 	{ "queue_cmp_1000",	queue_cmp_1000 },
+	{ "insert_cancel_cmp_10000",	insert_cancel_cmp_10000 },
+	{ "insert_cancel_cmp_1000000",	insert_cancel_cmp_1000000 },
 	{ NULL }
 };
@@ -87,8 +87,6 @@ static fr_md5_ctx_t *fr_md5_openssl_ctx_alloc(bool thread_local)
 	EVP_MD_CTX *md_ctx;
 	fr_md5_free_list_t *free_list;
 
-	thread_local = true;
-
 	/*
 	 *	Use the thread local ctx to avoid heap allocations.
 	 */
@@ -14,6 +14,7 @@ extern "C" {
 
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/talloc.h>
 
 #include <inttypes.h>
 #include <sys/types.h>
@@ -87,6 +88,54 @@ void		fr_md5_calc(uint8_t out[static MD5_DIGEST_LENGTH], uint8_t const *in, size
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+/** Precomputed MD5 state for a long lived secret
+ *
+ * RADIUS mixes the shared secret into MD5 in two ways, as a prefix
+ * (User-Password, Tunnel-Password) and as an HMAC key (Message-Authenticator).
+ * The secret rarely changes, so the state after absorbing it can be computed
+ * once, and copied into a working ctx for each packet.
+ *
+ * The contexts are read only once allocated, and may be shared between threads.
+ */
+typedef struct {
+	fr_md5_ctx_t	*prefix;		//!< State after absorbing the secret.
+	fr_md5_ctx_t	*hmac_ipad;		//!< State after absorbing (secret XOR ipad).
+	fr_md5_ctx_t	*hmac_opad;		//!< State after absorbing (secret XOR opad).
+
+	uint32_t	hmac_ipad_state[4];	//!< Raw MD5 state words of hmac_ipad, for the
+						///< multi-buffer functions.
+	uint32_t	hmac_opad_state[4];	//!< Raw MD5 state words of hmac_opad.
+} fr_md5_secret_t;
+
+fr_md5_secret_t	*fr_md5_secret_alloc(TALLOC_CTX *ctx, uint8_t const *secret, size_t secret_len);
+
+int		fr_hmac_md5_secret(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
+				   fr_md5_secret_t const *secret);
+
+/* md5_mb.c */
+
+/** A message for the multi-buffer MD5 functions
+ *
+ */
+typedef struct {
+	uint8_t const		*in;		//!< Data to hash.
+	size_t			inlen;		//!< Length of data.
+	uint8_t const		*suffix;	//!< Appended to in by #fr_md5_mb, may be NULL.
+	size_t			suffix_len;	//!< Length of suffix.
+	fr_md5_secret_t const	*secret;	//!< Key for #fr_hmac_md5_mb.
+	uint8_t			*out;		//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_mb_t;
+
+void		fr_md5_mb(fr_md5_mb_t *msgs, size_t num);
+
+void		fr_hmac_md5_mb(fr_md5_mb_t *msgs, size_t num);
+
+void		fr_md5_mb_block_state(uint32_t state[static 4], uint8_t const block[static 64]);
+
+char const	*fr_md5_mb_engine(unsigned int *lanes);
+
+int		fr_md5_mb_engine_set(char const *name);
 #ifdef __cplusplus
 }
 #endif
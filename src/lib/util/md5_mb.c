@@ -0,0 +1,476 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Multi-buffer MD5
+ *
+ * MD5 is a serial chain of dependent operations, so a single digest can't
+ * be made much faster.  What we can do is run several independent digests
+ * in the lanes of a SIMD register, which is the common case for RADIUS where
+ * a network thread has many packets to sign or verify at once.
+ *
+ * The transform is written once using compiler vector extensions, and
+ * instantiated for each vector width.  The widest engine the CPU supports
+ * is selected at runtime.
+ *
+ * @file src/lib/util/md5_mb.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/md5.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+
+#define MD5_BLOCK_LENGTH	64
+
+/** A single message being hashed in one lane of an engine
+ *
+ */
+typedef struct {
+	uint32_t	state[4];			//!< State before the first block.
+	uint64_t	absorbed;			//!< Bytes already absorbed into state.
+	uint8_t const	*seg[2];			//!< Message, as up to two segments.
+	size_t		seg_len[2];			//!< Length of each segment.
+	size_t		len;				//!< Total message length.
+	size_t		blocks;				//!< Number of blocks, including padding.
+	bool		pad;				//!< Whether to add MD5 padding.
+	uint8_t		*out;				//!< Where to write the digest.
+	uint8_t		buffer[MD5_BLOCK_LENGTH];	//!< For blocks which aren't contiguous in the input.
+} md5_mb_lane_t;
+
+typedef void (*md5_mb_engine_t)(md5_mb_lane_t *lanes, size_t num);
+
+static uint32_t const md5_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+/** Set up a lane to hash (seg0 || seg1)
+ *
+ */
+static inline void md5_mb_lane_init(md5_mb_lane_t *lane, uint32_t const state[static 4], uint64_t absorbed,
+				    uint8_t const *seg0, size_t seg0_len, uint8_t const *seg1, size_t seg1_len,
+				    uint8_t *out)
+{
+	memcpy(lane->state, state, sizeof(lane->state));
+	lane->absorbed = absorbed;
+	lane->seg[0] = seg0;
+	lane->seg_len[0] = seg0_len;
+	lane->seg[1] = seg1;
+	lane->seg_len[1] = seg1_len;
+	lane->len = seg0_len + seg1_len;
+	lane->blocks = ((lane->len + 8) / MD5_BLOCK_LENGTH) + 1;
+	lane->pad = true;
+	lane->out = out;
+}
+
+/** Return a pointer to block n of a lane's padded message
+ *
+ * Blocks which lie entirely within the first segment are read in place,
+ * everything else is assembled in the lane's buffer.
+ */
+static inline uint8_t const *md5_mb_block(md5_mb_lane_t *lane, size_t n)
+{
+	size_t	start = n * MD5_BLOCK_LENGTH;
+	size_t	end = start + MD5_BLOCK_LENGTH;
+	size_t	seg0_len = lane->seg_len[0];
+
+	if (end <= seg0_len) return lane->seg[0] + start;
+
+	memset(lane->buffer, 0, sizeof(lane->buffer));
+
+	if (start < seg0_len) memcpy(lane->buffer, lane->seg[0] + start, seg0_len - start);
+
+	if ((end > seg0_len) && (start < lane->len)) {
+		size_t from = (start > seg0_len) ? start - seg0_len : 0;
+		size_t to = ((end < lane->len) ? end : lane->len) - seg0_len;
+
+		memcpy(lane->buffer + (seg0_len + from) - start, lane->seg[1] + from, to - from);
+	}
+
+	if (!lane->pad) return lane->buffer;
+
+	if ((lane->len >= start) && (lane->len < end)) lane->buffer[lane->len - start] = 0x80;
+
+	if (n == (lane->blocks - 1)) {
+		uint64_t	bits = (lane->absorbed + lane->len) << 3;
+		int		i;
+
+		for (i = 0; i < 8; i++) lane->buffer[56 + i] = (bits >> (8 * i)) & 0xff;
+	}
+
+	return lane->buffer;
+}
+
+/* The four core functions */
+#define MD5_MB_F1(x, y, z) (z ^ (x & (y ^ z)))
+#define MD5_MB_F2(x, y, z) MD5_MB_F1(z, x, y)
+#define MD5_MB_F3(x, y, z) (x ^ y ^ z)
+#define MD5_MB_F4(x, y, z) (y ^ (x | ~z))
+
+#define MD5_MB_STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + (data), w = (w << s) | (w >> (32 - s)), w += x)
+
+/** The 64 MD5 steps, operating on whichever vector type a, b, c, d and in are
+ *
+ */
+#define MD5_MB_TRANSFORM(a, b, c, d, in) do { \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 0] + 0xd76aa478,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 2] + 0x242070db, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 5] + 0x4787c62a, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 6] + 0xa8304613, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 7] + 0xfd469501, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 8] + 0x698098d8,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[10] + 0xffff5bb1, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[11] + 0x895cd7be, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[12] + 0x6b901122,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[13] + 0xfd987193, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[14] + 0xa679438e, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[15] + 0x49b40821, 22); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 1] + 0xf61e2562,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 6] + 0xc040b340,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[11] + 0x265e5a51, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 5] + 0xd62f105d,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[10] + 0x02441453,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[15] + 0xd8a1e681, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[14] + 0xc33707d6,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 8] + 0x455a14ed, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[13] + 0xa9e3e905,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 7] + 0x676f02d9, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 5] + 0xfffa3942,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 8] + 0x8771f681, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[11] + 0x6d9d6122, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[14] + 0xfde5380c, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 1] + 0xa4beea44,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[10] + 0xbebfbc70, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[13] + 0x289b7ec6,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 6] + 0x04881d05, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[12] + 0xe6db99e5, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[15] + 0x1fa27cf8, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 2] + 0xc4ac5665, 23); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 0] + 0xf4292244,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 7] + 0x432aff97, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[14] + 0xab9423a7, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 5] + 0xfc93a039, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[12] + 0x655b59c3,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 3] + 0x8f0ccc92, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[10] + 0xffeff47d, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 1] + 0x85845dd1, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 8] + 0x6fa87e4f,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 6] + 0xa3014314, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[13] + 0x4e0811a1, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 4] + 0xf7537e82,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[11] + 0xbd3af235, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 2] + 0x2ad7d2bb, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 9] + 0xeb86d391, 21); \
+} while (0)
+
+/** Define an engine which hashes up to _lanes messages in parallel
+ *
+ * Messages are transposed into the engine one block at a time, so lane
+ * n of in[w] holds word w of the current block of message n.  Lanes whose
+ * message is complete keep running on zeroed input, and their digest is
+ * written out after their final block.
+ */
+#define MD5_MB_ENGINE(_name, _lanes, _attr) \
+_attr static void _name(md5_mb_lane_t *lanes, size_t num) \
+{ \
+	typedef uint32_t v_t __attribute__((vector_size((_lanes) * sizeof(uint32_t)))); \
+	v_t		a, b, c, d, sa, sb, sc, sd, in[16]; \
+	uint32_t	words[16][_lanes]; \
+	uint32_t	state[4][_lanes]; \
+	size_t		max_blocks = 0, n, l, w; \
+	memset(words, 0, sizeof(words)); \
+	memset(state, 0, sizeof(state)); \
+	for (l = 0; l < num; l++) { \
+		for (w = 0; w < 4; w++) state[w][l] = lanes[l].state[w]; \
+		if (lanes[l].blocks > max_blocks) max_blocks = lanes[l].blocks; \
+	} \
+	memcpy(&a, state[0], sizeof(a)); \
+	memcpy(&b, state[1], sizeof(b)); \
+	memcpy(&c, state[2], sizeof(c)); \
+	memcpy(&d, state[3], sizeof(d)); \
+	for (n = 0; n < max_blocks; n++) { \
+		for (l = 0; l < num; l++) { \
+			uint8_t const *p; \
+			if (n >= lanes[l].blocks) { \
+				for (w = 0; w < 16; w++) words[w][l] = 0; \
+				continue; \
+			} \
+			p = md5_mb_block(&lanes[l], n); \
+			for (w = 0; w < 16; w++) { \
+				words[w][l] = (uint32_t)p[(w * 4)] | ((uint32_t)p[(w * 4) + 1] << 8) | \
+					      ((uint32_t)p[(w * 4) + 2] << 16) | ((uint32_t)p[(w * 4) + 3] << 24); \
+			} \
+		} \
+		for (w = 0; w < 16; w++) memcpy(&in[w], words[w], sizeof(in[w])); \
+		sa = a; sb = b; sc = c; sd = d; \
+		MD5_MB_TRANSFORM(a, b, c, d, in); \
+		a += sa; b += sb; c += sc; d += sd; \
+		for (l = 0; l < num; l++) { \
+			uint32_t out[4]; \
+			if (n != (lanes[l].blocks - 1)) continue; \
+			memcpy(state[0], &a, sizeof(a)); \
+			memcpy(state[1], &b, sizeof(b)); \
+			memcpy(state[2], &c, sizeof(c)); \
+			memcpy(state[3], &d, sizeof(d)); \
+			for (w = 0; w < 4; w++) out[w] = state[w][l]; \
+			for (w = 0; w < 4; w++) { \
+				lanes[l].out[(w * 4)] = out[w] & 0xff; \
+				lanes[l].out[(w * 4) + 1] = (out[w] >> 8) & 0xff; \
+				lanes[l].out[(w * 4) + 2] = (out[w] >> 16) & 0xff; \
+				lanes[l].out[(w * 4) + 3] = (out[w] >> 24) & 0xff; \
+			} \
+		} \
+	} \
+}
+
+MD5_MB_ENGINE(md5_mb_scalar, 1, )
+
+#if defined(__x86_64__)
+MD5_MB_ENGINE(md5_mb_sse2, 4, )
+MD5_MB_ENGINE(md5_mb_avx2, 8, __attribute__((target("avx2"))))
+MD5_MB_ENGINE(md5_mb_avx512, 16, __attribute__((target("avx512f"))))
+
+static bool md5_mb_avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool md5_mb_avx512_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+#elif defined(__aarch64__)
+MD5_MB_ENGINE(md5_mb_neon, 4, )
+#endif
+
+typedef struct {
+	char const	*name;				//!< Engine name.
+	unsigned int	lanes;				//!< Messages processed in parallel.
+	md5_mb_engine_t	func;				//!< Engine entry point.
+	bool		(*supported)(void);		//!< Whether the CPU can run it, NULL if always.
+} md5_mb_impl_t;
+
+/** Engines in order of preference
+ *
+ */
+static md5_mb_impl_t const md5_mb_impls[] = {
+#if defined(__x86_64__)
+	{ .name = "avx512",	.lanes = 16,	.func = md5_mb_avx512,	.supported = md5_mb_avx512_supported },
+	{ .name = "avx2",	.lanes = 8,	.func = md5_mb_avx2,	.supported = md5_mb_avx2_supported },
+	{ .name = "sse2",	.lanes = 4,	.func = md5_mb_sse2 },
+#elif defined(__aarch64__)
+	{ .name = "neon",	.lanes = 4,	.func = md5_mb_neon },
+#endif
+	{ .name = "scalar",	.lanes = 1,	.func = md5_mb_scalar }
+};
+
+static md5_mb_impl_t const *md5_mb_impl;
+
+static inline CC_HINT(always_inline) md5_mb_impl_t const *md5_mb_impl_get(void)
+{
+	size_t i;
+
+	if (likely(md5_mb_impl != NULL)) return md5_mb_impl;
+
+	for (i = 0; i < NUM_ELEMENTS(md5_mb_impls); i++) {
+		if (md5_mb_impls[i].supported && !md5_mb_impls[i].supported()) continue;
+
+		md5_mb_impl = &md5_mb_impls[i];
+		break;
+	}
+
+	return md5_mb_impl;
+}
+
+/** Return the name of the multi-buffer engine in use
+ *
+ * @param[out] lanes	If not NULL, the number of messages the engine
+ *			processes in parallel.
+ * @return the engine name.
+ */
+char const *fr_md5_mb_engine(unsigned int *lanes)
+{
+	md5_mb_impl_t const *impl = md5_mb_impl_get();
+
+	if (lanes) *lanes = impl->lanes;
+
+	return impl->name;
+}
+
+/** Select a multi-buffer engine by name
+ *
+ * Mainly useful for benchmarking and testing, the default is the
+ * widest engine the CPU supports.
+ *
+ * @param[in] name	of the engine, e.g. "scalar" or "avx2".
+ * @return
+ *	- 0 on success.
+ *	- -1 if the engine doesn't exist, or isn't supported by this CPU.
+ */
+int fr_md5_mb_engine_set(char const *name)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(md5_mb_impls); i++) {
+		if (strcmp(md5_mb_impls[i].name, name) != 0) continue;
+
+		if (md5_mb_impls[i].supported && !md5_mb_impls[i].supported()) {
+			fr_strerror_printf("MD5 engine \"%s\" is not supported by this CPU", name);
+			return -1;
+		}
+
+		md5_mb_impl = &md5_mb_impls[i];
+		return 0;
+	}
+
+	fr_strerror_printf("Unknown MD5 engine \"%s\"", name);
+	return -1;
+}
+
+/** Run lanes through the engine, in groups of its width
+ *
+ */
+static void md5_mb_run(md5_mb_lane_t *lanes, size_t num)
+{
+	md5_mb_impl_t const	*impl = md5_mb_impl_get();
+	size_t			i, todo;
+
+	for (i = 0; i < num; i += todo) {
+		todo = num - i;
+		if (todo > impl->lanes) todo = impl->lanes;
+
+		impl->func(lanes + i, todo);
+	}
+}
+
+/*
+ *	Lanes are ~120 bytes, so process messages in bounded
+ *	chunks instead of allocating.
+ */
+#define MD5_MB_CHUNK	(64)
+
+/** Calculate MD5(in || suffix) for a batch of messages
+ *
+ * @param[in,out] msgs	to hash.  The digest of each is written to msgs[i].out.
+ * @param[in] num	Number of messages.
+ */
+void fr_md5_mb(fr_md5_mb_t *msgs, size_t num)
+{
+	md5_mb_lane_t	lanes[MD5_MB_CHUNK];
+	size_t		i, j, todo;
+
+	for (i = 0; i < num; i += todo) {
+		todo = num - i;
+		if (todo > MD5_MB_CHUNK) todo = MD5_MB_CHUNK;
+
+		for (j = 0; j < todo; j++) {
+			fr_md5_mb_t *msg = &msgs[i + j];
+
+			md5_mb_lane_init(&lanes[j], md5_iv, 0,
+					 msg->in, msg->inlen, msg->suffix, msg->suffix_len, msg->out);
+		}
+
+		md5_mb_run(lanes, todo);
+	}
+}
+
+/** Calculate HMAC-MD5(secret, in) for a batch of messages
+ *
+ * Each message may use a different secret.  The inner and outer
+ * passes each start from the secret's precomputed pad state, so
+ * short messages cost two MD5 blocks each.
+ *
+ * @param[in,out] msgs	to authenticate.  msgs[i].secret must be set,
+ *			and msgs[i].suffix is ignored.  The HMAC of each
+ *			is written to msgs[i].out.
+ * @param[in] num	Number of messages.
+ */
+void fr_hmac_md5_mb(fr_md5_mb_t *msgs, size_t num)
+{
+	md5_mb_lane_t	lanes[MD5_MB_CHUNK];
+	size_t		i, j, todo;
+
+	for (i = 0; i < num; i += todo) {
+		todo = num - i;
+		if (todo > MD5_MB_CHUNK) todo = MD5_MB_CHUNK;
+
+		/*
+		 *	Inner digest, written to out.
+		 */
+		for (j = 0; j < todo; j++) {
+			fr_md5_mb_t *msg = &msgs[i + j];
+
+			md5_mb_lane_init(&lanes[j], msg->secret->hmac_ipad_state, MD5_BLOCK_LENGTH,
+					 msg->in, msg->inlen, NULL, 0, msg->out);
+		}
+		md5_mb_run(lanes, todo);
+
+		/*
+		 *	Outer digest, reads the inner digest from out
+		 *	before overwriting it.
+		 */
+		for (j = 0; j < todo; j++) {
+			fr_md5_mb_t *msg = &msgs[i + j];
+
+			md5_mb_lane_init(&lanes[j], msg->secret->hmac_opad_state, MD5_BLOCK_LENGTH,
+					 msg->out, MD5_DIGEST_LENGTH, NULL, 0, msg->out);
+		}
+		md5_mb_run(lanes, todo);
+	}
+}
+
+/** Calculate the raw MD5 state after absorbing a single block
+ *
+ * Used to precompute HMAC pad state in a form the multi-buffer
+ * engines can start from.
+ *
+ * @param[out] state	MD5 state words.
+ * @param[in] block	to absorb.
+ */
+void fr_md5_mb_block_state(uint32_t state[static 4], uint8_t const block[static MD5_BLOCK_LENGTH])
+{
+	md5_mb_lane_t	lane;
+	uint8_t		out[MD5_DIGEST_LENGTH];
+	int		i;
+
+	md5_mb_lane_init(&lane, md5_iv, 0, block, MD5_BLOCK_LENGTH, NULL, 0, out);
+	lane.pad = false;
+	lane.blocks = 1;
+
+	md5_mb_scalar(&lane, 1);
+
+	for (i = 0; i < 4; i++) {
+		state[i] = (uint32_t)out[i * 4] | ((uint32_t)out[(i * 4) + 1] << 8) |
+			   ((uint32_t)out[(i * 4) + 2] << 16) | ((uint32_t)out[(i * 4) + 3] << 24);
+	}
+}
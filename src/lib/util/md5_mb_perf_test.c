@@ -0,0 +1,294 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Correctness and performance tests for multi-buffer MD5
+ *
+ * Compares the multi-buffer engines against the one-at-a-time MD5 and
+ * HMAC-MD5 functions, using batches of RADIUS sized packets.
+ *
+ * @file src/lib/util/md5_mb_perf_test.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/md5.h>
+#include <freeradius-devel/util/time.h>
+
+#define BATCH		(64)
+#define REPS		(2000)
+#define MAX_LEN		(4096)
+
+static char const *engines[] = { "scalar", "sse2", "avx2", "avx512", "neon" };
+
+static uint8_t const secret[] = "testing123-a-shared-secret";
+#define SECRET_LEN	(sizeof(secret) - 1)
+
+static uint8_t	data[BATCH][MAX_LEN];
+
+static void data_init(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < BATCH; i++) for (j = 0; j < MAX_LEN; j++) data[i][j] = (uint8_t)((i * 131) + (j * 7) + 3);
+}
+
+/** Check every engine against fr_md5_calc, for lengths around the block boundaries
+ *
+ */
+static void test_md5_mb_correct(void)
+{
+	uint8_t		buffer[MAX_LEN + SECRET_LEN];
+	uint8_t		expected[BATCH][MD5_DIGEST_LENGTH];
+	uint8_t		digest[BATCH][MD5_DIGEST_LENGTH];
+	fr_md5_mb_t	msgs[BATCH];
+	size_t		e, i;
+
+	data_init();
+
+	for (e = 0; e < NUM_ELEMENTS(engines); e++) {
+		if (fr_md5_mb_engine_set(engines[e]) < 0) continue;
+
+		TEST_CASE(engines[e]);
+
+		/*
+		 *	Lengths 0..63 and 64..127 cover every padding
+		 *	case, and the suffix makes every other message
+		 *	straddle two segments.
+		 */
+		for (i = 0; i < BATCH; i++) {
+			size_t inlen = (i * 2) + (i & 0x01);
+			size_t suffix_len = (i & 0x01) ? SECRET_LEN : 0;
+
+			msgs[i] = (fr_md5_mb_t){
+				.in = data[i],
+				.inlen = inlen,
+				.suffix = suffix_len ? secret : NULL,
+				.suffix_len = suffix_len,
+				.out = digest[i]
+			};
+
+			memcpy(buffer, data[i], inlen);
+			memcpy(buffer + inlen, secret, suffix_len);
+			fr_md5_calc(expected[i], buffer, inlen + suffix_len);
+		}
+
+		fr_md5_mb(msgs, BATCH);
+
+		for (i = 0; i < BATCH; i++) {
+			TEST_CHECK(memcmp(digest[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("engine %s, message %zu", engines[e], i);
+		}
+	}
+}
+
+/** Check multi-buffer HMAC-MD5 against the RFC 2202 vectors, and mixed secrets
+ *
+ */
+static void test_hmac_md5_mb_correct(void)
+{
+	fr_md5_secret_t	*jefe, *other;
+	uint8_t		expected[BATCH][MD5_DIGEST_LENGTH];
+	uint8_t		digest[BATCH][MD5_DIGEST_LENGTH];
+	fr_md5_mb_t	msgs[BATCH];
+	size_t		e, i;
+
+	data_init();
+
+	jefe = fr_md5_secret_alloc(NULL, (uint8_t const *)"Jefe", 4);
+	other = fr_md5_secret_alloc(NULL, secret, SECRET_LEN);
+	TEST_ASSERT(jefe && other);
+
+	for (e = 0; e < NUM_ELEMENTS(engines); e++) {
+		if (fr_md5_mb_engine_set(engines[e]) < 0) continue;
+
+		TEST_CASE(engines[e]);
+
+		for (i = 0; i < BATCH; i++) {
+			fr_md5_secret_t const *key = (i % 3) ? other : jefe;
+
+			msgs[i] = (fr_md5_mb_t){
+				.in = (i == 0) ? (uint8_t const *)"what do ya want for nothing?" : data[i],
+				.inlen = (i == 0) ? 28 : (i * 5),
+				.secret = key,
+				.out = digest[i]
+			};
+			fr_hmac_md5_secret(expected[i], msgs[i].in, msgs[i].inlen, key);
+		}
+
+		fr_hmac_md5_mb(msgs, BATCH);
+
+		TEST_CHECK_RET(memcmp(digest[0],
+				      (uint8_t[]){
+						0x75, 0x0c, 0x78, 0x3e, 0x6a, 0xb0, 0xb5, 0x03,
+						0xea, 0xa8, 0x6e, 0x31, 0x0a, 0x5d, 0xb7, 0x38
+				      },
+				      MD5_DIGEST_LENGTH), 0);
+
+		for (i = 0; i < BATCH; i++) {
+			TEST_CHECK(memcmp(digest[i], expected[i], MD5_DIGEST_LENGTH) == 0);
+			TEST_MSG("engine %s, message %zu", engines[e], i);
+		}
+	}
+
+	talloc_free(jefe);
+	talloc_free(other);
+}
+
+/** Time signing a batch of packets, as MD5(packet + secret)
+ *
+ */
+static void do_test_md5_perf(size_t len)
+{
+	uint8_t		buffer[MAX_LEN + SECRET_LEN];
+	uint8_t		digest[BATCH][MD5_DIGEST_LENGTH];
+	fr_md5_mb_t	msgs[BATCH];
+	fr_time_t	start;
+	fr_time_delta_t	used;
+	size_t		e, i;
+	int		r;
+
+	data_init();
+
+	start = fr_time();
+	for (r = 0; r < REPS; r++) {
+		for (i = 0; i < BATCH; i++) {
+			fr_md5_ctx_t *ctx;
+
+			/*
+			 *	What fr_radius_sign() does.
+			 */
+			memcpy(buffer, data[i], len);
+			ctx = fr_md5_ctx_alloc(true);
+			fr_md5_update(ctx, buffer, len);
+			fr_md5_update(ctx, secret, SECRET_LEN);
+			fr_md5_final(digest[i], ctx);
+			fr_md5_ctx_free(&ctx);
+		}
+	}
+	used = fr_time_sub(fr_time(), start);
+	TEST_MSG_ALWAYS("engine=md5_ctx len=%zu per_sec=%0.0lf", len,
+			(REPS * BATCH) / (fr_time_delta_unwrap(used) / (double)NSEC));
+
+	for (e = 0; e < NUM_ELEMENTS(engines); e++) {
+		if (fr_md5_mb_engine_set(engines[e]) < 0) continue;
+
+		for (i = 0; i < BATCH; i++) {
+			msgs[i] = (fr_md5_mb_t){
+				.in = data[i],
+				.inlen = len,
+				.suffix = secret,
+				.suffix_len = SECRET_LEN,
+				.out = digest[i]
+			};
+		}
+
+		start = fr_time();
+		for (r = 0; r < REPS; r++) fr_md5_mb(msgs, BATCH);
+		used = fr_time_sub(fr_time(), start);
+
+		TEST_MSG_ALWAYS("engine=%s len=%zu per_sec=%0.0lf", engines[e], len,
+				(REPS * BATCH) / (fr_time_delta_unwrap(used) / (double)NSEC));
+	}
+}
+
+/** Time calculating a Message-Authenticator for a batch of packets
+ *
+ */
+static void do_test_hmac_md5_perf(size_t len)
+{
+	uint8_t		digest[BATCH][MD5_DIGEST_LENGTH];
+	fr_md5_mb_t	msgs[BATCH];
+	fr_md5_secret_t	*key;
+	fr_time_t	start;
+	fr_time_delta_t	used;
+	size_t		e, i;
+	int		r;
+
+	data_init();
+
+	key = fr_md5_secret_alloc(NULL, secret, SECRET_LEN);
+	TEST_ASSERT(key != NULL);
+
+	start = fr_time();
+	for (r = 0; r < REPS; r++) {
+		for (i = 0; i < BATCH; i++) fr_hmac_md5(digest[i], data[i], len, secret, SECRET_LEN);
+	}
+	used = fr_time_sub(fr_time(), start);
+	TEST_MSG_ALWAYS("engine=hmac_md5 len=%zu per_sec=%0.0lf", len,
+			(REPS * BATCH) / (fr_time_delta_unwrap(used) / (double)NSEC));
+
+	start = fr_time();
+	for (r = 0; r < REPS; r++) {
+		for (i = 0; i < BATCH; i++) fr_hmac_md5_secret(digest[i], data[i], len, key);
+	}
+	used = fr_time_sub(fr_time(), start);
+	TEST_MSG_ALWAYS("engine=hmac_md5_secret len=%zu per_sec=%0.0lf", len,
+			(REPS * BATCH) / (fr_time_delta_unwrap(used) / (double)NSEC));
+
+	for (e = 0; e < NUM_ELEMENTS(engines); e++) {
+		if (fr_md5_mb_engine_set(engines[e]) < 0) continue;
+
+		for (i = 0; i < BATCH; i++) {
+			msgs[i] = (fr_md5_mb_t){
+				.in = data[i],
+				.inlen = len,
+				.secret = key,
+				.out = digest[i]
+			};
+		}
+
+		start = fr_time();
+		for (r = 0; r < REPS; r++) fr_hmac_md5_mb(msgs, BATCH);
+		used = fr_time_sub(fr_time(), start);
+
+		TEST_MSG_ALWAYS("engine=%s len=%zu per_sec=%0.0lf", engines[e], len,
+				(REPS * BATCH) / (fr_time_delta_unwrap(used) / (double)NSEC));
+	}
+
+	talloc_free(key);
+}
+
+#define test_func(_func, _len) \
+static void test_ ## _func ## _ ## _len(void)\
+{\
+	do_test_ ## _func(_len);\
+}
+
+#define test_funcs(_func) \
+	test_func(_func, 64) \
+	test_func(_func, 256) \
+	test_func(_func, 1024) \
+	test_func(_func, 4096)
+
+test_funcs(md5_perf)
+test_funcs(hmac_md5_perf)
+
+#define len_tests(_func) \
+	{ #_func "_64", test_ ## _func ## _64 },\
+	{ #_func "_256", test_ ## _func ## _256 },\
+	{ #_func "_1024", test_ ## _func ## _1024 },\
+	{ #_func "_4096", test_ ## _func ## _4096 },
+
+TEST_LIST = {
+	{ "md5_mb_correct",		test_md5_mb_correct },
+	{ "hmac_md5_mb_correct",	test_hmac_md5_mb_correct },
+
+	len_tests(md5_perf)
+	len_tests(hmac_md5_perf)
+
+	{ NULL }
+};
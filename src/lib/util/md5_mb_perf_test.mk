@@ -0,0 +1,6 @@
+TARGET := md5_mb_perf_test
+SOURCES := md5_mb_perf_test.c
+
+TGT_INSTALLDIR	:=
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util.la
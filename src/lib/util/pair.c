@@ -46,6 +46,308 @@ void fr_pair_list_init(fr_pair_list_t *list)
 	 *	all of them.
 	 */
 	fr_dlist_talloc_init(&list->order, fr_pair_t, order_entry);
+	list->index = NULL;
+}
+
+/*
+ *	Indexed lists shorter than this are still searched linearly.
+ */
+#define PAIR_LIST_INDEX_MIN	16
+
+/** Where to find instances of a da in an indexed list
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;			//!< Attribute the entry is for.  NULL if the slot is free.
+	fr_pair_t		*first;			//!< First instance of da in the list.
+	fr_pair_t		*last;			//!< Last instance of da in the list.
+	unsigned int		count;			//!< Number of instances of da in the list.
+} pair_list_index_entry_t;
+
+/** Index of the pairs in a list by da
+ *
+ * Built the first time an indexed list is searched, and then kept up
+ * to date as pairs are appended, prepended or removed.  Any other change
+ * to the list marks the index as invalid, and it's rebuilt on the next
+ * search.
+ */
+struct fr_pair_list_index_s {
+	pair_list_index_entry_t	*slots;			//!< Open addressed table of entries, keyed by da.
+	unsigned int		num_slots;		//!< Size of the table.  Always a power of 2.
+	unsigned int		used;			//!< Slots which have been assigned a da.
+	unsigned int		num_elements;		//!< Number of pairs in the list the index describes.
+	bool			valid;			//!< Whether the index describes the list.
+};
+
+/** Enable indexing for a pair list
+ *
+ * Makes #fr_pair_find_by_da, #fr_pair_find_by_da_idx and #fr_pair_count_by_da
+ * O(1) for long lists.  The index is only worth having for lists which
+ * are searched repeatedly, like the request lists.
+ *
+ * @note Indexed lists must not be shared between threads, as the index
+ *	 is (re)built by functions which take a const list.
+ *
+ * @param[in] ctx	to allocate the index in.  Must not be freed before the list.
+ * @param[in] list	to index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list)
+{
+	if (list->index) return 0;
+
+	list->index = talloc_zero(ctx, fr_pair_list_index_t);
+	if (unlikely(!list->index)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline CC_HINT(always_inline) void pair_list_index_invalidate(fr_pair_list_t const *list)
+{
+	if (list->index) list->index->valid = false;
+}
+
+static inline CC_HINT(always_inline) unsigned int pair_list_index_hash(fr_pair_list_index_t const *idx,
+									fr_dict_attr_t const *da)
+{
+	return (uint32_t)(((uintptr_t)da >> 4) * 2654435761U) & (idx->num_slots - 1);
+}
+
+/** Double the size of the index table, rehashing the existing entries
+ *
+ */
+static int pair_list_index_grow(fr_pair_list_index_t *idx)
+{
+	pair_list_index_entry_t	*old = idx->slots;
+	unsigned int		old_num = idx->num_slots, i, j;
+
+	idx->num_slots = old_num ? (old_num * 2) : 16;
+	idx->slots = talloc_zero_array(idx, pair_list_index_entry_t, idx->num_slots);
+	if (unlikely(!idx->slots)) {
+		idx->slots = old;
+		idx->num_slots = old_num;
+		return -1;
+	}
+
+	for (j = 0; j < old_num; j++) {
+		if (!old[j].da) continue;
+
+		i = pair_list_index_hash(idx, old[j].da);
+		while (idx->slots[i].da) i = (i + 1) & (idx->num_slots - 1);
+		idx->slots[i] = old[j];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Find the entry for a da, optionally assigning one
+ *
+ * @param[in] idx	to search in.
+ * @param[in] da	to search for.
+ * @param[in] create	assign an entry if the da doesn't have one.
+ * @return
+ *	- The entry for the da.
+ *	- NULL if the da has no entry and create is false, or we failed
+ *	  growing the table.
+ */
+static pair_list_index_entry_t *pair_list_index_slot(fr_pair_list_index_t *idx, fr_dict_attr_t const *da, bool create)
+{
+	pair_list_index_entry_t	*e;
+	unsigned int		i;
+
+	if (idx->num_slots) {
+		i = pair_list_index_hash(idx, da);
+		for (;;) {
+			e = &idx->slots[i];
+			if (e->da == da) return e;
+			if (!e->da) break;
+			i = (i + 1) & (idx->num_slots - 1);
+		}
+	}
+
+	if (!create) return NULL;
+
+	/*
+	 *	Keep the table at most half full
+	 */
+	if (((idx->used + 1) * 2) > idx->num_slots) {
+		if (pair_list_index_grow(idx) < 0) return NULL;
+	}
+
+	i = pair_list_index_hash(idx, da);
+	while (idx->slots[i].da) i = (i + 1) & (idx->num_slots - 1);
+
+	e = &idx->slots[i];
+	e->da = da;
+	idx->used++;
+
+	return e;
+}
+
+/** Rebuild the index from the contents of the list
+ *
+ */
+static bool pair_list_index_build(fr_pair_list_t const *list)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	fr_pair_t		*vp = NULL;
+
+	if (idx->slots) memset(idx->slots, 0, sizeof(*idx->slots) * idx->num_slots);
+	idx->used = 0;
+	idx->valid = false;
+
+	while ((vp = fr_dlist_next(&list->order, vp))) {
+		pair_list_index_entry_t *e;
+
+		e = pair_list_index_slot(idx, vp->da, true);
+		if (unlikely(!e)) return false;
+
+		if (!e->count) e->first = vp;
+		e->last = vp;
+		e->count++;
+	}
+
+	idx->num_elements = fr_dlist_num_elements(&list->order);
+	idx->valid = true;
+
+	return true;
+}
+
+/** Find the index entry for a da
+ *
+ * @param[out] out	The entry for the da, or NULL if there are no
+ *			instances of da in the list.
+ * @param[in] list	to search in.
+ * @param[in] da	to search for.
+ * @return
+ *	- true if out was populated from the index.
+ *	- false if the list isn't indexed, or is too short to bother
+ *	  using the index.  The caller should search the list.
+ */
+static inline CC_HINT(always_inline) bool pair_list_index_find(pair_list_index_entry_t const **out,
+							       fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_list_index_t *idx = list->index;
+
+	if (!idx || (fr_dlist_num_elements(&list->order) < PAIR_LIST_INDEX_MIN)) return false;
+
+	/*
+	 *	The element count catches most changes made
+	 *	to the list without going through the pair API.
+	 */
+	if ((!idx->valid || (idx->num_elements != fr_dlist_num_elements(&list->order))) &&
+	    !pair_list_index_build(list)) return false;
+
+	*out = pair_list_index_slot(idx, da, false);
+	if (!*out || !(*out)->count) {
+		*out = NULL;
+		return true;
+	}
+
+	/*
+	 *	The da of a pair was changed while it
+	 *	was in the list.
+	 */
+	if (unlikely(((*out)->first->da != da) || ((*out)->last->da != da))) {
+		idx->valid = false;
+		return false;
+	}
+
+	return true;
+}
+
+/** Record a pair which has just been inserted into the list
+ *
+ * @param[in] list	the pair was inserted into.
+ * @param[in] vp	which was inserted.
+ * @param[in] pos	the pair was inserted next to.  NULL if the pair
+ *			was inserted at the head or tail of the list.
+ * @param[in] before	whether the pair was inserted before pos (or at the
+ *			head of the list), or after pos (or at the tail).
+ */
+static void pair_list_index_insert(fr_pair_list_t *list, fr_pair_t *vp, fr_pair_t const *pos, bool before)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	pair_list_index_entry_t	*e;
+
+	if (!idx || !idx->valid) return;
+
+	if ((idx->num_elements + 1) != fr_dlist_num_elements(&list->order)) {
+	invalidate:
+		idx->valid = false;
+		return;
+	}
+
+	e = pair_list_index_slot(idx, vp->da, true);
+	if (unlikely(!e)) goto invalidate;
+
+	if (!e->count) {
+		e->first = e->last = vp;
+	} else if (!pos) {
+		if (before) {
+			e->first = vp;
+		} else {
+			e->last = vp;
+		}
+	/*
+	 *	Inserting next to another instance of the
+	 *	same da is the only case where we know where
+	 *	the pair sits relative to the other instances.
+	 */
+	} else if (pos->da == vp->da) {
+		if (before && (pos == e->first)) e->first = vp;
+		if (!before && (pos == e->last)) e->last = vp;
+	} else {
+		goto invalidate;
+	}
+
+	e->count++;
+	idx->num_elements++;
+}
+
+/** Record a pair which is about to be removed from the list
+ *
+ */
+static void pair_list_index_remove(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	fr_pair_list_index_t	*idx = list->index;
+	pair_list_index_entry_t	*e;
+
+	if (!idx || !idx->valid) return;
+
+	if (idx->num_elements != fr_dlist_num_elements(&list->order)) {
+	invalidate:
+		idx->valid = false;
+		return;
+	}
+
+	e = pair_list_index_slot(idx, vp->da, false);
+	if (!e || !e->count) goto invalidate;
+
+	if (e->count == 1) {
+		e->first = e->last = NULL;
+	} else {
+		fr_pair_t *p;
+
+		if (e->first == vp) {
+			for (p = fr_dlist_next(&list->order, vp); p && (p->da != vp->da); p = fr_dlist_next(&list->order, p));
+			e->first = p;
+		}
+		if (e->last == vp) {
+			for (p = fr_dlist_prev(&list->order, vp); p && (p->da != vp->da); p = fr_dlist_prev(&list->order, p));
+			e->last = p;
+		}
+		if (!e->first || !e->last) goto invalidate;
+	}
+
+	e->count--;
+	idx->num_elements--;
 }
 
 /** Free a fr_pair_t
@@ -310,6 +612,35 @@ fr_pair_t *fr_pair_afrom_da_with_pool(TALLOC_CTX *ctx, fr_dict_attr_t const *da,
 	return vp;
 }
 
+/** Allocate a pair to hold a value of a known length
+ *
+ * Intended for protocol decoders.  'string' and 'octets' pairs are allocated
+ * with #fr_pair_afrom_da_with_pool, so decoding the value into the pair
+ * doesn't need a second allocation.  Pairs of other types are allocated
+ * with #fr_pair_afrom_da.
+ *
+ * @param[in] ctx		to allocate the pair in.
+ * @param[in] da		Specifies the dictionary attribute to build the #fr_pair_t from.
+ * @param[in] value_len		The expected length of the value.
+ * @return
+ *	- A new #fr_pair_t.
+ *	- NULL if an error occurred.
+ */
+fr_pair_t *fr_pair_afrom_da_with_len(TALLOC_CTX *ctx, fr_dict_attr_t const *da, size_t value_len)
+{
+	switch (da->type) {
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_STRING:
+		if (value_len) return fr_pair_afrom_da_with_pool(ctx, da, value_len);
+		break;
+
+	default:
+		break;
+	}
+
+	return fr_pair_afrom_da(ctx, da);
+}
+
 /** Re-initialise an attribute with a different da
  *
  * If the new da has a different type to the old da, we'll attempt to cast
@@ -520,6 +851,7 @@ int fr_pair_steal_prepend(TALLOC_CTX *list_ctx, fr_pair_list_t *list, fr_pair_t
 void fr_pair_list_free(fr_pair_list_t *list)
 {
 	fr_dlist_talloc_free(&list->order);
+	pair_list_index_invalidate(list);
 }
 
 /** Is a valuepair list empty
@@ -617,11 +949,14 @@ void *fr_pair_iter_next_by_ancestor(fr_dlist_head_t *list, void *to_eval, void *
  */
 unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t const *da)
 {
-	fr_pair_t	*vp = NULL;
-	unsigned int	count = 0;
+	fr_pair_t		*vp = NULL;
+	unsigned int		count = 0;
+	pair_list_index_entry_t	const *e;
 
 	if (fr_dlist_empty(&list->order)) return 0;
 
+	if (pair_list_index_find(&e, list, da)) return e ? e->count : 0;
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) count++;
 
 	return count;
@@ -640,12 +975,19 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
  */
 fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev, fr_dict_attr_t const *da)
 {
-	fr_pair_t *vp = UNCONST(fr_pair_t *, prev);
+	fr_pair_t		*vp = UNCONST(fr_pair_t *, prev);
+	pair_list_index_entry_t	const *e;
 
 	if (fr_dlist_empty(&list->order)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
+	if (pair_list_index_find(&e, list, da)) {
+		if (!e) return NULL;
+		if (!prev) return e->first;
+		if (prev == e->last) return NULL;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
 
 	return NULL;
@@ -664,12 +1006,37 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
  */
 fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t const *da, unsigned int idx)
 {
-	fr_pair_t *vp = NULL;
+	fr_pair_t		*vp = NULL;
+	pair_list_index_entry_t	const *e;
 
 	if (fr_dlist_empty(&list->order)) return NULL;
 
 	PAIR_LIST_VERIFY(list);
 
+	if (pair_list_index_find(&e, list, da)) {
+		unsigned int	skip = idx;
+
+		if (!e || (idx >= e->count)) return NULL;
+		if (idx == (e->count - 1)) return e->last;
+
+		vp = e->first;
+		while (skip) {
+			vp = fr_pair_list_next(list, vp);
+
+			/*
+			 *	The index says there are more instances
+			 *	than the list has.  Don't trust it, and
+			 *	walk the whole list instead.
+			 */
+			if (unlikely(!vp)) {
+				fr_assert_fail("Pair list index for \"%s\" is stale", da->name);
+				break;
+			}
+			if (vp->da == da) skip--;
+		}
+		if (likely(vp != NULL)) return vp;
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da != vp->da) continue;
 
@@ -814,8 +1181,10 @@ fr_pair_list_t *fr_pair_children(fr_pair_t *vp)
  * @return
  *	- 0 on success.
  */
-static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *to_insert, UNUSED void *uctx)
+static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *to_insert, void *uctx)
 {
+	pair_list_index_invalidate(uctx);	/* Don't know where the cursor will insert */
+
 	return 0;
 }
 
@@ -827,8 +1196,10 @@ static int _pair_list_dcursor_insert(UNUSED fr_dlist_head_t *list, UNUSED void *
  * @return
  *	- 0 on success.
  */
-static int _pair_list_dcursor_remove(UNUSED fr_dlist_head_t *list, UNUSED void *to_remove, UNUSED void *uctx)
+static int _pair_list_dcursor_remove(UNUSED fr_dlist_head_t *list, UNUSED void *to_remove, void *uctx)
 {
+	pair_list_index_invalidate(uctx);	/* Replacements are signalled as removals */
+
 	return 0;
 }
 
@@ -990,6 +1361,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_dlist_insert_head(&list->order, to_add);
+	pair_list_index_insert(list, to_add, NULL, true);
 
 	return 0;
 }
@@ -1014,6 +1386,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_dlist_insert_tail(&list->order, to_add);
+	pair_list_index_insert(list, to_add, NULL, false);
 
 	return 0;
 }
@@ -1036,12 +1409,13 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 		return -1;
 	}
 
-	if (!fr_dlist_entry_in_list(&to_add->order_entry)) {
+	if (!fr_dlist_entry_in_list(&pos->order_entry)) {
 		fr_strerror_printf("Pair %pV not in list", pos);
 		return -1;
 	}
 
 	fr_dlist_insert_after(fr_pair_list_order(list), pos, to_add);
+	pair_list_index_insert(list, to_add, pos, false);
 
 	return 0;
 }
@@ -1064,12 +1438,13 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 		return -1;
 	}
 
-	if (!fr_dlist_entry_in_list(&to_add->order_entry)) {
+	if (!fr_dlist_entry_in_list(&pos->order_entry)) {
 		fr_strerror_printf("Pair %pV not in list", pos);
 		return -1;
 	}
 
 	fr_dlist_insert_before(fr_pair_list_order(list), pos, to_add);
+	pair_list_index_insert(list, to_add, pos, true);
 
 	return 0;
 }
@@ -1244,6 +1619,7 @@ fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 	fr_pair_t *prev;
 
 	prev = fr_pair_list_prev(list, vp);
+	pair_list_index_remove(list, vp);
 	fr_dlist_remove(&list->order, vp);
 
 	return prev;
@@ -1260,6 +1636,7 @@ fr_pair_t *fr_pair_delete(fr_pair_list_t *list, fr_pair_t *vp)
 	fr_pair_t *prev;
 
 	prev = fr_pair_list_prev(list, vp);
+	pair_list_index_remove(list, vp);
 	fr_dlist_remove(&list->order, vp);
 	talloc_free(vp);
 
@@ -1498,6 +1875,7 @@ int fr_pair_list_cmp(fr_pair_list_t const *a, fr_pair_list_t const *b)
 void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
 	fr_dlist_sort(&list->order, cmp);
+	pair_list_index_invalidate(list);
 }
 
 /** Write an error to the library errorbuff detailing the mismatch
@@ -1882,6 +2260,7 @@ void fr_pair_value_clear(fr_pair_t *vp)
 			fr_pair_value_clear(child);
 			talloc_free(child);
 		}
+		pair_list_index_invalidate(&vp->vp_group);
 		break;
 	}
 }
@@ -2772,6 +3151,8 @@ void fr_pair_list_tainted(fr_pair_list_t *list)
 void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
 	fr_dlist_move(&dst->order, &src->order);
+	pair_list_index_invalidate(dst);
+	pair_list_index_invalidate(src);
 }
 
 /** Move a list of fr_pair_t from a temporary list to the head of a destination list
@@ -2782,6 +3163,8 @@ void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
 	fr_dlist_move_head(&dst->order, &src->order);
+	pair_list_index_invalidate(dst);
+	pair_list_index_invalidate(src);
 }
 
 /** Evaluation function for matching if vp matches a given da
@@ -61,8 +61,12 @@ typedef enum value_type {
 
 typedef struct value_pair_s fr_pair_t;
 
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
 typedef struct {
         fr_dlist_head_t		order;				//!< Maintains the relative order of pairs in a list.
+	fr_pair_list_index_t	*index;				//!< Optional index of pairs by da.
+								///< See #fr_pair_list_index_enable.
 } fr_pair_list_t;
 
 static inline fr_dlist_head_t _CONST *fr_pair_list_order(fr_pair_list_t _CONST *list)
@@ -206,6 +210,8 @@ DIAG_ON(nonnull-compare)
 /* Initialisation */
 void fr_pair_list_init(fr_pair_list_t *head) CC_HINT(nonnull);
 
+int fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list) CC_HINT(nonnull(2));
+
 /*
  *  Temporary macro to point the head of a pair_list to a specific vp
  */
@@ -226,6 +232,9 @@ fr_pair_t	*fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da) CC_HINT(w
 fr_pair_t	*fr_pair_afrom_da_with_pool(TALLOC_CTX *ctx, fr_dict_attr_t const *da, size_t value_len)
 		CC_HINT(warn_unused_result) CC_HINT(nonnull(2));
 
+fr_pair_t	*fr_pair_afrom_da_with_len(TALLOC_CTX *ctx, fr_dict_attr_t const *da, size_t value_len)
+		CC_HINT(warn_unused_result) CC_HINT(nonnull(2));
+
 int		fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t const *da)
 		CC_HINT(nonnull(2, 3));
 
@@ -426,6 +426,75 @@ static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int r
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+/** Find the first instance of random DAs, with or without the list being indexed
+ *
+ */
+static void pair_find_by_da_test(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+				 bool indexed)
+{
+	fr_pair_list_t		test_vps;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp, *vp, *expected;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+	TALLOC_CTX		*ctx = talloc_new(autofree);
+
+	fr_pair_list_init(&test_vps);
+	if (indexed) TEST_CHECK(fr_pair_list_index_enable(ctx, &test_vps) == 0);
+	if (input_count > len) input_count = len;
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = rand() % input_count;
+		new_vp = fr_pair_copy(ctx, source_vps[idx]);
+		fr_pair_append(&test_vps, new_vp);
+	}
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = rand() % input_count;
+
+			da = source_vps[idx]->da;
+			start = fr_time();
+			vp = fr_pair_find_by_da(&test_vps, NULL, da);
+			end = fr_time();
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+			/*
+			 *  The index must agree with a walk of the list
+			 */
+			if (indexed && (i == 0)) {
+				for (expected = fr_pair_list_head(&test_vps);
+				     expected && (expected->da != da);
+				     expected = fr_pair_list_next(&test_vps, expected));
+				TEST_CHECK(vp == expected);
+			}
+		}
+	}
+	fr_pair_list_free(&test_vps);
+	talloc_free(ctx);
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_fr_pair_find_by_da(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	pair_find_by_da_test(len, perc, reps, source_vps, false);
+}
+
+static void do_test_fr_pair_find_by_da_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	pair_find_by_da_test(len, perc, reps, source_vps, true);
+}
+
 static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
 {
 	fr_pair_list_t  test_vps;
@@ -482,6 +551,32 @@ all_test_funcs(fr_pair_find_by_da_idx)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
 
+/*
+ *  Lookups are tested against shorter and much longer lists,
+ *  with fewer repetitions, as unindexed lookups on long lists
+ *  are slow.
+ */
+#define lookup_test_func(_func, _count, _perc, _source_vps) \
+static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
+{\
+	do_test_ ## _func(_count, _perc, 1000, _source_vps);\
+}
+
+#define lookup_test_funcs(_func, _perc) \
+	lookup_test_func(_func, 10, _perc, source_vps_ ## _perc) \
+	lookup_test_func(_func, 100, _perc, source_vps_ ## _perc) \
+	lookup_test_func(_func, 500, _perc, source_vps_ ## _perc)
+
+#define all_lookup_test_funcs(_func) \
+	lookup_test_funcs(_func, 0) \
+	lookup_test_funcs(_func, 25) \
+	lookup_test_funcs(_func, 50) \
+	lookup_test_funcs(_func, 75) \
+	lookup_test_funcs(_func, 100)
+
+all_lookup_test_funcs(fr_pair_find_by_da)
+all_lookup_test_funcs(fr_pair_find_by_da_indexed)
+
 #define repetition_tests(_func, _perc) \
 	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
 	{ #_func "_40_" #_perc, test_ ## _func ## _40_ ## _perc},\
@@ -489,6 +584,18 @@ all_test_funcs(fr_pair_list_free)
 	{ #_func "_80_" #_perc, test_ ## _func ## _80_ ## _perc},\
 	{ #_func "_100_" #_perc, test_ ## _func ## _100_ ## _perc},\
 
+#define lookup_tests(_func, _perc) \
+	{ #_func "_10_" #_perc, test_ ## _func ## _10_ ## _perc},\
+	{ #_func "_100_" #_perc, test_ ## _func ## _100_ ## _perc},\
+	{ #_func "_500_" #_perc, test_ ## _func ## _500_ ## _perc},\
+
+#define all_lookup_tests(_func) \
+	lookup_tests(_func, 0) \
+	lookup_tests(_func, 25) \
+	lookup_tests(_func, 50) \
+	lookup_tests(_func, 75) \
+	lookup_tests(_func, 100)
+
 #define all_repetition_tests(_func) \
 	repetition_tests(_func, 0) \
 	repetition_tests(_func, 25) \
@@ -501,6 +608,8 @@ TEST_LIST = {
 	all_repetition_tests(fr_pair_find_by_da_idx)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
+	all_lookup_tests(fr_pair_find_by_da)
+	all_lookup_tests(fr_pair_find_by_da_indexed)
 
 	{ NULL }
 };
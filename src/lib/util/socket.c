@@ -35,6 +35,10 @@
 
 #include <fcntl.h>
 
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#  include <linux/filter.h>
+#endif
+
 #ifndef SO_BINDTODEVICE
 #endif
 
@@ -1042,3 +1046,94 @@ done:
 #endif
 	return 0;
 }
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+/** Spread packets over a group of SO_REUSEPORT sockets by source IP address
+ *
+ * Attaches a classic BPF program to the SO_REUSEPORT group the socket
+ * is bound in.  The program hashes the source IP address of each
+ * packet, and returns the index of the socket which should receive it.
+ * All packets from one client are therefore read by the same socket,
+ * irrespective of their source port.
+ *
+ * Sockets are indexed in the order in which they were bound.  If the
+ * hash selects a socket which doesn't exist (yet), the kernel falls
+ * back to its normal 4-tuple hash.
+ *
+ * @param[in] sockfd	a bound socket in the SO_REUSEPORT group.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_socket_reuseport_hash(int sockfd, uint32_t num)
+{
+	struct sockaddr_storage	salocal;
+	socklen_t		salen = sizeof(salocal);
+	struct sock_fprog	prog;
+
+	/*
+	 *	The packet data starts after the UDP header, so the
+	 *	IP header is accessed relative to SKF_NET_OFF.
+	 */
+	struct sock_filter	v4[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),		/* A = ip->saddr */
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),		/* A *= golden ratio */
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),			/* A >>= 16 */
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num),			/* A %= num */
+		BPF_STMT(BPF_RET | BPF_A, 0)
+	};
+	struct sock_filter	v6[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),		/* A = ip6->saddr[0] */
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),		/* A = ip6->saddr[1] */
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),		/* A = ip6->saddr[2] */
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_MISC | BPF_TAX, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),		/* A = ip6->saddr[3] */
+		BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+		BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num),
+		BPF_STMT(BPF_RET | BPF_A, 0)
+	};
+
+	if (num < 2) return 0;
+
+	memset(&salocal, 0, sizeof(salocal));
+	if (getsockname(sockfd, (struct sockaddr *) &salocal, &salen) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	switch (salocal.ss_family) {
+	case AF_INET:
+		prog.filter = v4;
+		prog.len = NUM_ELEMENTS(v4);
+		break;
+
+	case AF_INET6:
+		prog.filter = v6;
+		prog.len = NUM_ELEMENTS(v6);
+		break;
+
+	default:
+		fr_strerror_printf("Cannot hash packets for address family %u", salocal.ss_family);
+		return -1;
+	}
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_reuseport_hash(UNUSED int sockfd, UNUSED uint32_t num)
+{
+	return 0;
+}
+#endif
@@ -312,6 +312,8 @@ int		fr_socket_server_tcp(fr_ipaddr_t const *ipaddr, uint16_t *port, char const
 
 int		fr_socket_bind(int sockfd, fr_ipaddr_t const *ipaddr, uint16_t *port, char const *interface);
 
+int		fr_socket_reuseport_hash(int sockfd, uint32_t num);
+
 #ifdef __cplusplus
 }
 #endif
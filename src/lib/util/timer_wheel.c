@@ -0,0 +1,459 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Functions for a hierarchical timer wheel
+ *
+ * @file src/lib/util/timer_wheel.c
+ *
+ * @copyright 2026 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/timer_wheel.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+
+/*
+ * A hierarchical timer wheel, in the style of the classic BSD and Linux
+ * kernel callout wheels (Varghese & Lauck, "Hashed and Hierarchical Timing
+ * Wheels", 1987).
+ *
+ * Time is measured in abstract "ticks".  Level 0 has one slot per tick,
+ * each higher level has one slot per full rotation of the level below.
+ * An element is placed in the lowest level whose range covers its expiry,
+ * and is moved ("cascaded") down a level each time the level below it
+ * wraps, until it reaches level 0, where it's due when its slot is current.
+ *
+ * Insertion and extraction are O(1), which makes the wheel well suited to
+ * timers that are almost always cancelled before they fire.  The cost is
+ * resolution: elements are only ever ordered by tick.
+ *
+ * With four levels of 256 slots, the wheel covers 2^32 ticks (~49 days
+ * of 1ms ticks).  Elements further out than that are placed in the last
+ * slot of the top level, and re-placed when it's cascaded.
+ */
+#define TW_BITS		8
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	4
+#define TW_WORDS	(TW_SLOTS / 64)
+#define TW_MAX_DELTA	((UINT64_C(1) << (TW_BITS * TW_LEVELS)) - 1)
+
+struct fr_timer_wheel_s {
+	uint64_t	tick;				//!< Current tick.  Elements in the current
+							///< level 0 slot are due.
+	unsigned int	num_elements;			//!< Number of elements in the wheel.
+	size_t		offset;				//!< Offset of the node in element structure.
+	char const	*type;				//!< Type of elements.
+
+	uint64_t	used[TW_LEVELS][TW_WORDS];	//!< Bitmap of non-empty slots.
+	fr_dlist_t	slot[TW_LEVELS][TW_SLOTS];	//!< Element lists.
+};
+
+static inline CC_HINT(always_inline, nonnull) fr_timer_wheel_node_t *node_addr(fr_timer_wheel_t const *tw, void *data)
+{
+	return (fr_timer_wheel_node_t *)(((uint8_t *)data) + tw->offset);
+}
+
+static inline CC_HINT(always_inline, nonnull) void *entry_to_item(fr_timer_wheel_t const *tw, fr_dlist_t const *entry)
+{
+	return fr_dlist_entry_to_item(tw->offset + offsetof(fr_timer_wheel_node_t, entry), entry);
+}
+
+/** Find the first non-empty slot at or after start, wrapping around
+ *
+ * @return
+ *	- The slot index.
+ *	- -1 if all slots are empty.
+ */
+static inline CC_HINT(nonnull) int slot_find(uint64_t const used[], unsigned int start)
+{
+	unsigned int	word = start / 64;
+	uint64_t	bits = used[word] & (UINT64_MAX << (start % 64));
+	unsigned int	i;
+
+	/*
+	 *	Bits at or above start in the first word,
+	 *	then whole words, wrapping around to the
+	 *	first word again for the bits below start.
+	 */
+	for (i = 0; i <= TW_WORDS; i++) {
+		if (bits) return (int)((word * 64) + fr_high_bit_pos(bits & -bits) - 1);
+
+		word = (word + 1) % TW_WORDS;
+		bits = used[word];
+	}
+
+	return -1;
+}
+
+static inline CC_HINT(nonnull) void slot_add(fr_timer_wheel_t *tw, fr_timer_wheel_node_t *node,
+					     unsigned int level, unsigned int slot)
+{
+	node->level = level;
+	node->slot = slot;
+	fr_dlist_entry_link_before(&tw->slot[level][slot], &node->entry);
+	tw->used[level][slot / 64] |= UINT64_C(1) << (slot % 64);
+}
+
+static inline CC_HINT(nonnull) void slot_remove(fr_timer_wheel_t *tw, fr_timer_wheel_node_t *node)
+{
+	fr_dlist_t *head = &tw->slot[node->level][node->slot];
+
+	fr_dlist_entry_unlink(&node->entry);
+	if (head->next == head) tw->used[node->level][node->slot / 64] &= ~(UINT64_C(1) << (node->slot % 64));
+}
+
+/** Place a node in the lowest level whose range covers its expiry
+ *
+ */
+static inline CC_HINT(nonnull) void timer_wheel_place(fr_timer_wheel_t *tw, fr_timer_wheel_node_t *node)
+{
+	uint64_t	when = node->when;
+	uint64_t	delta;
+	unsigned int	level;
+
+	/*
+	 *	Already due, goes in the current slot.
+	 */
+	if (when <= tw->tick) {
+		slot_add(tw, node, 0, tw->tick & TW_MASK);
+		return;
+	}
+
+	delta = when - tw->tick;
+	if (delta > TW_MAX_DELTA) {
+		delta = TW_MAX_DELTA;
+		when = tw->tick + TW_MAX_DELTA;
+	}
+
+	for (level = 0; (level + 1) < TW_LEVELS; level++) {
+		if (delta < (UINT64_C(1) << (TW_BITS * (level + 1)))) break;
+	}
+
+	slot_add(tw, node, level, (when >> (TW_BITS * level)) & TW_MASK);
+}
+
+/** Move elements down from higher levels after level 0 wraps
+ *
+ * Level n is cascaded when all the levels below it have wrapped.
+ */
+static void timer_wheel_cascade(fr_timer_wheel_t *tw)
+{
+	unsigned int level;
+
+	for (level = 1; level < TW_LEVELS; level++) {
+		unsigned int	idx = (tw->tick >> (TW_BITS * level)) & TW_MASK;
+		fr_dlist_t	*head = &tw->slot[level][idx];
+		fr_dlist_t	pending;
+
+		if (head->next != head) {
+			/*
+			 *	Detach the slot's elements before
+			 *	re-placing them.
+			 */
+			fr_dlist_entry_replace(head, &pending);
+			tw->used[level][idx / 64] &= ~(UINT64_C(1) << (idx % 64));
+
+			while (pending.next != &pending) {
+				fr_timer_wheel_node_t *node = fr_dlist_entry_to_item(offsetof(fr_timer_wheel_node_t, entry),
+										     pending.next);
+
+				fr_dlist_entry_unlink(&node->entry);
+				timer_wheel_place(tw, node);
+			}
+		}
+
+		if (idx != 0) break;
+	}
+}
+
+/** Advance the wheel's current tick towards now
+ *
+ * Stops early if the current level 0 slot holds due elements.
+ * Empty stretches of the wheel are skipped in a single step.
+ */
+static void timer_wheel_advance(fr_timer_wheel_t *tw, uint64_t now)
+{
+	while (tw->tick < now) {
+		fr_dlist_t	*head = &tw->slot[0][tw->tick & TW_MASK];
+		uint64_t	next;
+
+		if (head->next != head) return;
+
+		/*
+		 *	Nothing (including cascades) happens
+		 *	before next, so we can jump straight
+		 *	to it.
+		 */
+		next = fr_timer_wheel_next(tw);
+		if (next > now) {
+			tw->tick = now;
+			return;
+		}
+
+		tw->tick = next;
+		if ((next & TW_MASK) == 0) timer_wheel_cascade(tw);
+	}
+}
+
+/** Allocate a new timer wheel
+ *
+ * @param[in] ctx	to allocate the wheel in.
+ * @param[in] type	of elements, if not NULL elements will be checked
+ *			with talloc_get_type_abort on insertion.
+ * @param[in] offset	of the #fr_timer_wheel_node_t in elements.
+ * @param[in] now	The current tick.  Elements expiring at or before
+ *			this tick are due immediately.
+ * @return
+ *	- A new timer wheel.
+ *	- NULL on error.
+ */
+fr_timer_wheel_t *_fr_timer_wheel_alloc(TALLOC_CTX *ctx, char const *type, size_t offset, uint64_t now)
+{
+	fr_timer_wheel_t	*tw;
+	unsigned int		level, slot;
+
+	tw = talloc_zero(ctx, fr_timer_wheel_t);
+	if (unlikely(!tw)) return NULL;
+
+	tw->tick = now;
+	tw->offset = offset;
+	tw->type = type;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		for (slot = 0; slot < TW_SLOTS; slot++) fr_dlist_entry_init(&tw->slot[level][slot]);
+	}
+
+	return tw;
+}
+
+/** Insert an element into a timer wheel
+ *
+ * @param[in] tw	to insert the element into.
+ * @param[in] data	element to insert.
+ * @param[in] when	Tick the element expires on.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element is already in a wheel.
+ */
+int fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, uint64_t when)
+{
+	fr_timer_wheel_node_t *node = node_addr(tw, data);
+
+#ifndef TALLOC_GET_TYPE_ABORT_NOOP
+	if (tw->type) (void)_talloc_get_type_abort(data, tw->type, __location__);
+#endif
+
+	if (unlikely(fr_timer_wheel_entry_inserted(node))) {
+		fr_strerror_const("Node is already in the timer wheel");
+		return -1;
+	}
+
+	node->when = when;
+	timer_wheel_place(tw, node);
+	tw->num_elements++;
+
+	return 0;
+}
+
+/** Remove an element from a timer wheel
+ *
+ * @param[in] tw	to remove the element from.
+ * @param[in] data	element to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element isn't in a wheel.
+ */
+int fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data)
+{
+	fr_timer_wheel_node_t *node = node_addr(tw, data);
+
+	if (unlikely(!fr_timer_wheel_entry_inserted(node))) {
+		fr_strerror_const("Tried to extract element not in timer wheel");
+		return -1;
+	}
+
+	slot_remove(tw, node);
+	tw->num_elements--;
+
+	return 0;
+}
+
+/** Return an element which is due, without removing it
+ *
+ * Advances the wheel up to now.  Elements which are due are not
+ * returned in any particular order.
+ *
+ * If the wheel is empty, its current tick is set to now, which allows
+ * the caller to switch to a different time base.
+ *
+ * @param[in] tw	to check.
+ * @param[in] now	The current tick.
+ * @return
+ *	- An element expiring at or before now.
+ *	- NULL if no elements are due.
+ */
+void *fr_timer_wheel_peek(fr_timer_wheel_t *tw, uint64_t now)
+{
+	fr_dlist_t		*head;
+	fr_timer_wheel_node_t	*node;
+
+	/*
+	 *	Nothing to cascade, so an empty wheel
+	 *	can be moved to any tick, forwards or
+	 *	backwards.
+	 */
+	if (unlikely(tw->num_elements == 0)) {
+		tw->tick = now;
+		return NULL;
+	}
+
+	timer_wheel_advance(tw, now);
+
+	head = &tw->slot[0][tw->tick & TW_MASK];
+	if (head->next == head) return NULL;
+
+	node = fr_dlist_entry_to_item(offsetof(fr_timer_wheel_node_t, entry), head->next);
+	if (node->when > now) return NULL;
+
+	return entry_to_item(tw, head->next);
+}
+
+/** Remove and return an element which is due
+ *
+ * @param[in] tw	to check.
+ * @param[in] now	The current tick.
+ * @return
+ *	- An element expiring at or before now.
+ *	- NULL if no elements are due.
+ */
+void *fr_timer_wheel_pop(fr_timer_wheel_t *tw, uint64_t now)
+{
+	void *data;
+
+	data = fr_timer_wheel_peek(tw, now);
+	if (!data) return NULL;
+
+	slot_remove(tw, node_addr(tw, data));
+	tw->num_elements--;
+
+	return data;
+}
+
+/** Return the tick by which the wheel must next be checked
+ *
+ * This is the expiry of the earliest element in level 0, or the
+ * next tick at which a non-empty higher level slot is cascaded,
+ * whichever comes first.  It may be earlier than the expiry of
+ * any element, but is never later.
+ *
+ * @param[in] tw	to check.
+ * @return
+ *	- The tick.
+ *	- UINT64_MAX if the wheel is empty.
+ */
+uint64_t fr_timer_wheel_next(fr_timer_wheel_t const *tw)
+{
+	uint64_t	next = UINT64_MAX;
+	unsigned int	level;
+	int		slot;
+
+	if (tw->num_elements == 0) return UINT64_MAX;
+
+	/*
+	 *	Level 0 slots map directly onto ticks.
+	 */
+	slot = slot_find(tw->used[0], tw->tick & TW_MASK);
+	if (slot >= 0) next = tw->tick + (((uint64_t)slot - tw->tick) & TW_MASK);
+
+	/*
+	 *	Slots in higher levels are cascaded when
+	 *	the levels below them next wrap onto them.
+	 */
+	for (level = 1; level < TW_LEVELS; level++) {
+		unsigned int	shift = TW_BITS * level;
+		uint64_t	block = (tw->tick >> shift) + 1;
+		uint64_t	cascade;
+
+		slot = slot_find(tw->used[level], block & TW_MASK);
+		if (slot < 0) continue;
+
+		cascade = (block + (((uint64_t)slot - block) & TW_MASK)) << shift;
+		if (cascade < next) next = cascade;
+	}
+
+	return next;
+}
+
+unsigned int fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw)
+{
+	return tw->num_elements;
+}
+
+/** Iterate over entries in a timer wheel
+ *
+ * @note If the wheel is modified, the iterator should be considered invalidated.
+ *
+ * @param[in] tw	to iterate over.
+ * @param[in] iter	Pointer to an iterator struct, used to maintain
+ *			state between calls.
+ * @return
+ *	- User data.
+ *	- NULL if at the end of the wheel.
+ */
+void *fr_timer_wheel_iter_init(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter)
+{
+	iter->level = 0;
+	iter->slot = 0;
+	iter->entry = &tw->slot[0][0];
+
+	if (unlikely(tw->num_elements == 0)) {
+		iter->level = TW_LEVELS;
+		return NULL;
+	}
+
+	return fr_timer_wheel_iter_next(tw, iter);
+}
+
+/** Get the next entry in a timer wheel
+ *
+ * @note If the wheel is modified, the iterator should be considered invalidated.
+ *
+ * @param[in] tw	to iterate over.
+ * @param[in] iter	Pointer to an iterator struct, used to maintain
+ *			state between calls.
+ * @return
+ *	- User data.
+ *	- NULL if at the end of the wheel.
+ */
+void *fr_timer_wheel_iter_next(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter)
+{
+	if (iter->level >= TW_LEVELS) return NULL;
+
+	for (;;) {
+		if (iter->entry->next != &tw->slot[iter->level][iter->slot]) {
+			iter->entry = iter->entry->next;
+			return entry_to_item(tw, iter->entry);
+		}
+
+		if (++iter->slot == TW_SLOTS) {
+			iter->slot = 0;
+			if (++iter->level == TW_LEVELS) return NULL;
+		}
+		iter->entry = &tw->slot[iter->level][iter->slot];
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Structures and prototypes for hierarchical timer wheels
+ *
+ * @file src/lib/util/timer_wheel.h
+ *
+ * @copyright 2026 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSIDH(timer_wheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdint.h>
+
+typedef struct fr_timer_wheel_s fr_timer_wheel_t;
+
+/** Per-element wheel data
+ *
+ * The type passed to fr_timer_wheel_alloc() and fr_timer_wheel_talloc_alloc() in _type
+ * must be the type of a structure with a member of type fr_timer_wheel_node_t. That
+ * member's name must be passed as the _field argument.  The member must be zeroed before
+ * the element is first inserted.
+ */
+typedef struct {
+	fr_dlist_t	entry;		//!< Entry in a wheel slot.
+	uint64_t	when;		//!< Tick the element expires on.
+	uint8_t		level;		//!< Wheel level the element is in.
+	uint8_t		slot;		//!< Slot within the level.
+} fr_timer_wheel_node_t;
+
+typedef struct {
+	unsigned int	level;		//!< Level we're iterating over.
+	unsigned int	slot;		//!< Slot we're iterating over.
+	fr_dlist_t	*entry;		//!< Current entry.
+} fr_timer_wheel_iter_t;
+
+/** Creates a timer wheel that can be used with non-talloced elements
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _type		Of elements.
+ * @param[in] _field		to store wheel data in.
+ * @param[in] _now		The current tick.
+ * @return
+ *	- A pointer to the new timer wheel.
+ *	- NULL on error
+ */
+#define fr_timer_wheel_alloc(_ctx, _type, _field, _now) \
+	_fr_timer_wheel_alloc(_ctx, NULL, (size_t)offsetof(_type, _field), _now)
+
+/** Creates a timer wheel that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _field		to store wheel data in.
+ * @param[in] _now		The current tick.
+ * @return
+ *	- A pointer to the new timer wheel.
+ *	- NULL on error.
+ */
+#define fr_timer_wheel_talloc_alloc(_ctx, _talloc_type, _field, _now) \
+	_fr_timer_wheel_alloc(_ctx, #_talloc_type, (size_t)offsetof(_talloc_type, _field), _now)
+
+fr_timer_wheel_t	*_fr_timer_wheel_alloc(TALLOC_CTX *ctx, char const *type, size_t offset, uint64_t now);
+
+/** Check if an element is inserted into a timer wheel
+ *
+ * @param[in] node	The fr_timer_wheel_node_t *as stored in an element*.
+ */
+static inline CC_HINT(nonnull) bool fr_timer_wheel_entry_inserted(fr_timer_wheel_node_t const *node)
+{
+	return fr_dlist_entry_in_list(&node->entry);
+}
+
+int		fr_timer_wheel_insert(fr_timer_wheel_t *tw, void *data, uint64_t when) CC_HINT(nonnull);
+
+int		fr_timer_wheel_extract(fr_timer_wheel_t *tw, void *data) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_peek(fr_timer_wheel_t *tw, uint64_t now) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_pop(fr_timer_wheel_t *tw, uint64_t now) CC_HINT(nonnull);
+
+uint64_t	fr_timer_wheel_next(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+unsigned int	fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_iter_init(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter) CC_HINT(nonnull);
+
+void		*fr_timer_wheel_iter_next(fr_timer_wheel_t *tw, fr_timer_wheel_iter_t *iter) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,245 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/timer_wheel.h>
+
+typedef struct {
+	uint64_t		when;
+	fr_timer_wheel_node_t	node;
+	bool			visited;	/* Only used by iterator test */
+} tw_thing;
+
+#define NVALUES	20
+
+static void timer_wheel_test_basic(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing		values[NVALUES], *t;
+	uint64_t		now = 1000;
+	unsigned int		i;
+
+	tw = fr_timer_wheel_alloc(NULL, tw_thing, node, now);
+	TEST_CHECK(tw != NULL);
+
+	memset(values, 0, sizeof(values));
+
+	/*
+	 *	One value in each of the first few levels, and
+	 *	a couple which are already due.
+	 */
+	for (i = 0; i < NVALUES; i++) {
+		values[i].when = now + ((uint64_t)1 << i) - 2;
+		TEST_CHECK(fr_timer_wheel_insert(tw, &values[i], values[i].when) == 0);
+	}
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == NVALUES);
+
+	TEST_CASE("double insert");
+	TEST_CHECK(fr_timer_wheel_insert(tw, &values[0], 0) < 0);
+
+	TEST_CASE("due");
+	TEST_CHECK((t = fr_timer_wheel_pop(tw, now)) != NULL);
+	TEST_CHECK(t && (t->when <= now));
+	TEST_CHECK((t = fr_timer_wheel_pop(tw, now)) != NULL);
+	TEST_CHECK(t && (t->when <= now));
+	TEST_CHECK(fr_timer_wheel_pop(tw, now) == NULL);
+
+	TEST_CASE("in order");
+	for (i = 2; i < NVALUES; i++) {
+		uint64_t next = fr_timer_wheel_next(tw);
+
+		TEST_CHECK(next <= values[i].when);
+		TEST_MSG("next %"PRIu64" is after the earliest expiry %"PRIu64, next, values[i].when);
+
+		TEST_CHECK(fr_timer_wheel_pop(tw, values[i].when - 1) == NULL);
+		TEST_MSG("element popped early");
+
+		TEST_CHECK(fr_timer_wheel_pop(tw, values[i].when) == &values[i]);
+		TEST_MSG("expected element %u", i);
+	}
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+	TEST_CHECK(fr_timer_wheel_next(tw) == UINT64_MAX);
+
+	talloc_free(tw);
+}
+
+static void timer_wheel_test_extract(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing		values[NVALUES];
+	uint64_t		now = 0;
+	unsigned int		i;
+
+	tw = fr_timer_wheel_alloc(NULL, tw_thing, node, now);
+	TEST_CHECK(tw != NULL);
+
+	memset(values, 0, sizeof(values));
+
+	for (i = 0; i < NVALUES; i++) {
+		values[i].when = (i + 1) * 100;
+		TEST_CHECK(fr_timer_wheel_insert(tw, &values[i], values[i].when) == 0);
+	}
+
+	/*
+	 *	Extract the odd numbered elements
+	 */
+	for (i = 1; i < NVALUES; i += 2) {
+		TEST_CHECK(fr_timer_wheel_extract(tw, &values[i]) == 0);
+		TEST_CHECK(!fr_timer_wheel_entry_inserted(&values[i].node));
+	}
+	TEST_CHECK(fr_timer_wheel_extract(tw, &values[1]) < 0);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == NVALUES / 2);
+
+	for (i = 0; i < NVALUES; i += 2) {
+		TEST_CHECK(fr_timer_wheel_pop(tw, UINT32_MAX) == &values[i]);
+		TEST_MSG("expected element %u", i);
+	}
+	TEST_CHECK(fr_timer_wheel_pop(tw, UINT32_MAX) == NULL);
+
+	talloc_free(tw);
+}
+
+#define TW_CYCLE_SIZE	(2000)
+
+/** Insert, extract and expire elements at random, checking against a brute force search
+ *
+ */
+static void timer_wheel_cycle(void)
+{
+	fr_timer_wheel_t	*tw;
+	tw_thing		*values;
+	uint64_t		now;
+	unsigned int		i, j, inserted = 0, fired = 0;
+	fr_fast_rand_t		rand_ctx;
+
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *	Start close to where the top level wraps
+	 */
+	now = ((uint64_t)1 << 32) - 500;
+
+	tw = fr_timer_wheel_alloc(NULL, tw_thing, node, now);
+	TEST_CHECK(tw != NULL);
+
+	values = talloc_zero_array(NULL, tw_thing, TW_CYCLE_SIZE);
+
+	for (i = 0; i < TW_CYCLE_SIZE * 50; i++) {
+		tw_thing	*t = &values[fr_fast_rand(&rand_ctx) % TW_CYCLE_SIZE];
+		uint64_t	next, earliest = UINT64_MAX;
+
+		switch (fr_fast_rand(&rand_ctx) % 3) {
+		case 0:
+			if (fr_timer_wheel_entry_inserted(&t->node)) break;
+
+			switch (fr_fast_rand(&rand_ctx) % 4) {
+			case 0:
+				t->when = now + (fr_fast_rand(&rand_ctx) % 256);
+				break;
+
+			case 1:
+				t->when = now + (fr_fast_rand(&rand_ctx) % 65536);
+				break;
+
+			case 2:
+				t->when = now + fr_fast_rand(&rand_ctx);
+				break;
+
+			default:
+				t->when = now + ((uint64_t)fr_fast_rand(&rand_ctx) << 8);
+				break;
+			}
+			TEST_CHECK(fr_timer_wheel_insert(tw, t, t->when) == 0);
+			inserted++;
+			break;
+
+		case 1:
+			if (!fr_timer_wheel_entry_inserted(&t->node)) break;
+			TEST_CHECK(fr_timer_wheel_extract(tw, t) == 0);
+			inserted--;
+			break;
+
+		default:
+			for (j = 0; j < TW_CYCLE_SIZE; j++) {
+				if (fr_timer_wheel_entry_inserted(&values[j].node) &&
+				    (values[j].when < earliest)) earliest = values[j].when;
+			}
+
+			next = fr_timer_wheel_next(tw);
+			TEST_CHECK(next <= earliest);
+			TEST_MSG("next %"PRIu64" is after the earliest expiry %"PRIu64, next, earliest);
+
+			/*
+			 *	Either jump to the next expiry, or a
+			 *	short way forward.
+			 */
+			if ((earliest != UINT64_MAX) && (fr_fast_rand(&rand_ctx) % 2)) {
+				now = earliest;
+			} else {
+				now += fr_fast_rand(&rand_ctx) % 1000;
+			}
+
+			while ((t = fr_timer_wheel_pop(tw, now))) {
+				TEST_CHECK(t->when <= now);
+				TEST_MSG("element expiring at %"PRIu64" popped at %"PRIu64, t->when, now);
+				inserted--;
+				fired++;
+			}
+
+			for (j = 0; j < TW_CYCLE_SIZE; j++) {
+				if (!fr_timer_wheel_entry_inserted(&values[j].node)) continue;
+
+				TEST_CHECK(values[j].when > now);
+				TEST_MSG("element expiring at %"PRIu64" not popped at %"PRIu64, values[j].when, now);
+			}
+			break;
+		}
+
+		TEST_CHECK(fr_timer_wheel_num_elements(tw) == inserted);
+	}
+
+	TEST_MSG_ALWAYS("\nfired: %u, remaining %u\n", fired, inserted);
+
+	talloc_free(tw);
+	talloc_free(values);
+}
+
+static void timer_wheel_iter(void)
+{
+	fr_timer_wheel_t	*tw;
+	fr_timer_wheel_iter_t	iter;
+	tw_thing		values[NVALUES], *data;
+	unsigned int		i;
+
+	tw = fr_timer_wheel_alloc(NULL, tw_thing, node, 0);
+	TEST_CHECK(tw != NULL);
+
+	memset(values, 0, sizeof(values));
+
+	TEST_CHECK(fr_timer_wheel_iter_init(tw, &iter) == NULL);
+
+	for (i = 0; i < NVALUES; i++) fr_timer_wheel_insert(tw, &values[i], (uint64_t)1 << (i * 2));
+
+	for (i = 0, data = fr_timer_wheel_iter_init(tw, &iter);
+	     data;
+	     i++, data = fr_timer_wheel_iter_next(tw, &iter)) {
+		TEST_CHECK(!data->visited);
+		data->visited = true;
+	}
+	TEST_CHECK(i == NVALUES);
+
+	for (i = 0; i < NVALUES; i++) TEST_CHECK(values[i].visited);
+
+	talloc_free(tw);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "timer_wheel_test_basic",	timer_wheel_test_basic		},
+	{ "timer_wheel_test_extract",	timer_wheel_test_extract	},
+	{ "timer_wheel_cycle",		timer_wheel_cycle		},
+	{ "timer_wheel_iter",		timer_wheel_iter		},
+	{ NULL }
+};
@@ -213,3 +213,496 @@ done:
 
 	return slen;
 }
+
+/** Size of the control message buffer for each datagram in a batch
+ *
+ */
+#define UDP_RECV_BATCH_CBUF_SIZE	(256)
+
+/** A set of datagrams read from a socket with a single call to recvmmsg()
+ *
+ */
+struct fr_udp_recv_batch_s {
+	unsigned int		num;			//!< Number of slots in the batch.
+	unsigned int		used;			//!< Number of slots filled by the last read.
+	unsigned int		next;			//!< Next slot to return to the caller.
+	size_t			max_packet_size;	//!< Size of each slot.
+
+	int			sockfd;			//!< Socket "local" was retrieved from.
+	struct sockaddr_storage	local;			//!< Address the socket is bound to.
+	socklen_t		local_len;		//!< Length of the local address.
+
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr		*msgvec;		//!< One header per slot.
+	struct iovec		*iov;			//!< One iovec per slot.
+	struct sockaddr_storage	*src;			//!< Source address of each datagram.
+	uint8_t			*cbuf;			//!< Control messages for each datagram.
+	uint8_t			*data;			//!< Packet data for each datagram.
+#endif
+};
+
+/** Allocate a structure for reading multiple datagrams with one system call
+ *
+ * On systems without recvmmsg(), the batch is a placeholder, and
+ * #udp_recv_batch will read one packet at a time with #udp_recv.
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of datagrams to read at once.
+ *				If 0, #UDP_RECV_BATCH_SIZE is used.
+ * @param[in] max_packet_size	the largest datagram we accept.  Larger
+ *				datagrams are discarded.
+ * @return
+ *	- A new batch on success.
+ *	- NULL on failure.
+ */
+fr_udp_recv_batch_t *udp_recv_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	fr_udp_recv_batch_t	*batch;
+
+	if (!num) num = UDP_RECV_BATCH_SIZE;
+
+	batch = talloc_zero(ctx, fr_udp_recv_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+	batch->sockfd = -1;
+
+#ifdef HAVE_RECVMMSG
+	{
+		unsigned int i;
+
+		batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+		batch->iov = talloc_zero_array(batch, struct iovec, num);
+		batch->src = talloc_zero_array(batch, struct sockaddr_storage, num);
+		batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_RECV_BATCH_CBUF_SIZE);
+		batch->data = talloc_array(batch, uint8_t, num * max_packet_size);
+		if (!batch->msgvec || !batch->iov || !batch->src || !batch->cbuf || !batch->data) {
+			talloc_free(batch);
+			goto oom;
+		}
+
+		for (i = 0; i < num; i++) {
+			batch->iov[i].iov_base = batch->data + (i * max_packet_size);
+			batch->iov[i].iov_len = max_packet_size;
+
+			batch->msgvec[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msgvec[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+#endif
+
+	return batch;
+}
+
+#ifdef HAVE_RECVMMSG
+/** Read as many datagrams as are available, up to the size of the batch
+ *
+ * @param[in] batch	to fill.
+ * @param[in] sockfd	to read from.
+ * @return
+ *	- >= 0 the number of datagrams read.
+ *	- < 0 on error, with errno set.
+ */
+static int udp_recv_batch_fill(fr_udp_recv_batch_t *batch, int sockfd)
+{
+	unsigned int	i;
+	int		ret;
+
+	/*
+	 *	recvmsg doesn't provide the local port, so we have to
+	 *	retrieve it using getsockname().  The socket doesn't
+	 *	change, so we only do this once.
+	 */
+	if (batch->sockfd != sockfd) {
+#ifdef __clang_analyzer__
+		memset(&batch->local, 0, sizeof(batch->local));
+#endif
+		batch->local_len = sizeof(batch->local);
+		if (getsockname(sockfd, (struct sockaddr *)&batch->local, &batch->local_len) < 0) return -1;
+
+		batch->sockfd = sockfd;
+	}
+
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *msgh = &batch->msgvec[i].msg_hdr;
+
+		msgh->msg_name = &batch->src[i];
+		msgh->msg_namelen = sizeof(batch->src[i]);
+		msgh->msg_control = batch->cbuf + (i * UDP_RECV_BATCH_CBUF_SIZE);
+		msgh->msg_controllen = UDP_RECV_BATCH_CBUF_SIZE;
+		msgh->msg_flags = 0;
+
+		batch->msgvec[i].msg_len = 0;
+	}
+
+	batch->used = batch->next = 0;
+
+	ret = recvmmsg(sockfd, batch->msgvec, batch->num, MSG_DONTWAIT, NULL);
+	if (ret < 0) return ret;
+
+	batch->used = ret;
+
+	return ret;
+}
+#endif
+
+/** Read a UDP packet, using a batch of datagrams previously read from the socket
+ *
+ * When the batch is empty, it is refilled with a single call to
+ * recvmmsg().  Subsequent calls return the remaining datagrams
+ * without making any system calls.
+ *
+ * Connected sockets, peeks, and systems without recvmmsg() fall back
+ * to #udp_recv.
+ *
+ * @param[in] batch		of datagrams.  May be NULL.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if there is no data to read.
+ *	- < 0 on failure.
+ */
+ssize_t udp_recv_batch(fr_udp_recv_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr		*mmsg;
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst;
+	size_t			len;
+
+	if (!batch || ((flags & (UDP_FLAGS_CONNECTED | UDP_FLAGS_PEEK)) != 0)) {
+		return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+	}
+
+	*socket_out = (fr_socket_t){
+		.fd = sockfd,
+		.proto = IPPROTO_UDP
+	};
+
+	/*
+	 *	Datagrams larger than a slot are truncated by the
+	 *	kernel.  They're too large for us, so just skip them.
+	 */
+	do {
+		if (batch->next == batch->used) {
+			if (udp_recv_batch_fill(batch, sockfd) < 0) {
+				if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+				fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+				return -1;
+			}
+
+			if (batch->used == 0) return 0;
+		}
+
+		mmsg = &batch->msgvec[batch->next++];
+	} while ((mmsg->msg_hdr.msg_flags & MSG_TRUNC) != 0);
+
+	len = mmsg->msg_len;
+	if (len > data_len) len = data_len;
+	memcpy(data, mmsg->msg_hdr.msg_iov->iov_base, len);
+
+	/*
+	 *	The destination address starts off as the address the
+	 *	socket is bound to, and is then updated from IP_PKTINFO.
+	 */
+	memcpy(&dst, &batch->local, batch->local_len);
+	sizeof_dst = batch->local_len;
+
+	udpfromto_cmsg_parse(&mmsg->msg_hdr, &socket_out->inet.ifindex,
+			     (struct sockaddr *)&dst, &sizeof_dst, when);
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    mmsg->msg_hdr.msg_name, mmsg->msg_hdr.msg_namelen) < 0) {
+		fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port, &dst, sizeof_dst) < 0) {
+		fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+		return -1;
+	}
+
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
+
+	return len;
+#else
+	return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+#endif
+}
+
+/** Return the number of datagrams which can be read without a system call
+ *
+ * @param[in] batch	to check.  May be NULL.
+ * @return the number of datagrams remaining in the batch.
+ */
+unsigned int udp_recv_batch_pending(fr_udp_recv_batch_t const *batch)
+{
+	if (!batch) return 0;
+
+	return batch->used - batch->next;
+}
+
+/** A set of datagrams queued for transmission with a single call to sendmmsg()
+ *
+ */
+struct fr_udp_send_batch_s {
+	unsigned int		num;			//!< Number of slots in the batch.
+	unsigned int		used;			//!< Number of slots holding a queued datagram.
+	size_t			max_packet_size;	//!< Size of each slot.
+
+	int			sockfd;			//!< Socket the queued datagrams will be written to.
+
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr		*msgvec;		//!< One header per slot.
+	struct iovec		*iov;			//!< One iovec per slot.
+	struct sockaddr_storage	*dst;			//!< Destination address of each datagram.
+	uint8_t			*cbuf;			//!< Control messages for each datagram.
+	uint8_t			*data;			//!< Packet data for each datagram.
+#endif
+};
+
+/** Allocate a structure for writing multiple datagrams with one system call
+ *
+ * On systems without sendmmsg(), the batch is a placeholder, and
+ * #udp_send_batch will write each packet immediately with #udp_send.
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of datagrams to queue.
+ *				If 0, #UDP_SEND_BATCH_SIZE is used.
+ * @param[in] max_packet_size	the largest datagram which can be queued.
+ *				Larger datagrams are written immediately.
+ * @return
+ *	- A new batch on success.
+ *	- NULL on failure.
+ */
+fr_udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	fr_udp_send_batch_t	*batch;
+
+	if (!num) num = UDP_SEND_BATCH_SIZE;
+
+	batch = talloc_zero(ctx, fr_udp_send_batch_t);
+	if (!batch) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+	batch->sockfd = -1;
+
+#ifdef HAVE_SENDMMSG
+	{
+		unsigned int i;
+
+		batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+		batch->iov = talloc_zero_array(batch, struct iovec, num);
+		batch->dst = talloc_zero_array(batch, struct sockaddr_storage, num);
+		batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_RECV_BATCH_CBUF_SIZE);
+		batch->data = talloc_array(batch, uint8_t, num * max_packet_size);
+		if (!batch->msgvec || !batch->iov || !batch->dst || !batch->cbuf || !batch->data) {
+			talloc_free(batch);
+			goto oom;
+		}
+
+		for (i = 0; i < num; i++) {
+			batch->iov[i].iov_base = batch->data + (i * max_packet_size);
+
+			batch->msgvec[i].msg_hdr.msg_iov = &batch->iov[i];
+			batch->msgvec[i].msg_hdr.msg_iovlen = 1;
+			batch->msgvec[i].msg_hdr.msg_name = &batch->dst[i];
+		}
+	}
+#endif
+
+	return batch;
+}
+
+#ifdef HAVE_SENDMMSG
+/** Move a queued datagram to an earlier slot
+ *
+ * Each header always refers to the buffers of its own slot, so the
+ * contents of the buffers are copied, and not the pointers.
+ */
+static void udp_send_batch_move(fr_udp_send_batch_t *batch, unsigned int to, unsigned int from)
+{
+	struct msghdr	*dst = &batch->msgvec[to].msg_hdr;
+	struct msghdr	*src = &batch->msgvec[from].msg_hdr;
+
+	memcpy(&batch->dst[to], &batch->dst[from], src->msg_namelen);
+	dst->msg_namelen = src->msg_namelen;
+
+	if (src->msg_control) {
+		dst->msg_control = batch->cbuf + (to * UDP_RECV_BATCH_CBUF_SIZE);
+		memcpy(dst->msg_control, src->msg_control, src->msg_controllen);
+	} else {
+		dst->msg_control = NULL;
+	}
+	dst->msg_controllen = src->msg_controllen;
+
+	memcpy(dst->msg_iov->iov_base, src->msg_iov->iov_base, src->msg_iov->iov_len);
+	dst->msg_iov->iov_len = src->msg_iov->iov_len;
+}
+#endif
+
+/** Write all queued datagrams with as few calls to sendmmsg() as possible
+ *
+ * Datagrams which the kernel refuses for reasons other than a full
+ * socket buffer are discarded, as they would be if they had been
+ * written individually.
+ *
+ * @param[in] batch	to flush.  May be NULL.
+ * @return
+ *	- >= 0 the number of datagrams written.
+ *	- < 0 if the socket would block, with errno set.  Any datagrams which
+ *	  weren't written remain queued.
+ */
+int udp_send_batch_flush(fr_udp_send_batch_t *batch)
+{
+#ifdef HAVE_SENDMMSG
+	unsigned int	sent = 0;
+	int		ret;
+
+	if (!batch) return 0;
+
+	while (sent < batch->used) {
+		ret = sendmmsg(batch->sockfd, batch->msgvec + sent, batch->used - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) {
+				int err = errno;
+
+				/*
+				 *	Shuffle the unsent datagrams to the
+				 *	front of the batch, so that they're
+				 *	sent next time.
+				 */
+				if (sent > 0) {
+					unsigned int i;
+
+					for (i = sent; i < batch->used; i++) udp_send_batch_move(batch, i - sent, i);
+					batch->used -= sent;
+				}
+
+				fr_strerror_printf("udp_send_batch_flush failed: %s", fr_syserror(err));
+				errno = err;
+				return -1;
+			}
+
+			/*
+			 *	The first datagram is bad.  Drop it, and
+			 *	carry on with the rest.
+			 */
+			fr_strerror_printf("udp_send_batch_flush discarded packet: %s", fr_syserror(errno));
+			sent++;
+			continue;
+		}
+
+		sent += ret;
+	}
+
+	batch->used = 0;
+
+	return sent;
+#else
+	return 0;
+#endif
+}
+
+/** Queue a UDP packet for transmission with #udp_send_batch_flush
+ *
+ * Connected sockets, oversized packets, and systems without sendmmsg()
+ * fall back to #udp_send.  If the batch is full, the queued datagrams
+ * are flushed before the new one is added.
+ *
+ * @param[in] batch		of datagrams.  May be NULL.
+ * @param[in] socket		we're writing to.
+ * @param[in] flags		to pass to send(), or sendto()
+ * @param[in] data		to data to send
+ * @param[in] data_len		length of data to send
+ * @return
+ *	- >= 0 on success.
+ *	- -1 on failure.
+ */
+int udp_send_batch(fr_udp_send_batch_t *batch, fr_socket_t const *socket, int flags, void *data, size_t data_len)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr		*mmsg;
+	struct sockaddr_storage	src;
+	socklen_t		sizeof_src;
+	socklen_t		sizeof_dst;
+	unsigned int		slot;
+
+	if (!batch || ((flags & UDP_FLAGS_CONNECTED) != 0) || (data_len > batch->max_packet_size)) {
+		return udp_send(socket, flags, data, data_len);
+	}
+
+	if (unlikely(socket->proto != IPPROTO_UDP)) {
+		fr_strerror_printf("Invalid proto type %u", socket->proto);
+		return -1;
+	}
+
+	/*
+	 *	Everything in one batch goes to the same socket.
+	 */
+	if ((batch->used == batch->num) || (batch->used && (batch->sockfd != socket->fd))) {
+		if (udp_send_batch_flush(batch) < 0) return udp_send(socket, flags, data, data_len);
+	}
+
+	batch->sockfd = socket->fd;
+	slot = batch->used;
+	mmsg = &batch->msgvec[slot];
+
+	if (fr_ipaddr_to_sockaddr(&batch->dst[slot], &sizeof_dst,
+				  &socket->inet.dst_ipaddr, socket->inet.dst_port) < 0) return -1;
+	if (fr_ipaddr_to_sockaddr(&src, &sizeof_src,
+				  &socket->inet.src_ipaddr, socket->inet.src_port) < 0) return -1;
+
+	mmsg->msg_hdr.msg_name = &batch->dst[slot];
+	mmsg->msg_hdr.msg_namelen = sizeof_dst;
+	mmsg->msg_hdr.msg_flags = 0;
+	mmsg->msg_len = 0;
+
+	if (udpfromto_cmsg_build(socket->fd, &mmsg->msg_hdr,
+				 batch->cbuf + (slot * UDP_RECV_BATCH_CBUF_SIZE), UDP_RECV_BATCH_CBUF_SIZE,
+				 socket->inet.ifindex, (struct sockaddr *)&src, sizeof_src) < 0) {
+		fr_strerror_printf("udp_send_batch failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	memcpy(mmsg->msg_hdr.msg_iov->iov_base, data, data_len);
+	mmsg->msg_hdr.msg_iov->iov_len = data_len;
+
+	batch->used++;
+
+	return data_len;
+#else
+	return udp_send(socket, flags, data, data_len);
+#endif
+}
+
+/** Return the number of datagrams waiting to be flushed
+ *
+ * @param[in] batch	to check.  May be NULL.
+ * @return the number of datagrams queued in the batch.
+ */
+unsigned int udp_send_batch_pending(fr_udp_send_batch_t const *batch)
+{
+	if (!batch) return 0;
+
+	return batch->used;
+}
@@ -31,6 +31,7 @@ extern "C" {
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/inet.h>
 #include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/udpfromto.h>
 
@@ -38,6 +39,19 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** Default number of datagrams read by a single call to recvmmsg()
+ *
+ */
+#define UDP_RECV_BATCH_SIZE	(16)
+
+/** Default number of datagrams written by a single call to sendmmsg()
+ *
+ */
+#define UDP_SEND_BATCH_SIZE	(16)
+
+typedef struct fr_udp_recv_batch_s fr_udp_recv_batch_t;
+typedef struct fr_udp_send_batch_s fr_udp_send_batch_t;
+
 int udp_send(fr_socket_t const *socket, int flags, void *data, size_t data_len);
 
 int udp_recv_discard(int sockfd);
@@ -47,6 +61,21 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+fr_udp_recv_batch_t *udp_recv_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size);
+
+ssize_t udp_recv_batch(fr_udp_recv_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
+
+unsigned int udp_recv_batch_pending(fr_udp_recv_batch_t const *batch);
+
+fr_udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size);
+
+int udp_send_batch(fr_udp_send_batch_t *batch, fr_socket_t const *socket, int flags, void *data, size_t data_len);
+
+int udp_send_batch_flush(fr_udp_send_batch_t *batch);
+
+unsigned int udp_send_batch_pending(fr_udp_send_batch_t const *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -156,6 +156,80 @@ int udpfromto_init(int s)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Process the control messages returned by recvmsg() or recvmmsg()
+ *
+ * Updates the destination address and interface from IP_PKTINFO,
+ * IP_RECVDSTADDR, or IPV6_PKTINFO, and the receive time from SO_TIMESTAMP.
+ *
+ * @param[in] msgh	as filled in by recvmsg().
+ * @param[out] ifindex	The interface which received the datagram (may be NULL).
+ * @param[in,out] to	The destination address.  Must already be initialised
+ *			with the address the socket is bound to.
+ * @param[out] to_len	Length of the destination address.
+ * @param[out] when	the packet was received (may be NULL).
+ */
+void udpfromto_cmsg_parse(struct msghdr *msgh, int *ifindex,
+			  struct sockaddr *to, socklen_t *to_len, fr_time_t *when)
+{
+	struct cmsghdr		*cmsg;
+
+	if (ifindex) *ifindex = 0;
+	if (when) *when = fr_time_wrap(0);
+
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (ifindex) *ifindex = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+			break;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (ifindex) *ifindex = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		}
+#endif
+	}
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -190,7 +264,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       fr_time_t *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -293,93 +366,39 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 
 	if (from_len) *from_len = msgh.msg_namelen;
 
-	if (ifindex) *ifindex = 0;
-	if (when) *when = fr_time_wrap(0);
-
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
-
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
-
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
-
-			if (ifindex) *ifindex = i->ipi_ifindex;
-
-			break;
-		}
-#endif
-
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
-
-			((struct sockaddr_in *)to)->sin_addr = *i;
-
-			*to_len = sizeof(struct sockaddr_in);
-
-			break;
-		}
-#endif
-
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
-
-			if (ifindex) *ifindex = i->ipi6_ifindex;
-
-			break;
-		}
-#endif
-
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
-		}
-#endif
-	}
+	udpfromto_cmsg_parse(&msgh, ifindex, to, to_len, when);
 
 	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
 
 	return ret;
 }
 
-/** Send packet via a file descriptor, setting the src address and outbound interface
+/** Fill in the control message which sets the source address of an outbound datagram
  *
- * Abstracts away the complexity of using the complexity of using sendmsg().
+ * Abstracts away the platform differences between IP_PKTINFO,
+ * IP_SENDSRCADDR, and IPV6_PKTINFO.
  *
- * @param[in] fd	The file descriptor to write to.
- * @param[in] buf	Where to read datagram data from.
- * @param[in] len	of datagram data.
- * @param[in] flags	passed unmolested to sendmsg.
+ * If the source address cannot be set on this platform (or for this
+ * socket), msg_control is set to NULL, and the datagram should be
+ * sent as if with sendto().
+ *
+ * @param[in] fd	The file descriptor the datagram will be written to.
+ * @param[in,out] msgh	The message header to update.
+ * @param[in] cbuf	Buffer for the control message.  Must be at least 256 bytes.
+ * @param[in] cbuf_len	Length of cbuf.
  * @param[in] ifindex	The interface on which to send the datagram.
  *			If automatic interface selection is desired, value should be 0.
  * @param[in] from	The source address.
  * @param[in] from_len	Length of the structure pointed to by from.
- * @param[in] to	The destination address.
- * @param[in] to_len	Length of the structure pointed to by to.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-int sendfromto(int fd, void *buf, size_t len, int flags,
-	       int ifindex,
-	       struct sockaddr *from, socklen_t from_len,
-	       struct sockaddr *to, socklen_t to_len)
+int udpfromto_cmsg_build(int fd, struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+			 int ifindex, struct sockaddr *from, socklen_t from_len)
 {
-	struct msghdr	msgh;
-	struct iovec	iov;
-	char		cbuf[256];
+	msgh->msg_control = NULL;
+	msgh->msg_controllen = 0;
 
 	/*
 	 *	Unknown address family, die.
@@ -416,6 +435,8 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		}
 		break;
 	}
+#else
+	(void) fd;
 #endif	/* !__FreeBSD__ */
 
 	/*
@@ -433,21 +454,16 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 #  endif
 
 	/*
-	 *	No "from", just use regular sendto.
+	 *	No "from", the caller should just use regular sendto.
 	 */
-	if (!from || (from_len == 0)) return sendto(fd, buf, len, flags, to, to_len);
+	if (!from || (from_len == 0)) return 0;
 
-	/* Set up control buffer iov and msgh structures. */
-	memset(&cbuf, 0, sizeof(cbuf));
-	memset(&msgh, 0, sizeof(msgh));
-	memset(&iov, 0, sizeof(iov));
-	iov.iov_base = buf;
-	iov.iov_len = len;
+	if (cbuf_len < 256) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	msgh.msg_iov = &iov;
-	msgh.msg_iovlen = 1;
-	msgh.msg_name = to;
-	msgh.msg_namelen = to_len;
+	memset(cbuf, 0, cbuf_len);
 
 # if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
 	if (from->sa_family == AF_INET) {
@@ -457,10 +473,10 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in_pktinfo *pkt;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = SOL_IP;
 		cmsg->cmsg_type = IP_PKTINFO;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
@@ -474,10 +490,10 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in_addr *in;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = IPPROTO_IP;
 		cmsg->cmsg_type = IP_SENDSRCADDR;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
@@ -495,10 +511,10 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 		struct cmsghdr *cmsg;
 		struct in6_pktinfo *pkt;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
+		cmsg = CMSG_FIRSTHDR(msgh);
 		cmsg->cmsg_level = IPPROTO_IPV6;
 		cmsg->cmsg_type = IPV6_PKTINFO;
 		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
@@ -510,6 +526,54 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	}
 #  endif	/* IPV6_PKTINFO */
 
+	return 0;
+}
+
+/** Send packet via a file descriptor, setting the src address and outbound interface
+ *
+ * Abstracts away the complexity of using the complexity of using sendmsg().
+ *
+ * @param[in] fd	The file descriptor to write to.
+ * @param[in] buf	Where to read datagram data from.
+ * @param[in] len	of datagram data.
+ * @param[in] flags	passed unmolested to sendmsg.
+ * @param[in] ifindex	The interface on which to send the datagram.
+ *			If automatic interface selection is desired, value should be 0.
+ * @param[in] from	The source address.
+ * @param[in] from_len	Length of the structure pointed to by from.
+ * @param[in] to	The destination address.
+ * @param[in] to_len	Length of the structure pointed to by to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int sendfromto(int fd, void *buf, size_t len, int flags,
+	       int ifindex,
+	       struct sockaddr *from, socklen_t from_len,
+	       struct sockaddr *to, socklen_t to_len)
+{
+	struct msghdr	msgh;
+	struct iovec	iov;
+	char		cbuf[256];
+
+	/* Set up iov and msgh structures. */
+	memset(&msgh, 0, sizeof(msgh));
+	memset(&iov, 0, sizeof(iov));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	msgh.msg_iov = &iov;
+	msgh.msg_iovlen = 1;
+	msgh.msg_name = to;
+	msgh.msg_namelen = to_len;
+
+	if (udpfromto_cmsg_build(fd, &msgh, cbuf, sizeof(cbuf), ifindex, from, from_len) < 0) return -1;
+
+	/*
+	 *	No control message, just use regular sendto.
+	 */
+	if (!msgh.msg_control) return sendto(fd, buf, len, flags, to, to_len);
+
 	return sendmsg(fd, &msgh, flags);
 }
 
@@ -34,17 +34,24 @@ extern "C" {
 #include <freeradius-devel/util/time.h>
 
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include <stddef.h>
 #include <stdlib.h>
 
 int	udpfromto_init(int s);
 
+void	udpfromto_cmsg_parse(struct msghdr *msgh, int *ifindex,
+			     struct sockaddr *to, socklen_t *to_len, fr_time_t *when);
+
 int	recvfromto(int s, void *buf, size_t len, int flags,
 		   int *ifindex,
 	       	   struct sockaddr *from, socklen_t *fromlen,
 		   struct sockaddr *to, socklen_t *tolen,
 		   fr_time_t *when);
 
+int	udpfromto_cmsg_build(int fd, struct msghdr *msgh, void *cbuf, size_t cbuf_len,
+			     int ifindex, struct sockaddr *from, socklen_t from_len);
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
@@ -41,6 +41,8 @@ typedef struct {
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
+	fr_udp_recv_batch_t		*recv_batch;		//!< packets read by recvmmsg(), but not yet processed.
+	fr_udp_send_batch_t		*send_batch;		//!< replies waiting to be written by sendmmsg().
 
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv4_udp_thread_t;
@@ -153,7 +155,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	data_size = udp_recv_batch(thread->recv_batch, thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -463,7 +465,7 @@ send_reply:
 	/*
 	 *	proto_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_send_batch(thread->send_batch, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -474,6 +476,22 @@ send_reply:
 }
 
 
+static size_t mod_pending(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	return udp_recv_batch_pending(thread->recv_batch);
+}
+
+static int mod_flush(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	if (udp_send_batch_flush(thread->send_batch) < 0) return -1;
+
+	return 0;
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -546,6 +564,32 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Connected sockets read and write one packet at a time.
+	 */
+	if (!thread->connection) {
+		thread->recv_batch = udp_recv_batch_alloc(thread, UDP_RECV_BATCH_SIZE, inst->max_packet_size);
+		if (!thread->recv_batch) {
+			PERROR("Failed allocating receive batch");
+			return -1;
+		}
+
+		thread->send_batch = udp_send_batch_alloc(thread, UDP_SEND_BATCH_SIZE, inst->max_packet_size);
+		if (!thread->send_batch) {
+			PERROR("Failed allocating send batch");
+			return -1;
+		}
+
+		/*
+		 *	The first socket of a sharded listener steers
+		 *	all packets from one client to the same socket.
+		 */
+		if ((li->num_shards > 1) && (li->shard == 0) &&
+		    (fr_socket_reuseport_hash(sockfd, li->num_shards) < 0)) {
+			PWARN("Failed distributing clients across sockets");
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -813,7 +857,9 @@ fr_app_io_t proto_dhcpv4_udp = {
 
 	.open			= mod_open,
 	.read			= mod_read,
+	.pending		= mod_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
@@ -207,7 +207,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	client = address->radclient;
 
 	if (fr_radius_verify(data, NULL, (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
-			     client->message_authenticator) < 0) {
+			     client->message_authenticator, client->secret_md5) < 0) {
 		RPEDEBUG("Failed verifying packet signature.");
 		return -1;
 	}
@@ -230,7 +230,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	 */
 	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
 			     request->packet->data, request->packet->data_len, NULL,
-			     client->secret, talloc_array_length(client->secret) - 1) < 0) {
+			     client->secret, talloc_array_length(client->secret) - 1, client->secret_md5) < 0) {
 		RPEDEBUG("Failed decoding packet");
 		return -1;
 	}
@@ -385,14 +385,15 @@ static ssize_t mod_encode(void const *instance, request_t *request, uint8_t *buf
 
 	data_len = fr_radius_encode(buffer, buffer_len, request->packet->data,
 				    client->secret, talloc_array_length(client->secret) - 1,
-				    request->reply->code, request->reply->id, &request->reply_pairs);
+				    request->reply->code, request->reply->id, &request->reply_pairs, client->secret_md5);
 	if (data_len < 0) {
 		RPEDEBUG("Failed encoding RADIUS reply");
 		return -1;
 	}
 
 	if (fr_radius_sign(buffer, request->packet->data,
-			   (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1) < 0) {
+			   (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1,
+			   client->secret_md5) < 0) {
 		RPEDEBUG("Failed signing RADIUS reply");
 		return -1;
 	}
@@ -24,6 +24,7 @@
  */
 #include <netdb.h>
 #include <freeradius-devel/server/protocol.h>
+#include <freeradius-devel/server/state.h>
 #include <freeradius-devel/util/udp.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/radius/radius.h>
@@ -40,6 +41,8 @@ typedef struct {
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
+	fr_udp_recv_batch_t		*recv_batch;		//!< packets read by recvmmsg(), but not yet processed.
+	fr_udp_send_batch_t		*send_batch;		//!< replies waiting to be written by sendmmsg().
 	fr_hash_table_t			*sessions;		//!< hash of states for multiple rounds
 
 	fr_stats_t			stats;			//!< statistics for this socket
@@ -69,6 +72,9 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	char const			*worker_key_name;	//!< Attribute used to choose a worker.
+	fr_dict_attr_t const		*worker_key;		//!< Parsed version of worker_key_name.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
@@ -115,6 +121,8 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("worker_key", FR_TYPE_STRING, proto_radius_udp_t, worker_key_name) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -145,7 +153,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	data_size = udp_recv_batch(thread->recv_batch, thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -273,7 +281,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			(void) udp_send(&socket, flags, packet, track->reply_len);
+			(void) udp_send_batch(thread->send_batch, &socket, flags, packet, track->reply_len);
 		}
 
 		return buffer_len;
@@ -288,7 +296,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_send_batch(thread->send_batch, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -364,6 +372,70 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+static size_t mod_pending(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	return udp_recv_batch_pending(thread->recv_batch);
+}
+
+/** Return a key for choosing a worker
+ *
+ * This is the value of the 'worker_key' attribute, if it's in the
+ * packet.  Otherwise it's the client's IP address.
+ */
+static uint32_t mod_key(fr_listen_t *li, void const *packet_ctx, uint8_t const *buffer, size_t buffer_len)
+{
+	proto_radius_udp_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+	uint8_t const			*attr, *end;
+
+	if (!inst->worker_key || (buffer_len < RADIUS_HEADER_LENGTH)) return fr_master_io_track_key(track);
+
+	/*
+	 *	The packet has already been validated by read().
+	 */
+	attr = buffer + RADIUS_HEADER_LENGTH;
+	end = buffer + buffer_len;
+
+	while ((attr + 2) <= end) {
+		if ((attr[1] < 2) || ((attr + attr[1]) > end)) break;
+
+		if (attr[0] == inst->worker_key->attr) return fr_hash(attr + 2, attr[1] - 2);
+
+		attr += attr[1];
+	}
+
+	return fr_master_io_track_key(track);
+}
+
+/** Return the worker which created the State value in a packet
+ *
+ */
+static int mod_state_owner(UNUSED fr_listen_t *li, UNUSED void const *packet_ctx, uint8_t const *buffer, size_t buffer_len)
+{
+	uint8_t const *attr;
+
+	if (buffer_len < RADIUS_HEADER_LENGTH) return -1;
+
+	/*
+	 *	The packet has already been validated by read().
+	 */
+	attr = state_find(buffer, buffer_len);
+	if (!attr) return -1;
+
+	return fr_state_owner(attr + 2, attr[1] - 2);
+}
+
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	if (udp_send_batch_flush(thread->send_batch) < 0) return -1;
+
+	return 0;
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -470,6 +542,32 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Connected sockets read and write one packet at a time.
+	 */
+	if (!thread->connection) {
+		thread->recv_batch = udp_recv_batch_alloc(thread, UDP_RECV_BATCH_SIZE, inst->max_packet_size);
+		if (!thread->recv_batch) {
+			PERROR("Failed allocating receive batch");
+			return -1;
+		}
+
+		thread->send_batch = udp_send_batch_alloc(thread, UDP_SEND_BATCH_SIZE, inst->max_packet_size);
+		if (!thread->send_batch) {
+			PERROR("Failed allocating send batch");
+			return -1;
+		}
+
+		/*
+		 *	The first socket of a sharded listener steers
+		 *	all packets from one client to the same socket.
+		 */
+		if ((li->num_shards > 1) && (li->shard == 0) &&
+		    (fr_socket_reuseport_hash(sockfd, li->num_shards) < 0)) {
+			PWARN("Failed distributing clients across sockets");
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -540,6 +638,14 @@ static void *mod_track_create(void const *instance, void *thread_instance, UNUSE
 	return state;
 }
 
+/** Return the RADIUS ID, for the fixed size tracking table
+ *
+ */
+static uint8_t mod_track_id(uint8_t const *packet, UNUSED size_t packet_len)
+{
+	return packet[1];
+}
+
 static int mod_track_compare(void const *instance, UNUSED void *thread_instance, RADCLIENT *client,
 			     void const *one, void const *two)
 {
@@ -609,6 +715,26 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	/*
+	 *	The key is found by walking the raw packet, so it has
+	 *	to be a top-level RADIUS attribute.
+	 */
+	if (inst->worker_key_name) {
+		fr_dict_t const *dict = fr_dict_by_protocol_name("radius");
+
+		if (dict) inst->worker_key = fr_dict_attr_by_name(NULL, fr_dict_root(dict), inst->worker_key_name);
+		if (!inst->worker_key) {
+			cf_log_err(cs, "Unknown attribute 'worker_key = %s'", inst->worker_key_name);
+			return -1;
+		}
+
+		if (inst->worker_key->attr > UINT8_MAX) {
+			cf_log_err(cs, "Invalid attribute 'worker_key = %s' - it must be a standard RADIUS attribute",
+				   inst->worker_key_name);
+			return -1;
+		}
+	}
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -697,10 +823,15 @@ fr_app_io_t proto_radius_udp = {
 
 	.open			= mod_open,
 	.read			= mod_read,
+	.pending		= mod_pending,
 	.write			= mod_write,
+	.key			= mod_key,
+	.state_owner		= mod_state_owner,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
+	.track_id		= mod_track_id,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -30,6 +30,10 @@ typedef struct {
 	fr_rb_tree_t		*cache;		//!< Tree for looking up cache keys.
 	fr_heap_t		*heap;		//!< For managing entry expiry.
 
+	fr_dlist_head_t		clock;		//!< Ring of entries for CLOCK eviction.
+	void			*hand;		//!< Next entry the clock hand will examine.
+	size_t			memory;		//!< Bytes used by entries in the cache.
+
 	pthread_mutex_t		mutex;		//!< Protect the tree from multiple readers/writers.
 } rlm_cache_rbtree_t;
 
@@ -38,6 +42,9 @@ typedef struct {
 
 	fr_rb_node_t		node;		//!< Entry used for lookups.
 	fr_heap_index_t		heap_id;	//!< Offset used for expiry heap.
+
+	fr_dlist_t		clock_entry;	//!< Entry in the CLOCK ring.
+	bool			referenced;	//!< Entry was found since the clock hand last passed.
 } rlm_cache_rb_entry_t;
 
 /** Compare two entries by key
@@ -63,6 +70,20 @@ static int8_t cache_heap_cmp(void const *one, void const *two)
 	return fr_unix_time_cmp(a->expires, b->expires);
 }
 
+/** Remove an entry from the tree, the expiry heap and the CLOCK ring
+ *
+ * Does not free the entry.
+ */
+static void cache_entry_unlink(rlm_cache_rbtree_t *driver, rlm_cache_rb_entry_t *c)
+{
+	if (driver->hand == c) driver->hand = fr_dlist_next(&driver->clock, c);
+
+	fr_heap_extract(driver->heap, c);
+	fr_rb_delete(driver->cache, c);
+	fr_dlist_remove(&driver->clock, c);
+	driver->memory -= c->fields.size;
+}
+
 /** Cleanup a cache_rbtree instance
  *
  */
@@ -119,6 +140,8 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 		return -1;
 	}
 
+	fr_dlist_talloc_init(&driver->clock, rlm_cache_rb_entry_t, clock_entry);
+
 	if (pthread_mutex_init(&driver->mutex, NULL) < 0) {
 		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
 		return -1;
@@ -154,22 +177,23 @@ static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *con
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       rlm_cache_config_t const *config, void *instance,
 				       request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
-	rlm_cache_entry_t *c;
+	rlm_cache_rb_entry_t *c;
 
 	fr_assert(driver->cache);
 
 	/*
-	 *	Clear out old entries
+	 *	Clear out old entries, keeping any which may
+	 *	still be served stale.
 	 */
 	c = fr_heap_peek(driver->heap);
-	if (c && (fr_unix_time_lt(c->expires, fr_time_to_unix_time(request->packet->timestamp)))) {
-		fr_heap_extract(driver->heap, c);
-		fr_rb_delete(driver->cache, c);
+	if (c && (fr_unix_time_lt(fr_unix_time_add(c->fields.expires, config->stale_while_revalidate),
+				  fr_time_to_unix_time(request->packet->timestamp)))) {
+		cache_entry_unlink(driver, c);
 		talloc_free(c);
 	}
 
@@ -181,7 +205,8 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		*out = NULL;
 		return CACHE_MISS;
 	}
-	*out = c;
+	c->referenced = true;
+	*out = (rlm_cache_entry_t *)c;
 
 	return CACHE_OK;
 }
@@ -197,15 +222,14 @@ static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config
 					 uint8_t const *key, size_t key_len)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
-	rlm_cache_entry_t *c;
+	rlm_cache_rb_entry_t *c;
 
 	if (!request) return CACHE_ERROR;
 
 	c = fr_rb_find(driver->cache, &(rlm_cache_entry_t){ .key = key, .key_len = key_len });
 	if (!c) return CACHE_MISS;
 
-	fr_heap_extract(driver->heap, c);
-	fr_rb_delete(driver->cache, c);
+	cache_entry_unlink(driver, c);
 	talloc_free(c);
 
 	return CACHE_OK;
@@ -250,6 +274,13 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
 		return CACHE_ERROR;
 	}
 
+	/*
+	 *	New entries go just behind the hand, so they
+	 *	get a full revolution before being considered.
+	 */
+	fr_dlist_insert_before(&driver->clock, driver->hand, UNCONST(rlm_cache_entry_t *, c));
+	driver->memory += c->size;
+
 	return CACHE_OK;
 }
 
@@ -261,7 +292,7 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
  */
 static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
 					  request_t *request, UNUSED void *handle,
-					  rlm_cache_entry_t *c)
+					  rlm_cache_entry_t *c, fr_unix_time_t expires)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
@@ -274,8 +305,12 @@ static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *confi
 		return CACHE_ERROR;
 	}
 
+	c->expires = expires;
 	if (fr_heap_insert(driver->heap, c) < 0) {
 		fr_rb_delete(driver->cache, c);	/* make sure we don't leak entries... */
+		if (driver->hand == c) driver->hand = fr_dlist_next(&driver->clock, c);
+		fr_dlist_remove(&driver->clock, c);
+		driver->memory -= c->size;
 		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
 		return CACHE_ERROR;
 	}
@@ -298,6 +333,43 @@ static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void
 	return fr_rb_num_elements(driver->cache);
 }
 
+/** Evict entries using the CLOCK algorithm until there's room for a new entry
+ *
+ * Entries which have been found since the hand last passed get a second
+ * chance, everything else is removed.
+ *
+ * @copydetails cache_entry_evict_t
+ */
+static int cache_entry_evict(rlm_cache_config_t const *config, void *instance,
+			     request_t *request, UNUSED void *handle, rlm_cache_entry_t const *new)
+{
+	rlm_cache_rbtree_t	*driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
+	rlm_cache_rb_entry_t	*c;
+	int			evicted = 0;
+
+	if ((config->max_memory > 0) && (new->size > config->max_memory)) return -1;
+
+	while (((config->max_entries > 0) && (fr_rb_num_elements(driver->cache) >= config->max_entries)) ||
+	       ((config->max_memory > 0) && ((driver->memory + new->size) > config->max_memory))) {
+		c = driver->hand ? driver->hand : fr_dlist_head(&driver->clock);
+		if (!c) return -1;
+
+		if (c->referenced) {
+			c->referenced = false;
+			driver->hand = fr_dlist_next(&driver->clock, c);
+			continue;
+		}
+
+		RDEBUG3("Evicting entry \"%pV\"", fr_box_strvalue_len((char const *)c->fields.key, c->fields.key_len));
+
+		cache_entry_unlink(driver, c);
+		talloc_free(c);
+		evicted++;
+	}
+
+	return evicted;
+}
+
 /** Lock the rbtree
  *
  * @note handle not used except for sanity checks.
@@ -348,6 +420,7 @@ rlm_cache_driver_t rlm_cache_rbtree = {
 	.expire		= cache_entry_expire,
 	.set_ttl	= cache_entry_set_ttl,
 	.count		= cache_entry_count,
+	.evict		= cache_entry_evict,
 
 	.acquire	= cache_acquire,
 	.release	= cache_release,
@@ -255,7 +255,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
 					 request_t *request, UNUSED void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_redis_t	*driver = instance;
@@ -398,12 +398,18 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		 *	Set the expiry time and close out the transaction.
 		 */
 		if (fr_unix_time_ispos(c->expires)) {
+			/*
+			 *	Keep the entry around long enough to be
+			 *	served stale while it's revalidated.
+			 */
+			fr_unix_time_t expires = fr_unix_time_add(c->expires, config->stale_while_revalidate);
+
 			RDEBUG3("EXPIREAT \"%pV\" %" PRIu64,
 				fr_box_strvalue_len((char const *)c->key, c->key_len),
-				fr_unix_time_to_sec(c->expires));
+				fr_unix_time_to_sec(expires));
 			if (redisAppendCommand(conn->handle, "EXPIREAT %b %" PRIu64, c->key,
 					       c->key_len,
-					       fr_unix_time_to_sec(c->expires)) != REDIS_OK) goto append_error;
+					       fr_unix_time_to_sec(expires)) != REDIS_OK) goto append_error;
 			pipelined++;
 			RDEBUG3("EXEC");
 			if (redisAppendCommand(conn->handle, "EXEC") != REDIS_OK) goto append_error;
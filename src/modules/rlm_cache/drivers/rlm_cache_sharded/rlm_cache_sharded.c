@@ -0,0 +1,850 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief Sharded in memory cache with lock-free lookups.
+ *
+ * The keyspace is split across a number of shards, each with its own
+ * mutex, hash index and expiry heap.  Writers (insert, expire, set_ttl)
+ * lock only the shard the key hashes to.  Readers never lock, they walk
+ * the hash chains with acquire loads, and are protected from entries
+ * being freed underneath them by epoch based reclamation.
+ *
+ * Every worker thread registers a reader record when the module is
+ * thread instantiated.  #cache_acquire publishes the current global
+ * epoch in that record, and #cache_release clears it.  Entries unlinked
+ * from a chain are stamped with the global epoch and placed on the
+ * shard's retired list.  They are only freed once every active reader
+ * has published an epoch later than the one they were retired in.
+ *
+ * Expiry is incremental.  Each shard tracks the time its oldest entry
+ * expires, and lookups which notice that time has passed opportunistically
+ * reap a small batch of entries from that shard.
+ *
+ * max_entries and max_memory are divided evenly between the shards, and
+ * enforced per shard with the CLOCK algorithm.  Lookups set a reference
+ * bit on the entries they find, the clock hand clears it, and evicts
+ * entries it finds unreferenced.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#define LOG_PREFIX "cache - sharded"
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/heap.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include "../../rlm_cache.h"
+
+#define SHARDED_MAX_SHARDS	256
+#define SHARDED_EXPIRE_BATCH	8	//!< Maximum entries reaped per opportunistic expiry pass.
+#define SHARDED_RECLAIM_AT	64	//!< Retired entries a shard accumulates before attempting reclamation.
+
+typedef struct rlm_cache_sharded_entry_s rlm_cache_sharded_entry_t;
+
+struct rlm_cache_sharded_entry_s {
+	rlm_cache_entry_t			fields;		//!< Entry data.
+
+	uint32_t				hash;		//!< Hash of the entry's key.
+	_Atomic(rlm_cache_sharded_entry_t *)	next;		//!< Next entry in the hash chain.
+	fr_heap_index_t				heap_id;	//!< Offset used for expiry heap.
+
+	fr_dlist_t				clock_entry;	//!< Entry in the shard's CLOCK ring.
+	atomic_bool				referenced;	//!< Entry was found since the clock hand last passed.
+
+	uint64_t				retired;	//!< Epoch the entry was unlinked in.
+	fr_dlist_t				retired_entry;	//!< Entry in the shard's retired list.
+};
+
+typedef struct {
+	pthread_mutex_t				mutex;		//!< Serialises writers.  Readers never take it.
+
+	_Atomic(rlm_cache_sharded_entry_t *)	*buckets;	//!< Hash chain heads.
+	fr_heap_t				*heap;		//!< For managing entry expiry.
+
+	fr_dlist_head_t				clock;		//!< Ring of live entries for CLOCK eviction.
+	void					*hand;		//!< Next entry the clock hand will examine.
+	size_t					memory;		//!< Bytes used by live entries.
+
+	atomic_uint_fast64_t			num;		//!< Number of live entries.
+	atomic_uint_fast64_t			next_expiry;	//!< When the oldest entry in the shard expires.
+
+	fr_dlist_head_t				retired;	//!< Unlinked entries waiting to be freed.
+} rlm_cache_sharded_shard_t;
+
+typedef struct {
+	uint32_t				num_shards;	//!< Number of independently locked shards.
+	uint32_t				num_buckets;	//!< Hash buckets per shard.
+
+	rlm_cache_sharded_shard_t		*shards;	//!< Array of shards.
+
+	atomic_uint_fast64_t			epoch;		//!< Global reclamation epoch.
+
+	pthread_mutex_t				readers_mutex;	//!< Protects the reader list.
+	fr_dlist_head_t				readers;	//!< Registered reader records, one per thread.
+} rlm_cache_sharded_t;
+
+/** Per-thread reader record
+ *
+ */
+typedef struct {
+	rlm_cache_sharded_t			*driver;	//!< Driver this reader is registered with.
+
+	atomic_uint_fast64_t			epoch;		//!< Epoch observed on acquire, 0 if inactive.
+	unsigned int				depth;		//!< Nesting depth of acquire calls.
+
+	fr_dlist_t				entry;		//!< Entry in the driver's reader list.
+} rlm_cache_sharded_thread_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("buckets", FR_TYPE_UINT32, rlm_cache_sharded_t, num_buckets), .dflt = "4096" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return fr_unix_time_cmp(a->expires, b->expires);
+}
+
+/** Round a configured value up to the next power of 2
+ *
+ */
+static uint32_t sharded_pow2(uint32_t value)
+{
+	uint32_t out = 1;
+
+	while (out < value) out <<= 1;
+
+	return out;
+}
+
+static inline CC_HINT(always_inline)
+rlm_cache_sharded_shard_t *sharded_shard(rlm_cache_sharded_t const *driver, uint32_t hash)
+{
+	return &driver->shards[(hash >> 24) & (driver->num_shards - 1)];
+}
+
+static inline CC_HINT(always_inline)
+_Atomic(rlm_cache_sharded_entry_t *) *sharded_bucket(rlm_cache_sharded_t const *driver,
+						      rlm_cache_sharded_shard_t *shard, uint32_t hash)
+{
+	return &shard->buckets[hash & (driver->num_buckets - 1)];
+}
+
+/** Search a hash chain without holding any locks
+ *
+ * Must be called from within an acquire/release pair, or with the shard locked.
+ */
+static rlm_cache_sharded_entry_t *sharded_chain_find(_Atomic(rlm_cache_sharded_entry_t *) *bucket, uint32_t hash,
+						     uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	for (c = atomic_load_explicit(bucket, memory_order_acquire);
+	     c;
+	     c = atomic_load_explicit(&c->next, memory_order_acquire)) {
+		if ((c->hash == hash) && (c->fields.key_len == key_len) &&
+		    (memcmp(c->fields.key, key, key_len) == 0)) return c;
+	}
+
+	return NULL;
+}
+
+/** Find the link pointing at an entry
+ *
+ * Shard must be locked.
+ */
+static _Atomic(rlm_cache_sharded_entry_t *) *sharded_chain_link(_Atomic(rlm_cache_sharded_entry_t *) *bucket,
+								 rlm_cache_sharded_entry_t *c)
+{
+	_Atomic(rlm_cache_sharded_entry_t *)	*link = bucket;
+	rlm_cache_sharded_entry_t		*p;
+
+	while ((p = atomic_load_explicit(link, memory_order_relaxed))) {
+		if (p == c) return link;
+		link = &p->next;
+	}
+
+	return NULL;
+}
+
+/** Return the lowest epoch published by an active reader
+ *
+ * @return the lowest active epoch, or UINT64_MAX if no readers are active.
+ */
+static uint64_t sharded_min_epoch(rlm_cache_sharded_t *driver)
+{
+	rlm_cache_sharded_thread_t	*t = NULL;
+	uint64_t			min = UINT64_MAX;
+
+	pthread_mutex_lock(&driver->readers_mutex);
+	while ((t = fr_dlist_next(&driver->readers, t))) {
+		uint64_t epoch = atomic_load_explicit(&t->epoch, memory_order_seq_cst);
+
+		if (epoch && (epoch < min)) min = epoch;
+	}
+	pthread_mutex_unlock(&driver->readers_mutex);
+
+	return min;
+}
+
+/** Free retired entries which no active reader can still see
+ *
+ * Shard must be locked.
+ */
+static void sharded_reclaim(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard)
+{
+	rlm_cache_sharded_entry_t	*c, *next;
+	uint64_t			min;
+
+	if (fr_dlist_num_elements(&shard->retired) == 0) return;
+
+	min = sharded_min_epoch(driver);
+
+	for (c = fr_dlist_head(&shard->retired); c; c = next) {
+		next = fr_dlist_next(&shard->retired, c);
+
+		if (c->retired >= min) continue;
+
+		fr_dlist_remove(&shard->retired, c);
+		talloc_free(c);
+	}
+}
+
+/** Remove an entry from the expiry heap and place it on the retired list
+ *
+ * Shard must be locked, and the entry must already be unreachable from
+ * the hash chains.  It remains readable until it is reclaimed.
+ */
+static void sharded_retire(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard,
+			   rlm_cache_sharded_entry_t *c)
+{
+	(void) fr_heap_extract(shard->heap, c);
+	if (shard->hand == c) shard->hand = fr_dlist_next(&shard->clock, c);
+	fr_dlist_remove(&shard->clock, c);
+	shard->memory -= c->fields.size;
+	atomic_fetch_sub_explicit(&shard->num, 1, memory_order_relaxed);
+
+	c->retired = atomic_fetch_add_explicit(&driver->epoch, 1, memory_order_seq_cst);
+	fr_dlist_insert_tail(&shard->retired, c);
+
+	if (fr_dlist_num_elements(&shard->retired) >= SHARDED_RECLAIM_AT) sharded_reclaim(driver, shard);
+}
+
+/** Unlink an entry from its hash chain and retire it
+ *
+ * Shard must be locked.
+ */
+static void sharded_unlink(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard,
+			   _Atomic(rlm_cache_sharded_entry_t *) *link, rlm_cache_sharded_entry_t *c)
+{
+	atomic_store_explicit(link, atomic_load_explicit(&c->next, memory_order_relaxed), memory_order_release);
+	sharded_retire(driver, shard, c);
+}
+
+/** Record when the oldest entry in a shard expires
+ *
+ * Shard must be locked.
+ */
+static void sharded_next_expiry_update(rlm_cache_sharded_shard_t *shard)
+{
+	rlm_cache_entry_t *c = fr_heap_peek(shard->heap);
+
+	atomic_store_explicit(&shard->next_expiry,
+			      c ? fr_unix_time_unwrap(c->expires) : UINT64_MAX, memory_order_relaxed);
+}
+
+/** Reap up to #SHARDED_EXPIRE_BATCH expired entries from a shard
+ *
+ * Shard must be locked.
+ */
+static void sharded_expire(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard, fr_unix_time_t now)
+{
+	rlm_cache_sharded_entry_t	*c;
+	int				i;
+
+	for (i = 0; i < SHARDED_EXPIRE_BATCH; i++) {
+		_Atomic(rlm_cache_sharded_entry_t *) *link;
+
+		c = fr_heap_peek(shard->heap);
+		if (!c || !fr_unix_time_lt(c->fields.expires, now)) break;
+
+		link = sharded_chain_link(sharded_bucket(driver, shard, c->hash), c);
+		if (!fr_cond_assert(link)) {
+			(void) fr_heap_extract(shard->heap, c);
+			continue;
+		}
+
+		sharded_unlink(driver, shard, link, c);
+	}
+
+	sharded_next_expiry_update(shard);
+}
+
+/** Free every entry in a shard's chains and retired list
+ *
+ */
+static void sharded_shard_free(rlm_cache_sharded_t *driver, rlm_cache_sharded_shard_t *shard)
+{
+	rlm_cache_sharded_entry_t	*c, *next;
+	uint32_t			i;
+
+	if (shard->buckets) for (i = 0; i < driver->num_buckets; i++) {
+		for (c = atomic_load_explicit(&shard->buckets[i], memory_order_relaxed); c; c = next) {
+			next = atomic_load_explicit(&c->next, memory_order_relaxed);
+			talloc_free(c);
+		}
+		atomic_store_explicit(&shard->buckets[i], NULL, memory_order_relaxed);
+	}
+
+	while ((c = fr_dlist_pop_head(&shard->retired))) talloc_free(c);
+}
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		sharded_shard_free(driver, &driver->shards[i]);
+		pthread_mutex_destroy(&driver->shards[i].mutex);
+	}
+
+	pthread_mutex_destroy(&driver->readers_mutex);
+
+	return 0;
+}
+
+/** Create a new cache_sharded instance
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		i;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, SHARDED_MAX_SHARDS);
+	FR_INTEGER_BOUND_CHECK("buckets", driver->num_buckets, >=, 16);
+	FR_INTEGER_BOUND_CHECK("buckets", driver->num_buckets, <=, (1 << 24));
+
+	/*
+	 *	Shard and bucket selection are done with masks.
+	 */
+	driver->num_shards = sharded_pow2(driver->num_shards);
+	driver->num_buckets = sharded_pow2(driver->num_buckets);
+
+	driver->shards = talloc_zero_array(driver, rlm_cache_sharded_shard_t, driver->num_shards);
+	if (!driver->shards) {
+	oom:
+		ERROR("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shards[i];
+
+		shard->buckets = talloc_zero_array(driver->shards, _Atomic(rlm_cache_sharded_entry_t *),
+						   driver->num_buckets);
+		if (!shard->buckets) goto oom;
+
+		shard->heap = fr_heap_talloc_alloc(driver->shards, cache_heap_cmp,
+						   rlm_cache_sharded_entry_t, heap_id, 0);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		atomic_init(&shard->num, 0);
+		atomic_init(&shard->next_expiry, UINT64_MAX);
+		fr_dlist_talloc_init(&shard->clock, rlm_cache_sharded_entry_t, clock_entry);
+		fr_dlist_talloc_init(&shard->retired, rlm_cache_sharded_entry_t, retired_entry);
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	/*
+	 *	Zero marks a reader as inactive, so epochs start at 1.
+	 */
+	atomic_init(&driver->epoch, 1);
+	fr_dlist_talloc_init(&driver->readers, rlm_cache_sharded_thread_t, entry);
+
+	if (pthread_mutex_init(&driver->readers_mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	DEBUG2("Using %u shards of %u buckets", driver->num_shards, driver->num_buckets);
+
+	return 0;
+}
+
+/** Register this thread as a reader
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_thread_t	*t = talloc_get_type_abort(thread, rlm_cache_sharded_thread_t);
+
+	t->driver = driver;
+	atomic_init(&t->epoch, 0);
+
+	pthread_mutex_lock(&driver->readers_mutex);
+	fr_dlist_insert_tail(&driver->readers, t);
+	pthread_mutex_unlock(&driver->readers_mutex);
+
+	return 0;
+}
+
+/** Remove this thread from the reader list
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_cache_sharded_thread_t	*t = talloc_get_type_abort(thread, rlm_cache_sharded_thread_t);
+	rlm_cache_sharded_t		*driver = t->driver;
+
+	if (!driver) return 0;
+
+	pthread_mutex_lock(&driver->readers_mutex);
+	fr_dlist_remove(&driver->readers, t);
+	pthread_mutex_unlock(&driver->readers_mutex);
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Does not take any locks, unless the shard has entries which are due to
+ * expire, in which case we try to reap a few of them.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       rlm_cache_config_t const *config, void *instance,
+				       request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c;
+	fr_unix_time_t			now = fr_unix_time_sub(fr_time_to_unix_time(request->packet->timestamp),
+							       config->stale_while_revalidate);
+	uint32_t			hash;
+
+	hash = fr_hash(key, key_len);
+	shard = sharded_shard(driver, hash);
+
+	/*
+	 *	Clear out old entries, but only if nobody
+	 *	else is already writing to the shard.
+	 */
+	if ((fr_unix_time_unwrap(now) > atomic_load_explicit(&shard->next_expiry, memory_order_relaxed)) &&
+	    (pthread_mutex_trylock(&shard->mutex) == 0)) {
+		sharded_expire(driver, shard, now);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	c = sharded_chain_find(sharded_bucket(driver, shard, hash), hash, key, key_len);
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	/*
+	 *	Avoid dirtying the cache line if the bit
+	 *	is already set.
+	 */
+	if (!atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+		atomic_store_explicit(&c->referenced, true, memory_order_relaxed);
+	}
+	*out = (rlm_cache_entry_t *)c;
+
+	return CACHE_OK;
+}
+
+/** Remove an entry from the data store
+ *
+ * The entry isn't freed until all readers which may have seen it have
+ * released their handles.
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t			*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t		*shard;
+	_Atomic(rlm_cache_sharded_entry_t *)	*bucket, *link;
+	rlm_cache_sharded_entry_t		*c;
+	uint32_t				hash;
+
+	if (!request) return CACHE_ERROR;
+
+	hash = fr_hash(key, key_len);
+	shard = sharded_shard(driver, hash);
+	bucket = sharded_bucket(driver, shard, hash);
+
+	pthread_mutex_lock(&shard->mutex);
+	c = sharded_chain_find(bucket, hash, key, key_len);
+	if (!c) {
+		pthread_mutex_unlock(&shard->mutex);
+		return CACHE_MISS;
+	}
+
+	link = sharded_chain_link(bucket, c);
+	fr_assert(link);
+	sharded_unlink(driver, shard, link, c);
+	sharded_next_expiry_update(shard);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * Existing entries with the same key are replaced in place, so concurrent
+ * readers always see either the old or the new entry.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_sharded_t			*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t		*shard;
+	_Atomic(rlm_cache_sharded_entry_t *)	*bucket, *link;
+	rlm_cache_sharded_entry_t		*c = UNCONST(rlm_cache_sharded_entry_t *, entry), *old;
+
+	if (!request) return CACHE_ERROR;
+
+	c->hash = fr_hash(c->fields.key, c->fields.key_len);
+	shard = sharded_shard(driver, c->hash);
+	bucket = sharded_bucket(driver, shard, c->hash);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	/*
+	 *	Piggyback expiry on the write, we already
+	 *	hold the lock.
+	 */
+	sharded_expire(driver, shard, fr_unix_time_sub(fr_time_to_unix_time(request->packet->timestamp),
+						       config->stale_while_revalidate));
+
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		pthread_mutex_unlock(&shard->mutex);
+		RERROR("Failed adding entry to expiry heap");
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = sharded_chain_find(bucket, c->hash, c->fields.key, c->fields.key_len);
+	if (old) {
+		link = sharded_chain_link(bucket, old);
+		fr_assert(link);
+
+		atomic_store_explicit(&c->next, atomic_load_explicit(&old->next, memory_order_relaxed),
+				      memory_order_relaxed);
+		atomic_store_explicit(link, c, memory_order_release);
+
+		/*
+		 *	The new entry has taken the old one's
+		 *	place in the chain, so just retire it.
+		 */
+		sharded_retire(driver, shard, old);
+	} else {
+		atomic_store_explicit(&c->next, atomic_load_explicit(bucket, memory_order_relaxed),
+				      memory_order_relaxed);
+		atomic_store_explicit(bucket, c, memory_order_release);
+	}
+	atomic_fetch_add_explicit(&shard->num, 1, memory_order_relaxed);
+
+	/*
+	 *	New entries go just behind the hand, so they
+	 *	get a full revolution before being considered.
+	 */
+	fr_dlist_insert_before(&shard->clock, shard->hand, c);
+	shard->memory += c->fields.size;
+
+	sharded_next_expiry_update(shard);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * The expiry is only written with the shard locked, and while the entry
+ * is out of the heap, so writers comparing entries never see it change.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, UNUSED void *handle,
+					  rlm_cache_entry_t *entry, fr_unix_time_t expires)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c = (rlm_cache_sharded_entry_t *)entry;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = sharded_shard(driver, c->hash);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	/*
+	 *	Entry was expired by another thread between
+	 *	us finding it and updating the TTL.
+	 */
+	if (!fr_heap_entry_inserted(c->heap_id)) {
+		pthread_mutex_unlock(&shard->mutex);
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	(void) fr_heap_extract(shard->heap, c);
+	c->fields.expires = expires;
+	if (fr_heap_insert(shard->heap, c) < 0) {
+		_Atomic(rlm_cache_sharded_entry_t *) *link;
+
+		link = sharded_chain_link(sharded_bucket(driver, shard, c->hash), c);
+		if (link) sharded_unlink(driver, shard, link, c);	/* make sure we don't leak entries... */
+		sharded_next_expiry_update(shard);
+		pthread_mutex_unlock(&shard->mutex);
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+
+	sharded_next_expiry_update(shard);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * The count is approximate if writers are active on other threads.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint64_t		count = 0;
+	uint32_t		i;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		count += atomic_load_explicit(&driver->shards[i].num, memory_order_relaxed);
+	}
+
+	return count;
+}
+
+/** Evict entries using the CLOCK algorithm until there's room for a new entry
+ *
+ * Only the shard the new entry hashes to is examined, limits are applied
+ * per shard.  Another writer may fill the shard between us returning and
+ * the entry being inserted, so limits may briefly be exceeded.
+ *
+ * @copydetails cache_entry_evict_t
+ */
+static int cache_entry_evict(rlm_cache_config_t const *config, void *instance,
+			     request_t *request, UNUSED void *handle, rlm_cache_entry_t const *new)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c;
+	uint64_t			max_entries = 0;
+	size_t				max_memory = 0;
+	int				evicted = 0;
+
+	if (config->max_entries > 0) max_entries = ROUND_UP_DIV(config->max_entries, driver->num_shards);
+	if (config->max_memory > 0) max_memory = ROUND_UP_DIV(config->max_memory, driver->num_shards);
+
+	if ((max_memory > 0) && (new->size > max_memory)) return -1;
+
+	shard = sharded_shard(driver, fr_hash(new->key, new->key_len));
+
+	pthread_mutex_lock(&shard->mutex);
+	while (((max_entries > 0) && (atomic_load_explicit(&shard->num, memory_order_relaxed) >= max_entries)) ||
+	       ((max_memory > 0) && ((shard->memory + new->size) > max_memory))) {
+		_Atomic(rlm_cache_sharded_entry_t *) *link;
+
+		c = shard->hand ? shard->hand : fr_dlist_head(&shard->clock);
+		if (!c) {
+			evicted = -1;
+			break;
+		}
+
+		if (atomic_exchange_explicit(&c->referenced, false, memory_order_relaxed)) {
+			shard->hand = fr_dlist_next(&shard->clock, c);
+			continue;
+		}
+
+		RDEBUG3("Evicting entry \"%pV\"", fr_box_strvalue_len((char const *)c->fields.key, c->fields.key_len));
+
+		link = sharded_chain_link(sharded_bucket(driver, shard, c->hash), c);
+		if (!fr_cond_assert(link)) {
+			evicted = -1;
+			break;
+		}
+		sharded_unlink(driver, shard, link, c);
+		evicted++;
+	}
+	sharded_next_expiry_update(shard);
+	pthread_mutex_unlock(&shard->mutex);
+
+	return evicted;
+}
+
+/** Enter a read side critical section
+ *
+ * Publishes the current epoch so entries we may see aren't freed
+ * until we call #cache_release.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 request_t *request)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	module_thread_instance_t	*mti = module_thread_by_data(driver);
+	rlm_cache_sharded_thread_t	*t;
+
+	if (!mti) {
+		RERROR("No thread instance data for cache driver");
+		return -1;
+	}
+	t = talloc_get_type_abort(mti->data, rlm_cache_sharded_thread_t);
+
+	if (t->depth++ == 0) {
+		atomic_store_explicit(&t->epoch, atomic_load_explicit(&driver->epoch, memory_order_seq_cst),
+				      memory_order_seq_cst);
+	}
+
+	*handle = t;
+
+	RDEBUG3("Entered read section");
+
+	return 0;
+}
+
+/** Leave a read side critical section
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_thread_t	*t = talloc_get_type_abort(handle, rlm_cache_sharded_thread_t);
+
+	fr_assert(t->depth > 0);
+
+	if (--t->depth == 0) atomic_store_explicit(&t->epoch, 0, memory_order_release);
+
+	RDEBUG3("Left read section");
+}
+
+extern rlm_cache_driver_t rlm_cache_sharded;
+rlm_cache_driver_t rlm_cache_sharded = {
+	.name			= "rlm_cache_sharded",
+	.magic			= RLM_MODULE_INIT,
+	.config			= driver_config,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+	.inst_size		= sizeof(rlm_cache_sharded_t),
+
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+	.thread_inst_size	= sizeof(rlm_cache_sharded_thread_t),
+	.thread_inst_type	= "rlm_cache_sharded_thread_t",
+
+	.alloc			= cache_entry_alloc,
+
+	.find			= cache_entry_find,
+	.insert			= cache_entry_insert,
+	.expire			= cache_entry_expire,
+	.set_ttl		= cache_entry_set_ttl,
+	.count			= cache_entry_count,
+	.evict			= cache_entry_evict,
+
+	.acquire		= cache_acquire,
+	.release		= cache_release,
+};
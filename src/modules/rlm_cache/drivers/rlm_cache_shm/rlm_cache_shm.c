@@ -0,0 +1,926 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_shm.c
+ * @brief File backed shared memory cache which persists across restarts.
+ *
+ * The cache lives in a fixed size file, mapped into memory.  The file is
+ * divided into a header, followed by a number of stripes.  Each stripe is
+ * protected by its own mutex, and holds:
+ *
+ * - A stripe header, containing the page lists.
+ * - An open addressed hash table of slots, using linear probing.
+ * - A descriptor for each page of the arena.
+ * - An arena of 64KiB pages.  Pages are taken from the stripe's free
+ *   page list when a size class needs one, and split into chunks of that
+ *   class.  When the last chunk in a page is freed, the page goes back
+ *   on the free page list, so another class can use it.
+ *
+ * Each entry is stored as its key, followed by the entry serialized with
+ * #cache_serialize, in a single chunk.
+ *
+ * When a stripe is full, entries are evicted with the CLOCK algorithm.
+ * Lookups set a reference bit on the slots they find, and the stripe's
+ * clock hand clears it, evicting slots it finds unreferenced or expired.
+ *
+ * On clean shutdown the header is marked as clean, and the next instance
+ * to open the file with the same geometry reuses its contents.  If the
+ * server exited without closing the file, or the geometry changed, the
+ * file is reformatted.  Non-empty files which aren't caches are never
+ * touched.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#define LOG_PREFIX "cache - shm"
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../rlm_cache.h"
+#include "../../serialize.h"
+
+#define SHM_MAGIC		"FRCSHM01"
+#define SHM_VERSION		2
+#define SHM_HEADER_SIZE		4096		//!< Space reserved for the file header.
+#define SHM_PAGE_SIZE		65536		//!< Unit the arena is carved into slabs in.
+#define SHM_MIN_CHUNK		64		//!< Size of the smallest chunk class.
+#define SHM_CLASSES		11		//!< Chunk classes from 64 bytes to 64KiB.
+#define SHM_NONE		UINT64_MAX	//!< Empty chunk free list marker.
+#define SHM_PAGE_NONE		UINT32_MAX	//!< Empty page list marker.
+
+/** File header
+ *
+ */
+typedef struct {
+	char		magic[8];		//!< Identifies the file as a cache.
+	uint32_t	version;		//!< Layout version.
+	uint32_t	clean;			//!< Set when the file was closed cleanly.
+	uint64_t	size;			//!< Size of the file.
+	uint32_t	num_stripes;		//!< Number of stripes.
+	uint32_t	num_slots;		//!< Hash slots per stripe.
+	uint64_t	stripe_size;		//!< Bytes used by each stripe.
+} rlm_cache_shm_header_t;
+
+/** Hash slot, stored in the file
+ *
+ */
+typedef struct {
+	uint64_t	expires;		//!< When the entry expires.
+	uint64_t	offset;			//!< Of the entry's chunk in the stripe arena.
+	uint32_t	hash;			//!< Hash of the entry's key.
+	uint32_t	key_len;		//!< Length of the key, 0 if the slot is empty.
+	uint32_t	data_len;		//!< Length of the serialized entry.
+	uint16_t	class;			//!< Chunk class the entry is stored in.
+	uint16_t	referenced;		//!< Entry was found since the clock hand last passed.
+} rlm_cache_shm_slot_t;
+
+/** Page descriptor, stored in the file
+ *
+ */
+typedef struct {
+	uint64_t	free;			//!< Head of the page's chunk free list.
+	uint32_t	class;			//!< Chunk class the page is split into.
+	uint32_t	used;			//!< Chunks allocated from the page.
+	uint32_t	carved;			//!< Chunks handed out at least once.  Chunks
+						///< past this have never been used, and aren't
+						///< on the free list.
+	uint32_t	next;			//!< Next page in the class's partial list,
+						///< or the free page list.
+	uint32_t	prev;			//!< Previous page in the class's partial list.
+	uint32_t	pad;
+} rlm_cache_shm_page_t;
+
+/** Stripe header, stored in the file
+ *
+ */
+typedef struct {
+	uint64_t	num;			//!< Occupied slots.
+	uint32_t	free_pages;		//!< Head of the list of unused pages.
+	uint32_t	partial[SHM_CLASSES];	//!< Pages with chunks available, per class.
+	uint32_t	class_pages[SHM_CLASSES];	//!< Pages in use, per class.
+	uint32_t	pad;
+} rlm_cache_shm_stripe_hdr_t;
+
+/** Process local view of a stripe
+ *
+ */
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Serialises access to the stripe.
+
+	rlm_cache_shm_stripe_hdr_t	*hdr;		//!< Stripe header in the mapping.
+	rlm_cache_shm_slot_t		*slots;		//!< Hash slots in the mapping.
+	rlm_cache_shm_page_t		*pages;		//!< Page descriptors in the mapping.
+	uint32_t			num_pages;	//!< Pages in the arena.
+	uint8_t				*arena;		//!< Chunk storage in the mapping.
+
+	uint32_t			hand;		//!< Next slot the clock hand will examine.
+} rlm_cache_shm_stripe_t;
+
+typedef struct {
+	char const		*filename;	//!< File backing the cache.
+	size_t			size;		//!< Size of the file.
+	uint32_t		num_stripes;	//!< Number of independently locked stripes.
+	uint32_t		num_slots;	//!< Total hash slots, divided between the stripes.
+
+	int			fd;		//!< Open, locked, file descriptor.
+	uint8_t			*map;		//!< Start of the mapping.
+	rlm_cache_shm_header_t	*header;	//!< File header.
+
+	uint32_t		stripe_slots;	//!< Hash slots per stripe.  Always a power of 2.
+	rlm_cache_shm_stripe_t	*stripes;	//!< Array of stripes.
+} rlm_cache_shm_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED, rlm_cache_shm_t, filename) },
+	{ FR_CONF_OFFSET("size", FR_TYPE_SIZE, rlm_cache_shm_t, size), .dflt = "64M" },
+	{ FR_CONF_OFFSET("stripes", FR_TYPE_UINT32, rlm_cache_shm_t, num_stripes), .dflt = "16" },
+	{ FR_CONF_OFFSET("slots", FR_TYPE_UINT32, rlm_cache_shm_t, num_slots), .dflt = "65536" },
+	CONF_PARSER_TERMINATOR
+};
+
+static inline CC_HINT(always_inline)
+rlm_cache_shm_stripe_t *shm_stripe(rlm_cache_shm_t const *driver, uint32_t hash)
+{
+	return &driver->stripes[hash % driver->num_stripes];
+}
+
+static inline CC_HINT(always_inline)
+uint32_t shm_slot_ideal(rlm_cache_shm_t const *driver, uint32_t hash)
+{
+	return (hash / driver->num_stripes) & (driver->stripe_slots - 1);
+}
+
+/** Return the smallest chunk class which will hold len bytes
+ *
+ * @return the chunk class, or -1 if len is too large.
+ */
+static int shm_class(size_t len)
+{
+	int i;
+
+	for (i = 0; i < SHM_CLASSES; i++) if (len <= ((size_t)SHM_MIN_CHUNK << i)) return i;
+
+	return -1;
+}
+
+/** Add a page to its class's list of pages with chunks available
+ *
+ */
+static void shm_page_link(rlm_cache_shm_stripe_t *stripe, uint32_t p)
+{
+	rlm_cache_shm_page_t	*page = &stripe->pages[p];
+	uint32_t		*head = &stripe->hdr->partial[page->class];
+
+	page->prev = SHM_PAGE_NONE;
+	page->next = *head;
+	if (*head != SHM_PAGE_NONE) stripe->pages[*head].prev = p;
+	*head = p;
+}
+
+/** Remove a page from its class's list of pages with chunks available
+ *
+ */
+static void shm_page_unlink(rlm_cache_shm_stripe_t *stripe, uint32_t p)
+{
+	rlm_cache_shm_page_t	*page = &stripe->pages[p];
+
+	if (page->prev != SHM_PAGE_NONE) {
+		stripe->pages[page->prev].next = page->next;
+	} else {
+		stripe->hdr->partial[page->class] = page->next;
+	}
+	if (page->next != SHM_PAGE_NONE) stripe->pages[page->next].prev = page->prev;
+
+	page->next = page->prev = SHM_PAGE_NONE;
+}
+
+static inline CC_HINT(always_inline)
+bool shm_page_full(rlm_cache_shm_page_t const *page)
+{
+	return (page->free == SHM_NONE) && (page->carved == (SHM_PAGE_SIZE / ((uint32_t)SHM_MIN_CHUNK << page->class)));
+}
+
+/** Allocate a chunk from a stripe's arena
+ *
+ * Stripe must be locked.
+ *
+ * @return offset of the chunk, or #SHM_NONE if there are no chunks of
+ *	this class available, and no free pages.
+ */
+static uint64_t shm_chunk_alloc(rlm_cache_shm_stripe_t *stripe, int class)
+{
+	rlm_cache_shm_stripe_hdr_t	*hdr = stripe->hdr;
+	rlm_cache_shm_page_t		*page;
+	uint32_t			p = hdr->partial[class];
+	uint64_t			offset;
+
+	if (p == SHM_PAGE_NONE) {
+		p = hdr->free_pages;
+		if (p == SHM_PAGE_NONE) return SHM_NONE;
+
+		page = &stripe->pages[p];
+		hdr->free_pages = page->next;
+
+		*page = (rlm_cache_shm_page_t){
+			.free = SHM_NONE,
+			.class = class
+		};
+		shm_page_link(stripe, p);
+		hdr->class_pages[class]++;
+	}
+	page = &stripe->pages[p];
+
+	if (page->free != SHM_NONE) {
+		offset = page->free;
+		memcpy(&page->free, stripe->arena + offset, sizeof(uint64_t));
+	} else {
+		offset = ((uint64_t)p * SHM_PAGE_SIZE) + ((uint64_t)page->carved++ * ((uint64_t)SHM_MIN_CHUNK << class));
+	}
+	page->used++;
+
+	if (shm_page_full(page)) shm_page_unlink(stripe, p);
+
+	return offset;
+}
+
+/** Return a chunk to its page, and the page to the free page list if it's empty
+ *
+ * Stripe must be locked.
+ */
+static void shm_chunk_free(rlm_cache_shm_stripe_t *stripe, uint64_t offset)
+{
+	uint32_t		p = offset / SHM_PAGE_SIZE;
+	rlm_cache_shm_page_t	*page = &stripe->pages[p];
+	bool			full = shm_page_full(page);
+
+	if (--page->used == 0) {
+		if (!full) shm_page_unlink(stripe, p);
+		stripe->hdr->class_pages[page->class]--;
+
+		page->next = stripe->hdr->free_pages;
+		stripe->hdr->free_pages = p;
+		return;
+	}
+
+	memcpy(stripe->arena + offset, &page->free, sizeof(uint64_t));
+	page->free = offset;
+
+	if (full) shm_page_link(stripe, p);
+}
+
+/** Find the slot holding a key
+ *
+ * Stripe must be locked.
+ *
+ * @return the slot index, or -1 if the key isn't in the cache.
+ */
+static int64_t shm_probe(rlm_cache_shm_t const *driver, rlm_cache_shm_stripe_t *stripe, uint32_t hash,
+			 uint8_t const *key, size_t key_len)
+{
+	uint32_t	mask = driver->stripe_slots - 1;
+	uint32_t	i = shm_slot_ideal(driver, hash);
+	uint32_t	n;
+
+	for (n = 0; n < driver->stripe_slots; n++, i = (i + 1) & mask) {
+		rlm_cache_shm_slot_t *slot = &stripe->slots[i];
+
+		if (!slot->key_len) return -1;
+
+		if ((slot->hash == hash) && (slot->key_len == key_len) &&
+		    (memcmp(stripe->arena + slot->offset, key, key_len) == 0)) return i;
+	}
+
+	return -1;
+}
+
+/** Remove an entry, freeing its chunk
+ *
+ * Entries after it in the probe sequence are shifted back, so lookups
+ * never need to skip over deleted slots.
+ *
+ * Stripe must be locked.
+ */
+static void shm_slot_remove(rlm_cache_shm_t const *driver, rlm_cache_shm_stripe_t *stripe, uint32_t j)
+{
+	rlm_cache_shm_slot_t	*slots = stripe->slots;
+	uint32_t		mask = driver->stripe_slots - 1;
+	uint32_t		k = j;
+
+	shm_chunk_free(stripe, slots[j].offset);
+	stripe->hdr->num--;
+
+	for (;;) {
+		uint32_t ideal;
+
+		k = (k + 1) & mask;
+		if (!slots[k].key_len) break;
+
+		/*
+		 *	Leave entries whose ideal slot lies
+		 *	between the hole and where they are.
+		 */
+		ideal = shm_slot_ideal(driver, slots[k].hash);
+		if (((k - ideal) & mask) < ((k - j) & mask)) continue;
+
+		slots[j] = slots[k];
+		j = k;
+	}
+
+	memset(&slots[j], 0, sizeof(slots[j]));
+}
+
+/** Advance the clock hand to the next entry which should be evicted
+ *
+ * Referenced entries have their reference bit cleared, and are skipped.
+ * Expired entries are always chosen.
+ *
+ * Stripe must be locked.
+ *
+ * @param[in] driver	Driver instance.
+ * @param[in] stripe	to evict from.
+ * @param[in] class	only consider entries in this chunk class, or -1 for any.
+ * @param[in] now	Current time.
+ * @return the slot index, or -1 if there were no candidates.
+ */
+static int64_t shm_clock_victim(rlm_cache_shm_t const *driver, rlm_cache_shm_stripe_t *stripe, int class, uint64_t now)
+{
+	uint32_t	mask = driver->stripe_slots - 1;
+	uint32_t	n;
+
+	/*
+	 *	The first lap clears every reference bit, so
+	 *	the second is guaranteed to find a victim.
+	 */
+	for (n = 0; n < (driver->stripe_slots * 2); n++) {
+		uint32_t		i = stripe->hand;
+		rlm_cache_shm_slot_t	*slot = &stripe->slots[i];
+
+		stripe->hand = (i + 1) & mask;
+
+		if (!slot->key_len) continue;
+		if ((class >= 0) && (slot->class != (uint16_t)class)) continue;
+
+		if ((slot->expires >= now) && slot->referenced) {
+			slot->referenced = 0;
+			continue;
+		}
+
+		return i;
+	}
+
+	return -1;
+}
+
+/** Remove one entry to make room for another
+ *
+ * Stripe must be locked.
+ *
+ * @param[in] driver	Driver instance.
+ * @param[in] stripe	to evict from.
+ * @param[in] class	only consider entries in this chunk class, or -1 for any.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if an entry was removed.
+ *	- false if there were no candidates.
+ */
+static bool shm_evict(rlm_cache_shm_t const *driver, rlm_cache_shm_stripe_t *stripe, int class, uint64_t now)
+{
+	int64_t victim;
+
+	victim = shm_clock_victim(driver, stripe, class, now);
+	if (victim < 0) return false;
+
+	shm_slot_remove(driver, stripe, victim);
+
+	return true;
+}
+
+/** Empty the page holding the next entry the clock hand chooses
+ *
+ * Used when a chunk class has no pages, and there are no free pages,
+ * so the page can be split into chunks of another class.  This needs
+ * a scan of the stripe's slots, but only happens when the mix of
+ * entry sizes changes.
+ *
+ * Stripe must be locked.
+ *
+ * @return
+ *	- true if a page was freed.
+ *	- false if the stripe is empty.
+ */
+static bool shm_evict_page(rlm_cache_shm_t const *driver, rlm_cache_shm_stripe_t *stripe, uint64_t now)
+{
+	int64_t		victim;
+	uint32_t	p, i;
+
+	victim = shm_clock_victim(driver, stripe, -1, now);
+	if (victim < 0) return false;
+
+	p = stripe->slots[victim].offset / SHM_PAGE_SIZE;
+
+	/*
+	 *	Removing a slot may shift a later one into
+	 *	it, so only advance if nothing was removed.
+	 */
+	for (i = 0; i < driver->stripe_slots;) {
+		rlm_cache_shm_slot_t *slot = &stripe->slots[i];
+
+		if (!slot->key_len || ((slot->offset / SHM_PAGE_SIZE) != p)) {
+			i++;
+			continue;
+		}
+
+		shm_slot_remove(driver, stripe, i);
+		if (!stripe->pages[p].used) break;
+	}
+
+	return true;
+}
+
+/** Initialise an empty cache in the mapping
+ *
+ */
+static void shm_format(rlm_cache_shm_t *driver, uint64_t stripe_size)
+{
+	rlm_cache_shm_header_t	*header = driver->header;
+	uint32_t		i;
+
+	memset(header, 0, SHM_HEADER_SIZE);
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		rlm_cache_shm_stripe_t	*stripe = &driver->stripes[i];
+		int			j;
+		uint32_t		p;
+
+		memset(stripe->hdr, 0, sizeof(*stripe->hdr));
+		for (j = 0; j < SHM_CLASSES; j++) stripe->hdr->partial[j] = SHM_PAGE_NONE;
+		memset(stripe->slots, 0, sizeof(rlm_cache_shm_slot_t) * driver->stripe_slots);
+
+		stripe->hdr->free_pages = SHM_PAGE_NONE;
+		for (p = stripe->num_pages; p > 0; p--) {
+			stripe->pages[p - 1] = (rlm_cache_shm_page_t){ .next = stripe->hdr->free_pages };
+			stripe->hdr->free_pages = p - 1;
+		}
+	}
+
+	header->version = SHM_VERSION;
+	header->size = driver->size;
+	header->num_stripes = driver->num_stripes;
+	header->num_slots = driver->stripe_slots;
+	header->stripe_size = stripe_size;
+	memcpy(header->magic, SHM_MAGIC, sizeof(header->magic));
+}
+
+/** Cleanup a cache_shm instance
+ *
+ * Marks the file as clean so the next instance can reuse its contents.
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_shm_t	*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	uint32_t	i;
+
+	if (driver->map) {
+		driver->header->clean = 1;
+		if (msync(driver->map, driver->size, MS_SYNC) < 0) {
+			ERROR("Failed syncing \"%s\": %s", driver->filename, fr_syserror(errno));
+		}
+		munmap(driver->map, driver->size);
+	}
+	if (driver->fd > 0) close(driver->fd);	/* also releases the lock */
+
+	if (driver->stripes) for (i = 0; i < driver->num_stripes; i++) {
+		pthread_mutex_destroy(&driver->stripes[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_shm instance
+ *
+ * Opens, locks and maps the backing file, reusing its contents if it was
+ * closed cleanly with the same geometry.  Existing files are only
+ * reformatted if they start with #SHM_MAGIC.
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	struct stat		st;
+	uint64_t		stripe_size, fixed;
+	uint32_t		num_pages;
+	char const		*reformat = NULL;
+	bool			discard = false;
+	uint32_t		i;
+
+	driver->fd = -1;
+
+	FR_INTEGER_BOUND_CHECK("stripes", driver->num_stripes, >=, 1);
+	FR_INTEGER_BOUND_CHECK("stripes", driver->num_stripes, <=, 256);
+
+	/*
+	 *	Slot selection is done with a mask.
+	 */
+	driver->stripe_slots = 16;
+	while (driver->stripe_slots < (driver->num_slots / driver->num_stripes)) driver->stripe_slots <<= 1;
+
+	stripe_size = ((driver->size - SHM_HEADER_SIZE) / driver->num_stripes) & ~((uint64_t)63);
+	fixed = sizeof(rlm_cache_shm_stripe_hdr_t) + (sizeof(rlm_cache_shm_slot_t) * driver->stripe_slots);
+	if ((driver->size <= SHM_HEADER_SIZE) ||
+	    (stripe_size < (fixed + sizeof(rlm_cache_shm_page_t) + SHM_PAGE_SIZE))) {
+		cf_log_err(conf, "'size' of %zu bytes is too small for %u stripes of %u slots",
+			   driver->size, driver->num_stripes, driver->stripe_slots);
+		return -1;
+	}
+	num_pages = (stripe_size - fixed) / (sizeof(rlm_cache_shm_page_t) + SHM_PAGE_SIZE);
+
+	driver->fd = open(driver->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (driver->fd < 0) {
+		cf_log_err(conf, "Failed opening \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Only one server may use the file at a time.
+	 */
+	if (rad_lockfd_nonblock(driver->fd, 0) < 0) {
+		cf_log_err(conf, "Failed locking \"%s\", is another server using it?: %s",
+			   driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(driver->fd, &st) < 0) {
+		cf_log_err(conf, "Failed getting size of \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		reformat = "new file";
+	} else {
+		rlm_cache_shm_header_t	header;
+		ssize_t			len;
+
+		/*
+		 *	Never truncate or overwrite a file we didn't
+		 *	create, in case filename points at something
+		 *	important.
+		 */
+		len = pread(driver->fd, &header, sizeof(header), 0);
+		if (len < 0) {
+			cf_log_err(conf, "Failed reading \"%s\": %s", driver->filename, fr_syserror(errno));
+			return -1;
+		}
+		if (((size_t)len < sizeof(header)) || (memcmp(header.magic, SHM_MAGIC, sizeof(header.magic)) != 0)) {
+			cf_log_err(conf, "\"%s\" is not a cache file, refusing to overwrite it", driver->filename);
+			return -1;
+		}
+
+		if (header.version != SHM_VERSION) {
+			reformat = "version changed";
+			discard = true;
+		} else if ((header.size != driver->size) || ((uint64_t)st.st_size != driver->size) ||
+			   (header.num_stripes != driver->num_stripes) ||
+			   (header.num_slots != driver->stripe_slots) ||
+			   (header.stripe_size != stripe_size)) {
+			reformat = "geometry changed";
+			discard = true;
+		} else if (!header.clean) {
+			reformat = "not closed cleanly";
+		}
+	}
+
+	if ((uint64_t)st.st_size != driver->size) {
+		if (ftruncate(driver->fd, driver->size) < 0) {
+			cf_log_err(conf, "Failed resizing \"%s\": %s", driver->filename, fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	driver->map = mmap(NULL, driver->size, PROT_READ | PROT_WRITE, MAP_SHARED, driver->fd, 0);
+	if (driver->map == MAP_FAILED) {
+		driver->map = NULL;
+		cf_log_err(conf, "Failed mapping \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+	driver->header = (rlm_cache_shm_header_t *)driver->map;
+
+	driver->stripes = talloc_zero_array(driver, rlm_cache_shm_stripe_t, driver->num_stripes);
+	if (!driver->stripes) {
+		ERROR("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		rlm_cache_shm_stripe_t	*stripe = &driver->stripes[i];
+		uint8_t			*base = driver->map + SHM_HEADER_SIZE + (stripe_size * i);
+
+		stripe->hdr = (rlm_cache_shm_stripe_hdr_t *)base;
+		stripe->slots = (rlm_cache_shm_slot_t *)(base + sizeof(rlm_cache_shm_stripe_hdr_t));
+		stripe->pages = (rlm_cache_shm_page_t *)(base + fixed);
+		stripe->num_pages = num_pages;
+		stripe->arena = base + fixed + (sizeof(rlm_cache_shm_page_t) * num_pages);
+
+		if (pthread_mutex_init(&stripe->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	if (reformat) {
+		if (discard) {
+			WARN("Reformatting \"%s\" (%s), existing entries will be discarded",
+			     driver->filename, reformat);
+		} else {
+			INFO("Initialising \"%s\" (%s)", driver->filename, reformat);
+		}
+		shm_format(driver, stripe_size);
+	} else {
+		uint64_t num = 0;
+
+		for (i = 0; i < driver->num_stripes; i++) num += driver->stripes[i].hdr->num;
+		INFO("Loaded %" PRIu64 " entries from \"%s\"", num, driver->filename);
+	}
+
+	/*
+	 *	Until we close the file cleanly, its contents
+	 *	can't be trusted.
+	 */
+	driver->header->clean = 0;
+	if (msync(driver->map, SHM_HEADER_SIZE, MS_SYNC) < 0) {
+		ERROR("Failed syncing \"%s\": %s", driver->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Free an entry returned by #cache_entry_find
+ *
+ * @copydetails cache_entry_free_t
+ */
+static void cache_entry_free(rlm_cache_entry_t *c)
+{
+	talloc_free(c);
+}
+
+/** Locate a cache entry
+ *
+ * The serialized entry is copied out while the stripe is locked, and
+ * decoded after it's released.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       rlm_cache_config_t const *config, void *instance,
+				       request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	rlm_cache_shm_stripe_t	*stripe;
+	rlm_cache_shm_slot_t	*slot;
+	rlm_cache_entry_t	*c;
+	uint32_t		hash;
+	int64_t			idx;
+	char			*data;
+	size_t			data_len;
+
+	hash = fr_hash(key, key_len);
+	stripe = shm_stripe(driver, hash);
+
+	pthread_mutex_lock(&stripe->mutex);
+	idx = shm_probe(driver, stripe, hash, key, key_len);
+	if (idx < 0) {
+	miss:
+		pthread_mutex_unlock(&stripe->mutex);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	slot = &stripe->slots[idx];
+
+	if ((slot->expires + fr_time_delta_unwrap(config->stale_while_revalidate)) <
+	    fr_unix_time_unwrap(fr_time_to_unix_time(request->packet->timestamp))) {
+		shm_slot_remove(driver, stripe, idx);
+		goto miss;
+	}
+
+	slot->referenced = 1;
+
+	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+	fr_map_list_init(&c->maps);
+
+	data_len = slot->data_len;
+	MEM(data = talloc_array(c, char, data_len + 1));
+	memcpy(data, stripe->arena + slot->offset + slot->key_len, data_len);
+	data[data_len] = '\0';
+	pthread_mutex_unlock(&stripe->mutex);
+
+	if (cache_deserialize(c, request->dict, data, data_len) < 0) {
+		RPERROR("Invalid entry");
+		talloc_free(c);
+		return CACHE_ERROR;
+	}
+	talloc_free(data);
+
+	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
+
+	*out = c;
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If the stripe is full, or has no free chunks of the right size,
+ * entries are evicted with the stripe's clock hand to make room.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle, rlm_cache_entry_t const *c)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	rlm_cache_shm_stripe_t	*stripe;
+	TALLOC_CTX		*pool;
+	char			*to_store;
+	size_t			data_len;
+	uint64_t		now, offset;
+	uint32_t		hash, mask = driver->stripe_slots - 1, i;
+	int64_t			idx;
+	int			class;
+
+	pool = talloc_pool(NULL, 1024);
+	if (!pool) return CACHE_ERROR;
+
+	if (cache_serialize(pool, &to_store, c) < 0) {
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+	data_len = talloc_array_length(to_store) - 1;
+
+	class = shm_class(c->key_len + data_len);
+	if (class < 0) {
+		RERROR("Entry of %zu bytes is too large to cache", c->key_len + data_len);
+		talloc_free(pool);
+		return CACHE_ERROR;
+	}
+
+	now = fr_unix_time_unwrap(fr_time_to_unix_time(request->packet->timestamp));
+	hash = fr_hash(c->key, c->key_len);
+	stripe = shm_stripe(driver, hash);
+
+	pthread_mutex_lock(&stripe->mutex);
+
+	/*
+	 *	Allow overwriting
+	 */
+	idx = shm_probe(driver, stripe, hash, c->key, c->key_len);
+	if (idx >= 0) shm_slot_remove(driver, stripe, idx);
+
+	/*
+	 *	Keep the table at most 3/4 full so probe
+	 *	sequences stay short.
+	 */
+	while (stripe->hdr->num >= (driver->stripe_slots - (driver->stripe_slots / 4))) {
+		if (!shm_evict(driver, stripe, -1, now)) break;
+	}
+
+	/*
+	 *	If the class holds pages they're all full, so
+	 *	evicting one of its entries frees a chunk we
+	 *	can use.  Otherwise take a page from another
+	 *	class.
+	 */
+	while ((offset = shm_chunk_alloc(stripe, class)) == SHM_NONE) {
+		bool evicted;
+
+		if (stripe->hdr->class_pages[class] > 0) {
+			evicted = shm_evict(driver, stripe, class, now);
+		} else {
+			evicted = shm_evict_page(driver, stripe, now);
+		}
+		if (!evicted) {
+			pthread_mutex_unlock(&stripe->mutex);
+			talloc_free(pool);
+			RERROR("No space left for an entry of %zu bytes", c->key_len + data_len);
+			return CACHE_ERROR;
+		}
+	}
+
+	memcpy(stripe->arena + offset, c->key, c->key_len);
+	memcpy(stripe->arena + offset + c->key_len, to_store, data_len);
+
+	for (i = shm_slot_ideal(driver, hash); stripe->slots[i].key_len; i = (i + 1) & mask);
+
+	stripe->slots[i] = (rlm_cache_shm_slot_t){
+		.expires = fr_unix_time_unwrap(c->expires),
+		.offset = offset,
+		.hash = hash,
+		.key_len = c->key_len,
+		.data_len = data_len,
+		.class = class
+	};
+	stripe->hdr->num++;
+
+	pthread_mutex_unlock(&stripe->mutex);
+	talloc_free(pool);
+
+	return CACHE_OK;
+}
+
+/** Remove an entry from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_shm_t		*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	rlm_cache_shm_stripe_t	*stripe;
+	uint32_t		hash;
+	int64_t			idx;
+
+	if (!request) return CACHE_ERROR;
+
+	hash = fr_hash(key, key_len);
+	stripe = shm_stripe(driver, hash);
+
+	pthread_mutex_lock(&stripe->mutex);
+	idx = shm_probe(driver, stripe, hash, key, key_len);
+	if (idx < 0) {
+		pthread_mutex_unlock(&stripe->mutex);
+		return CACHE_MISS;
+	}
+	shm_slot_remove(driver, stripe, idx);
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_shm_t	*driver = talloc_get_type_abort(instance, rlm_cache_shm_t);
+	uint64_t	count = 0;
+	uint32_t	i;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		pthread_mutex_lock(&driver->stripes[i].mutex);
+		count += driver->stripes[i].hdr->num;
+		pthread_mutex_unlock(&driver->stripes[i].mutex);
+	}
+
+	return count;
+}
+
+extern rlm_cache_driver_t rlm_cache_shm;
+rlm_cache_driver_t rlm_cache_shm = {
+	.name		= "rlm_cache_shm",
+	.magic		= RLM_MODULE_INIT,
+	.config		= driver_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_shm_t),
+
+	.free		= cache_entry_free,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.count		= cache_entry_count,
+};
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #define LOG_PREFIX inst->config.name
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/dl_module.h>
@@ -40,6 +41,10 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_cache_config_t, key) },
 	{ FR_CONF_OFFSET("ttl", FR_TYPE_TIME_DELTA, rlm_cache_config_t, ttl), .dflt = "500s" },
 	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_cache_config_t, max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_memory", FR_TYPE_SIZE, rlm_cache_config_t, max_memory), .dflt = "0" },
+	{ FR_CONF_OFFSET("single_flight", FR_TYPE_BOOL, rlm_cache_config_t, single_flight), .dflt = "no" },
+	{ FR_CONF_OFFSET("single_flight_timeout", FR_TYPE_TIME_DELTA, rlm_cache_config_t, single_flight_timeout), .dflt = "1s" },
+	{ FR_CONF_OFFSET("stale_while_revalidate", FR_TYPE_TIME_DELTA, rlm_cache_config_t, stale_while_revalidate), .dflt = "0" },
 
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", FR_TYPE_INT32, rlm_cache_config_t, epoch), .dflt = "0" },
@@ -191,7 +196,228 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 		RLM_MODULE_OK;
 }
 
+/** Keys currently being populated by a request
+ *
+ * Shared between all workers.
+ */
+struct rlm_cache_flight_s {
+	pthread_mutex_t		mutex;			//!< Protects the tree.
+	fr_rb_tree_t		*tree;			//!< In flight keys.
+};
+
+/** Marker for a key which is being populated
+ *
+ * Stored as request data of the request populating the key, so it's
+ * removed automatically if that request is freed before the entry is
+ * stored.
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the in flight tree.
+	rlm_cache_flight_t	*flight;		//!< Tree we're in.
+	request_t const		*owner;			//!< Request populating the key.  Only compared.
+	uint8_t			*key;			//!< Key being populated.
+	size_t			key_len;		//!< Length of the key.
+	fr_time_t		expires;		//!< Stop making other requests wait after this.
+} cache_flight_entry_t;
+
+/** A request waiting for another to populate a key
+ *
+ */
+typedef struct {
+	rlm_cache_t const	*inst;			//!< Instance of rlm_cache.
+	request_t		*request;		//!< Request which is waiting.
+	uint8_t			*key;			//!< Key being waited on.
+	size_t			key_len;		//!< Length of the key.
+	fr_time_t		deadline;		//!< Give up waiting after this.
+	fr_time_delta_t		interval;		//!< Current polling interval.
+	fr_event_timer_t const	*ev;			//!< Polling timer.
+} cache_flight_wait_t;
+
+typedef enum {
+	CACHE_FLIGHT_PROCEED = 0,			//!< Nothing in flight, or single flight disabled.
+	CACHE_FLIGHT_LEAD,				//!< This request is populating the key.
+	CACHE_FLIGHT_WAIT				//!< Another request is populating the key.
+} cache_flight_status_t;
+
+static int8_t cache_flight_cmp(void const *one, void const *two)
+{
+	cache_flight_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+static int _cache_flight_entry_free(cache_flight_entry_t *fe)
+{
+	pthread_mutex_lock(&fe->flight->mutex);
+	fr_rb_delete(fe->flight->tree, fe);
+	pthread_mutex_unlock(&fe->flight->mutex);
+
+	return 0;
+}
+
+/** Claim a key, so other requests wait for us to populate it
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] key	to claim.
+ * @param[in] key_len	Length of the key.
+ * @param[in] waited	Whether the request already waited for this key.
+ *			If so it's never asked to wait again.
+ * @return
+ *	- #CACHE_FLIGHT_LEAD if the request now owns the key.
+ *	- #CACHE_FLIGHT_WAIT if another request owns the key.
+ *	- #CACHE_FLIGHT_PROCEED if the request should carry on without a claim.
+ */
+static cache_flight_status_t cache_flight_claim(rlm_cache_t const *inst, request_t *request,
+						uint8_t const *key, size_t key_len, bool waited)
+{
+	rlm_cache_flight_t	*flight = inst->flight;
+	cache_flight_entry_t	*fe;
+	fr_time_t		now = fr_time();
+
+	if (!flight) return CACHE_FLIGHT_PROCEED;
+
+	pthread_mutex_lock(&flight->mutex);
+	fe = fr_rb_find(flight->tree, &(cache_flight_entry_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (fe) {
+		cache_flight_status_t status;
+
+		if (fe->owner == request) {
+			status = CACHE_FLIGHT_LEAD;
+		} else if (waited || fr_time_gt(now, fe->expires)) {
+			status = CACHE_FLIGHT_PROCEED;
+		} else {
+			status = CACHE_FLIGHT_WAIT;
+		}
+		pthread_mutex_unlock(&flight->mutex);
+
+		return status;
+	}
+	pthread_mutex_unlock(&flight->mutex);
+
+	/*
+	 *	Replaces (and so releases) any other key this
+	 *	request was populating.
+	 */
+	MEM(fe = talloc_zero(NULL, cache_flight_entry_t));
+	fe->flight = flight;
+	fe->owner = request;
+	fe->key = talloc_memdup(fe, key, key_len);
+	fe->key_len = key_len;
+	fe->expires = fr_time_add(now, inst->config.single_flight_timeout);
+
+	pthread_mutex_lock(&flight->mutex);
+	if (!fr_rb_insert(flight->tree, fe)) {
+		pthread_mutex_unlock(&flight->mutex);
+		talloc_free(fe);
+
+		return waited ? CACHE_FLIGHT_PROCEED : CACHE_FLIGHT_WAIT;	/* Lost the race */
+	}
+	pthread_mutex_unlock(&flight->mutex);
+
+	talloc_set_destructor(fe, _cache_flight_entry_free);
+	(void) request_data_talloc_add(request, inst, 0, cache_flight_entry_t, fe, true, true, false);
+
+	RDEBUG3("Claimed \"%pV\", other requests will wait for it", fr_box_strvalue_len((char const *)key, key_len));
+
+	return CACHE_FLIGHT_LEAD;
+}
+
+/** Release any key claimed by this request
+ *
+ */
+static void cache_flight_release(rlm_cache_t const *inst, request_t *request)
+{
+	if (!inst->flight) return;
+
+	talloc_free(request_data_get(request, inst, 0));
+}
+
+/** Check whether a key is still being populated
+ *
+ */
+static bool cache_flight_busy(rlm_cache_t const *inst, uint8_t const *key, size_t key_len)
+{
+	bool busy;
+
+	pthread_mutex_lock(&inst->flight->mutex);
+	busy = (fr_rb_find(inst->flight->tree,
+			   &(cache_flight_entry_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len }) != NULL);
+	pthread_mutex_unlock(&inst->flight->mutex);
+
+	return busy;
+}
+
+/** Poll for the key we're waiting on to be populated
+ *
+ * The request populating the key is probably running on another worker,
+ * so it can't wake us directly.
+ */
+static void cache_flight_poll(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	cache_flight_wait_t	*w = talloc_get_type_abort(uctx, cache_flight_wait_t);
+
+	if (fr_time_lt(now, w->deadline) && cache_flight_busy(w->inst, w->key, w->key_len)) {
+		w->interval = fr_time_delta_add(w->interval, w->interval);
+		if (fr_time_delta_gt(w->interval, fr_time_delta_from_msec(50))) w->interval = fr_time_delta_from_msec(50);
+
+		if (fr_event_timer_in(w, el, &w->ev, w->interval, cache_flight_poll, w) == 0) return;
+	}
+
+	unlang_interpret_mark_runnable(w->request);
+}
+
+static void cache_flight_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	talloc_free(mctx->rctx);	/* Disarms the timer */
+}
+
+/** Yield until another request has populated a key, or we time out
+ *
+ * The resume function should retry the lookup, and must free mctx->rctx.
+ */
+static unlang_action_t cache_flight_wait(rlm_rcode_t *p_result, rlm_cache_t const *inst, request_t *request,
+					 uint8_t const *key, size_t key_len, unlang_module_resume_t resume)
+{
+	cache_flight_wait_t *w;
+
+	MEM(w = talloc_zero(request, cache_flight_wait_t));
+	w->inst = inst;
+	w->request = request;
+	w->key = talloc_memdup(w, key, key_len);
+	w->key_len = key_len;
+	w->deadline = fr_time_add(fr_time(), inst->config.single_flight_timeout);
+	w->interval = fr_time_delta_from_msec(1);
+
+	if (fr_event_timer_in(w, unlang_interpret_event_list(request), &w->ev, w->interval, cache_flight_poll, w) < 0) {
+		RPEDEBUG("Failed inserting event");
+		talloc_free(w);
+		RETURN_MODULE_FAIL;
+	}
+
+	RDEBUG2("Another request is populating \"%pV\", waiting for it", fr_box_strvalue_len((char const *)key, key_len));
+
+	return unlang_module_yield(request, resume, cache_flight_signal, w);
+}
+
 /** Find a cached entry.
+ *
+ * If stale_while_revalidate is set, and the entry expired recently, one
+ * request is told the entry doesn't exist so it refreshes it.  Everyone
+ * else is served the stale entry until the refresh completes.
+ *
+ * @param[out] p_result	Result of the lookup.
+ * @param[out] out	Where to write the entry.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] handle	Driver handle.
+ * @param[in] key	to look up.
+ * @param[in] key_len	Length of the key.
+ * @param[in] revalidate	Whether the caller will repopulate the entry on a miss.
+ *				Stale entries are only served to callers which set this.
  *
  * @return
  *	- #RLM_MODULE_OK on cache hit.
@@ -200,7 +426,7 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
  */
 static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out,
 				  rlm_cache_t const *inst, request_t *request,
-				  rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len)
+				  rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len, bool revalidate)
 {
 	cache_status_t ret;
 
@@ -221,6 +447,7 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 
 		case CACHE_MISS:
 			RDEBUG2("No cache entry found for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+			atomic_fetch_add_explicit(&inst->stats->misses, 1, memory_order_relaxed);
 			RETURN_MODULE_NOTFOUND;
 
 		default:
@@ -231,6 +458,28 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 		break;
 	}
 
+	/*
+	 *	It expired, but recently enough that it can still
+	 *	be served while one request refreshes it.
+	 */
+	if (fr_unix_time_lt(c->expires, fr_time_to_unix_time(request->packet->timestamp)) &&
+	    !fr_unix_time_lt(c->created, fr_unix_time_from_sec(inst->config.epoch)) &&
+	    !fr_unix_time_lt(fr_unix_time_add(c->expires, inst->config.stale_while_revalidate),
+			     fr_time_to_unix_time(request->packet->timestamp))) {
+		if (revalidate &&
+		    (cache_flight_claim(inst, request, key, key_len, false) == CACHE_FLIGHT_WAIT)) {
+			RDEBUG2("Found stale entry for \"%pV\", serving it while another request refreshes it",
+				fr_box_strvalue_len((char const *)key, key_len));
+			goto found;
+		}
+
+		RDEBUG2("Found stale entry for \"%pV\", treating it as a miss so it's refreshed",
+			fr_box_strvalue_len((char const *)key, key_len));
+		cache_free(inst, &c);
+		atomic_fetch_add_explicit(&inst->stats->misses, 1, memory_order_relaxed);
+		RETURN_MODULE_NOTFOUND;	/* Left in place, inserts overwrite it */
+	}
+
 	/*
 	 *	Yes, but it expired, OR the "forget all" epoch has
 	 *	passed.  Delete it, and pretend it doesn't exist.
@@ -243,10 +492,13 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 
 		inst->driver->expire(&inst->config, inst->driver_inst->dl_inst->data, request, handle, c->key, c->key_len);
 		cache_free(inst, &c);
+		atomic_fetch_add_explicit(&inst->stats->misses, 1, memory_order_relaxed);
 		RETURN_MODULE_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
 
 	RDEBUG2("Found entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+found:
+	atomic_fetch_add_explicit(&inst->stats->hits, 1, memory_order_relaxed);
 
 	c->hits++;
 	*out = c;
@@ -303,7 +555,11 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 	TALLOC_CTX		*pool;
 
-	if ((inst->config.max_entries > 0) && inst->driver->count &&
+	/*
+	 *	Drivers which can evict enforce the limits
+	 *	themselves, once we know how big the entry is.
+	 */
+	if (!inst->driver->evict && (inst->config.max_entries > 0) && inst->driver->count &&
 	    (inst->driver->count(&inst->config, inst->driver_inst->dl_inst->data, request, handle) > inst->config.max_entries)) {
 		RWDEBUG("Cache is full: %d entries", inst->config.max_entries);
 		RETURN_MODULE_FAIL;
@@ -432,6 +688,23 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 	if (merge) cache_merge(inst, request, c);
 
+	if (inst->driver->evict) {
+		int evicted;
+
+		c->size = talloc_total_size(c);
+
+		evicted = inst->driver->evict(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
+		if (evicted < 0) {
+			RWDEBUG("Cache is full, and no room could be made for an entry of %zu bytes", c->size);
+			talloc_free(c);
+			RETURN_MODULE_FAIL;
+		}
+		if (evicted > 0) {
+			RDEBUG2("Evicted %i entries", evicted);
+			atomic_fetch_add_explicit(&inst->stats->evictions, evicted, memory_order_relaxed);
+		}
+	}
+
 	for (;;) {
 		cache_status_t ret;
 
@@ -443,6 +716,7 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 		case CACHE_OK:
 			RDEBUG2("Committed entry, TTL %pV seconds", fr_box_time_delta(ttl));
+			atomic_fetch_add_explicit(&inst->stats->inserts, 1, memory_order_relaxed);
 			cache_free(inst, &c);
 			RETURN_MODULE_RCODE(merge ? RLM_MODULE_UPDATED : RLM_MODULE_OK);
 
@@ -455,32 +729,44 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 
 /** Update the TTL of an entry
  *
+ * @param[out] p_result	Result of the update.
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] handle	Driver handle.
+ * @param[in] c		Entry to update.
+ * @param[in] expires	New expiry time.
  * @return
  *	- #RLM_MODULE_OK on success.
  *	- #RLM_MODULE_FAIL on failure.
  */
 static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 				     rlm_cache_t const *inst, request_t *request,
-				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c)
+				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c, fr_unix_time_t expires)
 {
 	/*
-	 *	Call the driver's insert method to overwrite the old entry
+	 *	Call the driver's insert method to overwrite the old entry.
+	 *	Drivers without set_ttl return entries private to the
+	 *	request, so we can update the expiry ourselves.
 	 */
-	if (!inst->driver->set_ttl) for (;;) {
-		cache_status_t ret;
+	if (!inst->driver->set_ttl) {
+		c->expires = expires;
 
-		ret = inst->driver->insert(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
-		switch (ret) {
-		case CACHE_RECONNECT:
-			if (cache_reconnect(handle, inst, request) == 0) continue;
-			RETURN_MODULE_FAIL;
+		for (;;) {
+			cache_status_t ret;
 
-		case CACHE_OK:
-			RDEBUG2("Updated entry TTL");
-			RETURN_MODULE_OK;
+			ret = inst->driver->insert(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
+			switch (ret) {
+			case CACHE_RECONNECT:
+				if (cache_reconnect(handle, inst, request) == 0) continue;
+				RETURN_MODULE_FAIL;
 
-		default:
-			RETURN_MODULE_FAIL;
+			case CACHE_OK:
+				RDEBUG2("Updated entry TTL");
+				RETURN_MODULE_OK;
+
+			default:
+				RETURN_MODULE_FAIL;
+			}
 		}
 	}
 
@@ -491,7 +777,7 @@ static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 	for (;;) {
 		cache_status_t ret;
 
-		ret = inst->driver->set_ttl(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
+		ret = inst->driver->set_ttl(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c, expires);
 		switch (ret) {
 		case CACHE_RECONNECT:
 			if (cache_reconnect(handle, inst, request) == 0) continue;
@@ -523,6 +809,8 @@ static int cache_verify(map_t *map, void *ctx)
 	return 0;
 }
 
+static unlang_action_t mod_cache_it_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
 /** Do caching checks
  *
  * Since we can update ANY VP list, we do exactly the same thing for all sections
@@ -530,8 +818,14 @@ static int cache_verify(map_t *map, void *ctx)
  *
  * If you want to cache something different in different sections, configure
  * another cache module.
+ *
+ * @param[out] p_result	Result of the operation.
+ * @param[in] mctx	Module calling ctx.
+ * @param[in] request	The current request.
+ * @param[in] waited	Whether we already waited for another request to populate
+ *			the entry.
  */
-static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, bool waited)
 {
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_cache_t);
@@ -576,7 +870,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			RETURN_MODULE_FAIL;
 		}
 
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find(&rcode, &c, inst, request, &handle, key, key_len, false);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 		fr_assert(!inst->driver->acquire || handle);
 
@@ -623,7 +917,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	 *	recording whether the entry existed.
 	 */
 	if (merge) {
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find(&rcode, &c, inst, request, &handle, key, key_len, true);
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
@@ -688,7 +982,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if ((exists < 0) && (insert || set_ttl)) {
 		rlm_rcode_t tmp;
 
-		cache_find(&tmp, &c, inst, request, &handle, key, key_len);
+		cache_find(&tmp, &c, inst, request, &handle, key, key_len, false);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -717,9 +1011,8 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 		fr_assert(c);
 
-		c->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
-
-		cache_set_ttl(&tmp, inst, request, &handle, c);
+		cache_set_ttl(&tmp, inst, request, &handle, c,
+			      fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl));
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -735,6 +1028,18 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		}
 	}
 
+	/*
+	 *	If another request is already populating the
+	 *	entry, wait for it rather than repeating the work.
+	 */
+	if (inst->config.single_flight && insert && (exists == 0) &&
+	    (cache_flight_claim(inst, request, key, key_len, waited) == CACHE_FLIGHT_WAIT)) {
+		cache_free(inst, &c);
+		cache_release(inst, request, &handle);
+
+		return cache_flight_wait(p_result, inst, request, key, key_len, mod_cache_it_resume);
+	}
+
 	/*
 	 *	Inserts are upserts, so we don't care about the
 	 *	entry state, just that we're not meant to be
@@ -769,6 +1074,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 finish:
 	cache_free(inst, &c);
 	cache_release(inst, request, &handle);
+	cache_flight_release(inst, request);
 
 	/*
 	 *	Clear control attributes
@@ -797,6 +1103,21 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	return cache_it(p_result, mctx, request, false);
+}
+
+/** Retry the cache checks once another request has populated the entry
+ *
+ */
+static unlang_action_t mod_cache_it_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	talloc_free(mctx->rctx);
+
+	return cache_it(p_result, mctx, request, true);
+}
+
 static int mod_xlat_thread_instantiate(UNUSED void *xlat_inst, void *xlat_thread_inst,
 				       UNUSED xlat_exp_t const *exp, void *uctx)
 {
@@ -860,7 +1181,7 @@ static xlat_action_t cache_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, request_t *r
 		return XLAT_ACTION_FAIL;
 	}
 
-	cache_find(&rcode, &c, xti->inst, request, &handle, key, key_len);
+	cache_find(&rcode, &c, xti->inst, request, &handle, key, key_len, false);
 	switch (rcode) {
 	case RLM_MODULE_OK:		/* found */
 		break;
@@ -942,6 +1263,8 @@ static int mod_detach(void *instance)
 {
 	rlm_cache_t *inst = instance;
 
+	if (inst->flight) pthread_mutex_destroy(&inst->flight->mutex);
+
 	/*
 	 *	We need to explicitly free all children, so if the driver
 	 *	parented any memory off the instance, their destructors
@@ -1017,6 +1340,38 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int cmd_stats_cache(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_cache_t const *inst = ctx;
+
+	fprintf(fp, "count.hits\t%" PRIu64 "\n", (uint64_t)atomic_load_explicit(&inst->stats->hits, memory_order_relaxed));
+	fprintf(fp, "count.misses\t%" PRIu64 "\n", (uint64_t)atomic_load_explicit(&inst->stats->misses, memory_order_relaxed));
+	fprintf(fp, "count.inserts\t%" PRIu64 "\n", (uint64_t)atomic_load_explicit(&inst->stats->inserts, memory_order_relaxed));
+	fprintf(fp, "count.evictions\t%" PRIu64 "\n", (uint64_t)atomic_load_explicit(&inst->stats->evictions, memory_order_relaxed));
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_cache_table[] = {
+	{
+		.parent = "stats",
+		.name = "cache",
+		.help = "Statistics for cache modules.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats cache",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_cache,
+		.help = "Show hit, miss and eviction counters for a cache module.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Create a new rlm_cache_instance
  *
  */
@@ -1064,6 +1419,28 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if ((inst->config.max_memory > 0) && !inst->driver->evict) {
+		cf_log_err(conf, "Driver \"%s\" does not support 'max_memory'", inst->config.driver_name);
+		return -1;
+	}
+
+	MEM(inst->stats = talloc_zero(inst, rlm_cache_stats_t));
+
+	if (inst->config.single_flight || fr_time_delta_ispos(inst->config.stale_while_revalidate)) {
+		MEM(inst->flight = talloc_zero(inst, rlm_cache_flight_t));
+		MEM(inst->flight->tree = fr_rb_inline_alloc(inst->flight, cache_flight_entry_t, node,
+							    cache_flight_cmp, NULL));
+		if (pthread_mutex_init(&inst->flight->mutex, NULL) < 0) {
+			cf_log_err(conf, "Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	if (fr_command_register_hook(NULL, inst->config.name, inst, cmd_cache_table) < 0) {
+		PERROR("Failed registering radmin commands for cache %s", inst->config.name);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1104,7 +1481,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_status(rlm_rcode_t *p_result,
 
 	fr_assert(!inst->driver->acquire || handle);
 
-	cache_find(&rcode, &entry, inst, request, &handle, key, key_len);
+	cache_find(&rcode, &entry, inst, request, &handle, key, key_len, false);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	rcode = (entry) ? RLM_MODULE_OK : RLM_MODULE_NOTFOUND;
@@ -1115,14 +1492,20 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+static unlang_action_t mod_method_load_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
 /** Load the avps by ${key}.
+ *
+ * With single_flight enabled, the first request to miss claims the key
+ * until it calls store, or completes.  Other requests which miss wait
+ * for it, then retry the load.
  *
  * @return
  *	- #RLM_MODULE_UPDATED on success.
  *	- #RLM_MODULE_NOTFOUND on cache miss.
  *	- #RLM_MODULE_FAIL on failure.
  */
-static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t cache_load(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request, bool waited)
 {
 	rlm_cache_t const	*inst = talloc_get_type_abort(mctx->inst->data, rlm_cache_t);
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
@@ -1150,10 +1533,17 @@ static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, m
 		RETURN_MODULE_FAIL;
 	}
 
-	cache_find(&rcode, &entry, inst, request, &handle, key, key_len);
+	cache_find(&rcode, &entry, inst, request, &handle, key, key_len, true);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
+		if (inst->config.single_flight &&
+		    (cache_flight_claim(inst, request, key, key_len, waited) == CACHE_FLIGHT_WAIT)) {
+			cache_release(inst, request, &handle);
+
+			return cache_flight_wait(p_result, inst, request, key, key_len, mod_method_load_resume);
+		}
+
 		WARN("Entry not found to be load");
 		rcode = RLM_MODULE_NOTFOUND;
 		goto finish;
@@ -1167,6 +1557,21 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_method_load(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	return cache_load(p_result, mctx, request, false);
+}
+
+/** Retry the load once another request has populated the entry
+ *
+ */
+static unlang_action_t mod_method_load_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	talloc_free(mctx->rctx);
+
+	return cache_load(p_result, mctx, request, true);
+}
+
 /** Create and insert a cache entry
  *
  * @return
@@ -1224,7 +1629,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, key, key_len);
+	cache_find(&rcode, &entry, inst, request, &handle, key, key_len, false);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (rcode == RLM_MODULE_OK) {
@@ -1232,9 +1637,8 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 
 		DEBUG3("Updating the TTL -> %pV", fr_box_time_delta(ttl));
 
-		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
-
-		cache_set_ttl(&rcode, inst, request, &handle, entry);
+		cache_set_ttl(&rcode, inst, request, &handle, entry,
+			      fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl));
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 	}
 
@@ -1263,6 +1667,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_store(rlm_rcode_t *p_result,
 
 finish:
 	cache_unref(request, inst, entry, handle);
+	cache_flight_release(inst, request);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -1302,7 +1707,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_clear(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
-	cache_find(&rcode, &entry, inst, request, &handle, key, key_len);
+	cache_find(&rcode, &entry, inst, request, &handle, key, key_len, false);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (!entry) {
@@ -1373,7 +1778,7 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 	/*
 	 *	We can only alter the TTL on an entry if it exists.
 	 */
-	cache_find(&rcode, &entry, inst, request, &handle, key, key_len);
+	cache_find(&rcode, &entry, inst, request, &handle, key, key_len, false);
 	if (rcode == RLM_MODULE_FAIL) goto finish;
 
 	if (rcode == RLM_MODULE_OK) {
@@ -1381,9 +1786,8 @@ static unlang_action_t CC_HINT(nonnull) mod_method_ttl(rlm_rcode_t *p_result, mo
 
 		DEBUG3("Updating the TTL -> %pV", fr_box_time_delta(ttl));
 
-		entry->expires = fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl);
-
-		cache_set_ttl(&rcode, inst, request, &handle, entry);
+		cache_set_ttl(&rcode, inst, request, &handle, entry,
+			      fr_unix_time_add(fr_time_to_unix_time(request->packet->timestamp), ttl));
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 
 		rcode = RLM_MODULE_UPDATED;
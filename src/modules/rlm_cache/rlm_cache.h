@@ -30,7 +30,14 @@ RCSIDH(cache_h, "$Id$")
 #include <freeradius-devel/server/map.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 typedef struct rlm_cache_driver_s rlm_cache_driver_t;
+typedef struct rlm_cache_flight_s rlm_cache_flight_t;
 
 typedef void rlm_cache_handle_t;
 
@@ -54,10 +61,26 @@ typedef struct {
 	tmpl_t			*key;			//!< What to expand to get the value of the key.
 	fr_time_delta_t		ttl;			//!< How long an entry is valid for.
 	uint32_t		max_entries;		//!< Maximum entries allowed.
+	size_t			max_memory;		//!< Maximum bytes of entry data allowed.
+	bool			single_flight;		//!< Only let one request populate a missing entry.
+	fr_time_delta_t		single_flight_timeout;	//!< Longest other requests wait for it.
+	fr_time_delta_t		stale_while_revalidate;	//!< How long after expiry an entry may still be
+							//!< served, while one request refreshes it.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
 } rlm_cache_config_t;
 
+/** Counters for an rlm_cache instance
+ *
+ * Updated from every worker thread, and read by radmin.
+ */
+typedef struct {
+	atomic_uint_fast64_t	hits;			//!< Lookups which found a valid entry.
+	atomic_uint_fast64_t	misses;			//!< Lookups which found nothing, or an expired entry.
+	atomic_uint_fast64_t	inserts;		//!< Entries successfully added.
+	atomic_uint_fast64_t	evictions;		//!< Entries removed to stay within limits.
+} rlm_cache_stats_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -73,6 +96,10 @@ typedef struct {
 
 	fr_map_list_t		maps;			//!< Attribute map applied to users.
 							//!< and profiles.
+
+	rlm_cache_stats_t	*stats;			//!< Hit/miss/eviction counters.
+	rlm_cache_flight_t	*flight;		//!< Keys being populated, for single_flight and
+							//!< stale_while_revalidate.
 } rlm_cache_t;
 
 typedef struct {
@@ -81,6 +108,7 @@ typedef struct {
 	long long int		hits;			//!< How many times the entry has been retrieved.
 	fr_unix_time_t		created;		//!< When the entry was created.
 	fr_unix_time_t		expires;		//!< When the entry expires.
+	size_t			size;			//!< Bytes of memory used by the entry and its maps.
 
 	fr_map_list_t		maps;			//!< Head of the maps list.
 } rlm_cache_entry_t;
@@ -199,7 +227,9 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
  * @param[in] request The current request.
  * @param[in] handle the driver gave us when we called #cache_acquire_t, or NULL if no
  *	#cache_acquire_t callback was provided.
- * @param[in] c to update the TTL of. c->ttl will have been set to the new value.
+ * @param[in] c to update the TTL of.
+ * @param[in] expires New expiry time.  The driver must write it to c->expires
+ *	itself, as c may be shared with other threads.
  * @return
  *	- #CACHE_RECONNECT - If handle needs to be reinitialised/reconnected.
  *	- #CACHE_ERROR - If the entry TTL couldn't be updated.
@@ -207,7 +237,7 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
  */
 typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config, void *instance,
 						 request_t *request, void *handle,
-						 rlm_cache_entry_t *c);
+						 rlm_cache_entry_t *c, fr_unix_time_t expires);
 
 /** Get the number of entries in the cache
  *
@@ -223,6 +253,28 @@ typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config
 typedef uint64_t	(*cache_entry_count_t)(rlm_cache_config_t const *config, void *instance,
 					       request_t *request, void *handle);
 
+/** Make room in the cache for a new entry
+ *
+ * Called before #cache_entry_insert_t.  Drivers should remove entries until
+ * adding c would leave the cache within config->max_entries and config->max_memory.
+ * Which entries are removed is up to the driver.
+ *
+ * @note This callback is optional.  If it's not provided, inserts fail once
+ *	max_entries is reached, and max_memory is not enforced.
+ *
+ * @param[in] config for this instance of the rlm_cache module.
+ * @param[in] instance Driver specific instance data.
+ * @param[in] request The current request.
+ * @param handle the driver gave us when we called #cache_acquire_t, or NULL if no
+ *	#cache_acquire_t callback was provided.
+ * @param[in] c entry that is about to be inserted.  c->size holds its size.
+ * @return
+ *	- The number of entries evicted.
+ *	- -1 if room could not be made.
+ */
+typedef int		(*cache_entry_evict_t)(rlm_cache_config_t const *config, void *instance,
+					       request_t *request, void *handle, rlm_cache_entry_t const *c);
+
 /** Acquire a handle to access the cache
  *
  * @note This callback is optional. If it's not provided the handle argument to other callbacks
@@ -281,6 +333,8 @@ struct rlm_cache_driver_s {
 	cache_entry_set_ttl_t		set_ttl;		//!< (Optional) Update the TTL of an entry.
 	cache_entry_count_t		count;			//!< (Optional) Number of entries currently in
 								//!< the cache.
+	cache_entry_evict_t		evict;			//!< (Optional) Remove entries to enforce max_entries
+								//!< and max_memory.
 
 	cache_acquire_t			acquire;		//!< (optional) Acquire exclusive access to a resource
 								//!< used to retrieve the cache entry.
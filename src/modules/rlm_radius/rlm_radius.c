@@ -596,10 +596,13 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
 	/*
-	 *	These limits are specific to RADIUS, and cannot be over-ridden
+	 *	These limits are specific to RADIUS, and cannot be over-ridden.
+	 *
+	 *	Each source port has 256 IDs, and the transport checks
+	 *	that it has enough source ports for per_connection_max.
 	 */
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, >=, 2);
-	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255 * RLM_RADIUS_MAX_SRC_PORTS);
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", inst->trunk_conf.target_req_per_conn, <=, inst->trunk_conf.max_req_per_conn / 2);
 
 	FR_TIME_DELTA_BOUND_CHECK("response_window", inst->zombie_period, >=, fr_time_delta_from_sec(1));
@@ -36,6 +36,8 @@
 typedef struct rlm_radius_s rlm_radius_t;
 typedef struct rlm_radius_io_s rlm_radius_io_t;
 
+#define RLM_RADIUS_MAX_SRC_PORTS	(16)		//!< Maximum number of source ports per connection.
+
 /** Per-thread instance data
  *
  * Contains buffers and connection handles specific to the thread.
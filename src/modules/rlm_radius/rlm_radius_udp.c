@@ -49,6 +49,7 @@ typedef struct {
 	fr_ipaddr_t		src_ipaddr;		//!< IP we open our socket on.
 	uint16_t		dst_port;		//!< Port of the home server.
 	char const		*secret;		//!< Shared secret.
+	fr_md5_secret_t		*secret_md5;		//!< Precomputed MD5 state for the shared secret.
 
 	char const		*interface;		//!< Interface to bind to.
 
@@ -57,6 +58,7 @@ typedef struct {
 
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
+	uint32_t		num_src_ports;		//!< How many source ports each connection uses.
 
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
@@ -80,9 +82,21 @@ typedef struct {
 
 typedef struct udp_request_s udp_request_t;
 
+/** One source port of a connection
+ *
+ * Each source port has its own 256 entry ID space.
+ */
+typedef struct {
+	int			fd;			//!< File descriptor.
+	uint16_t		src_port;		//!< Source port of this socket.
+	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+} udp_socket_t;
+
 typedef struct {
 	struct iovec		out;			//!< Describes buffer to send.
+	udp_socket_t		*sock;			//!< Socket the packet is sent from.
 	fr_trunk_request_t	*treq;			//!< Used for signalling.
+	bool			sign;			//!< Waiting to be signed.
 } udp_coalesced_t;
 
 /** Track the handle, which is tightly correlated with the FD
@@ -92,10 +106,15 @@ typedef struct {
 	char const     		*name;			//!< From IP PORT to IP PORT.
 	char const		*module_name;		//!< the module that opened the connection
 
-	int			fd;			//!< File descriptor.
+	udp_socket_t		*sock;			//!< Sockets, one per source port.  The first is
+							///< used for status checks when opening the
+							///< connection, and for replication.
+	uint8_t			num_sock;		//!< How many sockets we have.
+	uint8_t			next_sock;		//!< Socket we try to allocate IDs from first.
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	fr_radius_sign_t	*signvec;		//!< Outbound requests waiting to be signed.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -113,13 +132,10 @@ typedef struct {
 							//!< to be the actual IP address packets will be
 							//!< sent on.  This is why we can't use the inst
 							//!< src_ipaddr field.
-	uint16_t		src_port;		//!< Source port specific to this connection.
 
 	uint8_t			*buffer;		//!< Receive buffer.
 	size_t			buflen;			//!< Receive buffer length.
 
-	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
-
 	fr_time_t		mrs_time;		//!< Most recent sent time which had a reply.
 	fr_time_t		last_reply;		//!< When we last received a reply.
 	fr_time_t		first_sent;		//!< first time we sent a packet since going idle
@@ -153,6 +169,7 @@ struct udp_request_s {
 
 	uint8_t			code;			//!< Packet code.
 	uint8_t			id;			//!< Last ID assigned to this packet.
+	uint8_t			sock;			//!< Socket the ID was allocated from.
 	uint8_t			*packet;		//!< Packet we write to the network.
 	size_t			packet_len;		//!< Length of the packet.
 
@@ -177,6 +194,7 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", FR_TYPE_UINT16, rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
+	{ FR_CONF_OFFSET("num_src_ports", FR_TYPE_UINT32, rlm_radius_udp_t, num_src_ports), .dflt = "1" },
 
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
@@ -262,7 +280,8 @@ static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
 static void		conn_writable_status_check(UNUSED fr_event_list_t *el, UNUSED int fd,
 						   UNUSED int flags, void *uctx);
 
-static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id);
+static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id,
+			       fr_radius_sign_t *sign);
 
 static decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       udp_handle_t *h, request_t *request, udp_request_t *u,
@@ -496,7 +515,7 @@ static void conn_status_check_timeout(fr_event_list_t *el, fr_time_t now, void *
 		return;
 
 	case FR_RETRY_CONTINUE:
-		if (fr_event_fd_insert(h, el, h->fd, conn_writable_status_check, NULL,
+		if (fr_event_fd_insert(h, el, h->sock[0].fd, conn_writable_status_check, NULL,
 				       conn_error_status_check, conn) < 0) {
 			PERROR("%s - Failed inserting FD event", h->module_name);
 			fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
@@ -515,7 +534,7 @@ static void conn_status_check_again(fr_event_list_t *el, UNUSED fr_time_t now, v
 	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 
-	if (fr_event_fd_insert(h, el, h->fd, conn_writable_status_check, NULL, conn_error_status_check, conn) < 0) {
+	if (fr_event_fd_insert(h, el, h->sock[0].fd, conn_writable_status_check, NULL, conn_error_status_check, conn) < 0) {
 		PERROR("%s - Failed inserting FD event", h->module_name);
 		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 	}
@@ -536,7 +555,7 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	uint8_t			code = 0;
 
 	fr_pair_list_init(&reply);
-	slen = read(h->fd, h->buffer, h->buflen);
+	slen = read(h->sock[0].fd, h->buffer, h->buflen);
 	if (slen == 0) return;
 
 	if (slen < 0) {
@@ -650,7 +669,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	DEBUG("%s - Sending %s ID %d length %ld over connection %s",
 	      h->module_name, fr_packet_codes[u->code], u->id, u->packet_len, h->name);
 
-	if (encode(h->inst, h->status_request, u, u->id) < 0) {
+	if (encode(h->inst, h->status_request, u, u->id, NULL) < 0) {
 	fail:
 		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 		return;
@@ -658,7 +677,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	DEBUG3("Encoded packet");
 	HEXDUMP3(u->packet, u->packet_len, NULL);
 
-	slen = write(h->fd, u->packet, u->packet_len);
+	slen = write(h->sock[0].fd, u->packet, u->packet_len);
 	if (slen < 0) {
 		ERROR("%s - Failed sending %s ID %d length %ld over connection %s: %s",
 		      h->module_name, fr_packet_codes[u->code], u->id, u->packet_len, h->name, fr_syserror(errno));
@@ -670,7 +689,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	 *	Switch to waiting on read and insert the event
 	 *	for the response timeout.
 	 */
-	if (fr_event_fd_insert(h, conn->el, h->fd, conn_readable_status_check, NULL, conn_error_status_check, conn) < 0) {
+	if (fr_event_fd_insert(h, conn->el, h->sock[0].fd, conn_readable_status_check, NULL, conn_error_status_check, conn) < 0) {
 		PERROR("%s - Failed inserting FD event", h->module_name);
 		goto fail;
 	}
@@ -690,88 +709,58 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
  */
 static int _udp_handle_free(udp_handle_t *h)
 {
-	fr_assert(h->fd >= 0);
+	uint8_t		i;
 
 	if (h->status_u) fr_event_timer_delete(&h->status_u->ev);
 
-	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
+	for (i = 0; i < h->num_sock; i++) {
+		udp_socket_t	*sock = &h->sock[i];
 
-	if (shutdown(h->fd, SHUT_RDWR) < 0) {
-		DEBUG3("%s - Failed shutting down connection %s: %s",
-		       h->module_name, h->name, fr_syserror(errno));
-	}
+		fr_assert(sock->fd >= 0);
 
-	if (close(h->fd) < 0) {
-		DEBUG3("%s - Failed closing connection %s: %s",
-		       h->module_name, h->name, fr_syserror(errno));
-	}
+		fr_event_fd_delete(h->thread->el, sock->fd, FR_EVENT_FILTER_IO);
 
-	h->fd = -1;
+		if (shutdown(sock->fd, SHUT_RDWR) < 0) {
+			DEBUG3("%s - Failed shutting down connection %s: %s",
+			       h->module_name, h->name, fr_syserror(errno));
+		}
+
+		if (close(sock->fd) < 0) {
+			DEBUG3("%s - Failed closing connection %s: %s",
+			       h->module_name, h->name, fr_syserror(errno));
+		}
+
+		sock->fd = -1;
+	}
 
 	DEBUG("%s - Connection closed - %s", h->module_name, h->name);
 
 	return 0;
 }
 
-/** Initialise a new outbound connection
+/** Open one of the sockets for a connection
  *
- * @param[out] h_out	Where to write the new file descriptor.
- * @param[in] conn	to initialise.
- * @param[in] uctx	A #udp_thread_t
+ * @param[in] h		the socket belongs to.
+ * @param[in] sock	to open.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
  */
-static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+static int conn_socket_open(udp_handle_t *h, udp_socket_t *sock)
 {
 	int			fd;
-	udp_handle_t		*h;
-	udp_thread_t		*thread = talloc_get_type_abort(uctx, udp_thread_t);
-	uint16_t		i;
 
-	MEM(h = talloc_zero(conn, udp_handle_t));
-	h->thread = thread;
-	h->inst = thread->inst;
-	h->module_name = h->inst->parent->name;
-	h->src_ipaddr = h->inst->src_ipaddr;
-	h->src_port = 0;
-	h->max_packet_size = h->inst->max_packet_size;
-	h->last_idle = fr_time();
-
-	/*
-	 *	mmsgvec is pre-populated with pointers
-	 *	to the iovec structs in coalesced, so we
-	 *	just need to setup the iovec, and pass how
-	 *      many messages we want to send to sendmmsg.
-	 */
-	h->mmsgvec = talloc_zero_array(h, struct mmsghdr, h->inst->max_send_coalesce);
-	h->coalesced = talloc_zero_array(h, udp_coalesced_t, h->inst->max_send_coalesce);
-	for (i = 0; i < h->inst->max_send_coalesce; i++) {
-		h->mmsgvec[i].msg_hdr.msg_iov = &h->coalesced[i].out;
-		h->mmsgvec[i].msg_hdr.msg_iovlen = 1;
-	}
-
-	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
-	h->buflen = h->max_packet_size;
-
-	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h));
+	sock->src_port = 0;
 
 	/*
 	 *	Open the outgoing socket.
 	 */
-	fd = fr_socket_client_udp(&h->src_ipaddr, &h->src_port, &h->inst->dst_ipaddr, h->inst->dst_port, true);
+	fd = fr_socket_client_udp(&h->src_ipaddr, &sock->src_port, &h->inst->dst_ipaddr, h->inst->dst_port, true);
 	if (fd < 0) {
 		PERROR("%s - Failed opening socket", h->module_name);
-	fail:
-		talloc_free(h);
-		return FR_CONNECTION_STATE_FAILED;
+		return -1;
 	}
-
-	/*
-	 *	Set the connection name.
-	 */
-	h->name = fr_asprintf(h, "proto udp local %pV port %u remote %pV port %u",
-			      fr_box_ipaddr(h->src_ipaddr), h->src_port,
-			      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
-
-	talloc_set_destructor(h, _udp_handle_free);
+	sock->fd = fd;
 
 #ifdef SO_RCVBUF
 	if (h->inst->recv_buff_is_set) {
@@ -833,7 +822,83 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	WARN("%s - Max coalesced outbound data will be %zu bytes", h->module_name, h->inst->send_buff_actual);
 #endif
 
-	h->fd = fd;
+	if (!h->inst->replicate) MEM(sock->tt = radius_track_alloc(h));
+
+	return 0;
+}
+
+/** Initialise a new outbound connection
+ *
+ * @param[out] h_out	Where to write the new file descriptor.
+ * @param[in] conn	to initialise.
+ * @param[in] uctx	A #udp_thread_t
+ */
+static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	udp_handle_t		*h;
+	udp_thread_t		*thread = talloc_get_type_abort(uctx, udp_thread_t);
+	uint16_t		i;
+
+	MEM(h = talloc_zero(conn, udp_handle_t));
+	h->thread = thread;
+	h->inst = thread->inst;
+	h->module_name = h->inst->parent->name;
+	h->src_ipaddr = h->inst->src_ipaddr;
+	h->max_packet_size = h->inst->max_packet_size;
+	h->last_idle = fr_time();
+
+	/*
+	 *	mmsgvec is pre-populated with pointers
+	 *	to the iovec structs in coalesced, so we
+	 *	just need to setup the iovec, and pass how
+	 *      many messages we want to send to sendmmsg.
+	 */
+	h->mmsgvec = talloc_zero_array(h, struct mmsghdr, h->inst->max_send_coalesce);
+	h->coalesced = talloc_zero_array(h, udp_coalesced_t, h->inst->max_send_coalesce);
+	h->signvec = talloc_zero_array(h, fr_radius_sign_t, h->inst->max_send_coalesce);
+	for (i = 0; i < h->inst->max_send_coalesce; i++) {
+		h->mmsgvec[i].msg_hdr.msg_iov = &h->coalesced[i].out;
+		h->mmsgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
+	h->buflen = h->max_packet_size;
+
+	/*
+	 *	Replicated packets never get replies, so
+	 *	there's no need for more IDs.
+	 */
+	h->num_sock = h->inst->replicate ? 1 : h->inst->num_src_ports;
+	MEM(h->sock = talloc_zero_array(h, udp_socket_t, h->num_sock));
+
+	/*
+	 *	Every socket shares the same source IP address, but
+	 *	gets its own source port, and therefore its own ID
+	 *	space.  Opening the first socket updates src_ipaddr
+	 *	with the address we're really bound to.
+	 */
+	for (i = 0; i < h->num_sock; i++) {
+		if (conn_socket_open(h, &h->sock[i]) < 0) {
+			while (i-- > 0) close(h->sock[i].fd);
+			talloc_free(h);
+			return FR_CONNECTION_STATE_FAILED;
+		}
+	}
+
+	/*
+	 *	Set the connection name.
+	 */
+	if (h->num_sock == 1) {
+		h->name = fr_asprintf(h, "proto udp local %pV port %u remote %pV port %u",
+				      fr_box_ipaddr(h->src_ipaddr), h->sock[0].src_port,
+				      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+	} else {
+		h->name = fr_asprintf(h, "proto udp local %pV port %u (+%u ports) remote %pV port %u",
+				      fr_box_ipaddr(h->src_ipaddr), h->sock[0].src_port, h->num_sock - 1,
+				      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+	}
+
+	talloc_set_destructor(h, _udp_handle_free);
 
 	/*
 	 *	If we're doing status checks, then we want at least
@@ -854,14 +919,17 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 		 *	one response to bring the connection online,
 		 *	otherwise we need inst->num_answers_to_alive
 		 */
-		if (fr_event_fd_insert(h, conn->el, h->fd, NULL,
-				       conn_writable_status_check, conn_error_status_check, conn) < 0) goto fail;
+		if (fr_event_fd_insert(h, conn->el, h->sock[0].fd, NULL,
+				       conn_writable_status_check, conn_error_status_check, conn) < 0) {
+			talloc_free(h);
+			return FR_CONNECTION_STATE_FAILED;
+		}
 	/*
 	 *	If we're not doing status-checks, signal the connection
 	 *	as open as soon as it becomes writable.
 	 */
 	} else {
-		fr_connection_signal_on_fd(conn, fd);
+		fr_connection_signal_on_fd(conn, h->sock[0].fd);
 	}
 
 	*h_out = h;
@@ -878,18 +946,23 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
  */
 static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uctx)
 {
-	udp_handle_t *h = talloc_get_type_abort(handle, udp_handle_t);
+	udp_handle_t	*h = talloc_get_type_abort(handle, udp_handle_t);
+	uint8_t		i;
 
 	/*
 	 *	There's tracking entries still allocated
 	 *	this is bad, they should have all been
 	 *	released.
 	 */
-	if (h->tt && (h->tt->num_requests != 0)) {
+	for (i = 0; i < h->num_sock; i++) {
+		radius_track_t *tt = h->sock[i].tt;
+
+		if (!tt || (tt->num_requests == 0)) continue;
+
 #ifndef NDEBUG
-		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, h->tt, udp_tracking_entry_log);
+		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, tt, udp_tracking_entry_log);
 #endif
-		fr_assert_fail("%u tracking entries still allocated at conn close", h->tt->num_requests);
+		fr_assert_fail("%u tracking entries still allocated at conn close", tt->num_requests);
 	}
 
 	DEBUG4("Freeing rlm_radius_udp handle %p", handle);
@@ -1043,6 +1116,7 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	fr_event_fd_cb_t	read_fn = NULL;
 	fr_event_fd_cb_t	write_fn = NULL;
+	uint8_t			i;
 
 	switch (notify_on) {
 		/*
@@ -1071,17 +1145,25 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 
 	}
 
-	if (fr_event_fd_insert(h, el, h->fd,
-			       read_fn,
-			       write_fn,
-			       conn_error,
-			       tconn) < 0) {
-		PERROR("%s - Failed inserting FD event", h->module_name);
+	/*
+	 *	All sockets signal the same trunk connection.  The
+	 *	demux and mux functions deal with every socket, no
+	 *	matter which one triggered the event.
+	 */
+	for (i = 0; i < h->num_sock; i++) {
+		if (fr_event_fd_insert(h, el, h->sock[i].fd,
+				       read_fn,
+				       write_fn,
+				       conn_error,
+				       tconn) < 0) {
+			PERROR("%s - Failed inserting FD event", h->module_name);
 
-		/*
-		 *	May free the connection!
-		 */
-		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			/*
+			 *	May free the connection!
+			 */
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
 	}
 }
 
@@ -1113,7 +1195,7 @@ static void thread_conn_notify_replicate(fr_trunk_connection_t *tconn, fr_connec
 		break;
 	}
 
-	if (fr_event_fd_insert(h, el, h->fd,
+	if (fr_event_fd_insert(h, el, h->sock[0].fd,
 			       read_fn,
 			       write_fn,
 			       conn_error,
@@ -1203,7 +1285,8 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	memcpy(original + RADIUS_AUTH_VECTOR_OFFSET, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
 
 	if (fr_radius_verify(data, original,
-			     (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1, false) < 0) {
+			     (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1, false,
+			     inst->secret_md5) < 0) {
 		RPWDEBUG("Ignoring response with invalid signature");
 		return DECODE_FAIL_MA_INVALID;
 	}
@@ -1240,7 +1323,7 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	 *	or if we run out of memory.
 	 */
 	if (fr_radius_decode(ctx, reply, data, packet_len, original,
-			     inst->secret, talloc_array_length(inst->secret) - 1) < 0) {
+			     inst->secret, talloc_array_length(inst->secret) - 1, inst->secret_md5) < 0) {
 		REDEBUG("Failed decoding attributes for packet");
 		fr_pair_list_free(reply);
 		return DECODE_FAIL_UNKNOWN;
@@ -1265,7 +1348,21 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	return DECODE_FAIL_NONE;
 }
 
-static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id)
+/** Encode a request, and sign it
+ *
+ * @param[in] inst	of rlm_radius_udp.
+ * @param[in] request	being proxied.
+ * @param[in] u		holding the packet to encode.
+ * @param[in] id	to give the packet.
+ * @param[out] sign	If not NULL, signing is left to the caller, so that it can be done
+ *			in batches.  sign->packet is set to NULL if the packet doesn't
+ *			need signing.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id,
+		  fr_radius_sign_t *sign)
 {
 	ssize_t			packet_len;
 	uint8_t			*msg = NULL;
@@ -1288,6 +1385,8 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	u->packet_len = inst->max_packet_size;
 	MEM(u->packet = talloc_array(u, uint8_t, u->packet_len));
 
+	if (sign) sign->packet = NULL;
+
 	/*
 	 *	All proxied Access-Request packets MUST have a
 	 *	Message-Authenticator, otherwise they're insecure.
@@ -1352,7 +1451,7 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	 */
 	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
 				      inst->secret, talloc_array_length(inst->secret) - 1,
-				      u->code, id, &request->request_pairs);
+				      u->code, id, &request->request_pairs, inst->secret_md5);
 	if (fr_pair_encode_is_error(packet_len)) {
 		RPERROR("Failed encoding packet");
 
@@ -1508,11 +1607,21 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
 	case FR_RADIUS_CODE_COA_REQUEST:
 	sign:
+		if (sign) {
+			*sign = (fr_radius_sign_t){
+				.packet = u->packet,
+				.secret = (uint8_t const *) inst->secret,
+				.secret_len = talloc_array_length(inst->secret) - 1,
+				.secret_md5 = inst->secret_md5
+			};
+			break;
+		}
+
 		/*
 		 *	Now that we're done mangling the packet, sign it.
 		 */
 		if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
-				   talloc_array_length(inst->secret) - 1) < 0) {
+				   talloc_array_length(inst->secret) - 1, inst->secret_md5) < 0) {
 			RERROR("Failed signing packet");
 			goto error;
 		}
@@ -1786,13 +1895,85 @@ static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *
         fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
 }
 
+/** Count the tracking entries allocated across all of a connection's sockets
+ *
+ */
+static inline uint32_t udp_handle_num_requests(udp_handle_t const *h)
+{
+	uint32_t	num = 0;
+	uint8_t		i;
+
+	for (i = 0; i < h->num_sock; i++) if (h->sock[i].tt) num += h->sock[i].tt->num_requests;
+
+	return num;
+}
+
+/** Allocate an ID for a request from any socket which has one free
+ *
+ * We keep allocating from the same socket until its ID space is
+ * full, so that batches of packets mostly go out through one
+ * sendmmsg() call.
+ *
+ * @param[in] h		to allocate the ID from.
+ * @param[in] u		to allocate the ID for.
+ * @param[in] treq	the tracking entry is bound to.
+ * @param[in] request	being proxied.
+ * @return
+ *	- 0 on success.
+ *	- -1 if every socket has run out of IDs.
+ */
+static int udp_track_entry_reserve(udp_handle_t *h, udp_request_t *u, fr_trunk_request_t *treq, request_t *request)
+{
+	uint8_t		i;
+
+	for (i = 0; i < h->num_sock; i++) {
+		if (radius_track_entry_reserve(&u->rr, treq, h->sock[h->next_sock].tt,
+					       request, u->code, treq) == 0) {
+			u->sock = h->next_sock;
+			return 0;
+		}
+
+		if (++h->next_sock == h->num_sock) h->next_sock = 0;
+	}
+
+	return -1;
+}
+
+/** Send coalesced packets, with one sendmmsg() call for each run of packets using the same socket
+ *
+ * @param[in] h		to send packets for.
+ * @param[in] queued	How many packets there are in h->coalesced.
+ * @return
+ *	- The number of packets sent, starting from the first.
+ *	- -1 if no packets were sent, with errno set.
+ */
+static int udp_send_coalesced(udp_handle_t *h, uint16_t queued)
+{
+	int		sent = 0, ret;
+	uint16_t	end;
+
+	while (sent < queued) {
+		udp_socket_t	*sock = h->coalesced[sent].sock;
+
+		for (end = sent + 1; (end < queued) && (h->coalesced[end].sock == sock); end++);
+
+		ret = sendmmsg(sock->fd, &h->mmsgvec[sent], end - sent, 0);
+		if (ret < 0) return (sent > 0) ? sent : -1;
+
+		sent += ret;
+		if (sent < end) break;	/* Socket buffer is full */
+	}
+
+	return sent;
+}
+
 static void request_mux(fr_event_list_t *el,
 			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_radius_udp_t const	*inst = h->inst;
 	int			sent;
-	uint16_t		i, queued;
+	uint16_t		i, j, queued, to_sign = 0;
 	size_t			total_len = 0;
 
 	/*
@@ -1845,10 +2026,12 @@ static void request_mux(fr_event_list_t *el,
 		if (!u->packet || !u->can_retransmit) {
 			fr_assert(!u->rr);
 
-			if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
+			if (unlikely(udp_track_entry_reserve(h, u, treq, request) < 0)) {
 #ifndef NDEBUG
-				radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
-						       h->tt, udp_tracking_entry_log);
+				for (j = 0; j < h->num_sock; j++) {
+					radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
+							       h->sock[j].tt, udp_tracking_entry_log);
+				}
 #endif
 				fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
 				fr_trunk_request_signal_fail(treq);
@@ -1859,7 +2042,7 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("Sending %s ID %d length %ld over connection %s",
 			       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, &h->signvec[to_sign]) < 0) {
 				/*
 				 *	Need to do this because request_conn_release
 				 *	may not be called.
@@ -1869,14 +2052,20 @@ static void request_mux(fr_event_list_t *el,
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
-			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
 
 			/*
-			 *	Remember the authentication vector, which now has the
-			 *	packet signature.
+			 *	Packets which need signing are signed
+			 *	together once the batch is encoded.
 			 */
-			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			h->coalesced[queued].sign = (h->signvec[to_sign].packet != NULL);
+			if (h->coalesced[queued].sign) {
+				to_sign++;
+			} else {
+				RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+				(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			}
 		} else {
+			h->coalesced[queued].sign = false;
 			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
 			       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
 		}
@@ -1890,6 +2079,7 @@ static void request_mux(fr_event_list_t *el,
 		 *      the pending state if the sendmmsg call fails.
 		 */
 		h->coalesced[queued].treq = treq;
+		h->coalesced[queued].sock = &h->sock[u->sock];
 		h->coalesced[queued].out.iov_base = u->packet;
 		h->coalesced[queued].out.iov_len = u->packet_len;
 
@@ -1914,6 +2104,46 @@ static void request_mux(fr_event_list_t *el,
 	}
 	if (queued == 0) return;	/* No work */
 
+	/*
+	 *	Sign the newly encoded packets together, so
+	 *	the multi-buffer MD5 code can be used.
+	 */
+	if (to_sign > 0) {
+		(void) fr_radius_sign_batch(h->signvec, to_sign);
+
+		for (i = 0, j = 0, to_sign = 0; i < queued; i++) {
+			fr_trunk_request_t	*treq = h->coalesced[i].treq;
+			udp_request_t		*u = talloc_get_type_abort(treq->preq, udp_request_t);
+			request_t		*request = treq->request;
+
+			if (h->coalesced[i].sign) {
+				if (h->signvec[to_sign++].rcode < 0) {
+					RPERROR("Failed signing packet");
+					fr_trunk_request_signal_fail(treq);
+					continue;
+				}
+
+				RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+				/*
+				 *	Remember the authentication vector, which now has the
+				 *	packet signature.
+				 */
+				(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			}
+
+			/*
+			 *	Close up any gaps left by failed packets.
+			 *	mmsgvec points at the iovecs in coalesced,
+			 *	so only coalesced needs moving.
+			 */
+			if (j != i) h->coalesced[j] = h->coalesced[i];
+			j++;
+		}
+		queued = j;
+		if (queued == 0) return;
+	}
+
 	/*
 	 *	Verify nothing accidentally freed the connection handle
 	 */
@@ -1922,7 +2152,7 @@ static void request_mux(fr_event_list_t *el,
 	/*
 	 *	Send the coalesced datagrams
 	 */
-	sent = sendmmsg(h->fd, h->mmsgvec, queued, 0);
+	sent = udp_send_coalesced(h, queued);
 	if (sent < 0) {		/* Error means no messages were sent */
 		sent = 0;
 
@@ -2016,16 +2246,20 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("%s request.  Expecting response within %pVs", action,
 			       fr_box_time_delta(u->retry.rt));
 
-			if (fr_event_timer_at(u, el, &u->ev, u->retry.next, request_retry, treq) < 0) {
+			/*
+			 *	Almost every request gets a reply before
+			 *	this fires, so use the cheaper timer wheel.
+			 */
+			if (fr_event_timer_coarse_at(u, el, &u->ev, u->retry.next, request_retry, treq) < 0) {
 				RERROR("Failed inserting retransmit timeout for connection");
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
 
 		} else if (u->retry.count == 1) {
-			if (fr_event_timer_at(u, el, &u->ev,
-					      fr_time_add(u->retry.start, h->inst->parent->response_window),
-					      request_timeout, treq) < 0) {
+			if (fr_event_timer_coarse_at(u, el, &u->ev,
+						     fr_time_add(u->retry.start, h->inst->parent->response_window),
+						     request_timeout, treq) < 0) {
 				RERROR("Failed inserting timeout for connection");
 				fr_trunk_request_signal_fail(treq);
 				continue;
@@ -2079,7 +2313,7 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 		if (!u->packet) {
 			u->id = h->last_id++;
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, NULL) < 0) {
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
@@ -2112,7 +2346,7 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 	 */
 	(void)talloc_get_type_abort(h, udp_handle_t);
 
-	sent = sendmmsg(h->fd, h->mmsgvec, queued, 0);
+	sent = sendmmsg(h->sock[0].fd, h->mmsgvec, queued, 0);
 	if (sent < 0) {		/* Error means no messages were sent */
 		sent = 0;
 
@@ -2368,6 +2602,7 @@ static void status_check_reply(fr_trunk_request_t *treq, fr_time_t now)
 static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);;
+	udp_socket_t		*sock = &h->sock[0];
 
 	DEBUG3("%s - Reading data for connection %s", h->module_name, h->name);
 
@@ -2387,20 +2622,21 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 
 		fr_pair_list_init(&reply);
 		/*
-		 *	Drain the socket of all packets.  If we're busy, this
+		 *	Drain every socket of all packets.  If we're busy, this
 		 *	saves a round through the event loop.  If we're not
 		 *	busy, a few extra system calls don't matter.
 		 */
-		slen = read(h->fd, h->buffer, h->buflen);
-		if (slen == 0) return;
-
-		if (slen < 0) {
-			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+		slen = read(sock->fd, h->buffer, h->buflen);
+		if (slen <= 0) {
+			if ((slen < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				ERROR("%s - Failed reading response from socket: %s",
+				      h->module_name, fr_syserror(errno));
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
 
-			ERROR("%s - Failed reading response from socket: %s",
-			      h->module_name, fr_syserror(errno));
-			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
-			return;
+			if (++sock == &h->sock[h->num_sock]) return;
+			continue;
 		}
 
 		if (slen < RADIUS_HEADER_LENGTH) {
@@ -2411,9 +2647,10 @@ static void request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, U
 
 		/*
 		 *	Note that we don't care about packet codes.  All
-		 *	packet codes share the same ID space.
+		 *	packet codes share the same ID space, but each
+		 *	socket has its own.
 		 */
-		rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
+		rr = radius_track_entry_find(sock->tt, h->buffer[1], NULL);
 		if (!rr) {
 			WARN("%s - Ignoring reply with ID %i that arrived too late",
 			     h->module_name, h->buffer[1]);
@@ -2571,7 +2808,7 @@ static void request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNU
 	 *	If there are no outstanding tracking entries
 	 *	allocated then the connection is "idle".
 	 */
-	if (!h->tt || (h->tt->num_requests == 0)) h->last_idle = fr_time();
+	if (udp_handle_num_requests(h) == 0) h->last_idle = fr_time();
 }
 
 /** Clear out anything associated with the handle from the request
@@ -2958,6 +3195,30 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
 	}
 
+	FR_INTEGER_BOUND_CHECK("num_src_ports", inst->num_src_ports, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_src_ports", inst->num_src_ports, <=, RLM_RADIUS_MAX_SRC_PORTS);
+
+	/*
+	 *	Each source port gives us another 256 IDs, so that's
+	 *	what limits the number of packets per connection.
+	 */
+	if (!inst->replicate) {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn,
+				       <=, 255 * inst->num_src_ports);
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", parent->trunk_conf.target_req_per_conn,
+				       <=, parent->trunk_conf.max_req_per_conn / 2);
+	}
+
+	/*
+	 *	Every packet to the home server is signed with
+	 *	the same secret, so only absorb it into MD5 once.
+	 */
+	inst->secret_md5 = fr_md5_secret_alloc(inst, (uint8_t const *) inst->secret,
+					       talloc_array_length(inst->secret) - 1);
+	if (!inst->secret_md5) {
+		cf_log_perr(conf, "Failed precomputing shared secret state");
+		return -1;
+	}
 
 	return 0;
 }
@@ -50,6 +50,8 @@ RCSID("$Id$")
 
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
+#include <freeradius-devel/redis/pipeline.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include "redis_ippool.h"
 
 #include <freeradius-devel/dhcpv4/dhcpv4.h>
@@ -97,11 +99,57 @@ typedef struct {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
-	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
+	fr_redis_cluster_t	*cluster;	//!< Redis cluster.  Used to find the node responsible
+						//!< for a pool.
+
+	fr_redis_io_conf_t	io_conf;	//!< Connection settings for the trunks to each node.
+	fr_trunk_conf_t		trunk_conf;	//!< Trunk configuration.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread instance
+ *
+ */
+typedef struct {
+	fr_redis_cluster_thread_t *cluster_thread;	//!< Trunks to each of the cluster nodes.
+} rlm_redis_ippool_thread_t;
+
+#define IPPOOL_SCRIPT_MAX_ARGS	10		//!< Most arguments any of the scripts take,
+						///< including EVALSHA and the digest.
+
+/** Resume context for a Lua script being run on the pipeline
+ *
+ */
+typedef struct {
+	rlm_redis_ippool_t const	*inst;		//!< Module instance.
+	rlm_redis_ippool_thread_t	*thread;	//!< Thread the script is running on.
+	ippool_action_t			action;		//!< What the script does to the pool.
+
+	char const			*digest;	//!< SHA1 of the script.
+	char const			*script;	//!< Script to load if the node doesn't have it cached.
+
+	int				argc;		//!< Number of EVALSHA arguments.
+	char const			*argv[IPPOOL_SCRIPT_MAX_ARGS];		//!< EVALSHA arguments.
+	size_t				argv_len[IPPOOL_SCRIPT_MAX_ARGS];	//!< Length of each argument.
+
+	char const			*ip_str;	//!< Address being updated or released.
+	uint32_t			expires;	//!< Lease time we set.
+
+	fr_redis_trunk_t		*rtrunk;	//!< Trunk the script was last sent on.
+	fr_redis_command_set_t		*cmds;		//!< Commands in flight, NULL once they've completed.
+	int				script_idx;	//!< Position of the script result in the replies.
+	int				wait_idx;	//!< Position of the WAIT result in the replies.
+
+	uint32_t			redirects;	//!< How many MOVED or ASK redirects we've followed.
+	bool				asking;		//!< Send ASKING before the script, we got an ASK redirect.
+	bool				load_script;	//!< Load the script before running it.
+
+	fr_redis_rcode_t		status;		//!< Of the commands we sent.
+	redisReply			*reply;		//!< Result of the script, or the first error.
+} ippool_script_ctx_t;
+
 static CONF_PARSER redis_config[] = {
 	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_redis_ippool_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -453,212 +501,263 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
-/** Execute a script against Redis cluster
+/** Allocate a new argument for a script
  *
- * Handles uploading the script to the server if required.
- *
- * @note All replies will be freed on error.
- *
- * @param[out] out		Where to write Redis reply object resulting from the command.
- * @param[in] request		The current request.
- * @param[in] cluster		configuration.
- * @param[in] key		to use to determine the cluster node.
- * @param[in] key_len		length of the key.
- * @param[in] wait_num		If > 0 wait until this many slaves have replicated the data
- *				from the last command.
- * @param[in] wait_timeout	How long to wait for slaves to replicate the data.
- * @param[in] digest		of script.
- * @param[in] script		to upload.
- * @param[in] cmd		EVALSHA command to execute.
- * @param[in] ...		Arguments for the eval command.
- * @return status of the command.
+ * @param[in] sctx	to add the argument to.
+ * @param[in] arg	Argument value, copied into the sctx.
+ * @param[in] arg_len	Length of the argument.
  */
-static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_redis_cluster_t *cluster,
-				      uint8_t const *key, size_t key_len,
-				      uint32_t wait_num, fr_time_delta_t wait_timeout,
-				      char const digest[], char const *script,
-				      char const *cmd, ...)
+static void ippool_script_arg(ippool_script_ctx_t *sctx, void const *arg, size_t arg_len)
 {
-	fr_redis_conn_t			*conn;
-	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
-	size_t				reply_cnt = 0, i;
+	fr_assert(sctx->argc < IPPOOL_SCRIPT_MAX_ARGS);
 
-	fr_redis_cluster_state_t	state;
-	fr_redis_rcode_t		s_ret, status;
-	unsigned int			pipelined = 0;
+	if (arg_len == 0) {
+		sctx->argv[sctx->argc] = "";
+	} else {
+		MEM(sctx->argv[sctx->argc] = talloc_memdup(sctx, arg, arg_len));
+	}
+	sctx->argv_len[sctx->argc++] = arg_len;
+}
 
-	va_list				ap;
+/** Add an unsigned integer argument for a script
+ *
+ */
+static void ippool_script_arg_uint(ippool_script_ctx_t *sctx, uint32_t num)
+{
+	char	buffer[sizeof("4294967295")];
+	size_t	len;
 
-	*out = NULL;
+	len = snprintf(buffer, sizeof(buffer), "%u", num);
+	ippool_script_arg(sctx, buffer, len);
+}
 
-#ifndef NDEBUG
-	memset(replies, 0, sizeof(replies));
-#endif
+/** Free any reply we're still holding on to
+ *
+ */
+static int _ippool_script_ctx_free(ippool_script_ctx_t *sctx)
+{
+	fr_redis_reply_free(&sctx->reply);
 
-	va_start(ap, cmd);
+	return 0;
+}
 
-	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
-	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
-	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
+/** Allocate a context to run one of the Lua scripts on the pipeline
+ *
+ * @param[in] inst	of rlm_redis_ippool.
+ * @param[in] t		Thread specific instance data.
+ * @param[in] request	The current request.
+ * @param[in] action	The script performs.
+ * @param[in] digest	of script.
+ * @param[in] script	to upload if the server doesn't have it cached.
+ * @param[in] key	Pool name, used to determine the cluster node.
+ * @param[in] key_len	Length of the pool name.
+ * @return A new script context, with the EVALSHA arguments up to, and including the key.
+ */
+static ippool_script_ctx_t *ippool_script_alloc(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+						request_t *request, ippool_action_t action,
+						char const *digest, char const *script,
+						uint8_t const *key, size_t key_len)
+{
+	ippool_script_ctx_t	*sctx;
+
+	MEM(sctx = talloc_zero(request, ippool_script_ctx_t));
+	talloc_set_destructor(sctx, _ippool_script_ctx_free);
+	sctx->inst = inst;
+	sctx->thread = t;
+	sctx->action = action;
+	sctx->digest = digest;
+	sctx->script = script;
+
+	sctx->argv[sctx->argc] = "EVALSHA";
+	sctx->argv_len[sctx->argc++] = sizeof("EVALSHA") - 1;
+	sctx->argv[sctx->argc] = digest;
+	sctx->argv_len[sctx->argc++] = strlen(digest);
+	sctx->argv[sctx->argc] = "1";
+	sctx->argv_len[sctx->argc++] = 1;
+	ippool_script_arg(sctx, key, key_len);
+
+	return sctx;
+}
 
-	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
-		pipelined = 1;
-		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
-			pipelined++;
+/** Record the replies we need from the commands sent to run a script
+ *
+ * Replies are in the same order as the commands were sent:
+ *
+ @verbatim
+   [ASKING], (EVALSHA | MULTI, SCRIPT LOAD, EVALSHA, EXEC), [WAIT]
+ @endverbatim
+ *
+ * Processing is left to #ippool_script_resume.  The first error reply
+ * is kept instead of the script result, so redirects can be followed.
+ */
+static void _ippool_script_complete(request_t *request, fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_script_ctx_t	*sctx = talloc_get_type_abort(rctx, ippool_script_ctx_t);
+	fr_redis_command_t	*cmd;
+	int			i = 0;
+
+	sctx->cmds = NULL;	/* Freed by the trunk once we return */
+	sctx->status = REDIS_RCODE_SUCCESS;
+
+	for (cmd = fr_dlist_head(completed);
+	     cmd;
+	     cmd = fr_dlist_next(completed, cmd), i++) {
+		redisReply		*reply = fr_redis_command_get_result(cmd);
+		fr_redis_rcode_t	status;
+
+		if (RDEBUG_ENABLED3) fr_redis_reply_print(L_DBG_LVL_3, reply, request, i);
+
+		status = reply ? fr_redis_command_status(NULL, reply) : REDIS_RCODE_RECONNECT;
+		if (status != REDIS_RCODE_SUCCESS) {
+			sctx->status = status;
+			fr_redis_reply_free(&sctx->reply);
+			sctx->reply = fr_redis_command_steal_result(cmd);
+			break;
 		}
-		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
-						     replies, NUM_ELEMENTS(replies),
-						     conn);
-		if (status != REDIS_RCODE_NO_SCRIPT) continue;
 
-		/*
-		 *	Clear out the existing reply
-		 */
-		fr_redis_pipeline_free(replies, reply_cnt);
+		if (i == sctx->script_idx) {
+			sctx->reply = fr_redis_command_steal_result(cmd);
 
-		/*
-		 *	Last command failed with NOSCRIPT, this means
-		 *	we have to send the Lua script up to the node
-		 *	so it can be cached.
-		 */
-	     	RDEBUG3("Loading script 0x%s", digest);
-		redisAppendCommand(conn->handle, "MULTI");
-		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
-		redisAppendCommand(conn->handle, "EXEC");
-		pipelined = 4;
-		if (wait_num) {
-			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, fr_time_delta_to_msec(wait_timeout));
-			pipelined++;
+		} else if ((i == sctx->wait_idx) && (ippool_wait_check(request, sctx->inst->wait_num, reply) < 0)) {
+			sctx->status = REDIS_RCODE_ERROR;
+			break;
 		}
+	}
 
-		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
-						     replies, NUM_ELEMENTS(replies),
-						     conn);
-		if (status == REDIS_RCODE_SUCCESS) {
-			if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) {
-				fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
-			}
+	unlang_interpret_mark_runnable(request);
+}
 
-			if (replies[3]->type != REDIS_REPLY_ARRAY) {
-				RERROR("Bad response to EXEC, expected array got %s",
-				       fr_table_str_by_value(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
-			error:
-				fr_redis_pipeline_free(replies, reply_cnt);
-				status = REDIS_RCODE_ERROR;
-				goto finish;
-			}
-			if (replies[3]->elements != 2) {
-				RERROR("Bad response to EXEC, expected 2 result elements, got %zu",
-				       replies[3]->elements);
-				goto error;
-			}
-			if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
-				RERROR("Bad response to SCRIPT LOAD, expected string got %s",
-				       fr_table_str_by_value(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
-				goto error;
-			}
-			if (strcmp(replies[3]->element[0]->str, digest) != 0) {
-				RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
-					digest, replies[3]->element[0]->str);
-				goto error;
-			}
-		}
-	}
-	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
+/** Record that the commands couldn't be sent, or the connection failed before we got the replies
+ *
+ */
+static void _ippool_script_fail(request_t *request, UNUSED fr_dlist_head_t *completed, void *rctx)
+{
+	ippool_script_ctx_t	*sctx = talloc_get_type_abort(rctx, ippool_script_ctx_t);
 
-	switch (reply_cnt) {
-	case 2:	/* EVALSHA with wait */
-		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto error;
-		fr_redis_reply_free(&replies[1]);	/* Free the wait response */
-		break;
+	sctx->cmds = NULL;	/* Freed by the trunk once we return */
+	sctx->status = REDIS_RCODE_RECONNECT;
 
-	case 1:	/* EVALSHA */
-		*out = replies[0];
-		break;
+	unlang_interpret_mark_runnable(request);
+}
 
-	case 5: /* LOADSCRIPT + EVALSHA + WAIT */
-		if (ippool_wait_check(request, wait_num, replies[4]) < 0) goto error;
-		fr_redis_reply_free(&replies[4]);	/* Free the wait response */
-		FALL_THROUGH;
-
-	case 4: /* LOADSCRIPT + EVALSHA */
-		fr_redis_reply_free(&replies[2]);	/* Free the queued cmd response*/
-		fr_redis_reply_free(&replies[1]);	/* Free the queued script load response */
-		fr_redis_reply_free(&replies[0]);	/* Free the queued multi response */
-		*out = replies[3]->element[1];
-		replies[3]->element[1] = NULL;		/* Prevent double free */
-		fr_redis_reply_free(&replies[3]);	/* This works because hiredis checks for NULL elements */
-		break;
+/** Stop waiting for the results of the script if the request is cancelled
+ *
+ */
+static void ippool_script_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_state_signal_t action)
+{
+	ippool_script_ctx_t	*sctx = talloc_get_type_abort(mctx->rctx, ippool_script_ctx_t);
 
-	case 0:
-		break;
-	}
+	if (action != FR_SIGNAL_CANCEL) return;
 
-finish:
-	va_end(ap);
-	return s_ret;
+	if (sctx->cmds) {
+		redis_command_set_cancel(sctx->cmds);
+		sctx->cmds = NULL;
+	}
 }
 
-/** Allocate a new IP address from a pool
+static unlang_action_t ippool_script_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
+/** Enqueue the commands to run a script on the trunk for the node responsible for the pool
+ *
+ * Any number of scripts may be in flight on the same connection, the
+ * pipeline matches the replies up with the commands.
  *
+ * If the server has previously told us it doesn't have the script, it's
+ * loaded, and run, in a transaction.  If wait_num is set, the script is
+ * followed by a WAIT, so we know enough slaves have a copy of the lease.
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
-					    uint8_t const *key_prefix, size_t key_prefix_len,
-					    uint8_t const *owner, size_t owner_len,
-					    uint8_t const *gateway_id, size_t gateway_id_len,
-					    uint32_t expires)
+static unlang_action_t ippool_script_send(rlm_rcode_t *p_result, ippool_script_ctx_t *sctx, request_t *request)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
+	rlm_redis_ippool_t const	*inst = sctx->inst;
+	fr_redis_command_set_t		*cmds;
+	int				i = 0;
+
+	fr_redis_reply_free(&sctx->reply);
+	sctx->script_idx = -1;
+	sctx->wait_idx = -1;
+
+	MEM(cmds = fr_redis_command_set_alloc(NULL, request, _ippool_script_complete, _ippool_script_fail, sctx));
+
+	if (sctx->asking) {
+		if (fr_redis_command_preformatted_add(cmds, "ASKING", sizeof("ASKING") - 1) != FR_REDIS_PIPELINE_OK) {
+		error:
+			talloc_free(cmds);
+		fail:
+			talloc_free(sctx);
+			RETURN_MODULE_FAIL;
+		}
+		i++;
+	}
 
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	if (sctx->load_script) {
+		char const	*load_argv[] = { "SCRIPT", "LOAD", sctx->script };
+		size_t		load_argv_len[] = { sizeof("SCRIPT") - 1, sizeof("LOAD") - 1, strlen(sctx->script) };
+
+		RDEBUG3("Loading script 0x%s", sctx->digest);
+		if ((fr_redis_command_preformatted_add(cmds, "MULTI", sizeof("MULTI") - 1) != FR_REDIS_PIPELINE_OK) ||
+		    (fr_redis_command_argv_add(cmds, NUM_ELEMENTS(load_argv),
+		    			       load_argv, load_argv_len) != FR_REDIS_PIPELINE_OK) ||
+		    (fr_redis_command_argv_add(cmds, sctx->argc, sctx->argv, sctx->argv_len) != FR_REDIS_PIPELINE_OK) ||
+		    (fr_redis_command_preformatted_add(cmds, "EXEC", sizeof("EXEC") - 1) != FR_REDIS_PIPELINE_OK)) {
+			goto error;
+		}
+		sctx->script_idx = i + 3;	/* The EXEC response contains the script result */
+		i += 4;
+	} else {
+		RDEBUG3("Calling script 0x%s", sctx->digest);
+		if (fr_redis_command_argv_add(cmds, sctx->argc, sctx->argv, sctx->argv_len) != FR_REDIS_PIPELINE_OK) {
+			goto error;
+		}
+		sctx->script_idx = i++;
+	}
 
-	fr_assert(key_prefix);
-	fr_assert(owner);
+	if (inst->wait_num) {
+		char		num_buff[sizeof("4294967295")], timeout_buff[sizeof("18446744073709551615")];
+		char const	*wait_argv[] = { "WAIT", num_buff, timeout_buff };
+		size_t		wait_argv_len[3];
 
-	now = fr_time_to_timeval(fr_time());
+		wait_argv_len[0] = sizeof("WAIT") - 1;
+		wait_argv_len[1] = snprintf(num_buff, sizeof(num_buff), "%u", inst->wait_num);
+		wait_argv_len[2] = snprintf(timeout_buff, sizeof(timeout_buff), "%" PRIu64,
+					    (uint64_t)fr_time_delta_to_msec(inst->wait_timeout));
+
+		if (fr_redis_command_argv_add(cmds, NUM_ELEMENTS(wait_argv),
+					      wait_argv, wait_argv_len) != FR_REDIS_PIPELINE_OK) goto error;
+		sctx->wait_idx = i++;
+	}
 
 	/*
-	 *	hiredis doesn't deal well with NULL string pointers
+	 *	The fail callback may be called before
+	 *	enqueue returns, so record the command
+	 *	set first.
 	 */
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       key_prefix, key_prefix_len,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       key_prefix, key_prefix_len,
-			       (unsigned int)now.tv_sec, expires,
-			       owner, owner_len,
-			       gateway_id, gateway_id_len);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+	sctx->cmds = cmds;
+	if (redis_command_set_enqueue(sctx->rtrunk, cmds) != FR_REDIS_PIPELINE_OK) {
+		REDEBUG("Failed enqueueing script");
+		sctx->cmds = NULL;	/* Freed by enqueue */
+		goto fail;
 	}
 
+	return unlang_module_yield(request, ippool_script_resume, ippool_script_signal, sctx);
+}
+
+/** Process the result of an allocate script
+ *
+ */
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request, redisReply *reply)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
 	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -667,11 +766,10 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
+	if (ret < 0) return ret;
 
 	/*
 	 *	Process IP address
@@ -702,8 +800,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 				if (fr_value_box_cast(NULL, tmpl_value(ip_map.rhs), FR_TYPE_IPV4_ADDR,
 						      NULL, &tmp)) {
 					RPEDEBUG("Failed converting integer to IPv4 address");
-					ret = IPPOOL_RCODE_FAIL;
-					goto finish;
+					return IPPOOL_RCODE_FAIL;
 				}
 			} else {
 				fr_value_box_shallow(&ip_map.rhs->data.literal,
@@ -716,17 +813,13 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 			fr_value_box_bstrndup_shallow(&ip_map.rhs->data.literal,
 						      NULL, reply->element[1]->str, reply->element[1]->len, false);
 		do_ip_map:
-			if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
-			}
+			if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
 			break;
 
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for IP element (result[1])",
 				fr_table_str_by_value(redis_reply_types, reply->element[1]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -750,10 +843,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 			tmpl_init_shallow(&range_rhs, TMPL_TYPE_DATA, T_DOUBLE_QUOTED_STRING, "", 0);
 			fr_value_box_bstrndup_shallow(&range_map.rhs->data.literal,
 						      NULL, reply->element[2]->str, reply->element[2]->len, true);
-			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
-			}
+			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
 		}
 			break;
 
@@ -763,8 +853,7 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for range element (result[2])",
 				fr_table_str_by_value(redis_reply_types, reply->element[2]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -783,35 +872,22 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 		if (reply->element[3]->type != REDIS_REPLY_INTEGER) {
 			REDEBUG("Server returned unexpected type \"%s\" for expiry element (result[3])",
 				fr_table_str_by_value(redis_reply_types, reply->element[3]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 
 		fr_value_box_shallow(&expiry_map.rhs->data.literal, (uint32_t)reply->element[3]->integer, true);
-		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) {
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
-		}
+		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
 	}
-finish:
-	fr_redis_reply_free(&reply);
+
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Process the result of an update script
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, request_t *request,
-					  uint8_t const *key_prefix, size_t key_prefix_len,
-					  fr_ipaddr_t *ip,
-					  uint8_t const *owner, size_t owner_len,
-					  uint8_t const *gateway_id, size_t gateway_id_len,
+static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, request_t *request, redisReply *reply,
 					  uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
 	tmpl_t		range_rhs;
@@ -819,58 +895,15 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 
 	tmpl_init_shallow(&range_rhs, TMPL_TYPE_DATA, T_DOUBLE_QUOTED_STRING, "", 0);
 
-	now = fr_time_to_timeval(fr_time());
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!owner) owner = (uint8_t const *)"";
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->addr.v4.s_addr),
-				       owner, owner_len,
-				       gateway_id, gateway_id_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       owner, owner_len,
-				       gateway_id, gateway_id_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -879,11 +912,10 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
+	if (ret < 0) return ret;
 
 	/*
 	 *	Process Range identifier
@@ -896,10 +928,7 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 		case REDIS_REPLY_STRING:
 			fr_value_box_bstrndup_shallow(&range_map.rhs->data.literal, NULL,
 						      reply->element[1]->str, reply->element[1]->len, true);
-			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) {
-				ret = IPPOOL_RCODE_FAIL;
-				goto finish;
-			}
+			if (map_to_request(request, &range_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
 			break;
 
 		case REDIS_REPLY_NIL:
@@ -908,8 +937,7 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 		default:
 			REDEBUG("Server returned unexpected type \"%s\" for range element (result[1])",
 				fr_table_str_by_value(redis_reply_types, reply->element[0]->type, "<UNKNOWN>"));
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
+			return IPPOOL_RCODE_FAIL;
 		}
 	}
 
@@ -928,81 +956,26 @@ static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, reques
 		tmpl_init_shallow(&expiry_rhs, TMPL_TYPE_DATA, T_DOUBLE_QUOTED_STRING, "", 0);
 
 		fr_value_box_shallow(&expiry_map.rhs->data.literal, expires, false);
-		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) {
-			ret = IPPOOL_RCODE_FAIL;
-			goto finish;
-		}
+		if (map_to_request(request, &expiry_map, map_to_vp, NULL) < 0) return IPPOOL_RCODE_FAIL;
 	}
 
-finish:
-	fr_redis_reply_free(&reply);
-
 	return ret;
 }
 
-/** Release an existing IP address in a pool
+/** Process the result of a release script
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, request_t *request,
-					   uint8_t const *key_prefix, size_t key_prefix_len,
-					   fr_ipaddr_t *ip,
-					   uint8_t const *owner, size_t owner_len)
+static ippool_rcode_t redis_ippool_release(request_t *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
-
-	now = fr_time_to_timeval(fr_time());
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!owner) owner = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->addr.v4.s_addr),
-				       owner, owner_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, inst->wait_timeout,
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       owner, owner_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	if (reply->elements == 0) {
 		REDEBUG("Got empty result array");
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
 
 	/*
@@ -1011,16 +984,10 @@ static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, reque
 	if (reply->element[0]->type != REDIS_REPLY_INTEGER) {
 		REDEBUG("Server returned unexpected type \"%s\" for rcode element (result[0])",
 			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+		return IPPOOL_RCODE_FAIL;
 	}
-	ret = reply->element[0]->integer;
-	if (ret < 0) goto finish;
 
-finish:
-	fr_redis_reply_free(&reply);
-
-	return ret;
+	return reply->element[0]->integer;
 }
 
 /** Find the pool name we'll be allocating from
@@ -1062,111 +1029,121 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_redis_ippool_t const *inst, request_t *request, ippool_action_t action)
+/** Process the results of a script, following redirects and loading the script if required
+ *
+ */
+static unlang_action_t ippool_script_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], owner_buff[256], gateway_id_buff[256];
-	uint8_t const	*key_prefix, *owner = NULL, *gateway_id = NULL;
-	size_t		key_prefix_len, owner_len = 0, gateway_id_len = 0;
-	ssize_t		slen;
-	fr_ipaddr_t	ip;
-	char		expires_buff[20];
-	char const	*expires_str;
-	unsigned long	expires = 0;
-	char		*q;
+	ippool_script_ctx_t		*sctx = talloc_get_type_abort(mctx->rctx, ippool_script_ctx_t);
+	rlm_redis_ippool_t const	*inst = sctx->inst;
+	redisReply			*reply;
+	rlm_rcode_t			rcode;
 
-	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
-	if (slen < 0) RETURN_MODULE_FAIL;
-	if (slen == 0) RETURN_MODULE_NOOP;
+	switch (sctx->status) {
+	case REDIS_RCODE_SUCCESS:
+		break;
 
-	key_prefix_len = (size_t)slen;
+	/*
+	 *	The cluster has been resharded, or is being
+	 *	resharded.  Send the script to the node the
+	 *	key slot now lives on.
+	 */
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (sctx->redirects++ >= inst->conf.max_redirects) {
+			REDEBUG("Too many redirects, limit is %u", inst->conf.max_redirects);
+			goto fail;
+		}
 
-	if (inst->owner) {
-		slen = tmpl_expand((char const **)&owner,
-				   (char *)&owner_buff, sizeof(owner_buff),
-				   request, inst->owner, NULL, NULL);
-		if (slen < 0) {
-			REDEBUG("Failed expanding device (%s)", inst->owner->name);
-			RETURN_MODULE_FAIL;
+		RDEBUG2("Following redirect \"%s\"", sctx->reply->str);
+		sctx->rtrunk = fr_redis_cluster_thread_trunk_by_redirect(sctx->thread->cluster_thread, sctx->reply);
+		if (!sctx->rtrunk) {
+			RPEDEBUG("Failed following redirect");
+			goto fail;
 		}
-		owner_len = (size_t)slen;
-	}
+		sctx->asking = (sctx->status == REDIS_RCODE_ASK);
+		return ippool_script_send(p_result, sctx, request);
 
-	if (inst->gateway_id) {
-		slen = tmpl_expand((char const **)&gateway_id,
-				   (char *)&gateway_id_buff, sizeof(gateway_id_buff),
-				   request, inst->gateway_id, NULL, NULL);
-		if (slen < 0) {
-			REDEBUG("Failed expanding gateway (%s)", inst->gateway_id->name);
-			RETURN_MODULE_FAIL;
+	/*
+	 *	The node doesn't have the script cached,
+	 *	try again, uploading the script first.
+	 */
+	case REDIS_RCODE_NO_SCRIPT:
+		if (sctx->load_script) {
+			REDEBUG("Script 0x%s still not available after loading it", sctx->digest);
+			goto fail;
 		}
-		gateway_id_len = (size_t)slen;
-	}
+		sctx->load_script = true;
+		return ippool_script_send(p_result, sctx, request);
 
-	switch (action) {
-	case POOL_ACTION_ALLOCATE:
-		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
-				request, inst->offer_time, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
-			RETURN_MODULE_FAIL;
+	case REDIS_RCODE_RECONNECT:
+		REDEBUG("Failed running script, connection to the server was lost");
+		goto fail;
+
+	default:
+		if (sctx->reply && (sctx->reply->type == REDIS_REPLY_ERROR)) {
+			REDEBUG("Failed running script: %s", sctx->reply->str);
+		} else {
+			REDEBUG("Failed running script");
 		}
+	fail:
+		talloc_free(sctx);
+		RETURN_MODULE_FAIL;
+	}
 
-		expires = strtoul(expires_str, &q, 10);
-		if (q != (expires_str + strlen(expires_str))) {
-			REDEBUG("Invalid offer_time.  Must be an integer value");
-			RETURN_MODULE_FAIL;
+	reply = sctx->reply;
+
+	/*
+	 *	Script was loaded and run in a transaction,
+	 *	the EXEC response contains the SHA1 from
+	 *	SCRIPT LOAD, and the script result.
+	 */
+	if (sctx->load_script) {
+		if (reply->type != REDIS_REPLY_ARRAY) {
+			RERROR("Bad response to EXEC, expected array got %s",
+			       fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+			goto fail;
+		}
+		if (reply->elements != 2) {
+			RERROR("Bad response to EXEC, expected 2 result elements, got %zu", reply->elements);
+			goto fail;
+		}
+		if (reply->element[0]->type != REDIS_REPLY_STRING) {
+			RERROR("Bad response to SCRIPT LOAD, expected string got %s",
+			       fr_table_str_by_value(redis_reply_types, reply->element[0]->type, "<UNKNOWN>"));
+			goto fail;
+		}
+		if (strcmp(reply->element[0]->str, sctx->digest) != 0) {
+			RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
+				sctx->digest, reply->element[0]->str);
+			goto fail;
 		}
+		reply = reply->element[1];
+	}
 
-		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
-				    owner, owner_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
-					      owner, owner_len,
-					      gateway_id, gateway_id_len, (uint32_t)expires)) {
+	switch (sctx->action) {
+	case POOL_ACTION_ALLOCATE:
+		switch (redis_ippool_allocate(inst, request, reply)) {
 		case IPPOOL_RCODE_SUCCESS:
 			RDEBUG2("IP address lease allocated");
-			RETURN_MODULE_UPDATED;
+			rcode = RLM_MODULE_UPDATED;
+			break;
 
 		case IPPOOL_RCODE_POOL_EMPTY:
 			RWDEBUG("Pool contains no free addresses");
-			RETURN_MODULE_NOTFOUND;
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
 
 		default:
-			RETURN_MODULE_FAIL;
+			rcode = RLM_MODULE_FAIL;
+			break;
 		}
+		break;
 
 	case POOL_ACTION_UPDATE:
-	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
-
-		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
-				request, inst->lease_time, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
-			RETURN_MODULE_FAIL;
-		}
-
-		expires = strtoul(expires_str, &q, 10);
-		if (q != (expires_str + strlen(expires_str))) {
-			REDEBUG("Invalid expires.  Must be an integer value");
-			RETURN_MODULE_FAIL;
-		}
-
-		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			RETURN_MODULE_FAIL;
-		}
-
-		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
-			RPEDEBUG("Failed parsing address");
-			RETURN_MODULE_FAIL;
-		}
-
-		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
-				    ip_str, owner, owner_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_update(inst, request, key_prefix, key_prefix_len,
-					    &ip, owner, owner_len,
-					    gateway_id, gateway_id_len, (uint32_t)expires)) {
+		switch (redis_ippool_update(inst, request, reply, sctx->expires)) {
 		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
+			RDEBUG2("Requested IP address' \"%s\" lease updated", sctx->ip_str);
 
 			/*
 			 *	Copy over the input IP address to the reply attribute
@@ -1183,11 +1160,12 @@ static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_redis_ippool_t cons
 					.rhs = &ip_rhs
 				};
 
-				fr_value_box_strdup_shallow(&ip_rhs.data.literal, NULL, ip_str, false);
+				fr_value_box_strdup_shallow(&ip_rhs.data.literal, NULL, sctx->ip_str, false);
 
-				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) RETURN_MODULE_FAIL;
+				if (map_to_request(request, &ip_map, map_to_vp, NULL) < 0) goto fail;
 			}
-			RETURN_MODULE_UPDATED;
+			rcode = RLM_MODULE_UPDATED;
+			break;
 
 		/*
 		 *	It's useful to be able to identify the 'not found' case
@@ -1195,27 +1173,166 @@ static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_redis_ippool_t cons
 		 *	be found.  This extremely useful for migrations.
 		 */
 		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			RETURN_MODULE_NOTFOUND;
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", sctx->ip_str);
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
 
 		case IPPOOL_RCODE_EXPIRED:
-			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", ip_str);
-			RETURN_MODULE_INVALID;
+			REDEBUG("Requested IP address' \"%s\" lease already expired at time of renewal", sctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
 
 		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			RETURN_MODULE_INVALID;
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", sctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
 
 		default:
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+		break;
+
+	case POOL_ACTION_RELEASE:
+		switch (redis_ippool_release(request, reply)) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address \"%s\" released", sctx->ip_str);
+			rcode = RLM_MODULE_UPDATED;
+			break;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", sctx->ip_str);
+			rcode = RLM_MODULE_NOTFOUND;
+			break;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", sctx->ip_str);
+			rcode = RLM_MODULE_INVALID;
+			break;
+
+		default:
+			rcode = RLM_MODULE_FAIL;
+			break;
+		}
+		break;
+
+	default:
+		fr_assert(0);
+		goto fail;
+	}
+
+	talloc_free(sctx);
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+				  request_t *request, ippool_action_t action)
+{
+	uint8_t			key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], owner_buff[256], gateway_id_buff[256];
+	uint8_t const		*key_prefix, *owner = NULL, *gateway_id = NULL;
+	size_t			key_prefix_len, owner_len = 0, gateway_id_len = 0;
+	ssize_t			slen;
+	fr_ipaddr_t		ip;
+	char			expires_buff[20];
+	char const		*expires_str;
+	unsigned long		expires = 0;
+	char			*q;
+	uint32_t		now;
+	fr_redis_trunk_t	*rtrunk;
+	ippool_script_ctx_t	*sctx;
+
+	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
+	if (slen < 0) RETURN_MODULE_FAIL;
+	if (slen == 0) RETURN_MODULE_NOOP;
+
+	key_prefix_len = (size_t)slen;
+
+	if (inst->owner) {
+		slen = tmpl_expand((char const **)&owner,
+				   (char *)&owner_buff, sizeof(owner_buff),
+				   request, inst->owner, NULL, NULL);
+		if (slen < 0) {
+			REDEBUG("Failed expanding device (%s)", inst->owner->name);
+			RETURN_MODULE_FAIL;
+		}
+		owner_len = (size_t)slen;
+	}
+
+	if (inst->gateway_id) {
+		slen = tmpl_expand((char const **)&gateway_id,
+				   (char *)&gateway_id_buff, sizeof(gateway_id_buff),
+				   request, inst->gateway_id, NULL, NULL);
+		if (slen < 0) {
+			REDEBUG("Failed expanding gateway (%s)", inst->gateway_id->name);
 			RETURN_MODULE_FAIL;
 		}
+		gateway_id_len = (size_t)slen;
 	}
 
+	if (action == POOL_ACTION_BULK_RELEASE) {
+		RDEBUG2("Bulk release not yet implemented");
+		RETURN_MODULE_NOOP;
+	}
+
+	/*
+	 *	All the scripts operate on keys in the same
+	 *	hash slot as the pool name.
+	 */
+	rtrunk = fr_redis_cluster_thread_trunk_by_key(t->cluster_thread, request, key_prefix, key_prefix_len);
+	if (!rtrunk) RETURN_MODULE_FAIL;
+
+	now = (uint32_t)fr_time_to_timeval(fr_time()).tv_sec;
+
+	switch (action) {
+	case POOL_ACTION_ALLOCATE:
+		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
+				request, inst->offer_time, NULL, NULL) < 0) {
+			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
+			RETURN_MODULE_FAIL;
+		}
+
+		expires = strtoul(expires_str, &q, 10);
+		if (q != (expires_str + strlen(expires_str))) {
+			REDEBUG("Invalid offer_time.  Must be an integer value");
+			RETURN_MODULE_FAIL;
+		}
+
+		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
+				    owner, owner_len, gateway_id, gateway_id_len, expires);
+
+		sctx = ippool_script_alloc(inst, t, request, action, lua_alloc_digest, lua_alloc_cmd,
+					   key_prefix, key_prefix_len);
+		ippool_script_arg_uint(sctx, now);
+		ippool_script_arg_uint(sctx, (uint32_t)expires);
+		ippool_script_arg(sctx, owner, owner_len);
+		ippool_script_arg(sctx, gateway_id, gateway_id_len);
+		break;
+
+	case POOL_ACTION_UPDATE:
 	case POOL_ACTION_RELEASE:
 	{
 		char		ip_buff[INET6_ADDRSTRLEN + 4];
 		char const	*ip_str;
 
+		if (action == POOL_ACTION_UPDATE) {
+			if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
+					request, inst->lease_time, NULL, NULL) < 0) {
+				REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
+				RETURN_MODULE_FAIL;
+			}
+
+			expires = strtoul(expires_str, &q, 10);
+			if (q != (expires_str + strlen(expires_str))) {
+				REDEBUG("Invalid expires.  Must be an integer value");
+				RETURN_MODULE_FAIL;
+			}
+		}
+
 		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
 			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
 			RETURN_MODULE_FAIL;
@@ -1227,51 +1344,56 @@ static unlang_action_t mod_action(rlm_rcode_t *p_result, rlm_redis_ippool_t cons
 		}
 
 		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
-				    ip_str, owner, owner_len, gateway_id, gateway_id_len, 0);
-		switch (redis_ippool_release(inst, request, key_prefix, key_prefix_len,
-					     &ip, owner, owner_len)) {
-		case IPPOOL_RCODE_SUCCESS:
-			RDEBUG2("IP address \"%s\" released", ip_str);
-			RETURN_MODULE_UPDATED;
+				    ip_str, owner, owner_len, gateway_id, gateway_id_len, expires);
 
-		/*
-		 *	It's useful to be able to identify the 'not found' case
-		 *	as we can relay to a server where the IP address might
-		 *	be found.  This extremely useful for migrations.
-		 */
-		case IPPOOL_RCODE_NOT_FOUND:
-			REDEBUG("Requested IP address \"%s\" is not a member of the specified pool", ip_str);
-			RETURN_MODULE_NOTFOUND;
+		if (action == POOL_ACTION_UPDATE) {
+			sctx = ippool_script_alloc(inst, t, request, action, lua_update_digest, lua_update_cmd,
+						   key_prefix, key_prefix_len);
+			ippool_script_arg_uint(sctx, now);
+			ippool_script_arg_uint(sctx, (uint32_t)expires);
+		} else {
+			sctx = ippool_script_alloc(inst, t, request, action, lua_release_digest, lua_release_cmd,
+						   key_prefix, key_prefix_len);
+			ippool_script_arg_uint(sctx, now);
+		}
 
-		case IPPOOL_RCODE_DEVICE_MISMATCH:
-			REDEBUG("Requested IP address' \"%s\" lease allocated to another device", ip_str);
-			RETURN_MODULE_INVALID;
+		if ((ip.af == AF_INET) && inst->ipv4_integer) {
+			ippool_script_arg_uint(sctx, htonl(ip.addr.v4.s_addr));
+		} else {
+			char ip_sprint_buff[FR_IPADDR_PREFIX_STRLEN];
 
-		default:
-			RETURN_MODULE_FAIL;
+			IPPOOL_SPRINT_IP(ip_sprint_buff, &ip, ip.prefix);
+			ippool_script_arg(sctx, ip_sprint_buff, strlen(ip_sprint_buff));
 		}
-	}
+		ippool_script_arg(sctx, owner, owner_len);
+		if (action == POOL_ACTION_UPDATE) ippool_script_arg(sctx, gateway_id, gateway_id_len);
 
-	case POOL_ACTION_BULK_RELEASE:
-		RDEBUG2("Bulk release not yet implemented");
-		RETURN_MODULE_NOOP;
+		MEM(sctx->ip_str = talloc_strdup(sctx, ip_str));
+	}
+		break;
 
 	default:
 		fr_assert(0);
 		RETURN_MODULE_FAIL;
 	}
+
+	sctx->expires = (uint32_t)expires;
+	sctx->rtrunk = rtrunk;
+
+	return ippool_script_send(p_result, sctx, request);
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
 	fr_pair_t			*vp;
 
 	/*
 	 *	IP-Pool.Action override
 	 */
 	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
-	if (vp) return mod_action(p_result, inst, request, vp->vp_uint32);
+	if (vp) return mod_action(p_result, inst, t, request, vp->vp_uint32);
 
 	/*
 	 *	Otherwise, guess the action by Acct-Status-Type
@@ -1284,14 +1406,14 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 
 	if ((vp->vp_uint32 == enum_acct_status_type_start->vb_uint32) ||
 	    (vp->vp_uint32 == enum_acct_status_type_interim_update->vb_uint32)) {
-		return mod_action(p_result, inst, request, POOL_ACTION_UPDATE);
+		return mod_action(p_result, inst, t, request, POOL_ACTION_UPDATE);
 
 	} else if (vp->vp_uint32 == enum_acct_status_type_stop->vb_uint32) {
-		return mod_action(p_result, inst, request, POOL_ACTION_RELEASE);
+		return mod_action(p_result, inst, t, request, POOL_ACTION_RELEASE);
 
 	} else if ((vp->vp_uint32 == enum_acct_status_type_on->vb_uint32) ||
 		   (vp->vp_uint32 == enum_acct_status_type_off->vb_uint32)) {
-		return mod_action(p_result, inst, request, POOL_ACTION_BULK_RELEASE);
+		return mod_action(p_result, inst, t, request, POOL_ACTION_BULK_RELEASE);
 
 	}
 
@@ -1301,6 +1423,7 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
 	fr_pair_t			*vp;
 
 	/*
@@ -1308,12 +1431,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
-	return mod_action(p_result, inst, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
+	return mod_action(p_result, inst, t, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
 	fr_pair_t			*vp;
 	ippool_action_t			action = POOL_ACTION_ALLOCATE;
 
@@ -1339,12 +1463,13 @@ static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, mod
 	}
 
 run:
-	return mod_action(p_result, inst, request, action);
+	return mod_action(p_result, inst, t, request, action);
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_request(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
 	fr_pair_t			*vp;
 
 	/*
@@ -1353,12 +1478,13 @@ static unlang_action_t CC_HINT(nonnull) mod_request(rlm_rcode_t *p_result, modul
 	 */
 
 	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
-	return mod_action(p_result, inst, request, vp ? vp->vp_uint32 : POOL_ACTION_UPDATE);
+	return mod_action(p_result, inst, t, request, vp ? vp->vp_uint32 : POOL_ACTION_UPDATE);
 }
 
 static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_redis_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_redis_ippool_thread_t);
 	fr_pair_t			*vp;
 
 	/*
@@ -1367,7 +1493,7 @@ static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, modul
 	 */
 
 	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
-	return mod_action(p_result, inst, request, vp ? vp->vp_uint32 : POOL_ACTION_RELEASE);
+	return mod_action(p_result, inst, t, request, vp ? vp->vp_uint32 : POOL_ACTION_RELEASE);
 }
 
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
@@ -1380,9 +1506,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	fr_assert(tmpl_is_attr(inst->allocated_address_attr));
 	fr_assert(subcs);
 
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
 	inst->cluster = fr_redis_cluster_alloc(inst, subcs, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
+	/*
+	 *	Each thread's trunks fill in the address
+	 *	of the node they connect to.
+	 */
+	inst->io_conf = (fr_redis_io_conf_t){
+		.port = inst->conf.port,
+		.database = inst->conf.database,
+		.password = inst->conf.password,
+		.connection_timeout = inst->conf.connection_timeout,
+		.reconnection_delay = inst->conf.reconnection_delay,
+		.log_prefix = inst->name
+	};
+
 	if (!fr_redis_cluster_min_version(inst->cluster, "3.0.2")) {
 		PERROR("Cluster error");
 		return -1;
@@ -1420,6 +1562,31 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Create the trunks for this thread
+ *
+ * Trunks to each node are created the first time a pool maps to them.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_redis_ippool_t		*inst = talloc_get_type_abort(instance, rlm_redis_ippool_t);
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(thread, rlm_redis_ippool_thread_t);
+
+	t->cluster_thread = fr_redis_cluster_thread_alloc(t, el, &inst->trunk_conf,
+							  inst->cluster, &inst->io_conf, inst->name);
+	if (!t->cluster_thread) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_redis_ippool_thread_t	*t = talloc_get_type_abort(thread, rlm_redis_ippool_thread_t);
+
+	TALLOC_FREE(t->cluster_thread);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1436,6 +1603,10 @@ module_t rlm_redis_ippool = {
 	.config		= module_config,
 	.onload		= mod_load,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+	.thread_inst_type	= "rlm_redis_ippool_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
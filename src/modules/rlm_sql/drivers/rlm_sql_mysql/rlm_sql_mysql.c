@@ -69,6 +69,14 @@ DIAG_ON(strict-prototypes)
 #define HAVE_TLS_VERIFY_OPTIONS 0
 #endif
 
+/*
+ *	The non-blocking API was added in MySQL 8.0.16.  MariaDB's
+ *	equivalent (mysql_*_start/cont) is different, and not used.
+ */
+#if !defined(MARIADB_BASE_VERSION) && (MYSQL_VERSION_ID >= 80016)
+#  define HAVE_MYSQL_NONBLOCKING 1
+#endif
+
 #include "rlm_sql.h"
 
 typedef enum {
@@ -217,20 +225,20 @@ static int mod_load(void)
 	return 0;
 }
 
-static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t const *config, fr_time_delta_t timeout)
+/** Set the options for a new connection
+ *
+ * @param[in] db	initialised with mysql_init().
+ * @param[in] inst	Driver instance.
+ * @param[in] config	rlm_sql configuration.
+ * @param[in] timeout	for the connection to be established.
+ * @return flags to pass to mysql_real_connect().
+ */
+static unsigned long sql_options_set(MYSQL *db, rlm_sql_mysql_t const *inst, rlm_sql_config_t const *config,
+				     fr_time_delta_t timeout)
 {
-	rlm_sql_mysql_conn_t *conn;
-	rlm_sql_mysql_t *inst = config->driver;
 	unsigned int connect_timeout = (unsigned int)fr_time_delta_to_sec(timeout);
 	unsigned long sql_flags;
 
-	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
-	talloc_set_destructor(conn, _sql_socket_destructor);
-
-	DEBUG("Starting connect to MySQL server");
-
-	mysql_init(&(conn->db));
-
 	/*
 	 *	If any of the TLS options are set, configure TLS
 	 *
@@ -239,7 +247,7 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 	 */
 	if (inst->tls_ca_file || inst->tls_ca_path ||
 	    inst->tls_certificate_file || inst->tls_private_key_file) {
-		mysql_ssl_set(&(conn->db), inst->tls_private_key_file, inst->tls_certificate_file,
+		mysql_ssl_set(db, inst->tls_private_key_file, inst->tls_certificate_file,
 			      inst->tls_ca_file, inst->tls_ca_path, inst->tls_cipher);
 	}
 
@@ -262,16 +270,16 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 			ssl_mode_isset = true;
 		}
 #  endif
-		if (ssl_mode_isset) mysql_options(&(conn->db), MYSQL_OPT_SSL_MODE, &ssl_mode);
+		if (ssl_mode_isset) mysql_options(db, MYSQL_OPT_SSL_MODE, &ssl_mode);
 	}
 #endif
 
 #if HAVE_CRL_OPTIONS
-	if (inst->tls_crl_file) mysql_options(&(conn->db), MYSQL_OPT_SSL_CRL, inst->tls_crl_file);
-	if (inst->tls_crl_path) mysql_options(&(conn->db), MYSQL_OPT_SSL_CRLPATH, inst->tls_crl_path);
+	if (inst->tls_crl_file) mysql_options(db, MYSQL_OPT_SSL_CRL, inst->tls_crl_file);
+	if (inst->tls_crl_path) mysql_options(db, MYSQL_OPT_SSL_CRLPATH, inst->tls_crl_path);
 #endif
 
-	mysql_options(&(conn->db), MYSQL_READ_DEFAULT_GROUP, "freeradius");
+	mysql_options(db, MYSQL_READ_DEFAULT_GROUP, "freeradius");
 
 	/*
 	 *	We need to know about connection errors, and are capable
@@ -280,12 +288,12 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 #if MYSQL_VERSION_ID >= 50013
 	{
 		bool reconnect = 0;
-		mysql_options(&(conn->db), MYSQL_OPT_RECONNECT, &reconnect);
+		mysql_options(db, MYSQL_OPT_RECONNECT, &reconnect);
 	}
 #endif
 
 #if (MYSQL_VERSION_ID >= 50000)
-	mysql_options(&(conn->db), MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+	mysql_options(db, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
 
 	if (fr_time_delta_ispos(config->query_timeout)) {
 		unsigned int read_timeout = fr_time_delta_to_sec(config->query_timeout);
@@ -309,8 +317,8 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 		 *	Connect timeout is actually connect timeout (according to the
 		 *	docs) there are no automatic retries.
 		 */
-		mysql_options(&(conn->db), MYSQL_OPT_READ_TIMEOUT, &read_timeout);
-		mysql_options(&(conn->db), MYSQL_OPT_WRITE_TIMEOUT, &write_timeout);
+		mysql_options(db, MYSQL_OPT_READ_TIMEOUT, &read_timeout);
+		mysql_options(db, MYSQL_OPT_WRITE_TIMEOUT, &write_timeout);
 	}
 #endif
 
@@ -323,6 +331,25 @@ static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t co
 #ifdef CLIENT_MULTI_STATEMENTS
 	sql_flags |= CLIENT_MULTI_STATEMENTS;
 #endif
+
+	return sql_flags;
+}
+
+static sql_rcode_t sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_config_t const *config, fr_time_delta_t timeout)
+{
+	rlm_sql_mysql_conn_t *conn;
+	rlm_sql_mysql_t *inst = config->driver;
+	unsigned long sql_flags;
+
+	MEM(conn = handle->conn = talloc_zero(handle, rlm_sql_mysql_conn_t));
+	talloc_set_destructor(conn, _sql_socket_destructor);
+
+	DEBUG("Starting connect to MySQL server");
+
+	mysql_init(&(conn->db));
+
+	sql_flags = sql_options_set(&(conn->db), inst, config, timeout);
+
 	conn->sock = mysql_real_connect(&(conn->db),
 					config->sql_server,
 					config->sql_login,
@@ -839,6 +866,436 @@ static size_t sql_escape_func(UNUSED request_t *request, char *out, size_t outle
 	return mysql_real_escape_string(conn->sock, out, in, inlen);
 }
 
+#ifdef HAVE_MYSQL_NONBLOCKING
+/** Where a trunk connection is in the MySQL protocol
+ *
+ */
+typedef enum {
+	SQL_MYSQL_ASYNC_CONNECT = 0,			//!< Connecting and authenticating.
+	SQL_MYSQL_ASYNC_IDLE,				//!< Ready for a query.
+	SQL_MYSQL_ASYNC_QUERY,				//!< Waiting for the query to complete.
+	SQL_MYSQL_ASYNC_STORE,				//!< Reading (and discarding) a result set.
+	SQL_MYSQL_ASYNC_NEXT				//!< Moving to the next result set.
+} rlm_sql_mysql_async_state_t;
+
+/** Non-blocking connection used by the trunk
+ *
+ * The MySQL protocol only allows one query in flight per connection,
+ * so the trunk opens more connections as the number of outstanding
+ * queries grows.
+ */
+typedef struct {
+	MYSQL				db;		//!< libmysql handle.
+	rlm_sql_mysql_t const		*inst;		//!< Driver instance.
+	rlm_sql_config_t const		*config;	//!< rlm_sql configuration.
+	unsigned long			flags;		//!< Passed to mysql_real_connect_nonblocking().
+
+	fr_connection_t			*conn;		//!< Connection this handle belongs to.
+	rlm_sql_handle_t		*handle;	//!< Wraps db, so queries can be expanded
+							///< and escaped for this connection.
+	fr_trunk_connection_t		*tconn;		//!< Trunk connection, set when the trunk first
+							///< asks for events.
+	int				fd;		//!< Socket libmysql is using.
+	bool				want_write;	//!< Trunk wants write notifications.
+
+	rlm_sql_mysql_async_state_t	state;		//!< What we're waiting for.
+	sql_async_query_t		*query;		//!< Query being run.  NULL if idle or orphaned.
+	char				*query_str;	//!< Our copy of the query text.  libmysql needs
+							///< it on every call until the query completes,
+							///< even if the query is orphaned.
+} rlm_sql_mysql_trunk_conn_t;
+
+static void sql_trunk_events_update(rlm_sql_mysql_trunk_conn_t *c);
+
+/** Finish the current query, and tell the trunk
+ *
+ */
+static void sql_trunk_query_done(rlm_sql_mysql_trunk_conn_t *c)
+{
+	sql_async_query_t	*query = c->query;
+
+	c->state = SQL_MYSQL_ASYNC_IDLE;
+	c->query = NULL;
+	TALLOC_FREE(c->query_str);
+
+	if (!query) return;
+
+	query->uctx = NULL;
+	fr_trunk_request_signal_complete(query->treq);
+}
+
+/** Record an error for the current query
+ *
+ * @return the rcode for the error.
+ */
+static sql_rcode_t sql_trunk_query_error(rlm_sql_mysql_trunk_conn_t *c)
+{
+	sql_rcode_t	rcode = sql_check_error(&c->db, 0);
+
+	if (c->query) {
+		request_t *request = c->query->request;
+
+		ROPTIONAL(REDEBUG, ERROR, "MySQL error: %s", mysql_error(&c->db));
+		c->query->rcode = rcode;
+	}
+
+	return rcode;
+}
+
+/** Advance the current query as far as we can without blocking
+ *
+ * As with sql_finish_query, any result sets are read and discarded.
+ *
+ * @return
+ *	- 0 if the query is complete or is waiting for data.
+ *	- -1 if the connection needs to be re-established.
+ */
+static int sql_trunk_query_step(rlm_sql_mysql_trunk_conn_t *c)
+{
+	enum net_async_status	status;
+	MYSQL_RES		*result = NULL;
+	sql_rcode_t		rcode;
+
+again:
+	switch (c->state) {
+	case SQL_MYSQL_ASYNC_QUERY:
+		status = mysql_real_query_nonblocking(&c->db, c->query_str, talloc_array_length(c->query_str) - 1);
+		if (status == NET_ASYNC_NOT_READY) return 0;
+		if (status == NET_ASYNC_ERROR) {
+		error:
+			rcode = sql_trunk_query_error(c);
+			sql_trunk_query_done(c);
+			return (rcode == RLM_SQL_RECONNECT) ? -1 : 0;
+		}
+
+		if (c->query) {
+			c->query->rcode = RLM_SQL_OK;
+			c->query->affected_rows = mysql_affected_rows(&c->db);
+		}
+		c->state = SQL_MYSQL_ASYNC_STORE;
+		FALL_THROUGH;
+
+	case SQL_MYSQL_ASYNC_STORE:
+		status = mysql_store_result_nonblocking(&c->db, &result);
+		if (status == NET_ASYNC_NOT_READY) return 0;
+		if (result) mysql_free_result(result);
+		if (status == NET_ASYNC_ERROR) goto error;
+
+		c->state = SQL_MYSQL_ASYNC_NEXT;
+		FALL_THROUGH;
+
+	case SQL_MYSQL_ASYNC_NEXT:
+		if (!mysql_more_results(&c->db)) break;
+
+		status = mysql_next_result_nonblocking(&c->db);
+		switch (status) {
+		case NET_ASYNC_NOT_READY:
+			return 0;
+
+		case NET_ASYNC_COMPLETE:
+			c->state = SQL_MYSQL_ASYNC_STORE;
+			goto again;
+
+		case NET_ASYNC_ERROR:
+			goto error;
+
+		default:
+			break;
+		}
+		break;
+
+	default:
+		return 0;
+	}
+
+	sql_trunk_query_done(c);
+
+	return 0;
+}
+
+static void _sql_trunk_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_mysql_trunk_conn_t);
+
+	fr_trunk_connection_signal_readable(c->tconn);
+}
+
+static void _sql_trunk_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_mysql_trunk_conn_t);
+
+	fr_trunk_connection_signal_writable(c->tconn);
+}
+
+static void _sql_trunk_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_mysql_trunk_conn_t);
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+}
+
+/** Install or remove I/O events for a connected trunk connection
+ *
+ * We read while a query is in progress, even an orphaned one, and
+ * only ask for writes when there's no query in progress.
+ *
+ * @note Queries are written when they're muxed, and are assumed to
+ *	 fit in the socket buffer.  The response is what we wait for.
+ */
+static void sql_trunk_events_update(rlm_sql_mysql_trunk_conn_t *c)
+{
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	if (c->state != SQL_MYSQL_ASYNC_IDLE) {
+		read_fn = _sql_trunk_conn_readable;
+	} else if (c->want_write) {
+		write_fn = _sql_trunk_conn_writable;
+	}
+
+	if (!read_fn && !write_fn) {
+		fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+		return;
+	}
+
+	if (fr_event_fd_insert(c, c->conn->el, c->fd, read_fn, write_fn, _sql_trunk_conn_error, c) < 0) {
+		PERROR("Failed inserting FD event");
+		fr_trunk_connection_signal_reconnect(c->tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+static int sql_trunk_connect_step(rlm_sql_mysql_trunk_conn_t *c);
+
+static void _sql_trunk_connect_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_mysql_trunk_conn_t);
+
+	if (sql_trunk_connect_step(c) < 0) fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+}
+
+/** Advance the connection handshake as far as we can without blocking
+ *
+ * After the TCP connection is established the server speaks first,
+ * and every client message is answered, so we only wait for reads.
+ */
+static int sql_trunk_connect_step(rlm_sql_mysql_trunk_conn_t *c)
+{
+	rlm_sql_config_t const	*config = c->config;
+
+	switch (mysql_real_connect_nonblocking(&c->db, config->sql_server, config->sql_login, config->sql_password,
+					       config->sql_db, config->sql_port, NULL, c->flags)) {
+	case NET_ASYNC_NOT_READY:
+		if ((c->fd >= 0) && (c->fd != c->db.net.fd)) fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = c->db.net.fd;
+		if (c->fd < 0) {
+			ERROR("Unable to obtain socket");
+			return -1;
+		}
+
+		if (fr_event_fd_insert(c, c->conn->el, c->fd, _sql_trunk_connect_io, NULL, _sql_trunk_conn_error, c) < 0) {
+			PERROR("Failed inserting FD event");
+			return -1;
+		}
+		return 0;
+
+	case NET_ASYNC_COMPLETE:
+		break;
+
+	default:
+		ERROR("Couldn't connect to MySQL server %s@%s:%s", config->sql_login,
+		      config->sql_server, config->sql_db);
+		ERROR("MySQL error: %s", mysql_error(&c->db));
+		return -1;
+	}
+
+	DEBUG2("Connected to database '%s' on %s, server version %s, protocol version %i",
+	       config->sql_db, mysql_get_host_info(&c->db),
+	       mysql_get_server_info(&c->db), mysql_get_proto_info(&c->db));
+
+	/*
+	 *	The trunk installs its own events once
+	 *	it knows what it wants to be notified of.
+	 */
+	c->fd = c->db.net.fd;
+	fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+	c->state = SQL_MYSQL_ASYNC_IDLE;
+	fr_connection_signal_connected(c->conn);
+
+	return 0;
+}
+
+static int _sql_trunk_conn_free(rlm_sql_mysql_trunk_conn_t *c)
+{
+	if (c->query) c->query->uctx = NULL;
+
+	mysql_close(&c->db);
+
+	return 0;
+}
+
+/** Start a non-blocking connection to the database
+ *
+ */
+static fr_connection_state_t _sql_trunk_conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	rlm_sql_thread_t const		*t = talloc_get_type_abort_const(uctx, rlm_sql_thread_t);
+	rlm_sql_mysql_trunk_conn_t	*c;
+
+	MEM(c = talloc_zero(conn, rlm_sql_mysql_trunk_conn_t));
+	c->inst = t->inst->config.driver;
+	c->config = &t->inst->config;
+	c->conn = conn;
+	c->fd = -1;
+	c->state = SQL_MYSQL_ASYNC_CONNECT;
+
+	DEBUG("Starting connect to MySQL server");
+
+	mysql_init(&c->db);
+	talloc_set_destructor(c, _sql_trunk_conn_free);
+
+	MEM(c->handle = talloc_zero(c, rlm_sql_handle_t));
+	c->handle->inst = t->inst;
+	MEM(c->handle->conn = talloc_zero(c->handle, rlm_sql_mysql_conn_t));
+	((rlm_sql_mysql_conn_t *)c->handle->conn)->sock = &c->db;
+
+	c->flags = sql_options_set(&c->db, c->inst, c->config, t->inst->config.trunk_conf.conn_conf->connection_timeout);
+
+	if (sql_trunk_connect_step(c) < 0) {
+		talloc_free(c);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	*h_out = c;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+static void _sql_trunk_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(h, rlm_sql_mysql_trunk_conn_t);
+
+	if (c->fd >= 0) {
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = -1;
+	}
+
+	talloc_free(c);
+}
+
+static fr_connection_t *sql_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						   fr_connection_conf_t const *conn_conf,
+						   char const *log_prefix, void *uctx)
+{
+	return fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_trunk_conn_init,
+					.close = _sql_trunk_conn_close
+				   },
+				   conn_conf, log_prefix, uctx);
+}
+
+static void sql_trunk_connection_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+					UNUSED fr_event_list_t *el,
+					fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_mysql_trunk_conn_t);
+
+	c->tconn = tconn;
+	c->want_write = (notify_on == FR_TRUNK_CONN_EVENT_WRITE) || (notify_on == FR_TRUNK_CONN_EVENT_BOTH);
+
+	sql_trunk_events_update(c);
+}
+
+/** Send the next pending query, if the connection is idle
+ *
+ */
+static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				  fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_mysql_trunk_conn_t);
+	fr_trunk_request_t		*treq;
+	sql_async_query_t		*query;
+
+	if (c->state != SQL_MYSQL_ASYNC_IDLE) return;
+
+next:
+	if ((fr_trunk_connection_pop_request(&treq, tconn) != 0) || !treq) return;
+
+	query = talloc_get_type_abort(treq->preq, sql_async_query_t);
+
+	/*
+	 *	Expand now we know which connection the query is
+	 *	going out on, so mysql_real_escape_string can use
+	 *	its character set.
+	 */
+	switch (c->handle->inst->sql_async_query_expand(query, c->handle)) {
+	case 0:
+		break;
+
+	case 1:
+		fr_trunk_request_signal_complete(treq);
+		goto next;
+
+	default:
+		fr_trunk_request_signal_fail(treq);
+		goto next;
+	}
+
+	MEM(c->query_str = talloc_typed_strdup(c, query->query_str));
+	c->query = query;
+	c->state = SQL_MYSQL_ASYNC_QUERY;
+	query->uctx = c;
+
+	fr_trunk_request_signal_sent(treq);
+
+	if (sql_trunk_query_step(c) < 0) {
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	sql_trunk_events_update(c);
+}
+
+/** Continue the query in progress
+ *
+ */
+static void sql_trunk_request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_mysql_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_mysql_trunk_conn_t);
+
+	if (sql_trunk_query_step(c) < 0) {
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	sql_trunk_events_update(c);
+}
+
+/** Orphan a sent query, so its results are discarded when they arrive
+ *
+ */
+static void sql_trunk_request_conn_release(UNUSED fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	sql_async_query_t		*query = talloc_get_type_abort(preq_to_reset, sql_async_query_t);
+	rlm_sql_mysql_trunk_conn_t	*c = query->uctx;
+
+	if (!c) return;
+
+	c->query = NULL;
+	query->uctx = NULL;
+}
+
+static fr_trunk_io_funcs_t const trunk_io_funcs = {
+	.connection_alloc	= sql_trunk_connection_alloc,
+	.connection_notify	= sql_trunk_connection_notify,
+	.request_mux		= sql_trunk_request_mux,
+	.request_demux		= sql_trunk_request_demux,
+	.request_conn_release	= sql_trunk_request_conn_release
+};
+#endif
+
 
 /* Exported to rlm_sql */
 extern rlm_sql_driver_t rlm_sql_mysql;
@@ -864,5 +1321,8 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_finish_query,
 	.sql_finish_select_query	= sql_finish_query,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+#ifdef HAVE_MYSQL_NONBLOCKING
+	.trunk_io_funcs			= &trunk_io_funcs
+#endif
 };
@@ -74,6 +74,51 @@ typedef struct {
 	char		**row;
 } rlm_sql_postgres_conn_t;
 
+/** A query which has been sent on a trunk connection, and is awaiting results
+ *
+ * PostgreSQL returns results in the order queries were sent, so these
+ * are kept in a FIFO.  If the trunk request is removed from the connection
+ * before its results arrive, query is set to NULL and the results are
+ * discarded.
+ *
+ * A batch is sent as BEGIN, the member queries, then COMMIT, with a
+ * single sync.  slots maps each member statement to its member.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the connection's list of sent queries.
+	sql_async_query_t	*query;			//!< Query the results belong to.  NULL if orphaned.
+	bool			have_result;		//!< We've already recorded the first result for
+							///< the current statement.
+
+	size_t			stmt;			//!< Statement we're reading results for.
+	size_t			*slots;			//!< Member slot for statements 1..n of a batch.
+	size_t			num_slots;		//!< Number of members sent.
+	bool			failed;			//!< A statement in the batch failed, so the
+							///< transaction was rolled back.
+	size_t			failed_slot;		//!< Member that caused the rollback, or
+							///< num_members if it was BEGIN or COMMIT.
+} rlm_sql_postgres_pending_t;
+
+/** Non-blocking connection used by the trunk
+ *
+ */
+typedef struct {
+	PGconn			*db;			//!< libpq connection, in non-blocking (and pipeline) mode.
+	rlm_sql_postgres_t	*inst;			//!< Driver instance.
+	fr_connection_t		*conn;			//!< Connection this handle belongs to.
+	rlm_sql_handle_t	*handle;		//!< Wraps db, so queries can be expanded
+							///< and escaped for this connection.
+	fr_trunk_connection_t	*tconn;			//!< Trunk connection, set when the trunk first
+							///< asks for events.
+	int			fd;			//!< Socket libpq is currently using.
+
+	bool			want_read;		//!< Trunk wants read notifications.
+	bool			want_write;		//!< Trunk wants write notifications.
+	bool			flush_pending;		//!< libpq has data queued that it couldn't write.
+
+	fr_dlist_head_t		sent;			//!< Queries awaiting results, oldest first.
+} rlm_sql_postgres_trunk_conn_t;
+
 static CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", FR_TYPE_BOOL, rlm_sql_postgres_t, send_application_name), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
@@ -544,6 +589,569 @@ static size_t sql_escape_func(request_t *request, char *out, size_t outlen, char
 	return ret;
 }
 
+/** Write the result of a query sent on a trunk connection to the rlm_sql query
+ *
+ */
+static void sql_trunk_query_result(rlm_sql_postgres_trunk_conn_t *c, sql_async_query_t *query, PGresult *result)
+{
+	request_t	*request = query->request;
+	ExecStatusType	status = PQresultStatus(result);
+
+	switch (status) {
+	case PGRES_COMMAND_OK:
+		query->affected_rows = affected_rows(result);
+		break;
+
+#ifdef HAVE_PGRES_SINGLE_TUPLE
+	case PGRES_SINGLE_TUPLE:
+#endif
+	case PGRES_TUPLES_OK:
+		query->affected_rows = PQntuples(result);
+		break;
+
+	default:
+		break;
+	}
+
+	query->rcode = sql_classify_error(c->inst, status, result);
+	if (query->rcode != RLM_SQL_OK) {
+		char const *msg = PQresultErrorMessage(result);
+
+		if (msg && *msg) ROPTIONAL(REDEBUG, ERROR, "%s", msg);
+	}
+}
+
+/** Record a result for the current statement of a sent query or batch
+ *
+ */
+static void sql_trunk_pending_result(rlm_sql_postgres_trunk_conn_t *c, rlm_sql_postgres_pending_t *pending,
+				     PGresult *result)
+{
+	sql_async_query_t	*query = pending->query;
+	sql_async_query_t	*member;
+	ExecStatusType		status;
+
+	if (!query) return;
+
+	if (!query->members) {
+		sql_trunk_query_result(c, query, result);
+		return;
+	}
+
+	status = PQresultStatus(result);
+
+	/*
+	 *	Something earlier in the transaction failed.
+	 */
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	if (status == PGRES_PIPELINE_ABORTED) return;
+#endif
+
+	/*
+	 *	BEGIN or COMMIT
+	 */
+	if ((pending->stmt == 0) || (pending->stmt > pending->num_slots)) {
+		if (sql_classify_error(c->inst, status, result) == RLM_SQL_OK) return;
+
+		ERROR("Batch %s failed: %s", (pending->stmt == 0) ? "BEGIN" : "COMMIT", PQresultErrorMessage(result));
+		if (!pending->failed) {
+			pending->failed = true;
+			pending->failed_slot = query->num_members;
+		}
+		return;
+	}
+
+	member = query->members[pending->slots[pending->stmt - 1]];
+	if (member) {
+		sql_trunk_query_result(c, member, result);
+		if (member->rcode == RLM_SQL_OK) return;
+	} else {
+		if (sql_classify_error(c->inst, status, result) == RLM_SQL_OK) return;
+	}
+
+	if (!pending->failed) {
+		pending->failed = true;
+		pending->failed_slot = pending->slots[pending->stmt - 1];
+	}
+}
+
+/** Remove a query from the head of the sent list, and tell the trunk it's done
+ *
+ */
+static void sql_trunk_query_done(rlm_sql_postgres_trunk_conn_t *c, rlm_sql_postgres_pending_t *pending)
+{
+	sql_async_query_t	*query = pending->query;
+
+	/*
+	 *	Everything in the transaction was rolled back.  Members
+	 *	other than the one which caused it are run again.
+	 */
+	if (query && query->members && pending->failed) {
+		size_t i;
+
+		for (i = 0; i < query->num_members; i++) {
+			if (!query->members[i] || (i == pending->failed_slot)) continue;
+			query->members[i]->retry = true;
+		}
+	}
+
+	fr_dlist_remove(&c->sent, pending);
+	talloc_free(pending);
+
+	if (!query) return;
+
+	query->uctx = NULL;
+	fr_trunk_request_signal_complete(query->treq);
+}
+
+/** Install or remove I/O events for a connected trunk connection
+ *
+ * We always read while there are queries outstanding, even cancelled ones,
+ * so their results don't back up on the socket.  We always write while
+ * libpq has unflushed data.
+ */
+static void sql_trunk_events_update(rlm_sql_postgres_trunk_conn_t *c);
+
+static void _sql_trunk_conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+
+	fr_trunk_connection_signal_readable(c->tconn);
+}
+
+static void _sql_trunk_conn_writable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+
+	if (c->flush_pending) {
+		int ret;
+
+		ret = PQflush(c->db);
+		if (ret < 0) {
+			ERROR("Failed sending queries: %s", PQerrorMessage(c->db));
+			fr_trunk_connection_signal_reconnect(c->tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+		c->flush_pending = (ret == 1);
+		if (c->flush_pending) return;
+
+		sql_trunk_events_update(c);
+	}
+
+	if (c->want_write) fr_trunk_connection_signal_writable(c->tconn);
+}
+
+static void _sql_trunk_conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+}
+
+static void sql_trunk_events_update(rlm_sql_postgres_trunk_conn_t *c)
+{
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	if (c->want_read || (fr_dlist_num_elements(&c->sent) > 0)) read_fn = _sql_trunk_conn_readable;
+	if (c->want_write || c->flush_pending) write_fn = _sql_trunk_conn_writable;
+
+	if (!read_fn && !write_fn) {
+		fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+		return;
+	}
+
+	if (fr_event_fd_insert(c, c->conn->el, c->fd, read_fn, write_fn, _sql_trunk_conn_error, c) < 0) {
+		PERROR("Failed inserting FD event");
+		fr_trunk_connection_signal_reconnect(c->tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** Advance the libpq connection state machine
+ *
+ */
+static void _sql_trunk_connect_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+
+static void _sql_trunk_connect_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+
+	ERROR("Connection failed: %s", fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+}
+
+/** Wait for the event libpq needs to make progress connecting
+ *
+ * libpq may move to a different socket when it tries another host, so
+ * the socket is re-read every time.
+ */
+static int sql_trunk_connect_wait(rlm_sql_postgres_trunk_conn_t *c, PostgresPollingStatusType poll)
+{
+	int fd;
+
+	fd = PQsocket(c->db);
+	if (fd < 0) {
+		ERROR("Unable to obtain socket: %s", PQerrorMessage(c->db));
+		return -1;
+	}
+
+	if ((c->fd >= 0) && (c->fd != fd)) fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+	c->fd = fd;
+
+	if (fr_event_fd_insert(c, c->conn->el, c->fd,
+			       (poll == PGRES_POLLING_READING) ? _sql_trunk_connect_io : NULL,
+			       (poll == PGRES_POLLING_WRITING) ? _sql_trunk_connect_io : NULL,
+			       _sql_trunk_connect_error, c) < 0) {
+		PERROR("Failed inserting FD event");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void _sql_trunk_connect_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(uctx, rlm_sql_postgres_trunk_conn_t);
+	PostgresPollingStatusType	poll;
+
+	poll = PQconnectPoll(c->db);
+	switch (poll) {
+	case PGRES_POLLING_READING:
+	case PGRES_POLLING_WRITING:
+		if (sql_trunk_connect_wait(c, poll) < 0) goto error;
+		return;
+
+	case PGRES_POLLING_OK:
+		break;
+
+	default:
+		ERROR("Connection failed: %s", PQerrorMessage(c->db));
+	error:
+		fr_connection_signal_reconnect(c->conn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	if (PQsetnonblocking(c->db, 1) != 0) {
+		ERROR("Failed setting connection non-blocking: %s", PQerrorMessage(c->db));
+		goto error;
+	}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	if (PQenterPipelineMode(c->db) != 1) {
+		ERROR("Failed entering pipeline mode: %s", PQerrorMessage(c->db));
+		goto error;
+	}
+#endif
+
+	DEBUG2("Connected to database '%s' on '%s' server version %i, protocol version %i, backend PID %i ",
+	       PQdb(c->db), PQhost(c->db), PQserverVersion(c->db), PQprotocolVersion(c->db),
+	       PQbackendPID(c->db));
+
+	/*
+	 *	The trunk installs its own events once
+	 *	it knows what it wants to be notified of.
+	 */
+	fr_event_fd_delete(c->conn->el, c->fd, FR_EVENT_FILTER_IO);
+	fr_connection_signal_connected(c->conn);
+}
+
+static int _sql_trunk_conn_free(rlm_sql_postgres_trunk_conn_t *c)
+{
+	rlm_sql_postgres_pending_t *pending;
+
+	/*
+	 *	Stop any queries still associated with this
+	 *	connection pointing at freed memory.
+	 */
+	while ((pending = fr_dlist_head(&c->sent))) {
+		if (pending->query) pending->query->uctx = NULL;
+		fr_dlist_remove(&c->sent, pending);
+	}
+
+	if (c->db) PQfinish(c->db);
+
+	return 0;
+}
+
+/** Start a non-blocking connection to the database
+ *
+ */
+static fr_connection_state_t _sql_trunk_conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	rlm_sql_thread_t const		*t = talloc_get_type_abort_const(uctx, rlm_sql_thread_t);
+	rlm_sql_postgres_trunk_conn_t	*c;
+
+	MEM(c = talloc_zero(conn, rlm_sql_postgres_trunk_conn_t));
+	c->inst = t->inst->config.driver;
+	c->conn = conn;
+	c->fd = -1;
+	fr_dlist_talloc_init(&c->sent, rlm_sql_postgres_pending_t, entry);
+	talloc_set_destructor(c, _sql_trunk_conn_free);
+
+	DEBUG2("Connecting using parameters: %s", c->inst->db_string);
+	c->db = PQconnectStart(c->inst->db_string);
+	if (!c->db) {
+		ERROR("Connection failed: Out of memory");
+	error:
+		talloc_free(c);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	if (PQstatus(c->db) == CONNECTION_BAD) {
+		ERROR("Connection failed: %s", PQerrorMessage(c->db));
+		goto error;
+	}
+
+	MEM(c->handle = talloc_zero(c, rlm_sql_handle_t));
+	c->handle->inst = t->inst;
+	MEM(c->handle->conn = talloc_zero(c->handle, rlm_sql_postgres_conn_t));
+	((rlm_sql_postgres_conn_t *)c->handle->conn)->db = c->db;
+
+	/*
+	 *	libpq says to behave as if the last poll
+	 *	returned PGRES_POLLING_WRITING.
+	 */
+	if (sql_trunk_connect_wait(c, PGRES_POLLING_WRITING) < 0) goto error;
+
+	*h_out = c;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+static void _sql_trunk_conn_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(h, rlm_sql_postgres_trunk_conn_t);
+
+	if (c->fd >= 0) {
+		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
+		c->fd = -1;
+	}
+
+	talloc_free(c);
+}
+
+static fr_connection_t *sql_trunk_connection_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+						   fr_connection_conf_t const *conn_conf,
+						   char const *log_prefix, void *uctx)
+{
+	return fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = _sql_trunk_conn_init,
+					.close = _sql_trunk_conn_close
+				   },
+				   conn_conf, log_prefix, uctx);
+}
+
+static void sql_trunk_connection_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+					UNUSED fr_event_list_t *el,
+					fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+
+	c->tconn = tconn;
+	c->want_read = (notify_on == FR_TRUNK_CONN_EVENT_READ) || (notify_on == FR_TRUNK_CONN_EVENT_BOTH);
+	c->want_write = (notify_on == FR_TRUNK_CONN_EVENT_WRITE) || (notify_on == FR_TRUNK_CONN_EVENT_BOTH);
+
+	sql_trunk_events_update(c);
+}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** Send a batch of queries as a single transaction
+ *
+ * There's only one sync, after the COMMIT, so if any statement fails the
+ * rest are aborted and the transaction is rolled back.
+ */
+static int sql_trunk_batch_send(rlm_sql_postgres_trunk_conn_t *c, rlm_sql_postgres_pending_t *pending,
+				sql_async_query_t *batch)
+{
+	size_t i;
+
+	MEM(pending->slots = talloc_array(pending, size_t, batch->num_members));
+
+	if (!PQsendQueryParams(c->db, "BEGIN", 0, NULL, NULL, NULL, NULL, 0)) return -1;
+
+	for (i = 0; i < batch->num_members; i++) {
+		if (!batch->members[i]) continue;
+
+		if (!PQsendQueryParams(c->db, batch->members[i]->query_str, 0, NULL, NULL, NULL, NULL, 0)) return -1;
+		pending->slots[pending->num_slots++] = i;
+	}
+
+	if (!PQsendQueryParams(c->db, "COMMIT", 0, NULL, NULL, NULL, NULL, 0) ||
+	    !PQpipelineSync(c->db)) return -1;
+
+	return 0;
+}
+#endif
+
+/** Send pending queries
+ *
+ * With pipeline mode every query is followed by a sync, so a failed
+ * query doesn't abort the ones sent after it.  Without it, only one
+ * query can be outstanding on a connection.
+ */
+static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn,
+				  fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+	fr_trunk_request_t		*treq;
+	int				ret;
+
+	while (true) {
+		sql_async_query_t		*query;
+		rlm_sql_postgres_pending_t	*pending;
+
+#ifndef HAVE_PGRES_PIPELINE_SYNC
+		if (fr_dlist_num_elements(&c->sent) > 0) break;
+#endif
+
+		if ((fr_trunk_connection_pop_request(&treq, tconn) != 0) || !treq) break;
+
+		query = talloc_get_type_abort(treq->preq, sql_async_query_t);
+
+		/*
+		 *	Expand now we know which connection the query
+		 *	is going out on, so PQescapeStringConn can use
+		 *	its client encoding.
+		 */
+		switch (c->handle->inst->sql_async_query_expand(query, c->handle)) {
+		case 0:
+			break;
+
+		case 1:
+			fr_trunk_request_signal_complete(treq);
+			continue;
+
+		default:
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		MEM(pending = talloc_zero(c, rlm_sql_postgres_pending_t));
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		if (query->members) {
+			if (sql_trunk_batch_send(c, pending, query) < 0) goto send_error;
+		} else
+		if (!PQsendQueryParams(c->db, query->query_str, 0, NULL, NULL, NULL, NULL, 0) ||
+		    !PQpipelineSync(c->db)) {
+#else
+		if (!PQsendQuery(c->db, query->query_str)) {
+#endif
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		send_error:
+#endif
+			ERROR("Failed to send query: %s", PQerrorMessage(c->db));
+			talloc_free(pending);
+			fr_trunk_request_signal_fail(treq);
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+
+		pending->query = query;
+		query->uctx = pending;
+		fr_dlist_insert_tail(&c->sent, pending);
+
+		fr_trunk_request_signal_sent(treq);
+	}
+
+	ret = PQflush(c->db);
+	if (ret < 0) {
+		ERROR("Failed sending queries: %s", PQerrorMessage(c->db));
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+	c->flush_pending = (ret == 1);
+
+	sql_trunk_events_update(c);
+}
+
+/** Read results, and complete the queries they belong to
+ *
+ * Only the first result of each query is recorded, any others (from
+ * multiple statements) are discarded as they are in the synchronous path.
+ * Batches get the first result of each statement.
+ */
+static void sql_trunk_request_demux(fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_trunk_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_trunk_conn_t);
+	rlm_sql_postgres_pending_t	*pending;
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	bool				prev_null = false;
+#endif
+
+	if (!PQconsumeInput(c->db)) {
+		ERROR("Failed reading input: %s", PQerrorMessage(c->db));
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	while ((pending = fr_dlist_head(&c->sent)) && !PQisBusy(c->db)) {
+		PGresult *result;
+
+		result = PQgetResult(c->db);
+		if (!result) {
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+			/*
+			 *	End of this query's results, the sync
+			 *	result follows.  Two in a row means
+			 *	there's nothing else to read yet.
+			 */
+			if (prev_null) break;
+			prev_null = true;
+			pending->stmt++;
+			pending->have_result = false;
+#else
+			sql_trunk_query_done(c, pending);
+#endif
+			continue;
+		}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		prev_null = false;
+
+		if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+			PQclear(result);
+			sql_trunk_query_done(c, pending);
+			continue;
+		}
+#endif
+
+		if (!pending->have_result) {
+			pending->have_result = true;
+			sql_trunk_pending_result(c, pending, result);
+		}
+		PQclear(result);
+	}
+
+	sql_trunk_events_update(c);
+}
+
+/** Orphan a sent query, so its results are discarded when they arrive
+ *
+ */
+static void sql_trunk_request_conn_release(UNUSED fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	sql_async_query_t		*query = talloc_get_type_abort(preq_to_reset, sql_async_query_t);
+	rlm_sql_postgres_pending_t	*pending = query->uctx;
+
+	if (!pending) return;
+
+	pending->query = NULL;
+	query->uctx = NULL;
+}
+
+static fr_trunk_io_funcs_t const trunk_io_funcs = {
+	.connection_alloc	= sql_trunk_connection_alloc,
+	.connection_notify	= sql_trunk_connection_notify,
+	.request_mux		= sql_trunk_request_mux,
+	.request_demux		= sql_trunk_request_demux,
+	.request_conn_release	= sql_trunk_request_conn_release
+};
+
 static int mod_instantiate(rlm_sql_config_t const *config, void *instance, CONF_SECTION *conf)
 {
 	rlm_sql_postgres_t	*inst = instance;
@@ -669,7 +1277,11 @@ extern rlm_sql_driver_t rlm_sql_postgresql;
 rlm_sql_driver_t rlm_sql_postgresql = {
 	.name				= "rlm_sql_postgresql",
 	.magic				= RLM_MODULE_INIT,
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY | RLM_SQL_FLAGS_BATCH,
+#else
 	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,
+#endif
 	.inst_size			= sizeof(rlm_sql_postgres_t),
 	.onload				= mod_load,
 	.config				= driver_config,
@@ -684,5 +1296,6 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
 	.sql_affected_rows		= sql_affected_rows,
-	.sql_escape_func		= sql_escape_func
+	.sql_escape_func		= sql_escape_func,
+	.trunk_io_funcs			= &trunk_io_funcs
 };
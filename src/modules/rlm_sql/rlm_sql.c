@@ -68,6 +68,8 @@ static const CONF_PARSER type_config[] = {
 static const CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, accounting.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", FR_TYPE_TIME_DELTA, rlm_sql_config_t, accounting.batch_delay), .dflt = "0.01" },
 
 	{ FR_CONF_POINTER("type", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) type_config },
 	CONF_PARSER_TERMINATOR
@@ -76,6 +78,8 @@ static const CONF_PARSER acct_config[] = {
 static const CONF_PARSER postauth_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, postauth.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, postauth.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, postauth.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_delay", FR_TYPE_TIME_DELTA, rlm_sql_config_t, postauth.batch_delay), .dflt = "0.01" },
 
 	{ FR_CONF_OFFSET("query", FR_TYPE_STRING | FR_TYPE_XLAT | FR_TYPE_MULTI, rlm_sql_config_t, postauth.query) },
 	CONF_PARSER_TERMINATOR
@@ -112,6 +116,11 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
+
+	/*
+	 *	Only used by drivers with an async interface.
+	 */
+	{ FR_CONF_OFFSET("trunk", FR_TYPE_SUBSECTION, rlm_sql_config_t, trunk_conf), .subcs = (void const *) fr_trunk_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -154,6 +163,7 @@ static sql_fall_through_t fall_through(fr_pair_list_t *vps)
  *	Yucky prototype.
  */
 static size_t sql_escape_func(request_t *, char *out, size_t outlen, char const *in, void *arg);
+static int sql_async_query_expand(sql_async_query_t *query, rlm_sql_handle_t *handle);
 
 /** Escape a tainted VB used as an xlat argument
  *
@@ -1191,6 +1201,25 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->config.postauth.cs = cf_section_find(conf, "post-auth", NULL);
 	inst->config.postauth.reference_cp = (cf_pair_find(inst->config.postauth.cs, "reference") != NULL);
 
+	/*
+	 *	Batching needs the driver to run a set of
+	 *	queries in one transaction on the trunk.
+	 */
+	if (!inst->driver->trunk_io_funcs || !(inst->driver->flags & RLM_SQL_FLAGS_BATCH)) {
+		if (inst->config.accounting.batch_size > 1) {
+			WARN("Ignoring accounting.batch_size, driver %s does not support batching",
+			     inst->config.sql_driver_name);
+		}
+		if (inst->config.postauth.batch_size > 1) {
+			WARN("Ignoring post-auth.batch_size, driver %s does not support batching",
+			     inst->config.sql_driver_name);
+		}
+		inst->config.accounting.batch_size = 0;
+		inst->config.postauth.batch_size = 0;
+	}
+	FR_INTEGER_BOUND_CHECK("accounting.batch_size", inst->config.accounting.batch_size, <=, 10000);
+	FR_INTEGER_BOUND_CHECK("post-auth.batch_size", inst->config.postauth.batch_size, <=, 10000);
+
 	/*
 	 *	Cache the SQL-User-Name fr_dict_attr_t, so we can be slightly
 	 *	more efficient about creating SQL-User-Name attributes.
@@ -1204,6 +1233,7 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->sql_query			= rlm_sql_query;
 	inst->sql_select_query		= rlm_sql_select_query;
 	inst->sql_fetch_row		= rlm_sql_fetch_row;
+	inst->sql_async_query_expand	= sql_async_query_expand;
 
 	/*
 	 *	Either use the module specific escape function
@@ -1230,6 +1260,305 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+/** Wake up the requests waiting on a batch
+ *
+ * @param[in] batch	whose members should be resumed.
+ * @param[in] failed	if true, the batch couldn't be run.
+ * @param[in] current	member not to mark runnable, as it's still running.
+ */
+static void sql_batch_resume(sql_async_query_t *batch, bool failed, sql_async_query_t *current)
+{
+	size_t i;
+
+	for (i = 0; i < batch->num_members; i++) {
+		sql_async_query_t *member = batch->members[i];
+
+		if (!member) continue;
+
+		batch->members[i] = NULL;
+		member->batch = NULL;
+		if (failed) member->rcode = RLM_SQL_ERROR;
+		if (member != current) unlang_interpret_mark_runnable(member->request);
+	}
+}
+
+/** Wake up the request (or requests) waiting for a query to complete
+ *
+ * The driver has already written the result to the #sql_async_query_t.
+ */
+static void sql_trunk_request_complete(request_t *request, void *preq, UNUSED void *rctx, UNUSED void *uctx)
+{
+	sql_async_query_t	*query = talloc_get_type_abort(preq, sql_async_query_t);
+
+	query->treq = NULL;
+
+	if (query->members) {
+		sql_batch_resume(query, false, NULL);
+		return;
+	}
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Wake up the request (or requests) waiting for a query that couldn't be run
+ *
+ */
+static void sql_trunk_request_fail(request_t *request, void *preq, UNUSED void *rctx,
+				   UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	sql_async_query_t	*query = talloc_get_type_abort(preq, sql_async_query_t);
+
+	query->treq = NULL;
+
+	if (query->members) {
+		sql_batch_resume(query, true, NULL);
+		return;
+	}
+
+	query->rcode = RLM_SQL_ERROR;
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Free batches once the trunk is done with them
+ *
+ * Single queries belong to the request that enqueued them.
+ */
+static void sql_trunk_request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+{
+	sql_async_query_t	*query = talloc_get_type_abort(preq_to_free, sql_async_query_t);
+
+	if (query->members) talloc_free(query);
+}
+
+static void _sql_batch_timeout(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Send the batch being filled
+ *
+ * @param[in] b		Batch to send.
+ * @param[in] current	Member being added by the caller, which shouldn't
+ *			be marked runnable if the batch can't be sent.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the batch couldn't be enqueued.  All members have
+ *	  rcode RLM_SQL_ERROR.
+ */
+static int sql_batch_flush(rlm_sql_batch_t *b, sql_async_query_t *current)
+{
+	rlm_sql_t const		*inst = b->t->inst;
+	sql_async_query_t	*batch = b->query;
+	size_t			i, live = 0;
+
+	if (!batch) return 0;
+
+	b->query = NULL;
+	if (b->ev) fr_event_timer_delete(&b->ev);
+
+	for (i = 0; i < batch->num_members; i++) if (batch->members[i]) live++;
+	if (!live) {
+		talloc_free(batch);
+		return 0;
+	}
+
+	DEBUG3("Sending batch of %zu queries", live);
+
+	switch (fr_trunk_request_enqueue(&batch->treq, b->t->trunk, NULL, batch, NULL)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		return 0;
+
+	default:
+		break;
+	}
+
+	ERROR("Unable to enqueue batch of %zu queries", live);
+	sql_batch_resume(batch, true, current);
+	if (batch->treq) {
+		fr_trunk_request_free(&batch->treq);	/* Frees the batch */
+	} else {
+		talloc_free(batch);
+	}
+
+	return -1;
+}
+
+static void _sql_batch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_sql_batch_t		*b = uctx;
+
+	(void) sql_batch_flush(b, NULL);
+}
+
+/** Add a query to this thread's batch for its section
+ *
+ * The batch is sent when it's full, or batch_delay after the first
+ * query was added.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the batch couldn't be sent.
+ */
+static int sql_batch_add(rlm_sql_batch_t *b, sql_async_query_t *query)
+{
+	rlm_sql_thread_t		*t = b->t;
+	rlm_sql_t const			*inst = t->inst;
+	sql_acct_section_t const	*section = b->section;
+	sql_async_query_t		*batch = b->query;
+
+	if (!batch) {
+		MEM(batch = b->query = talloc_zero(t, sql_async_query_t));
+		MEM(batch->members = talloc_zero_array(batch, sql_async_query_t *, section->batch_size));
+		batch->rcode = RLM_SQL_ERROR;
+
+		if (fr_event_timer_in(batch, t->el, &b->ev, section->batch_delay, _sql_batch_timeout, b) < 0) {
+			PERROR("Failed inserting batch timer");
+			talloc_free(batch);
+			b->query = NULL;
+			return -1;
+		}
+	}
+
+	query->batch = batch;
+	query->batch_slot = batch->num_members;
+	batch->members[batch->num_members++] = query;
+
+	if (batch->num_members < section->batch_size) return 0;
+
+	return sql_batch_flush(b, query);
+}
+
+/** Expand a single query for the connection it's about to be sent on
+ *
+ * @return
+ *	- 0 on success.
+ *	- 1 if the query expanded to an empty string.
+ *	- -1 on failure.
+ */
+static int sql_async_query_expand_one(sql_async_query_t *query, rlm_sql_handle_t *handle)
+{
+	rlm_sql_t const		*inst = handle->inst;
+	request_t		*request = query->request;
+	char			*expanded = NULL;
+	int			ret;
+
+	/*
+	 *	Already expanded, this is a retry after
+	 *	the batch it was in was rolled back.
+	 */
+	if (query->query_str) return 0;
+
+	sql_set_user(inst, request, NULL);
+	ret = xlat_aeval(query, &expanded, request, query->query_fmt, inst->sql_escape_func, handle);
+	sql_unset_user(inst, request);
+	if (ret < 0) {
+		query->rcode = RLM_SQL_ERROR;
+		return -1;
+	}
+
+	if (!*expanded) {
+		talloc_free(expanded);
+		query->noop = true;
+		return 1;
+	}
+
+	rlm_sql_query_log(inst, request, query->section, expanded);
+	query->query_str = expanded;
+
+	return 0;
+}
+
+/** Expand a query, or the members of a batch, once the driver has chosen a connection
+ *
+ * Drivers call this from request_mux, with a handle for the connection
+ * the query will be sent on, so values are escaped using that connection's
+ * character set.
+ *
+ * Batch members which can't be expanded, or which expand to an empty
+ * string, are removed from the batch and their requests resumed.
+ *
+ * @param[in] query	to expand.
+ * @param[in] handle	wrapping the connection the query will be sent on.
+ * @return
+ *	- 0 on success.  Batches always succeed.
+ *	- 1 if the query expanded to an empty string, and should be
+ *	  signalled complete without being sent.
+ *	- -1 if the query couldn't be expanded, and should be signalled
+ *	  failed.
+ */
+static int sql_async_query_expand(sql_async_query_t *query, rlm_sql_handle_t *handle)
+{
+	size_t i;
+
+	if (!query->members) return sql_async_query_expand_one(query, handle);
+
+	for (i = 0; i < query->num_members; i++) {
+		sql_async_query_t *member = query->members[i];
+
+		if (!member || (sql_async_query_expand_one(member, handle) == 0)) continue;
+
+		query->members[i] = NULL;
+		member->batch = NULL;
+		unlang_interpret_mark_runnable(member->request);
+	}
+
+	return 0;
+}
+
+/** Remove a query from the trunk or its batch, so its result is discarded
+ *
+ */
+static void sql_async_query_cancel(sql_async_query_t *query)
+{
+	if (query->batch) {
+		query->batch->members[query->batch_slot] = NULL;
+		query->batch = NULL;
+		return;
+	}
+
+	if (!query->treq) return;
+
+	fr_trunk_request_signal_cancel(query->treq);
+	query->treq = NULL;
+}
+
+/** Create a trunk for this thread, if the driver supports async queries
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(instance, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+	fr_trunk_io_funcs_t	io_funcs;
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->driver->trunk_io_funcs) return 0;
+
+	io_funcs = *inst->driver->trunk_io_funcs;
+	io_funcs.request_complete = sql_trunk_request_complete;
+	io_funcs.request_fail = sql_trunk_request_fail;
+	io_funcs.request_free = sql_trunk_request_free;
+
+	t->accounting_batch = (rlm_sql_batch_t){ .t = t, .section = &inst->config.accounting };
+	t->postauth_batch = (rlm_sql_batch_t){ .t = t, .section = &inst->config.postauth };
+
+	t->trunk = fr_trunk_alloc(t, el, &io_funcs, &inst->config.trunk_conf, inst->name, t, false);
+	if (!t->trunk) return -1;
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_sql_thread_t	*t = talloc_get_type_abort(thread, rlm_sql_thread_t);
+
+	TALLOC_FREE(t->accounting_batch.query);
+	TALLOC_FREE(t->postauth_batch.query);
+	TALLOC_FREE(t->trunk);
+
+	return 0;
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
@@ -1643,14 +1972,241 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/** Context for accounting and post-auth queries run on the trunk
+ *
+ */
+typedef struct {
+	rlm_sql_t const			*inst;		//!< Module instance.
+	rlm_sql_thread_t		*t;		//!< Thread the query was enqueued on.
+	sql_acct_section_t const	*section;	//!< Section the queries came from.
+	CONF_PAIR			*pair;		//!< Query currently being run.
+	char const			*attr;		//!< Name shared by the set of redundant queries.
+	sql_async_query_t		*query;		//!< Query in progress.
+} sql_acct_ctx_t;
+
+static unlang_action_t acct_redundant_async_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request);
+
+/** Cancel an outstanding query if the request is cancelled
+ *
+ */
+static void acct_redundant_async_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
+{
+	sql_acct_ctx_t	*actx = talloc_get_type_abort(mctx->rctx, sql_acct_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_timeout_delete(request, actx);
+
+	sql_async_query_cancel(actx->query);
+}
+
+/** Give up on a query which has taken longer than query_timeout
+ *
+ */
+static void acct_redundant_async_timeout(module_ctx_t const *mctx, request_t *request, UNUSED fr_time_t fired)
+{
+	sql_acct_ctx_t	*actx = talloc_get_type_abort(mctx->rctx, sql_acct_ctx_t);
+
+	/*
+	 *	Result arrived, but we've not resumed yet.
+	 */
+	if (!actx->query->treq && !actx->query->batch) return;
+
+	RERROR("Query timed out after %pVs", fr_box_time_delta(actx->inst->config.query_timeout));
+
+	sql_async_query_cancel(actx->query);
+	actx->query->rcode = RLM_SQL_ERROR;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Hand a query to the trunk, or add it to the current batch
+ *
+ * The query is expanded by the driver once it's chosen a connection.
+ *
+ * @param[out] p_result	Result of the module call, if we don't yield.
+ * @param[in] actx	Query context.
+ * @param[in] request	The current request.
+ * @param[in] expanded	Query which has already been expanded, or NULL
+ *			to expand the current pair.
+ * @param[in] batch	Whether the query may be added to a batch.
+ */
+static unlang_action_t acct_redundant_async_enqueue(rlm_rcode_t *p_result, sql_acct_ctx_t *actx, request_t *request,
+						    char *expanded, bool batch)
+{
+	rlm_sql_t const		*inst = actx->inst;
+	sql_async_query_t	*query;
+
+	TALLOC_FREE(actx->query);
+	MEM(actx->query = query = talloc_zero(actx, sql_async_query_t));
+	query->request = request;
+	query->section = actx->section;
+	query->query_fmt = cf_pair_value(actx->pair);
+	if (expanded) query->query_str = talloc_steal(query, expanded);
+	query->rcode = RLM_SQL_ERROR;
+
+	if (batch) {
+		rlm_sql_batch_t *b = (actx->section == &inst->config.accounting) ?
+				     &actx->t->accounting_batch : &actx->t->postauth_batch;
+
+		if (sql_batch_add(b, query) < 0) {
+			REDEBUG("Unable to enqueue query");
+		fail:
+			talloc_free(actx);
+			RETURN_MODULE_FAIL;
+		}
+	} else switch (fr_trunk_request_enqueue(&query->treq, actx->t->trunk, request, query, actx)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		REDEBUG("Unable to enqueue query");
+		if (query->treq) fr_trunk_request_free(&query->treq);
+		goto fail;
+	}
+
+	if (fr_time_delta_ispos(inst->config.query_timeout) &&
+	    (unlang_module_timeout_add(request, acct_redundant_async_timeout, actx,
+				       fr_time_add(fr_time(), inst->config.query_timeout)) < 0)) {
+		RPEDEBUG("Failed adding query timeout");
+		sql_async_query_cancel(query);
+		goto fail;
+	}
+
+	return unlang_module_yield(request, acct_redundant_async_resume, acct_redundant_async_signal, actx);
+}
+
+/** Hand the current query to the trunk
+ *
+ */
+static unlang_action_t acct_redundant_async_send(rlm_rcode_t *p_result, sql_acct_ctx_t *actx, request_t *request)
+{
+	if (!cf_pair_value(actx->pair)) {
+		RDEBUG2("Ignoring null query");
+		talloc_free(actx);
+		RETURN_MODULE_NOOP;
+	}
+
+	return acct_redundant_async_enqueue(p_result, actx, request, NULL, (actx->section->batch_size > 1));
+}
+
+/** Process the result of a query run on the trunk, and try the next one if required
+ *
+ */
+static unlang_action_t acct_redundant_async_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	sql_acct_ctx_t		*actx = talloc_get_type_abort(mctx->rctx, sql_acct_ctx_t);
+	sql_async_query_t	*query = actx->query;
+	rlm_rcode_t		rcode;
+
+	(void) unlang_module_timeout_delete(request, actx);
+
+	/*
+	 *	Another query in the batch caused the
+	 *	transaction to be rolled back.
+	 */
+	if (query->retry) {
+		RDEBUG2("Batch was rolled back, running query on its own");
+		return acct_redundant_async_enqueue(p_result, actx, request,
+						    talloc_steal(actx, UNCONST(char *, query->query_str)), false);
+	}
+
+	if (query->noop) {
+		RDEBUG2("Ignoring null query");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("SQL query returned: %s", fr_table_str_by_value(sql_rcode_description_table, query->rcode, "<INVALID>"));
+
+	switch (query->rcode) {
+	case RLM_SQL_ERROR:
+	case RLM_SQL_RECONNECT:
+		rcode = RLM_MODULE_FAIL;
+	finish:
+		talloc_free(actx);
+		RETURN_MODULE_RCODE(rcode);
+
+	case RLM_SQL_QUERY_INVALID:
+		rcode = RLM_MODULE_INVALID;
+		goto finish;
+
+	case RLM_SQL_ALT_QUERY:
+		break;
+
+	default:
+		RDEBUG2("%i record(s) updated", query->affected_rows);
+		if (query->affected_rows > 0) {
+			rcode = RLM_MODULE_OK;
+			goto finish;
+		}
+		break;
+	}
+
+	actx->pair = cf_pair_find_next(actx->section->cs, actx->pair, actx->attr);
+	if (!actx->pair) {
+		RDEBUG2("No additional queries configured");
+		rcode = RLM_MODULE_NOOP;
+		goto finish;
+	}
+
+	RDEBUG2("Trying next query...");
+
+	return acct_redundant_async_send(p_result, actx, request);
+}
+
+/** Run accounting or post-auth queries on this thread's trunk
+ *
+ * Behaves the same as #acct_redundant, but yields while the query is
+ * in progress instead of blocking the worker.
+ */
+static unlang_action_t acct_redundant_async(rlm_rcode_t *p_result, rlm_sql_t const *inst, rlm_sql_thread_t *t,
+					    request_t *request, sql_acct_section_t const *section)
+{
+	sql_acct_ctx_t		*actx;
+	CONF_ITEM		*item;
+
+	char			path[FR_MAX_STRING_LEN];
+	char			*p = path;
+
+	if (section->reference[0] != '.') *p++ = '.';
+
+	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) RETURN_MODULE_FAIL;
+
+	item = cf_reference_item(NULL, section->cs, path);
+	if (!item) {
+		RWDEBUG("No such configuration item %s", path);
+		RETURN_MODULE_NOOP;
+	}
+	if (cf_item_is_section(item)){
+		RWDEBUG("Sections are not supported as references");
+		RETURN_MODULE_NOOP;
+	}
+
+	MEM(actx = talloc_zero(request, sql_acct_ctx_t));
+	actx->inst = inst;
+	actx->t = t;
+	actx->section = section;
+	actx->pair = cf_item_to_pair(item);
+	actx->attr = cf_pair_attr(actx->pair);
+
+	RDEBUG2("Using query template '%s'", actx->attr);
+
+	return acct_redundant_async_send(p_result, actx, request);
+}
+
 /*
  *	Accounting: Insert or update session data in our sql table
  */
 static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_sql_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 
 	if (inst->config.accounting.reference_cp) {
+		if (t->trunk) return acct_redundant_async(p_result, inst, t, request, &inst->config.accounting);
+
 		return acct_redundant(p_result, inst, request, &inst->config.accounting);
 	}
 
@@ -1662,9 +2218,12 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
  */
 static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_sql_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_sql_t);
+	rlm_sql_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 
 	if (inst->config.postauth.reference_cp) {
+		if (t->trunk) return acct_redundant_async(p_result, inst, t, request, &inst->config.postauth);
+
 		return acct_redundant(p_result, inst, request, &inst->config.postauth);
 	}
 
@@ -1686,6 +2245,10 @@ module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_sql_thread_t),
+	.thread_inst_type	= "rlm_sql_thread_t",
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_ACCOUNTING]	= mod_accounting,
@@ -29,6 +29,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/pool.h>
+#include <freeradius-devel/server/trunk.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/exfile.h>
 
@@ -83,6 +84,11 @@ typedef struct {
 	char const		*logfile;
 
 	char const		**query;			/* for xlat parsing */
+
+	uint32_t		batch_size;			//!< Maximum number of queries to run in a
+								///< single transaction.  0 disables batching.
+	fr_time_delta_t		batch_delay;			//!< Maximum time a query waits for its batch
+								///< to fill before the batch is sent.
 } sql_acct_section_t;
 
 typedef struct {
@@ -128,6 +134,9 @@ typedef struct {
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
+	fr_trunk_conf_t		trunk_conf;			//!< Configuration for the per-thread trunk
+								///< used by drivers with an async interface.
+
 	/*
 	 *	@todo The rest of the queries should also be moved into
 	 *	their own sections.
@@ -150,6 +159,72 @@ typedef struct {
 								//!< when log strings need to be copied.
 } rlm_sql_handle_t;
 
+typedef struct sql_async_query_s sql_async_query_t;
+
+/** A query run asynchronously on a thread's trunk
+ *
+ * This is the preq of the trunk request.  Drivers write the result of the
+ * query here before signalling the trunk request complete.
+ *
+ * Queries are expanded by the driver's request_mux function, with
+ * rlm_sql_t->sql_async_query_expand, so that values are escaped for
+ * the connection the query is sent on.
+ *
+ * If members is set, this is a batch.  The driver runs the member queries
+ * in a single transaction, and writes the result of each to the member.
+ * Member slots are NULL if that query was cancelled.  If the transaction
+ * is rolled back, the driver sets retry on every member that didn't cause
+ * the rollback.
+ */
+struct sql_async_query_s {
+	request_t		*request;			//!< Request the query is being run for.
+								///< NULL for batches.
+	sql_acct_section_t const *section;			//!< Section the query comes from.
+	char const		*query_fmt;			//!< Query to expand.
+	char const		*query_str;			//!< Expanded query.  NULL until the query
+								///< is muxed.
+	bool			noop;				//!< Query expanded to an empty string,
+								///< and wasn't sent.
+	fr_trunk_request_t	*treq;				//!< Trunk request, for signalling.
+
+	sql_rcode_t		rcode;				//!< Result of the query.
+	int			affected_rows;			//!< Number of rows changed or returned.
+	bool			retry;				//!< Batch was rolled back, run the query again.
+
+	sql_async_query_t	*batch;				//!< Batch this query is waiting on.
+	size_t			batch_slot;			//!< Position in the batch's members.
+
+	sql_async_query_t	**members;			//!< Queries in this batch.
+	size_t			num_members;			//!< Number of member slots used.
+
+	void			*uctx;				//!< Driver specific tracking data.
+};
+
+typedef struct rlm_sql_thread_s rlm_sql_thread_t;
+
+/** Queries waiting to be sent in a single transaction
+ *
+ */
+typedef struct {
+	rlm_sql_thread_t	*t;				//!< Thread the batch belongs to.
+	sql_acct_section_t const *section;			//!< Section the queries come from.
+	sql_async_query_t	*query;				//!< Batch being filled.  NULL if there isn't one.
+	fr_event_timer_t const	*ev;				//!< Sends the batch when batch_delay expires.
+} rlm_sql_batch_t;
+
+/** Thread specific instance data
+ *
+ */
+struct rlm_sql_thread_s {
+	rlm_sql_t const		*inst;				//!< The rlm_sql instance this thread belongs to.
+	fr_event_list_t		*el;				//!< This thread's event list.
+	fr_trunk_t		*trunk;				//!< Connections for asynchronous queries.
+								///< NULL if the driver is synchronous only.
+
+	rlm_sql_batch_t		accounting_batch;		//!< Batch of accounting queries being filled.
+	rlm_sql_batch_t		postauth_batch;			//!< Batch of post-auth queries being filled.
+};
+
 extern fr_table_num_sorted_t const sql_rcode_description_table[];
 extern size_t sql_rcode_description_table_len;
 extern fr_table_num_sorted_t const sql_rcode_table[];
@@ -160,6 +235,8 @@ extern size_t sql_rcode_table_len;
  */
 #define RLM_SQL_RCODE_FLAGS_ALT_QUERY	1			//!< Can distinguish between other errors and those
 								//!< resulting from a unique key violation.
+#define RLM_SQL_FLAGS_BATCH		2			//!< Trunk can run batches of queries in a
+								//!< single transaction.
 
 /** Retrieve errors from the last query operation
  *
@@ -211,6 +288,18 @@ typedef struct {
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t const *config);
 
 	xlat_escape_legacy_t	sql_escape_func;
+
+	/*
+	 *	Asynchronous interface.  If set, accounting and post-auth
+	 *	queries are run on a per-thread trunk instead of blocking
+	 *	on a pooled connection.  The trunk's uctx is the
+	 *	#rlm_sql_thread_t, and each preq is an #sql_async_query_t.
+	 *
+	 *	request_complete, request_fail and request_free are
+	 *	provided by rlm_sql.  request_mux must expand each query
+	 *	with rlm_sql_t->sql_async_query_expand before sending it.
+	 */
+	fr_trunk_io_funcs_t const	*trunk_io_funcs;
 } rlm_sql_driver_t;
 
 struct sql_inst {
@@ -229,6 +318,7 @@ struct sql_inst {
 	sql_rcode_t (*sql_query)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_select_query)(rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle, char const *query);
 	sql_rcode_t (*sql_fetch_row)(rlm_sql_row_t *out, rlm_sql_t const *inst, request_t *request, rlm_sql_handle_t **handle);
+	int (*sql_async_query_expand)(sql_async_query_t *query, rlm_sql_handle_t *handle);
 
 	char const		*name;			//!< Module instance name.
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
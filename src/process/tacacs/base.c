@@ -589,7 +589,8 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 	 *	(allegedly) random value.  It MUST be unique per TCP
 	 *	connection.
 	 */
-	inst->state_tree = fr_state_tree_init(inst, attr_tacacs_state, main_config->spawn_workers, inst->max_session,
+	inst->state_tree = fr_state_tree_init(inst, attr_tacacs_state, main_config->spawn_workers,
+					      main_config->state_affinity, inst->max_session,
 					      inst->session_timeout, inst->state_server_id,
 					      fr_hash_string(cf_section_name2(inst->server_cs)));
 
@@ -661,7 +661,8 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *process_app_cs)
 {
 	process_ttls_t	*inst = instance;
 
-	inst->auth.state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->auth.max_session,
+	inst->auth.state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers,
+						   main_config->state_affinity, inst->auth.max_session,
 						   inst->auth.session_timeout, inst->auth.state_server_id,
 						   fr_hash_string(cf_section_name2(inst->server_cs)));
 
@@ -78,7 +78,7 @@ static ssize_t decode_value_internal(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_di
 	FR_PROTO_TRACE("%s called to parse %zu bytes", __FUNCTION__, data_len);
 	FR_PROTO_HEX_DUMP(data, data_len, NULL);
 
-	vp = fr_pair_afrom_da(ctx, da);
+	vp = fr_pair_afrom_da_with_len(ctx, da, data_len);
 	if (!vp) return -1;
 
 	/*
@@ -61,7 +61,7 @@ static ssize_t decode_raw(TALLOC_CTX *ctx, fr_pair_list_t *out, UNUSED fr_dict_t
 	}
 	unknown->flags.is_raw = 1;
 
-	vp = fr_pair_afrom_da(ctx, unknown);
+	vp = fr_pair_afrom_da_with_len(ctx, unknown, data_len);
 	if (!vp) return PAIR_DECODE_OOM;
 
 	slen = fr_value_box_from_network(vp, &vp->data, vp->da->type, vp->da,
@@ -211,7 +211,7 @@ static ssize_t decode_value(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dict_t cons
 		return PAIR_DECODE_FATAL_ERROR; /* not supported */
 
 	default:
-		vp = fr_pair_afrom_da(ctx, parent);
+		vp = fr_pair_afrom_da_with_len(ctx, parent, data_len);
 		if (!vp) return PAIR_DECODE_OOM;
 
 		if (fr_value_box_from_network(vp, &vp->data, vp->da->type, vp->da,
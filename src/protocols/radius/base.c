@@ -221,6 +221,39 @@ size_t fr_radius_attr_len(fr_pair_t const *vp)
 	}
 }
 
+/** Set up the MD5 contexts used to hide passwords with the shared secret
+ *
+ * On return md5_ctx has absorbed the secret, and the returned ctx holds the
+ * same state, so that md5_ctx can be reset to it between blocks.  If the
+ * caller has precomputed state for the secret it's used directly, otherwise
+ * the secret is hashed here, and a copy kept in md5_ctx_old.
+ *
+ * Both md5_ctx and md5_ctx_old must be freed by the caller.
+ *
+ * @param[out] md5_ctx		Working ctx.
+ * @param[out] md5_ctx_old	Saved secret state, NULL if secret_md5 was used.
+ * @param[in] secret		The shared secret.  MUST be talloc'd.
+ * @param[in] secret_md5	Precomputed state for the secret, may be NULL.
+ * @return the ctx holding the MD5 state after absorbing the secret.
+ */
+fr_md5_ctx_t const *fr_radius_md5_secret_init(fr_md5_ctx_t **md5_ctx, fr_md5_ctx_t **md5_ctx_old,
+					      char const *secret, fr_md5_secret_t const *secret_md5)
+{
+	*md5_ctx = fr_md5_ctx_alloc(true);
+
+	if (secret_md5) {
+		*md5_ctx_old = NULL;
+		fr_md5_ctx_copy(*md5_ctx, secret_md5->prefix);
+		return secret_md5->prefix;
+	}
+
+	*md5_ctx_old = fr_md5_ctx_alloc(false);
+	fr_md5_update(*md5_ctx, (uint8_t const *) secret, talloc_array_length(secret) - 1);
+	fr_md5_ctx_copy(*md5_ctx_old, *md5_ctx);	/* save intermediate work */
+
+	return *md5_ctx_old;
+}
+
 /**  Do Ascend-Send / Recv-Secret calculation.
  *
  * The secret is hidden by xoring with a MD5 digest created from
@@ -326,25 +359,24 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
- *
- * Calculates the request/response authenticator for packets which need it, and fills
- * in the message-authenticator value if the attribute is present in the encoded packet.
+/** Find Message-Authenticator, and set up the packet for calculating it
  *
+ * @param[out] msg_p		Where to write a pointer to the Message-Authenticator
+ *				attribute, or NULL if the packet doesn't contain one.
  * @param[in,out] packet	(request or response).
  * @param[in] original		request (only if this is a response).
- * @param[in] secret		to sign the packet with.
  * @param[in] secret_len	The length of the secret.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *original,
-		   uint8_t const *secret, size_t secret_len)
+static int radius_sign_ma_prepare(uint8_t **msg_p, uint8_t *packet, uint8_t const *original, size_t secret_len)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = (packet[2] << 8) | packet[3];
 
+	*msg_p = NULL;
+
 	/*
 	 *	No real limit on secret length, this is just
 	 *	to catch uninitialised fields.
@@ -407,7 +439,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		case FR_RADIUS_CODE_ACCESS_REJECT:
 		case FR_RADIUS_CODE_ACCESS_CHALLENGE:
 		do_ack:
-			if (!original) goto need_original;
+			if (!original) {
+			need_original:
+				fr_strerror_const("Cannot sign response packet without a request packet");
+				return -1;
+			}
 			memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
 			break;
 
@@ -417,19 +453,33 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			break;
 
 		default:
-			goto bad_packet;
+			fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+			return -1;
 		}
 
 		/*
 		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
+		 *	so the caller can calculate the HMAC.
 		 */
 		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		*msg_p = msg;
 		break;
 	}
 
+	return 0;
+}
+
+/** Set up the packet for calculating the Request / Response Authenticator
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] original		request (only if this is a response).
+ * @return
+ *	- <0 on error
+ *	- 0 if the packet has a random Request Authenticator, and needs no more signing.
+ *	- 1 if the caller should calculate MD5(packet + secret).
+ */
+static int radius_sign_authenticator_prepare(uint8_t *packet, uint8_t const *original)
+{
 	/*
 	 *	Initialize the request authenticator.
 	 */
@@ -438,7 +488,7 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
 	case FR_RADIUS_CODE_COA_REQUEST:
 		memset(packet + 4, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
+		return 1;
 
 	case FR_RADIUS_CODE_ACCESS_ACCEPT:
 	case FR_RADIUS_CODE_ACCESS_REJECT:
@@ -450,12 +500,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	case FR_RADIUS_CODE_COA_NAK:
 	case FR_RADIUS_CODE_PROTOCOL_ERROR:
 		if (!original) {
-		need_original:
 			fr_strerror_const("Cannot sign response packet without a request packet");
 			return -1;
 		}
 		memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
-		break;
+		return 1;
 
 		/*
 		 *	The Request Authenticator is random numbers.
@@ -467,10 +516,48 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		return 0;
 
 	default:
-	bad_packet:
 		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
 		return -1;
 	}
+}
+
+/** Sign a previously encoded packet
+ *
+ * Calculates the request/response authenticator for packets which need it, and fills
+ * in the message-authenticator value if the attribute is present in the encoded packet.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] original		request (only if this is a response).
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @param[in] secret_md5	Precomputed HMAC-MD5 state for the secret, may be NULL.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *original,
+		   uint8_t const *secret, size_t secret_len, fr_md5_secret_t const *secret_md5)
+{
+	uint8_t		*msg;
+	size_t		packet_len = (packet[2] << 8) | packet[3];
+	int		ret;
+
+	if (radius_sign_ma_prepare(&msg, packet, original, secret_len) < 0) return -1;
+
+	/*
+	 *	Calculate the HMAC, and put it into the
+	 *	Message-Authenticator attribute.
+	 */
+	if (msg) {
+		if (secret_md5) {
+			fr_hmac_md5_secret(msg + 2, packet, packet_len, secret_md5);
+		} else {
+			fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		}
+	}
+
+	ret = radius_sign_authenticator_prepare(packet, original);
+	if (ret <= 0) return ret;
 
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
@@ -488,6 +575,88 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	return 0;
 }
 
+/** Sign a batch of previously encoded packets
+ *
+ * Produces the same result as calling fr_radius_sign() on each packet, but the
+ * Message-Authenticators, and then the Request / Response Authenticators of the
+ * whole batch are calculated together with the multi-buffer MD5 functions.
+ *
+ * Packets without precomputed secret state are signed individually.
+ *
+ * @param[in,out] batch	of packets to sign.  The result for each packet is
+ *			written to batch[i].rcode.
+ * @param[in] num	Number of packets in the batch.
+ * @return the number of packets which could not be signed.
+ */
+int fr_radius_sign_batch(fr_radius_sign_t *batch, size_t num)
+{
+	fr_md5_mb_t	msgs[FR_RADIUS_SIGN_BATCH_MAX];
+	bool		done[FR_RADIUS_SIGN_BATCH_MAX];
+	size_t		i, j, n, todo;
+	int		failed = 0;
+
+	for (i = 0; i < num; i += todo) {
+		todo = num - i;
+		if (todo > FR_RADIUS_SIGN_BATCH_MAX) todo = FR_RADIUS_SIGN_BATCH_MAX;
+
+		/*
+		 *	Message-Authenticator first, as it's part of
+		 *	the data covered by the authenticator.
+		 */
+		for (j = 0, n = 0; j < todo; j++) {
+			fr_radius_sign_t	*s = &batch[i + j];
+			uint8_t			*msg;
+
+			done[j] = true;
+
+			if (!s->secret_md5) {
+				s->rcode = fr_radius_sign(s->packet, s->original, s->secret, s->secret_len, NULL);
+				continue;
+			}
+
+			s->rcode = radius_sign_ma_prepare(&msg, s->packet, s->original, s->secret_len);
+			if (s->rcode < 0) continue;
+
+			done[j] = false;
+			if (!msg) continue;
+
+			msgs[n++] = (fr_md5_mb_t){
+				.in = s->packet,
+				.inlen = (s->packet[2] << 8) | s->packet[3],
+				.secret = s->secret_md5,
+				.out = msg + 2
+			};
+		}
+		if (n > 0) fr_hmac_md5_mb(msgs, n);
+
+		/*
+		 *	Request / Response Authenticator = MD5(packet + secret)
+		 */
+		for (j = 0, n = 0; j < todo; j++) {
+			fr_radius_sign_t	*s = &batch[i + j];
+
+			if (done[j]) continue;
+
+			s->rcode = radius_sign_authenticator_prepare(s->packet, s->original);
+			if (s->rcode <= 0) continue;
+
+			s->rcode = 0;
+			msgs[n++] = (fr_md5_mb_t){
+				.in = s->packet,
+				.inlen = (s->packet[2] << 8) | s->packet[3],
+				.suffix = s->secret,
+				.suffix_len = s->secret_len,
+				.out = s->packet + 4
+			};
+		}
+		if (n > 0) fr_md5_mb(msgs, n);
+
+		for (j = 0; j < todo; j++) if (batch[i + j].rcode < 0) failed++;
+	}
+
+	return failed;
+}
+
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
@@ -765,12 +934,13 @@ finish:
  * @param secret the shared secret
  * @param secret_len the length of the secret
  * @param[in] require_ma	whether we require Message-Authenticator.
+ * @param[in] secret_md5	Precomputed HMAC-MD5 state for the secret, may be NULL.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
 int fr_radius_verify(uint8_t *packet, uint8_t const *original,
-		     uint8_t const *secret, size_t secret_len, bool require_ma)
+		     uint8_t const *secret, size_t secret_len, bool require_ma, fr_md5_secret_t const *secret_md5)
 {
 	bool found_ma;
 	int rcode;
@@ -835,7 +1005,7 @@ int fr_radius_verify(uint8_t *packet, uint8_t const *original,
 	 *	slightly more CPU work than having verify-specific
 	 *	functions, but it ends up being cleaner in the code.
 	 */
-	rcode = fr_radius_sign(packet, original, secret, secret_len);
+	rcode = fr_radius_sign(packet, original, secret, secret_len, secret_md5);
 	if (rcode < 0) {
 		fr_strerror_const_push("Failed calculating correct authenticator");
 		return -1;
@@ -906,13 +1076,16 @@ void *fr_radius_next_encodable(fr_dlist_head_t *list, void *to_eval, void *uctx)
  *
  */
 ssize_t fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
-			 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps)
+			 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps,
+			 fr_md5_secret_t const *secret_md5)
 {
-	return fr_radius_encode_dbuff(&FR_DBUFF_TMP(packet, packet_len), original, secret, secret_len, code, id, vps);
+	return fr_radius_encode_dbuff(&FR_DBUFF_TMP(packet, packet_len), original, secret, secret_len, code, id, vps,
+				      secret_md5);
 }
 
 ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
-			 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps)
+			 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps,
+			 fr_md5_secret_t const *secret_md5)
 {
 	ssize_t			slen;
 	fr_pair_t const	*vp;
@@ -922,6 +1095,7 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 
 	memset(&packet_ctx, 0, sizeof(packet_ctx));
 	packet_ctx.secret = secret;
+	packet_ctx.secret_md5 = secret_md5;
 	packet_ctx.rand_ctx.a = fr_rand();
 	packet_ctx.rand_ctx.b = fr_rand();
 
@@ -1032,7 +1206,7 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
  */
 ssize_t fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 			 uint8_t const *packet, size_t packet_len, uint8_t const *original,
-			 char const *secret, UNUSED size_t secret_len)
+			 char const *secret, UNUSED size_t secret_len, fr_md5_secret_t const *secret_md5)
 {
 	ssize_t			slen;
 	uint8_t const		*attr, *end;
@@ -1041,6 +1215,7 @@ ssize_t fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	memset(&packet_ctx, 0, sizeof(packet_ctx));
 	packet_ctx.tmp_ctx = talloc_init_const("tmp");
 	packet_ctx.secret = secret;
+	packet_ctx.secret_md5 = secret_md5;
 	memcpy(packet_ctx.vector, original ? original + 4 : packet + 4, sizeof(packet_ctx.vector));
 
 	attr = packet + 20;
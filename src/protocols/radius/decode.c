@@ -60,11 +60,12 @@ static void memcpy_bounded(void * restrict dst, const void * restrict src, size_
  * above.
  */
 ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
-					 char const *secret, uint8_t const *vector, bool tunnel_password_zeros)
+					 char const *secret, uint8_t const *vector, bool tunnel_password_zeros,
+					 fr_md5_secret_t const *secret_md5)
 {
 	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t const *md5_secret;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
-	int		secretlen;
 	size_t		i, n, encrypted_len, embedded_len;
 
 	encrypted_len = *pwlen;
@@ -98,13 +99,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 	/*
 	 *	Use the secret to setup the decryption digest
 	 */
-	secretlen = talloc_array_length(secret) - 1;
-
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, secretlen);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx); /* save intermediate work */
+	md5_secret = fr_radius_md5_secret_init(&md5_ctx, &md5_ctx_old, secret, secret_md5);
 
 	/*
 	 *	Set up the initial key:
@@ -130,7 +125,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 			base = 1;
 
 			fr_md5_final(digest, md5_ctx);
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 
 			/*
 			 *	A quick check: decrypt the first octet
@@ -153,7 +148,7 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 			fr_md5_update(md5_ctx, passwd + n + 2, block_len);
 		}
 
@@ -187,12 +182,14 @@ ssize_t fr_radius_decode_tunnel_password(uint8_t *passwd, size_t *pwlen,
 /** Decode password
  *
  */
-ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret, uint8_t const *vector)
+ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret, uint8_t const *vector,
+				  fr_md5_secret_t const *secret_md5)
 {
 	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t const *md5_secret;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	int		i;
-	size_t		n, secretlen;
+	size_t		n;
 
 	/*
 	 *	The RFC's say that the maximum is 128.
@@ -209,13 +206,7 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 	/*
 	 *	Use the secret to setup the decryption digest
 	 */
-	secretlen = talloc_array_length(secret) - 1;
-
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, secretlen);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);	/* save intermediate work */
+	md5_secret = fr_radius_md5_secret_init(&md5_ctx, &md5_ctx_old, secret, secret_md5);
 
 	/*
 	 *	The inverse of the code above.
@@ -225,14 +216,14 @@ ssize_t fr_radius_decode_password(char *passwd, size_t pwlen, char const *secret
 			fr_md5_update(md5_ctx, vector, RADIUS_AUTH_VECTOR_LENGTH);
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 			if (pwlen > AUTH_PASS_LEN) {
 				fr_md5_update(md5_ctx, (uint8_t *) passwd, AUTH_PASS_LEN);
 			}
 		} else {
 			fr_md5_final(digest, md5_ctx);
 
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 			if (pwlen > (n + AUTH_PASS_LEN)) {
 				fr_md5_update(md5_ctx, (uint8_t *) passwd + n, AUTH_PASS_LEN);
 			}
@@ -392,7 +383,7 @@ static ssize_t decode_concat(TALLOC_CTX *ctx, fr_pair_list_t *list,
 	 */
 	if (!total) return 2;
 
-	vp = fr_pair_afrom_da(ctx, parent);
+	vp = fr_pair_afrom_da_with_len(ctx, parent, total);
 	if (!vp) return -1;
 
 	if (fr_pair_value_mem_alloc(vp, &p, total, true) != 0) {
@@ -500,7 +491,7 @@ static ssize_t decode_nas_filter_rule(TALLOC_CTX *ctx, fr_pair_list_t *out,
 
 			FR_PROTO_TRACE("This NAS-Filter-Rule has %lu octets", len);
 			FR_PROTO_HEX_DUMP(decode, len, "This NAS-Filter-Rule");
-			vp = fr_pair_afrom_da(ctx, parent);
+			vp = fr_pair_afrom_da_with_len(ctx, parent, len);
 			if (!vp) {
 				talloc_free(buffer);
 				return -1;
@@ -1302,7 +1293,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dic
 		 */
 		case FLAG_ENCRYPT_USER_PASSWORD:
 			fr_radius_decode_password((char *)buffer, attr_len,
-						  packet_ctx->secret, packet_ctx->vector);
+						  packet_ctx->secret, packet_ctx->vector, packet_ctx->secret_md5);
 			buffer[253] = '\0';
 
 			/*
@@ -1338,7 +1329,7 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dic
 		case FLAG_ENCRYPT_TUNNEL_PASSWORD:
 			if (fr_radius_decode_tunnel_password(buffer, &data_len,
 							     packet_ctx->secret, packet_ctx->vector,
-							     packet_ctx->tunnel_password_zeros) < 0) {
+							     packet_ctx->tunnel_password_zeros, packet_ctx->secret_md5) < 0) {
 				goto raw;
 			}
 			break;
@@ -1596,11 +1587,11 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_dic
 	 *	information, decode the actual p.
 	 */
 	if (!tag) {
-		vp = fr_pair_afrom_da(ctx, parent);
+		vp = fr_pair_afrom_da_with_len(ctx, parent, data_len);
 	} else {
 		fr_assert(packet_ctx->tags != NULL);
 		fr_assert(packet_ctx->tags[tag] != NULL);
-		vp = fr_pair_afrom_da(packet_ctx->tags[tag]->parent, parent);
+		vp = fr_pair_afrom_da_with_len(packet_ctx->tags[tag]->parent, parent, data_len);
 	}
 	if (!vp) return -1;
 
@@ -1876,7 +1867,7 @@ static ssize_t fr_radius_decode_proto(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	memset(original, 0, 4);
 	memcpy(original + 4, test_ctx->vector, sizeof(test_ctx->vector));
 	return fr_radius_decode(ctx, out, data, packet_len, original,
-				test_ctx->secret, talloc_array_length(test_ctx->secret) - 1);
+				test_ctx->secret, talloc_array_length(test_ctx->secret) - 1, NULL);
 }
 
 /*
@@ -74,9 +74,10 @@ void fr_radius_encode_chap_password(uint8_t out[static 1 + RADIUS_CHAP_CHALLENGE
  * Input and output buffers can be identical if in-place encryption is needed.
  */
 static ssize_t encode_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *input, size_t inlen,
-			       char const *secret, uint8_t const *vector)
+			       char const *secret, uint8_t const *vector, fr_md5_secret_t const *secret_md5)
 {
 	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t const *md5_secret;
 	uint8_t	digest[RADIUS_AUTH_VECTOR_LENGTH];
 	uint8_t	passwd[RADIUS_MAX_PASS_LENGTH] = {0};
 	size_t		i, n;
@@ -98,11 +99,7 @@ static ssize_t encode_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *input, size
 		len &= ~0x0f;
 	}
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) secret, talloc_array_length(secret) - 1);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);
+	md5_secret = fr_radius_md5_secret_init(&md5_ctx, &md5_ctx_old, secret, secret_md5);
 
 	/*
 	 *	Do first pass.
@@ -111,7 +108,7 @@ static ssize_t encode_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *input, size
 
 	for (n = 0; n < len; n += AUTH_PASS_LEN) {
 		if (n > 0) {
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 			fr_md5_update(md5_ctx, passwd + n - AUTH_PASS_LEN, AUTH_PASS_LEN);
 		}
 
@@ -129,6 +126,7 @@ static ssize_t encode_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *input, size
 static ssize_t encode_tunnel_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *in, size_t inlen, void *encode_ctx)
 {
 	fr_md5_ctx_t	*md5_ctx, *md5_ctx_old;
+	fr_md5_ctx_t const *md5_secret;
 	uint8_t		digest[RADIUS_AUTH_VECTOR_LENGTH];
 	uint8_t		tpasswd[RADIUS_MAX_STRING_LENGTH];
 	size_t		i, n;
@@ -198,11 +196,7 @@ static ssize_t encode_tunnel_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *in,
 	tpasswd[1] = r & 0xff;
 	tpasswd[2] = inlen;	/* length of the password string */
 
-	md5_ctx = fr_md5_ctx_alloc(false);
-	md5_ctx_old = fr_md5_ctx_alloc(true);
-
-	fr_md5_update(md5_ctx, (uint8_t const *) packet_ctx->secret, talloc_array_length(packet_ctx->secret) - 1);
-	fr_md5_ctx_copy(md5_ctx_old, md5_ctx);
+	md5_secret = fr_radius_md5_secret_init(&md5_ctx, &md5_ctx_old, packet_ctx->secret, packet_ctx->secret_md5);
 
 	fr_md5_update(md5_ctx, packet_ctx->vector, RADIUS_AUTH_VECTOR_LENGTH);
 	fr_md5_update(md5_ctx, &tpasswd[0], 2);
@@ -211,7 +205,7 @@ static ssize_t encode_tunnel_password(fr_dbuff_t *dbuff, fr_dbuff_marker_t *in,
 		size_t block_len;
 
 		if (n > 0) {
-			fr_md5_ctx_copy(md5_ctx, md5_ctx_old);
+			fr_md5_ctx_copy(md5_ctx, md5_secret);
 			fr_md5_update(md5_ctx, tpasswd + 2 + n - AUTH_PASS_LEN, AUTH_PASS_LEN);
 		}
 		fr_md5_final(digest, md5_ctx);
@@ -531,7 +525,7 @@ static ssize_t encode_value(fr_dbuff_t *dbuff,
 		 *	Encode the password in place
 		 */
 		slen = encode_password(&work_dbuff, &value_start, fr_dbuff_used(&value_dbuff),
-				       packet_ctx->secret, packet_ctx->vector);
+				       packet_ctx->secret, packet_ctx->vector, packet_ctx->secret_md5);
 		if (slen < 0) return slen;
 		encrypted = true;
 		break;
@@ -1657,10 +1651,11 @@ static ssize_t fr_radius_encode_proto(UNUSED TALLOC_CTX *ctx, fr_pair_list_t *vp
 	 *	can leverage a consistent random number generator.
 	 */
 	slen = fr_radius_encode(data, data_len, NULL, test_ctx->secret, talloc_array_length(test_ctx->secret) - 1,
-				packet_type, 0, vps);
+				packet_type, 0, vps, NULL);
 	if (slen <= 0) return slen;
 
-	if (fr_radius_sign(data, NULL, (uint8_t const *) test_ctx->secret, talloc_array_length(test_ctx->secret) - 1) < 0) {
+	if (fr_radius_sign(data, NULL, (uint8_t const *) test_ctx->secret, talloc_array_length(test_ctx->secret) - 1,
+			   NULL) < 0) {
 		return -1;
 	}
 
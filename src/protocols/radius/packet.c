@@ -76,7 +76,7 @@ ssize_t fr_radius_packet_encode(fr_radius_packet_t *packet, fr_pair_list_t *list
 	memcpy(data + 4, packet->vector, sizeof(packet->vector));
 
 	slen = fr_radius_encode(data, sizeof(data), original_data, secret, talloc_array_length(secret) - 1,
-				packet->code, packet->id, list);
+				packet->code, packet->id, list, NULL);
 	if (slen < 0) return slen;
 
 	/*
@@ -290,7 +290,7 @@ int fr_radius_packet_verify(fr_radius_packet_t *packet, fr_radius_packet_t *orig
 	}
 
 	if (fr_radius_verify(packet->data, original_data,
-			     (uint8_t const *) secret, talloc_array_length(secret) - 1, false) < 0) {
+			     (uint8_t const *) secret, talloc_array_length(secret) - 1, false, NULL) < 0) {
 		fr_strerror_printf_push("Received invalid packet from %s",
 					inet_ntop(packet->socket.inet.src_ipaddr.af, &packet->socket.inet.src_ipaddr.addr,
 						  buffer, sizeof(buffer)));
@@ -327,7 +327,7 @@ int fr_radius_packet_sign(fr_radius_packet_t *packet, fr_radius_packet_t const *
 	}
 
 	ret = fr_radius_sign(packet->data, original_data,
-			       (uint8_t const *) secret, talloc_array_length(secret) - 1);
+			       (uint8_t const *) secret, talloc_array_length(secret) - 1, NULL);
 	if (ret < 0) return ret;
 
 	memcpy(packet->vector, packet->data + 4, RADIUS_AUTH_VECTOR_LENGTH);
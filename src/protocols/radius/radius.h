@@ -27,6 +27,7 @@
 #include <freeradius-devel/util/packet.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/dbuff.h>
 
 #define RADIUS_AUTH_VECTOR_OFFSET      		4
@@ -105,15 +106,35 @@ enum {
 #define flag_long_extended(_flags)   (!(_flags)->extra && (_flags)->subtype == FLAG_LONG_EXTENDED_ATTR)
 #define flag_tunnel_password(_flags) (!(_flags)->extra && (((_flags)->subtype == FLAG_ENCRYPT_TUNNEL_PASSWORD) || ((_flags)->subtype == FLAG_TAGGED_TUNNEL_PASSWORD)))
 
+/** A packet to sign with fr_radius_sign_batch()
+ *
+ */
+typedef struct {
+	uint8_t			*packet;		//!< Encoded packet to sign.
+	uint8_t const		*original;		//!< Original request, if packet is a response.
+	uint8_t const		*secret;		//!< Shared secret.
+	size_t			secret_len;		//!< Length of the shared secret.
+	fr_md5_secret_t const	*secret_md5;		//!< Precomputed state for the secret, may be NULL.
+	int			rcode;			//!< Result, as fr_radius_sign() would have returned.
+} fr_radius_sign_t;
+
+#define FR_RADIUS_SIGN_BATCH_MAX		64
+
 /*
  *	protocols/radius/base.c
  */
 size_t		fr_radius_attr_len(fr_pair_t const *vp);
 
+fr_md5_ctx_t const *fr_radius_md5_secret_init(fr_md5_ctx_t **md5_ctx, fr_md5_ctx_t **md5_ctx_old,
+					      char const *secret, fr_md5_secret_t const *secret_md5) CC_HINT(nonnull(1,2,3));
+
 int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
-			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+			       uint8_t const *secret, size_t secret_len,
+			       fr_md5_secret_t const *secret_md5) CC_HINT(nonnull (1,3));
+int		fr_radius_sign_batch(fr_radius_sign_t *batch, size_t num) CC_HINT(nonnull);
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
-				 uint8_t const *secret, size_t secret_len, bool require_ma) CC_HINT(nonnull (1,3));
+				 uint8_t const *secret, size_t secret_len, bool require_ma,
+				 fr_md5_secret_t const *secret_md5) CC_HINT(nonnull (1,3));
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
 			     uint32_t max_attributes, bool require_ma, decode_fail_t *reason) CC_HINT(nonnull (1,2));
 
@@ -123,14 +144,17 @@ ssize_t		fr_radius_ascend_secret(fr_dbuff_t *dbuff, uint8_t const *in, size_t in
 ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, unsigned int *code);
 
 ssize_t		fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *original,
-				 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps);
+				 char const *secret, size_t secret_len, int code, int id, fr_pair_list_t *vps,
+				 fr_md5_secret_t const *secret_md5);
 
 ssize_t		fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
-				 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps);
+				 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps,
+				 fr_md5_secret_t const *secret_md5);
 
 ssize_t		fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 				 uint8_t const *packet, size_t packet_len, uint8_t const *original,
-				 char const *secret, UNUSED size_t secret_len) CC_HINT(nonnull(1,2,3,6));
+				 char const *secret, UNUSED size_t secret_len,
+				 fr_md5_secret_t const *secret_md5) CC_HINT(nonnull(1,2,3,6));
 
 int		fr_radius_init(void);
 
@@ -171,6 +195,7 @@ typedef struct {
 	TALLOC_CTX		*tmp_ctx;		//!< for temporary things cleaned up during decoding
 	uint8_t 		vector[RADIUS_AUTH_VECTOR_LENGTH]; //!< vector for encryption / decryption of data
 	char const		*secret;		//!< shared secret.  MUST be talloc'd
+	fr_md5_secret_t const	*secret_md5;		//!< precomputed MD5 state for the secret, may be NULL.
 	fr_fast_rand_t		rand_ctx;		//!< for tunnel passwords
 	int			salt_offset;		//!< for tunnel passwords
 	bool 			tunnel_password_zeros;  //!< check for trailing zeros on decode
@@ -203,11 +228,13 @@ ssize_t		fr_radius_encode_pair(fr_dbuff_t *dbuff, fr_dcursor_t *cursor, void *en
  */
 int		fr_radius_decode_tlv_ok(uint8_t const *data, size_t length, size_t dv_type, size_t dv_length);
 
-ssize_t		fr_radius_decode_password(char *encpw, size_t len, char const *secret, uint8_t const *vector);
+ssize_t		fr_radius_decode_password(char *encpw, size_t len, char const *secret, uint8_t const *vector,
+					  fr_md5_secret_t const *secret_md5);
 
 
 ssize_t		fr_radius_decode_tunnel_password(uint8_t *encpw, size_t *len, char const *secret,
-						 uint8_t const *vector, bool tunnel_password_zeros);
+						 uint8_t const *vector, bool tunnel_password_zeros,
+						 fr_md5_secret_t const *secret_md5);
 
 ssize_t		fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_pair_list_t *list, fr_dict_t const *dict,
 					    fr_dict_attr_t const *parent,
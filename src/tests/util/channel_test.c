@@ -25,6 +25,8 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -33,24 +35,59 @@ RCSID("$Id$")
 #endif
 
 #include <pthread.h>
-#include <sys/event.h>
 
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
+#define MAX_OUTSTANDING		(1000)	//!< Must be less than the size of the channel queues.
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
 
 static int			debug_lvl = 0;
-static int			kq_master, kq_worker;
+static fr_event_list_t		*el_master, *el_worker;
 static fr_atomic_queue_t	*aq_master, *aq_worker;
 static fr_control_t		*control_master, *control_worker;
 static int			max_messages = 10;
 static int			max_control_plane = 0;
 static int			max_outstanding = 1;
+static int			wakeup_timeout = 5;
+static uint32_t			control_spin = 0;
+static bool			stress = false;
 static bool			touch_memory = false;
 
+/** State for the master (requestor) thread
+ *
+ */
+typedef struct {
+	fr_channel_t		*channel;
+	fr_message_set_t	*ms;
+
+	int			num_messages;	//!< Number of requests sent.
+	int			num_outstanding; //!< Number of requests without a reply.
+	int			num_replies;	//!< Number of replies received.
+	int			last_replies;	//!< num_replies when the watchdog last ran.
+
+	bool			signaled_close;
+
+	fr_event_timer_t const	*ev;		//!< Lost wakeup watchdog.
+} master_ctx_t;
+
+/** State for the worker (responder) thread
+ *
+ */
+typedef struct {
+	fr_channel_t		*channel;
+	fr_message_set_t	*ms;
+
+	int			num_messages;	//!< Number of requests received.
+
+	fr_channel_data_t	**pending;	//!< Requests we haven't replied to yet.
+	int			num_pending;
+} worker_ctx_t;
+
+static master_ctx_t		master;
+static worker_ctx_t		worker;
+
 /**********************************************************************/
 typedef struct request_s request_t;
 
@@ -71,392 +108,347 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
+	fprintf(stderr, "  -p <polls>             Poll the control plane this many times before sleeping.\n");
+	fprintf(stderr, "  -s                     Stress mode.  Send requests in random sized bursts.\n");
 	fprintf(stderr, "  -t                     Touch memory for fake packets.\n");
+	fprintf(stderr, "  -w <seconds>           Fail if no replies arrive for this long (lost wakeup).\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_FAILURE);
 }
 
-static void *channel_master(void *arg)
+static void touch(fr_channel_data_t *cd)
 {
-	bool			running, signaled_close;
-	int			rcode, i, num_events;
-	int			num_outstanding, num_messages;
-	int			num_replies;
-	fr_message_set_t	*ms;
-	TALLOC_CTX		*ctx;
-	fr_channel_t		*channel = arg;
-	fr_channel_t		*new_channel;
-	fr_channel_event_t	ce;
-	struct kevent		events[MAX_KEVENTS];
+	size_t j, k;
 
-	MEM(ctx = talloc_init_const("channel_master"));
+	if (!touch_memory) return;
 
-	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
-	if (!ms) {
-		fprintf(stderr, "Failed creating message set\n");
-		fr_exit_now(EXIT_FAILURE);
+	for (j = k = 0; j < cd->m.data_size; j++) {
+		k += cd->m.data[j];
 	}
 
-	MPRINT1("Master started.\n");
+	cd->m.data[4] = k;
+}
 
-	/*
-	 *	Signal the worker that the channel is open
-	 */
-	rcode = fr_channel_signal_open(channel);
-	if (rcode < 0) {
-		fprintf(stderr, "Failed signaling open: %s\n", fr_syserror(errno));
-		fr_exit_now(EXIT_FAILURE);
+/** Send as many requests as we're allowed to have outstanding
+ *
+ */
+static void master_send(master_ctx_t *mc)
+{
+	int			i, num_to_send;
+	fr_channel_data_t	*cd;
+
+	if (mc->num_messages >= max_messages) return;
+
+	num_to_send = max_outstanding - mc->num_outstanding;
+	if ((mc->num_messages + num_to_send) > max_messages) {
+		num_to_send = max_messages - mc->num_messages;
 	}
+	if (num_to_send <= 0) return;
 
 	/*
-	 *	Bootstrap the queue with messages.
+	 *	Vary the size of the bursts, so that the requestor
+	 *	and responder race each other around the point where
+	 *	the queues go empty.
 	 */
-	num_replies = num_outstanding = num_messages = 0;
+	if (stress) num_to_send = (fr_rand() % num_to_send) + 1;
 
-	running = true;
-	signaled_close = false;
+	MPRINT1("Master sending %d messages\n", num_to_send);
 
-	while (running) {
-		fr_time_t now;
-		int num_to_send;
-		fr_channel_data_t *cd, *reply;
+	for (i = 0; i < num_to_send; i++) {
+		cd = (fr_channel_data_t *) fr_message_alloc(mc->ms, NULL, 100);
+		fr_assert(cd != NULL);
 
-#if 0
-		/*
-		 *	Drain the input queues before sleeping.
-		 */
-		while ((reply = fr_channel_recv_reply(channel)) != NULL) {
-			num_replies++;
-			num_outstanding--;
-			MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-				num_replies, num_outstanding, num_messages, max_messages);
-			fr_message_done(&reply->m);
-		}
-#endif
+		mc->num_outstanding++;
+		mc->num_messages++;
 
-		/*
-		 *	Ensure we have outstanding messages.
-		 */
-		if (num_messages >= max_messages) {
-			MPRINT1("Master DONE sending\n");
-			goto check_close;
-		}
+		cd->m.when = fr_time();
+		touch(cd);
+		memcpy(cd->m.data, &mc->num_messages, sizeof(mc->num_messages));
 
-		num_to_send = max_outstanding - num_outstanding;
-		if ((num_messages + num_to_send) > max_messages) {
-			num_to_send = max_messages - num_messages;
-		}
-		MPRINT1("Master sending %d messages\n", num_to_send);
-
-		for (i = 0; i < num_to_send; i++) {
-			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
-			fr_assert(cd != NULL);
-
-			num_outstanding++;
-			num_messages++;
-
-			cd->m.when = fr_time();
-
-			if (touch_memory) {
-				size_t j, k;
-
-				for (j = k = 0; j < cd->m.data_size; j++) {
-					k += cd->m.data[j];
-				}
-
-				cd->m.data[4] = k;
-			}
-
-			memcpy(cd->m.data, &num_messages, sizeof(num_messages));
-
-			MPRINT1("Master sent message %d\n", num_messages);
-			rcode = fr_channel_send_request(channel, cd, &reply);
-			if (rcode < 0) {
-				fprintf(stderr, "Failed sending request: %s\n", fr_syserror(errno));
-			}
-			fr_assert(rcode == 0);
-			if (reply) {
-				num_replies++;
-				num_outstanding--;
-				MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-					num_replies, num_outstanding, num_messages, max_messages);
-				fr_message_done(&reply->m);
-			}
+		MPRINT1("Master sent message %d\n", mc->num_messages);
+		if (fr_channel_send_request(mc->channel, cd) < 0) {
+			fprintf(stderr, "Failed sending request: %s\n", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
 		}
+	}
+}
 
-		/*
-		 *	Signal close only when done.
-		 */
-check_close:
+static void master_recv_reply(void *uctx, UNUSED fr_channel_t *ch, fr_channel_data_t *reply)
+{
+	master_ctx_t *mc = uctx;
 
-		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
-			MPRINT1("Master signaling worker to exit.\n");
-			rcode = fr_channel_signal_responder_close(channel);
-			if (rcode < 0) {
-				fprintf(stderr, "Failed signaling close: %s\n", fr_syserror(errno));
-				fr_exit_now(EXIT_FAILURE);
-			}
+	mc->num_replies++;
+	mc->num_outstanding--;
+	MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
+		mc->num_replies, mc->num_outstanding, mc->num_messages, max_messages);
+	fr_message_done(&reply->m);
+}
 
-			signaled_close = true;
-		}
+/** Check that replies are still arriving
+ *
+ * The channel only signals the other end when it may be asleep.  If
+ * that ever goes wrong, a request or reply sits in a queue which
+ * no-one is draining, and the test stalls.
+ */
+static void master_watchdog(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	master_ctx_t *mc = uctx;
 
-		MPRINT1("Master waiting on events.\n");
-		fr_assert(num_messages <= max_messages);
+	if ((mc->num_outstanding > 0) && (mc->num_replies == mc->last_replies)) {
+		fprintf(stderr, "Lost wakeup: no replies for %d seconds, outstanding=%d, %d/%d sent, %d replies\n",
+			wakeup_timeout, mc->num_outstanding, mc->num_messages, max_messages, mc->num_replies);
+		fr_channel_stats_log(mc->channel, &default_log, __FILE__, __LINE__);
+		fr_exit_now(EXIT_FAILURE);
+	}
+	mc->last_replies = mc->num_replies;
 
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
+	if (fr_event_timer_in(mc, el, &mc->ev, fr_time_delta_from_sec(wakeup_timeout), master_watchdog, mc) < 0) {
+		fprintf(stderr, "Failed inserting watchdog timer: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
 
-		if (num_events < 0) {
-			if (num_events == EINTR) continue;
+static void master_channel_callback(void *uctx, void const *data, size_t data_size, fr_time_t now)
+{
+	master_ctx_t		*mc = uctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
 
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
-			fr_exit_now(EXIT_FAILURE);
-		}
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("Master got channel event %d\n", ce);
 
-		if (num_events == 0) continue;
+	switch (ce) {
+	case FR_CHANNEL_DATA_READY_REQUESTOR:
+		MPRINT1("Master got data ready signal\n");
+		fr_assert(ch == mc->channel);
 
-		/*
-		 *	Service the events.
-		 */
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_master, &events[i]);
+		if (!fr_channel_recv_reply(ch)) {
+			MPRINT1("Master SIGNAL WITH NO DATA!\n");
+			break;
 		}
+		while (fr_channel_recv_reply(ch));
+		break;
 
-		now = fr_time();
-
-		MPRINT1("Master servicing control-plane aq %p\n", aq_master);
-
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-
-			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
-			if (!data_size) break;
-
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
-
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("Master got channel event %d\n", ce);
-
-			switch (ce) {
-			case FR_CHANNEL_DATA_READY_REQUESTOR:
-				MPRINT1("Master got data ready signal\n");
-				fr_assert(new_channel == channel);
-
-				reply = fr_channel_recv_reply(channel);
-				if (!reply) {
-					MPRINT1("Master SIGNAL WITH NO DATA!\n");
-					continue;
-				}
-
-				do {
-					num_replies++;
-					num_outstanding--;
-					MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-						num_replies, num_outstanding, num_messages, max_messages);
-					fr_message_done(&reply->m);
-				} while ((reply = fr_channel_recv_reply(channel)) != NULL);
-				break;
-
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("Master received close signal\n");
-				fr_assert(new_channel == channel);
-				fr_assert(signaled_close == true);
-				running = false;
-				break;
-
-			case FR_CHANNEL_NOOP:
-				MPRINT1("Master got NOOP\n");
-				break;
-
-			default:
-				fprintf(stderr, "Master got unexpected CE %d\n", ce);
-
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signal returned */
-		} /* drain the control plane */
-	} /* loop until told to exit */
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("Master received close signal\n");
+		fr_assert(ch == mc->channel);
+		fr_assert(mc->signaled_close == true);
+		fr_event_loop_exit(el_master, 1);
+		return;
 
-	MPRINT1("Master exiting.\n");
+	case FR_CHANNEL_NOOP:
+		MPRINT1("Master got NOOP\n");
+		break;
 
-	/*
-	 *	Force all messages to be garbage collected
-	 */
-	MPRINT2("GC\n");
-	fr_message_set_gc(ms);
+	default:
+		fprintf(stderr, "Master got unexpected CE %d\n", ce);
+
+		/*
+		 *	Not written yet!
+		 */
+		fr_assert(0 == 1);
+		break;
+	}
 
-	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+	master_send(mc);
 
 	/*
-	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
+	 *	Signal close only when done.
 	 */
-	rcode = fr_message_set_messages_used(ms);
-	MPRINT2("Master messages used = %d\n", rcode);
-	fr_assert(rcode == 0);
-
-	talloc_free(ctx);
+	if (!mc->signaled_close && (mc->num_messages >= max_messages) && (mc->num_outstanding == 0)) {
+		MPRINT1("Master signaling worker to exit.\n");
+		if (fr_channel_signal_responder_close(mc->channel) < 0) {
+			fprintf(stderr, "Failed signaling close: %s\n", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
+		}
 
-	return NULL;
+		mc->signaled_close = true;
+	}
 }
 
-static void *channel_worker(void *arg)
+static void *channel_master(void *arg)
 {
-	bool running = true;
-	int rcode, num_events;
-	int worker_messages = 0;
-	fr_message_set_t *ms;
-	TALLOC_CTX *ctx;
-	fr_channel_t *channel = arg;
-	fr_channel_event_t ce;
-	struct kevent events[MAX_KEVENTS];
+	int			rcode;
+	TALLOC_CTX		*ctx;
+	master_ctx_t		*mc = arg;
 
-	MEM(ctx = talloc_init_const("channel_worker"));
+	MEM(ctx = talloc_init_const("channel_master"));
 
-	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
-	if (!ms) {
+	mc->ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!mc->ms) {
 		fprintf(stderr, "Failed creating message set\n");
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	MPRINT1("\tWorker started.\n");
+	MPRINT1("Master started.\n");
 
-	while (running) {
-		int i;
-		fr_time_t now;
-		fr_channel_t *new_channel;
+	/*
+	 *	Signal the worker that the channel is open
+	 */
+	rcode = fr_channel_signal_open(mc->channel);
+	if (rcode < 0) {
+		fprintf(stderr, "Failed signaling open: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
 
-		MPRINT1("\tWorker waiting on events.\n");
+	master_watchdog(el_master, fr_time(), mc);
 
-		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("\tWorker kevent returned %d events\n", num_events);
+	/*
+	 *	Bootstrap the queue with messages.
+	 */
+	master_send(mc);
 
-		if (num_events < 0) {
-			if (errno == EINTR) continue;
+	(void) fr_event_loop(el_master);
 
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
-			fr_exit_now(EXIT_FAILURE);
-		}
+	MPRINT1("Master exiting.\n");
 
-		if (num_events == 0) continue;
+	if (mc->num_replies != max_messages) {
+		fprintf(stderr, "Master got %d replies, expected %d\n", mc->num_replies, max_messages);
+		fr_exit_now(EXIT_FAILURE);
+	}
 
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_worker, &events[i]);
-		}
+	/*
+	 *	Force all messages to be garbage collected
+	 */
+	MPRINT2("GC\n");
+	fr_message_set_gc(mc->ms);
 
-		MPRINT1("\tWorker servicing control-plane aq %p\n", aq_worker);
+	if (debug_lvl > 1) fr_message_set_debug(mc->ms, stdout);
 
-		now = fr_time();
+	/*
+	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
+	 */
+	rcode = fr_message_set_messages_used(mc->ms);
+	MPRINT2("Master messages used = %d\n", rcode);
+	fr_assert(rcode == 0);
 
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-			fr_channel_data_t *cd, *reply;
+	talloc_free(ctx);
 
-			data_size = fr_control_message_pop(aq_worker, &id, data, sizeof(data));
-			if (!data_size) break;
+	return NULL;
+}
 
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
+static void worker_recv_request(void *uctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	worker_ctx_t	*wc = uctx;
+	int		message_id;
 
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("\tWorker got channel event %d\n", ce);
+	wc->num_messages++;
 
-			switch (ce) {
+	fr_assert(cd->m.data != NULL);
+	memcpy(&message_id, cd->m.data, sizeof(message_id));
+	MPRINT1("\tWorker got message %d (says %d)\n", wc->num_messages, message_id);
 
-			case FR_CHANNEL_OPEN:
-				MPRINT1("\tWorker received a new channel\n");
-				fr_assert(new_channel == channel);
-				break;
+	fr_assert(wc->num_pending < max_outstanding);
+	wc->pending[wc->num_pending++] = cd;
+}
 
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("\tWorker requested to close the channel.\n");
-				fr_assert(new_channel == channel);
-				running = false;
+/** Reply to everything we've received
+ *
+ * Sending a reply also drains the request queue, so we keep going
+ * until there's nothing left.
+ */
+static void worker_reply(worker_ctx_t *wc)
+{
+	fr_channel_data_t *cd, *reply;
 
-				/*
-				 *	Drain the input before we ACK the exit.
-				 */
-				while ((cd = fr_channel_recv_request(channel)) != NULL) {
-					worker_messages++;
-					MPRINT1("\tWorker got message %d\n", worker_messages);
-					fr_message_done(&cd->m);
-				}
+	while (wc->num_pending > 0) {
+		cd = wc->pending[--wc->num_pending];
 
-				(void) fr_channel_responder_ack_close(channel);
-				break;
+		reply = (fr_channel_data_t *) fr_message_alloc(wc->ms, NULL, 100);
+		fr_assert(reply != NULL);
 
-			case FR_CHANNEL_DATA_READY_RESPONDER:
-				MPRINT1("\tWorker got data ready signal\n");
-				fr_assert(new_channel == channel);
+		reply->m.when = fr_time();
+		reply->reply.processing_time = fr_time_delta_wrap(0);
+		reply->reply.cpu_time = fr_time_delta_wrap(0);
+		fr_message_done(&cd->m);
 
-				cd = fr_channel_recv_request(channel);
-				if (!cd) {
-					MPRINT1("\tWorker SIGNAL WITH NO DATA!\n");
-					break;
-				}
+		touch(reply);
 
-				while (cd) {
-					int message_id;
+		MPRINT1("\tWorker sending reply to messages %d\n", wc->num_messages);
+		if (fr_channel_send_reply(wc->channel, reply) < 0) {
+			fprintf(stderr, "Failed sending reply: %s\n", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+}
 
-					worker_messages++;
+static void worker_channel_callback(void *uctx, void const *data, size_t data_size, fr_time_t now)
+{
+	worker_ctx_t		*wc = uctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
 
-					fr_assert(cd->m.data != NULL);
-					memcpy(&message_id, cd->m.data, sizeof(message_id));
-					MPRINT1("\tWorker got message %d (says %d)\n", worker_messages, message_id);
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("\tWorker got channel event %d\n", ce);
 
-					reply = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
-					fr_assert(reply != NULL);
+	switch (ce) {
+	case FR_CHANNEL_OPEN:
+		MPRINT1("\tWorker received a new channel\n");
+		fr_assert(ch == wc->channel);
+		break;
 
-					reply->m.when = fr_time();
-					fr_message_done(&cd->m);
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("\tWorker requested to close the channel.\n");
+		fr_assert(ch == wc->channel);
 
-					if (touch_memory) {
-						size_t j, k;
+		/*
+		 *	Drain the input before we ACK the exit.
+		 */
+		while (fr_channel_recv_request(ch));
+		while (wc->num_pending > 0) fr_message_done(&wc->pending[--wc->num_pending]->m);
 
-						for (j = k = 0; j < reply->m.data_size; j++) {
-							k += reply->m.data[j];
-						}
+		(void) fr_channel_responder_ack_close(ch);
+		fr_event_loop_exit(el_worker, 1);
+		break;
 
-						reply->m.data[4] = k;
-					}
+	case FR_CHANNEL_DATA_READY_RESPONDER:
+		MPRINT1("\tWorker got data ready signal\n");
+		fr_assert(ch == wc->channel);
 
+		if (!fr_channel_recv_request(ch)) {
+			MPRINT1("\tWorker SIGNAL WITH NO DATA!\n");
+			break;
+		}
+		while (fr_channel_recv_request(ch));
 
-					MPRINT1("\tWorker sending reply to messages %d\n", worker_messages);
-					rcode = fr_channel_send_reply(channel, reply, &cd);
-					if (rcode < 0) {
-						fprintf(stderr, "Failed sending reply: %s\n", fr_syserror(errno));
-					}
-					fr_assert(rcode == 0);
-				}
-				break;
+		worker_reply(wc);
+		break;
 
-			case FR_CHANNEL_NOOP:
-				MPRINT1("\tWorker got NOOP\n");
-				fr_assert(new_channel == channel);
-				break;
+	case FR_CHANNEL_NOOP:
+		MPRINT1("\tWorker got NOOP\n");
+		fr_assert(ch == wc->channel);
+		break;
 
-			default:
-				fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
+	default:
+		fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
 
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signals */
+		/*
+		 *	Not written yet!
+		 */
+		fr_assert(0 == 1);
+		break;
+	}
+}
+
+static void *channel_worker(void *arg)
+{
+	int rcode;
+	TALLOC_CTX *ctx;
+	worker_ctx_t *wc = arg;
 
-			/*
-			 *	Get a new idea of "now".
-			 */
-			now = fr_time();
-		} /* drain the control plane */
+	MEM(ctx = talloc_init_const("channel_worker"));
+
+	wc->ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!wc->ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		fr_exit_now(EXIT_FAILURE);
 	}
+	MEM(wc->pending = talloc_array(ctx, fr_channel_data_t *, max_outstanding));
+
+	MPRINT1("\tWorker started.\n");
+
+	(void) fr_event_loop(el_worker);
 
 	MPRINT1("\tWorker exiting.\n");
 
@@ -464,14 +456,14 @@ static void *channel_worker(void *arg)
 	 *	Force all messages to be garbage collected
 	 */
 	MPRINT2("Worker GC\n");
-	fr_message_set_gc(ms);
+	fr_message_set_gc(wc->ms);
 
-	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+	if (debug_lvl > 1) fr_message_set_debug(wc->ms, stdout);
 
 	/*
 	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
 	 */
-	rcode = fr_message_set_messages_used(ms);
+	rcode = fr_message_set_messages_used(wc->ms);
 	fr_cond_assert(rcode == 0);
 
 	talloc_free(ctx);
@@ -491,7 +483,7 @@ int main(int argc, char *argv[])
 
 	fr_time_start();
 
-	while ((c = getopt(argc, argv, "c:hm:o:tx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "c:hm:o:p:stw:x")) != -1) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
@@ -508,32 +500,42 @@ int main(int argc, char *argv[])
 			max_outstanding = atoi(optarg);
 			break;
 
+		case 'p':
+			control_spin = atoi(optarg);
+			break;
+
+		case 's':
+			stress = true;
+			break;
+
 		case 't':
 			touch_memory = true;
 			break;
 
+		case 'w':
+			wakeup_timeout = atoi(optarg);
+			break;
+
 		case 'h':
 		default:
 			usage();
 	}
 
 	if (max_outstanding > max_messages) max_outstanding = max_messages;
+	if (max_outstanding > MAX_OUTSTANDING) max_outstanding = MAX_OUTSTANDING;
+	if (max_outstanding < 1) max_outstanding = 1;
+	if (wakeup_timeout < 1) wakeup_timeout = 1;
 
 	if (!max_control_plane) {
 		max_control_plane = MAX_CONTROL_PLANE;
 		if (max_outstanding > max_control_plane) max_control_plane = max_outstanding;
 	}
 
-#if 0
-	argc -= (optind - 1);
-	argv += (optind - 1);
-#endif
-
-	kq_master = kqueue();
-	fr_assert(kq_master >= 0);
+	el_master = fr_event_list_alloc(autofree, NULL, NULL);
+	fr_assert(el_master != NULL);
 
-	kq_worker = kqueue();
-	fr_assert(kq_worker >= 0);
+	el_worker = fr_event_list_alloc(autofree, NULL, NULL);
+	fr_assert(el_worker != NULL);
 
 	aq_master = fr_atomic_queue_alloc(autofree, max_control_plane);
 	fr_assert(aq_master != NULL);
@@ -541,34 +543,46 @@ int main(int argc, char *argv[])
 	aq_worker = fr_atomic_queue_alloc(autofree, max_control_plane);
 	fr_assert(aq_worker != NULL);
 
-	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
+	control_master = fr_control_create(autofree, el_master, aq_master);
 	fr_assert(control_master != NULL);
 
-	control_worker = fr_control_create(autofree, kq_worker, aq_worker, 1025);
+	control_worker = fr_control_create(autofree, el_worker, aq_worker);
 	fr_assert(control_worker != NULL);
 
+	if ((fr_control_callback_add(control_master, FR_CONTROL_ID_CHANNEL, &master, master_channel_callback) < 0) ||
+	    (fr_control_callback_add(control_worker, FR_CONTROL_ID_CHANNEL, &worker, worker_channel_callback) < 0)) {
+		fprintf(stderr, "channel_test: Failed adding control callbacks: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if ((fr_control_spin_set(control_master, control_spin) < 0) ||
+	    (fr_control_spin_set(control_worker, control_spin) < 0)) {
+		fr_exit_now(EXIT_FAILURE);
+	}
+
 	channel = fr_channel_create(autofree, control_master, control_worker, false);
 	if (!channel) {
 		fprintf(stderr, "channel_test: Failed to create channel\n");
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+	master.channel = worker.channel = channel;
+	(void) fr_channel_set_recv_reply(channel, &master, master_recv_reply);
+	(void) fr_channel_set_recv_request(channel, &worker, worker_recv_request);
+
 	/*
 	 *	Start the two threads, with the channel.
 	 */
 	(void) pthread_attr_init(&attr);
 	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 
-	(void) pthread_create(&master_id, &attr, channel_master, channel);
-	(void) pthread_create(&worker_id, &attr, channel_worker, channel);
+	(void) pthread_create(&master_id, &attr, channel_master, &master);
+	(void) pthread_create(&worker_id, &attr, channel_worker, &worker);
 
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
 
-	close(kq_master);
-	close(kq_worker);
-
-	fr_channel_debug(channel, stdout);
+	if (debug_lvl) fr_channel_stats_log(channel, &default_log, __FILE__, __LINE__);
 
 	fr_exit_now(EXIT_SUCCESS);
 }
@@ -0,0 +1,304 @@
+/*
+ * track_test.c	Benchmark the master IO packet tracking tables
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2026 Network RADIUS SARL (legal@networkradius.com)
+ */
+
+/*
+ *	The tracking tables are internal to master.c, so we include
+ *	it, and exercise the same functions the network thread uses.
+ */
+#include "../../lib/io/master.c"
+
+#include <freeradius-devel/util/hash.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#define MPRINT1 if (debug_lvl) printf
+
+#define PACKET_LEN	(20)
+
+static int		debug_lvl = 0;
+static int		num_ports = 4;
+static int		num_rounds = 1000;
+
+static char const      	*seed_string = "foo";
+static size_t		seed_string_len = 3;
+
+/**********************************************************************/
+typedef struct request_s request_t;
+request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args);
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request);
+
+request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args)
+{
+	return NULL;
+}
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *request)
+{
+}
+
+/**********************************************************************/
+
+/*
+ *	Same ordering as proto_radius_udp, without dedup_authenticator.
+ */
+static int test_track_compare(UNUSED void const *instance, UNUSED void *thread_instance, UNUSED RADCLIENT *client,
+			      void const *one, void const *two)
+{
+	int ret;
+	uint8_t const *a = one;
+	uint8_t const *b = two;
+
+	ret = (a[1] < b[1]) - (a[1] > b[1]);
+	if (ret != 0) return ret;
+
+	return (a[0] < b[0]) - (a[0] > b[0]);
+}
+
+static fr_app_io_t test_app_io = {
+	.name			= "track_test",
+	.track_duplicates	= true,
+	.track_compare		= test_track_compare,
+};
+
+static fr_io_instance_t test_inst = {
+	.app_io			= &test_app_io,
+};
+
+typedef struct {
+	char const		*name;
+	fr_io_client_t		*client;
+	fr_io_track_t		**track;	//!< Entries in the table.
+	fr_io_track_t		**probe;	//!< Same keys as "track", for lookups.
+
+	fr_time_delta_t		add;
+	fr_time_delta_t		lookup;
+	fr_time_delta_t		expire;
+} track_bench_t;
+
+static NEVER_RETURNS void usage(void)
+{
+	fprintf(stderr, "usage: track_test [OPTS]\n");
+	fprintf(stderr, "  -p <ports>             Number of source ports (256 IDs each).\n");
+	fprintf(stderr, "  -r <rounds>            Number of add / lookup / expire rounds.\n");
+	fprintf(stderr, "  -s <string>            Set random seed to <string>.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	fr_exit_now(EXIT_SUCCESS);
+}
+
+static fr_io_client_t *client_alloc(TALLOC_CTX *ctx, fr_io_thread_t *thread, bool slots)
+{
+	fr_io_client_t *client;
+
+	MEM(client = talloc_zero(ctx, fr_io_client_t));
+	client->inst = &test_inst;
+	client->thread = thread;
+	client->state = PR_CLIENT_STATIC;
+
+	if (slots) {
+		MEM(client->slots = talloc_zero_array(client, fr_io_track_t *, FR_IO_TRACK_SLOTS));
+	} else {
+		MEM(client->table = fr_rb_inline_talloc_alloc(client, fr_io_track_t, node, track_cmp, NULL));
+	}
+
+	return client;
+}
+
+/** Fill in a tracking entry the way track_add() does
+ *
+ */
+static void track_init(fr_io_track_t *track, fr_io_client_t *client, fr_io_address_t const *address,
+		       uint8_t const *packet)
+{
+	track->client = client;
+	track->address = address;
+	track->packets = 1;
+	track->id = packet[1];
+
+	MEM(track->packet = talloc_memdup(track, packet, PACKET_LEN));
+}
+
+/** Add, look up, and expire one entry per ID on every port
+ *
+ */
+static void track_bench_round(track_bench_t *tb, fr_io_address_t **address, uint8_t *packets)
+{
+	fr_io_client_t	*client = tb->client;
+	int		i, num = num_ports * 256;
+	fr_time_t	start, end;
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		fr_io_track_t *track;
+
+		track = track_alloc(client);
+		track_init(track, client, address[i >> 8], packets + (i * PACKET_LEN));
+
+		if (!fr_cond_assert(track_table_find(client, track) == NULL)) fr_exit_now(EXIT_FAILURE);
+
+		(void) track_table_insert(client, track);
+		client->packets++;
+		talloc_set_destructor(track, track_dedup_free);
+
+		tb->track[i] = track;
+	}
+	end = fr_time();
+	tb->add = fr_time_delta_add(tb->add, fr_time_sub(end, start));
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		if (!fr_cond_assert(track_table_find(client, tb->probe[i]) == tb->track[i])) fr_exit_now(EXIT_FAILURE);
+	}
+	end = fr_time();
+	tb->lookup = fr_time_delta_add(tb->lookup, fr_time_sub(end, start));
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		track_release(tb->track[i]);
+		tb->track[i] = NULL;
+	}
+	end = fr_time();
+	tb->expire = fr_time_delta_add(tb->expire, fr_time_sub(end, start));
+
+	if (!fr_cond_assert(client->packets == 0)) fr_exit_now(EXIT_FAILURE);
+}
+
+static void track_bench_print(track_bench_t const *tb)
+{
+	double ops = (double) num_rounds * num_ports * 256;
+
+	printf("%-6s add %6.1fns  lookup %6.1fns  expire %6.1fns  (per packet)\n", tb->name,
+	       fr_time_delta_unwrap(tb->add) / ops,
+	       fr_time_delta_unwrap(tb->lookup) / ops,
+	       fr_time_delta_unwrap(tb->expire) / ops);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, j, num;
+	uint32_t		seed;
+	fr_io_thread_t		*thread;
+	fr_io_address_t		**address;
+	uint8_t			*packets;
+	track_bench_t		bench[2] = {
+					{ .name = "tree" },
+					{ .name = "slots" }
+				};
+
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	while ((c = getopt(argc, argv, "hp:r:s:x")) != -1) switch (c) {
+		case 'p':
+			num_ports = atoi(optarg);
+			if ((num_ports <= 0) || (num_ports > 1024)) usage();
+			break;
+
+		case 'r':
+			num_rounds = atoi(optarg);
+			if (num_rounds <= 0) usage();
+			break;
+
+		case 's':
+			seed_string = optarg;
+			seed_string_len = strlen(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	MEM(thread = talloc_zero(autofree, fr_io_thread_t));
+	MEM(thread->child = talloc_zero(thread, fr_listen_t));
+
+	num = num_ports * 256;
+
+	/*
+	 *	One address per source port, shared by all of the
+	 *	packets from that port, as in the network thread.
+	 */
+	MEM(address = talloc_array(autofree, fr_io_address_t *, num_ports));
+	for (i = 0; i < num_ports; i++) {
+		MEM(address[i] = talloc_zero(address, fr_io_address_t));
+		address[i]->socket.inet.src_ipaddr = (fr_ipaddr_t){ .af = AF_INET, .prefix = 32,
+								   .addr.v4.s_addr = htonl(0x7f000001) };
+		address[i]->socket.inet.dst_ipaddr = address[i]->socket.inet.src_ipaddr;
+		address[i]->socket.inet.src_port = 1024 + i;
+		address[i]->socket.inet.dst_port = 1812;
+	}
+
+	/*
+	 *	Access-Requests, with every ID on every port, and
+	 *	random authenticators.
+	 */
+	MEM(packets = talloc_zero_array(autofree, uint8_t, num * PACKET_LEN));
+	seed = 0xabcdef;
+	for (i = 0; i < num; i++) {
+		uint8_t *p = packets + (i * PACKET_LEN);
+
+		p[0] = 1;	/* Access-Request */
+		p[1] = i & 0xff;
+		p[3] = PACKET_LEN;
+
+		for (j = 4; j < PACKET_LEN; j += sizeof(seed)) {
+			seed = fr_hash_update(seed_string, seed_string_len, seed);
+			memcpy(p + j, &seed, sizeof(seed));
+		}
+	}
+
+	for (i = 0; i < (int) NUM_ELEMENTS(bench); i++) {
+		track_bench_t *tb = &bench[i];
+
+		tb->client = client_alloc(autofree, thread, (i == 1));
+
+		MEM(tb->track = talloc_zero_array(autofree, fr_io_track_t *, num));
+		MEM(tb->probe = talloc_zero_array(autofree, fr_io_track_t *, num));
+
+		for (j = 0; j < num; j++) {
+			MEM(tb->probe[j] = talloc_zero(tb->probe, fr_io_track_t));
+			track_init(tb->probe[j], tb->client, address[j >> 8], packets + (j * PACKET_LEN));
+		}
+
+		/*
+		 *	Warm up the slab and the allocator.
+		 */
+		track_bench_round(tb, address, packets);
+		tb->add = tb->lookup = tb->expire = fr_time_delta_wrap(0);
+
+		for (j = 0; j < num_rounds; j++) track_bench_round(tb, address, packets);
+
+		MPRINT1("%s: %u entries left in the slab\n", tb->name, thread->num_track_slab);
+	}
+
+	printf("%d packets outstanding, %d rounds\n", num, num_rounds);
+	for (i = 0; i < (int) NUM_ELEMENTS(bench); i++) track_bench_print(&bench[i]);
+
+	fr_exit_now(EXIT_SUCCESS);
+}
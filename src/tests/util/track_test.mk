@@ -0,0 +1,6 @@
+TARGET := track_test
+
+SOURCES		:= track_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)